@@ -13,11 +13,23 @@ Handles_New(size_t size)
 {
     Handles *handles;
 
+    if (size == 0) {
+        size = 1;
+    }
+
     handles = (Handles *)malloc(sizeof(Handles));
-    handles->stream = (StreamReference **)malloc(sizeof(void *)*size);
+    if (handles == NULL) {
+        return NULL;
+    }
+    handles->stream = (StreamReference *)malloc(sizeof(StreamReference)*size);
+    if (handles->stream == NULL) {
+        free(handles);
+        return NULL;
+    }
     handles->size = 0;
     handles->reserved = size;
-    handles->next_handle = 0x7e0000;
+    handles->next_handle = BASE_WIRE_HANDLE;
+    handles->replay = HANDLES_NO_REPLAY;
 
     return handles;
 }
@@ -25,72 +37,138 @@ Handles_New(size_t size)
 uint8_t
 Handles_Destruct(Handles *handles)
 {
-
-    size_t i;
-    
-    for (i = 0; i < handles->size; i++){
-        JavaType_Destruct(handles->stream[i]->ob);
-        handles->stream[i]->ob = NULL;
-    }
-    for (i = 0; i < handles->size; i++){
-        free(handles->stream[i]->ob);
-        handles->stream[i]->handle = 0;
-        handles->stream[i] = NULL;
-        free(handles->stream[i]);
+    /* * Frees the table itself. The objects the handles point at are
+     * shared with each other (class descriptors, supers, field strings)
+     * and are not owned by the table.
+     * */
+    if (handles == NULL) {
+        return 0;
     }
+    free(handles->stream);
+    handles->stream = NULL;
+    handles->size = 0;
+    handles->reserved = 0;
+    free(handles);
     return 1;
 }
 
-void 
+int
 Handles_Append(Handles *handles, JavaType_Type *ob)
 {
     /* * Appends a stream object to the list of references
-     * for later use. Will reallocate memory if the size 
-     * attemps to grow greater than the reserved allocation
-     * on the heap. 
+     * for later use. The table doubles when it is full, so
+     * appends are amortized constant time. Returns -1 when
+     * the table can't grow, and the table is left as it was.
      * */
-    
-    if (handles->size < handles->reserved){
-        StreamReference *ref;
+    StreamReference *ref;
 
-        ref = (StreamReference *)malloc(sizeof(StreamReference));
-        assert(ref != NULL);
+    if (handles->replay < handles->size) {
+        /* the same content decoded again takes the same handles */
+        ref = &handles->stream[handles->replay++];
+        Py_CLEAR(ref->ob->value);
         ref->ob = ob;
-        ref->handle = handles->next_handle++;
-        handles->stream[handles->size++] = ref;
+        return 0;
+    }
+
+    if (handles->size == handles->reserved) {
+        StreamReference *stream;
+        size_t new_reserved;
 
+        new_reserved = handles->reserved * 2;
+        stream = (StreamReference *)realloc(handles->stream,
+                                            sizeof(StreamReference) * new_reserved);
+        if (stream == NULL) {
+            return -1;
+        }
+        handles->stream = stream;
+        handles->reserved = new_reserved;
     }
-    else {
-        size_t new_size;
 
-        new_size = sizeof(void *) * handles->reserved * 2;
-        handles->stream = realloc(handles->stream, new_size);
-        assert(handles->stream != NULL);
-        handles->reserved = new_size;
-        Handles_Append(handles, ob);
+    ref = &handles->stream[handles->size++];
+    ref->ob = ob;
+    ref->handle = handles->next_handle++;
+    if (handles->replay != HANDLES_NO_REPLAY) {
+        handles->replay = handles->size;
     }
+    return 0;
 }
 
 JavaType_Type *
 Handles_Find(Handles *handles, uint32_t handle)
 {
+    /* direct index, NULL for handles that haven't been issued */
+    uint32_t index = handle - BASE_WIRE_HANDLE;
+
+    if (handle < BASE_WIRE_HANDLE || index >= handles->size) {
+        return NULL;
+    }
+    return handles->stream[index].ob;
+}
+
+void
+Handles_Truncate(Handles *handles, size_t size)
+{
+    /* * Forget every handle issued after the first 'size', so a
+     * speculative parse can be rewound and parsed again. The handles
+     * are issued again in the same order by the second parse.
+     * */
     size_t i;
-    for (i = 0; i < handles->size; i++){
-        if (handles->stream[i]->handle == handle){
 
-            return handles->stream[i]->ob;
+    if (handles->replay != HANDLES_NO_REPLAY && size <= handles->replay) {
+        /* rewinding inside a replay only moves the cursor back */
+        for (i = size; i < handles->replay; i++) {
+            Py_CLEAR(handles->stream[i].ob->value);
         }
+        handles->replay = size;
+        return;
+    }
+    assert(size <= handles->size);
+    for (i = size; i < handles->size; i++) {
+        Py_CLEAR(handles->stream[i].ob->value);
+    }
+    handles->size = size;
+    handles->next_handle = BASE_WIRE_HANDLE + (uint32_t)size;
+}
+
+size_t
+Handles_BeginReplay(Handles *handles, size_t index)
+{
+    size_t saved = handles->replay;
+
+    assert(index < handles->size);
+    handles->replay = index;
+    return saved;
+}
+
+void
+Handles_EndReplay(Handles *handles, size_t saved)
+{
+    handles->replay = saved;
+}
+
+void
+Handles_ClearValues(Handles *handles)
+{
+    /* * Drops the references the handles hold on the python objects
+     * they were resolved to. The JavaType_Type nodes themselves belong
+     * to the parse arena and go away with it.
+     * */
+    size_t i;
+
+    for (i = 0; i < handles->size; i++) {
+        Py_CLEAR(handles->stream[i].ob->value);
     }
-    return NULL;
 }
 
 JavaType_Type *
-JavaType_New(char type)
+JavaType_New(Arena *arena, char type)
 {
     JavaType_Type *ob = NULL;
 
-    ob = (JavaType_Type *)malloc(sizeof(JavaType_Type));
-    assert(ob != NULL);
+    ob = (JavaType_Type *)Arena_Alloc(arena, sizeof(JavaType_Type));
+    if (ob == NULL) {
+        return NULL;
+    }
     ob->jt_type = type;
     ob->prim_typecode = 0;
     ob->obj_typecode = 0;
@@ -101,6 +179,7 @@ JavaType_New(char type)
     ob->is_primitive = 0;
     ob->is_array = 0;
     ob->is_object = 0;
+    ob->handler_resolved = 0;
     ob->unused = 0;
     ob->array_size = 0;
     ob->n_fields = 0;
@@ -116,79 +195,81 @@ JavaType_New(char type)
     ob->class_annotation = NULL;
     ob->super = NULL;
     ob->class_descriptor = NULL;
+    ob->array_base = NULL;
+    ob->array_offset = 0;
+    ob->plan = NULL;
+    ob->class_kind = Class_Plain;
+    ob->handler = NULL;
     ob->value = NULL;
+    ob->key = NULL;
+    ob->super_key = NULL;
+    ob->skipped = NULL;
+    ob->skipped_handle = 0;
     ob->ref_count = 1;
     return ob;
 }
 
-void
-JavaType_Destruct(JavaType_Type *type)
+/* * Perfect hash of the special class names. All of them are at least
+ * 14 characters and share the "java.lang." or "java.util." prefix, so
+ * the hash mixes the length, the 12th character and the last one; it
+ * has no collisions over the table below. A hit is confirmed with one
+ * exact comparison.
+ * */
+
+#define CLASS_HASH_SIZE 64
+#define CLASS_HASH(name, length) \
+    (((length) * 4 + (unsigned char)(name)[11] + (unsigned char)(name)[(length) - 1]) \
+     & (CLASS_HASH_SIZE - 1))
+
+static const struct {
+    const char *name;
+    size_t length;
+    ClassKind kind;
+} class_names[CLASS_HASH_SIZE] = {
+    [14] = {"java.lang.Long", 14, Class_Long},
+    [18] = {"java.util.Hashtable", 19, Class_Hashtable},
+    [20] = {"java.lang.Double", 16, Class_Double},
+    [21] = {"java.util.HashMap", 17, Class_HashMap},
+    [22] = {"java.lang.Byte", 14, Class_Byte},
+    [24] = {"java.lang.Short", 15, Class_Short},
+    [25] = {"java.util.HashSet", 17, Class_HashSet},
+    [27] = {"java.util.Calendar", 18, Class_Calendar},
+    [28] = {"java.lang.Float", 15, Class_Float},
+    [29] = {"java.util.BitSet", 16, Class_BitSet},
+    [33] = {"java.lang.Boolean", 17, Class_Boolean},
+    [34] = {"java.util.EnumMap", 17, Class_EnumMap},
+    [36] = {"java.lang.Integer", 17, Class_Integer},
+    [38] = {"java.lang.Character", 19, Class_Character},
+    [39] = {"java.util.ArrayDeque", 20, Class_ArrayDeque},
+    [45] = {"java.util.LinkedList", 20, Class_LinkedList},
+    [50] = {"java.util.ArrayList", 19, Class_ArrayList},
+    [51] = {"java.util.PriorityQueue", 23, Class_PriorityQueue},
+    [54] = {"java.util.Collections", 21, Class_Collections},
+    [56] = {"java.util.IdentityHashMap", 25, Class_IdentityHashMap},
+    [62] = {"java.util.Date", 14, Class_Date},
+};
+
+ClassKind
+JavaType_Classify(const char *classname, size_t length)
 {
-    if (type == NULL) {
-        return;
-    }
-
-    size_t i;
-
-    /* clear all pointers first */
+    /* exact match of 'classname' against the classes with special decoding */
+    static const char collections[] = "java.util.Collections$";
+    size_t slot;
 
-    free(type->classname);
-    type->classname = NULL;
-
-    free(type->fieldname);
-    type->fieldname = NULL;
-
-    free(type->string);
-    type->string = NULL;
-
-
-    for (i = 0; i < type->n_proxy_interface_names; i++){
-
-        free(type->proxy_interface_names[i]);
-        type->proxy_interface_names[i] = NULL;
+    if (length < 14) {
+        return Class_Plain;
     }
-    free(type->proxy_interface_names);
-    type->proxy_interface_names = NULL;
-
-
-    for (i = 0; i < type->n_fields; i++){
-
-        JavaType_Destruct(type->fields[i]);
-        type->fields[i] = NULL;
+    slot = CLASS_HASH(classname, length);
+    if (class_names[slot].length == length
+        && memcmp(class_names[slot].name, classname, length) == 0) {
+        return class_names[slot].kind;
     }
-    free(type->fields);
-    type->fields = NULL;
-
-    JavaType_Destruct(type->class_annotation);
-    type->class_annotation = NULL;
-
-
-    JavaType_Destruct(type->super);
-    type->super = NULL;
-
-    JavaType_Destruct(type->class_descriptor);
-    type->class_descriptor = NULL;
-
-
-    Py_XDECREF(type->value);
-
-    type->jt_type = 0;
-    type->prim_typecode = 0;
-    type->obj_typecode = 0;
-    type->is_primitive = 0;
-    type->is_array = 0;
-    type->is_object = 0;
-    type->unused = 0;
-    type->array_size = 0;
-    type->n_fields = 0;
-    type->n_proxy_interface_names = 0;
-    type->n_chars = 0;
-    type->serial_version_uid = 0;
-    type->flags.sc_write_method = 0;
-    type->flags.sc_serializable = 0;
-    type->flags.sc_externalizable = 0;
-    type->flags.sc_block_data = 0;
-    type->flags.sc_enum = 0;
+    /* the wrappers and views of java.util.Collections are nested classes */
+    if (length > sizeof(collections) - 1
+        && memcmp(classname, collections, sizeof(collections) - 1) == 0) {
+        return Class_Collections;
+    }
+    return Class_Plain;
 }
 
 void 
@@ -196,21 +277,21 @@ Handles_Print(Handles *handles){
     
     size_t i;
     for (i = 0; i < handles->size; i++) {
-        printf("0x%x: 0x%x = ", handles->stream[i]->ob->jt_type, handles->stream[i]->handle);
+        printf("0x%x: 0x%x = ", handles->stream[i].ob->jt_type, handles->stream[i].handle);
         
-        switch(handles->stream[i]->ob->jt_type){
+        switch(handles->stream[i].ob->jt_type){
             case TC_OBJECT:
             case TC_CLASS:
             case TC_ENUM:
             case TC_ARRAY:
-                printf("%s\n", handles->stream[i]->ob->class_descriptor->classname);
+                printf("%s\n", handles->stream[i].ob->class_descriptor->classname);
                 break;
             case TC_CLASSDESC:
-                printf("%s\n", handles->stream[i]->ob->classname);
+                printf("%s\n", handles->stream[i].ob->classname);
                 break;
             case TC_STRING:
             case TC_LONGSTRING:
-                printf("%s\n", handles->stream[i]->ob->string);
+                printf("%s\n", handles->stream[i].ob->string);
                 break;
             default:
                 printf("???\n");
@@ -1,26 +1,48 @@
+#ifndef JAVATYPE_H
+#define JAVATYPE_H
+
 #include "Python.h"
+#include "jso_arena.h"
+#include "jso_stream.h"
 
 #define DEFAULT_REFERENCE_SIZE 300
-#define TC_NULL 0x70
-#define TC_REFERENCE 0x71
-#define TC_CLASSDESC 0x72
-#define TC_OBJECT 0x73
-#define TC_STRING 0x74
-#define TC_ARRAY 0x75
-#define TC_CLASS 0x76
-#define TC_BLOCKDATA 0x77
-#define TC_ENDBLOCKDATA 0x78
-#define TC_RESET 0x79
-#define TC_EXCEPTION 0x7B
-#define TC_LONGSTRING 0x7C
-#define TC_PROXYCLASSDESC 0x7D
-#define TC_ENUM 0x7E 
 
 #define isinstance(a, b) ((a)->jt_type == b)
 
+/* classes with a special decoding, found once per class descriptor */
+typedef enum {
+    Class_Plain = 0,
+    Class_Boolean,
+    Class_Byte,
+    Class_Character,
+    Class_Double,
+    Class_Float,
+    Class_Integer,
+    Class_Long,
+    Class_Short,
+    Class_ArrayDeque,
+    Class_ArrayList,
+    Class_BitSet,
+    Class_Calendar,
+    Class_Collections,          /* java.util.Collections and its nested classes */
+    Class_Date,
+    Class_EnumMap,
+    Class_HashMap,
+    Class_HashSet,
+    Class_Hashtable,
+    Class_IdentityHashMap,
+    Class_LinkedList,
+    Class_PriorityQueue
+} ClassKind;
+
+/* java.lang wrappers of the primitive types */
+#define Class_IsBoxed(kind) (Class_Boolean <= (kind) && (kind) <= Class_Short)
+
 typedef struct JavaType_Type JavaType_Type;
 typedef struct StreamReference StreamReference;
 typedef struct Handles Handles;
+typedef struct DecodePlan DecodePlan;
+typedef struct ReadObjectHandler ReadObjectHandler;
 
 
 /* This may or may not work for a field descriptor. A field descriptor
@@ -41,7 +63,8 @@ struct JavaType_Type {
     uint8_t is_primitive:1;
     uint8_t is_array:1;
     uint8_t is_object:1;
-    uint8_t unused:5;
+    uint8_t handler_resolved:1;     /* 'handler' has been looked up */
+    uint8_t unused:4;
     size_t array_size;
     size_t n_fields;
     size_t n_proxy_interface_names;
@@ -58,7 +81,16 @@ struct JavaType_Type {
     JavaType_Type *class_annotation;
     JavaType_Type *super;
     JavaType_Type *class_descriptor;
+    JavaType_Type *array_base;      /* flattened multi-dimensional array holding this one */
+    size_t array_offset;            /* element offset into array_base */
+    DecodePlan *plan;               /* field decode plan, compiled on the first instance */
+    ClassKind class_kind;
+    ReadObjectHandler *handler;     /* registered readObject handler, or NULL */
     PyObject *value;
+    PyObject *key;                  /* interned fieldname, the dict key of a field */
+    PyObject *super_key;            /* interned "super." + fieldname */
+    const unsigned char *skipped;   /* object or array stepped over by a projection */
+    size_t skipped_handle;          /* first handle index the skipped content took */
     size_t ref_count;
 };
 
@@ -67,14 +99,22 @@ struct StreamReference {
     JavaType_Type *ob;
 };
 
+/* Handles are issued sequentially from BASE_WIRE_HANDLE, so the table is
+ * a dense array of inline entries indexed by handle - BASE_WIRE_HANDLE.
+ *
+ * Content that was skipped can be decoded later from where it started.
+ * While that replay runs, appends overwrite the entries the content took
+ * the first time instead of issuing new handles. */
 struct Handles {
-    size_t size;
-    size_t index;
-    size_t reserved;
+    size_t size;            /* entries in use */
+    size_t reserved;        /* entries allocated */
     uint32_t next_handle;
-    StreamReference **stream;
+    size_t replay;          /* entry the next append overwrites, or HANDLES_NO_REPLAY */
+    StreamReference *stream;
 };
 
+#define HANDLES_NO_REPLAY ((size_t)-1)
+
 #define Type_Object 1
 #define Type_Class 2
 #define Type_Array 3
@@ -91,17 +131,40 @@ Handles_New(size_t size);
 uint8_t
 Handles_Destruct(Handles *handles);
 
-void 
+int
 Handles_Append(Handles *handles, JavaType_Type *ob);
 
 JavaType_Type *
 Handles_Find(Handles *handles, uint32_t handle);
 
-JavaType_Type *
-JavaType_New(char type);
+void
+Handles_Truncate(Handles *handles, size_t size);
+
+/* index of the entry the next append fills, the size outside a replay */
+static inline size_t
+Handles_Position(const Handles *handles)
+{
+    return handles->replay != HANDLES_NO_REPLAY ? handles->replay : handles->size;
+}
+
+/* start overwriting from entry 'index', returns the state to restore */
+size_t
+Handles_BeginReplay(Handles *handles, size_t index);
 
 void
-JavaType_Destruct(JavaType_Type *type);
+Handles_EndReplay(Handles *handles, size_t saved);
 
 void
-Handles_Print(Handles *handles);
\ No newline at end of file
+Handles_ClearValues(Handles *handles);
+
+/* a node in 'arena', NULL when the arena can't get more memory */
+JavaType_Type *
+JavaType_New(Arena *arena, char type);
+
+ClassKind
+JavaType_Classify(const char *classname, size_t length);
+
+void
+Handles_Print(Handles *handles);
+
+#endif /* JAVATYPE_H */
@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jso.h"
+#include "jso_file.h"
+#include "jso_scan.h"
+#include "jso_stream.h"
+#include "jso_bswap.h"
+#include "jso_internal.h"
+
+static JsoStream *
+index_stream(JsoStream *stream, int flags)
+{
+    /* a failed scan is kept, Jso_Error reports it */
+    ScanIndex_Init(&stream->index);
+    stream->index.with_nodes = (flags & JSO_TAPE) != 0;
+    Scan_Stream(&stream->index, stream->input, stream->length);
+    return stream;
+}
+
+JsoStream *
+Jso_Open(const char *filename, int flags)
+{
+    JsoStream *stream;
+
+    stream = (JsoStream *)calloc(1, sizeof(JsoStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+    if (StreamFile_Open(&stream->file, filename, (flags & JSO_MMAP) != 0) < 0) {
+        free(stream);
+        return NULL;
+    }
+    stream->has_file = 1;
+    stream->input = (const unsigned char *)stream->file.buffer;
+    stream->length = stream->file.length;
+    return index_stream(stream, flags);
+}
+
+JsoStream *
+Jso_OpenBuffer(const void *buffer, size_t length, int flags)
+{
+    JsoStream *stream;
+
+    stream = (JsoStream *)calloc(1, sizeof(JsoStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+    stream->input = (const unsigned char *)buffer;
+    stream->length = length;
+    return index_stream(stream, flags);
+}
+
+void
+Jso_Close(JsoStream *stream)
+{
+    if (stream == NULL) {
+        return;
+    }
+    ScanIndex_Release(&stream->index);
+    if (stream->has_file) {
+        StreamFile_Close(&stream->file);
+    }
+    free(stream);
+}
+
+const char *
+Jso_Error(const JsoStream *stream, size_t *offset)
+{
+    if (offset != NULL) {
+        *offset = stream->index.error != NULL ? stream->index.error_offset : 0;
+    }
+    return stream->index.error;
+}
+
+const unsigned char *
+Jso_Data(const JsoStream *stream, size_t *length)
+{
+    if (length != NULL) {
+        *length = stream->length;
+    }
+    return stream->input;
+}
+
+size_t
+Jso_RecordCount(const JsoStream *stream)
+{
+    return stream->index.n_records;
+}
+
+int
+Jso_GetRecord(const JsoStream *stream, size_t i, JsoRecord *record)
+{
+    const ScanIndex *index = &stream->index;
+    const ScanRecord *r;
+
+    if (i >= index->n_records) {
+        return -1;
+    }
+    r = &index->records[i];
+    record->offset = r->offset;
+    record->length = r->length;
+    record->type = r->type;
+    record->handle = r->handle;
+    record->first_handle = r->first_handle;
+    /* not up to the table size: a failed scan leaves the handles of the
+     * record it stopped in after the last one */
+    record->n_handles = r->n_handles;
+    record->generation = r->generation;
+    return 0;
+}
+
+size_t
+Jso_HandleCount(const JsoStream *stream)
+{
+    return stream->index.n_handles;
+}
+
+static uint64_t
+after_class_ref(const JsoStream *stream, const ScanHandle *h)
+{
+    /* * First byte after the class descriptor of an object or array: the
+     * descriptor follows the TC_ byte either in full or as a reference.
+     * */
+    const ScanHandle *desc = &stream->index.handles[h->class_handle];
+
+    if (desc->offset == h->offset + 1) {
+        return desc->offset + desc->length;
+    }
+    return h->offset + 1 + 5;
+}
+
+int
+Jso_GetHandle(const JsoStream *stream, size_t i, JsoHandle *handle)
+{
+    const ScanIndex *index = &stream->index;
+    const ScanHandle *h;
+    const ScanClass *cls;
+    const unsigned char *p;
+
+    if (i >= index->n_handles) {
+        return -1;
+    }
+    h = &index->handles[i];
+    if (h->length == 0) {
+        /* issued by the record a failed scan stopped in, its bytes may not be there */
+        return -1;
+    }
+    memset(handle, 0, sizeof(JsoHandle));
+    handle->index = i;
+    handle->offset = h->offset;
+    handle->length = h->length;
+    handle->type = h->type;
+    handle->class_handle = h->class_handle;
+
+    p = stream->input + h->offset;
+    switch (h->type) {
+        case TC_STRING:
+            /* the scan files long strings under TC_STRING as well */
+            if (p[0] == TC_STRING) {
+                handle->body = h->offset + 3;
+                handle->count = load_be16(p + 1);
+            }
+            else {
+                handle->body = h->offset + 9;
+                handle->count = load_be64(p + 1);
+            }
+            break;
+        case TC_ARRAY:
+            cls = &index->classes[index->handles[h->class_handle].layout];
+            handle->element_type = cls->element;
+            handle->body = after_class_ref(stream, h);
+            handle->count = load_be32(stream->input + handle->body);
+            handle->body += 4;
+            break;
+        case TC_OBJECT:
+            handle->body = after_class_ref(stream, h);
+            break;
+        case TC_CLASSDESC:
+        case TC_PROXYCLASSDESC:
+            cls = &index->classes[h->layout];
+            handle->name = (const char *)stream->input + cls->name_offset;
+            handle->name_length = cls->name_length;
+            handle->flags = cls->flags;
+            handle->n_fields = cls->n_fields;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+int
+Jso_Visit(const JsoStream *stream, const JsoVisitor *visitor, void *context)
+{
+    JsoRecord record;
+    JsoHandle handle;
+    size_t i, j;
+    int status;
+
+    for (i = 0; i < stream->index.n_records; i++) {
+        Jso_GetRecord(stream, i, &record);
+        if (visitor->record_begin != NULL
+            && (status = visitor->record_begin(context, &record)) != 0) {
+            return status;
+        }
+        for (j = 0; visitor->handle != NULL && j < record.n_handles; j++) {
+            if (Jso_GetHandle(stream, record.first_handle + j, &handle) < 0) {
+                return -1;
+            }
+            if ((status = visitor->handle(context, &handle)) != 0) {
+                return status;
+            }
+        }
+        if (visitor->record_end != NULL
+            && (status = visitor->record_end(context, &record)) != 0) {
+            return status;
+        }
+    }
+    return 0;
+}
+
+size_t
+Jso_DecodeArray(char typecode, void *dst, const void *src, size_t n_elements)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    size_t size, i;
+
+    switch (typecode) {
+        case 'Z':
+            for (i = 0; i < n_elements; i++) {
+                ((unsigned char *)dst)[i] = s[i] != 0;
+            }
+            return n_elements;
+        case 'B': size = 1; break;
+        case 'C':
+        case 'S': size = 2; break;
+        case 'F':
+        case 'I': size = 4; break;
+        case 'D':
+        case 'J': size = 8; break;
+        default:
+            return 0;
+    }
+    Bswap_Copy(dst, src, n_elements, size);
+    return n_elements * size;
+}
@@ -0,0 +1,199 @@
+#ifndef JSO_H
+#define JSO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* * libjso: the stream grammar without Python. A JsoStream is one input,
+ * a file or a caller's buffer, validated and indexed by a single pass
+ * over the grammar (see jso_scan.h): where every top-level record and
+ * every handle is, what it is and which class it belongs to. Nothing is
+ * decoded into values; the input stays in place and values are read
+ * from it on demand, primitive array payloads with Jso_DecodeArray.
+ *
+ * The handle table is the one the python reader keeps: handles are
+ * numbered in the order the stream issues them, and a TC_RESET starts a
+ * new generation without forgetting the handles before it, so an index
+ * stays valid for the life of the JsoStream.
+ *
+ * This is not the grammar the python reader decodes values with:
+ * stream_read, iter_stream, read_records and StreamParser parse with
+ * their own recursive descent in jso_reader.c, and only use the scan
+ * (jso_scan.c) to index a stream first. walk_stream is the python
+ * entry point onto this library. A change to the grammar has to be made
+ * in jso_scan.c, jso_events.c and jso_reader.c alike;
+ * TestWalkStream.test_matches_iter_stream checks that they agree.
+ *
+ * Built as libjso.a / libjso.so by the Makefile, along with jsodump.
+ * A JsoStream is not locked; separate streams can be used from
+ * separate threads.
+ * */
+
+#define JSO_NONE ((uint32_t)-1)
+
+/* Jso_Open flags */
+#define JSO_MMAP 0x01               /* map the file instead of reading it */
+#define JSO_TAPE 0x02               /* keep the content tape for Jso_Walk */
+
+typedef struct JsoStream JsoStream;
+typedef struct JsoRecord JsoRecord;
+typedef struct JsoHandle JsoHandle;
+typedef struct JsoVisitor JsoVisitor;
+typedef struct JsoValue JsoValue;
+typedef struct JsoEvents JsoEvents;
+
+struct JsoRecord {
+    uint64_t offset;                /* of the first byte of the record */
+    uint64_t length;
+    uint8_t type;                   /* TC_OBJECT, TC_STRING, TC_BLOCKDATA, ... */
+    uint32_t handle;                /* what the record resolves to, JSO_NONE for
+                                     * null and block data */
+    size_t first_handle;            /* handles the record issued, in order */
+    size_t n_handles;
+    size_t generation;              /* first handle since the last TC_RESET */
+};
+
+struct JsoHandle {
+    size_t index;
+    uint64_t offset;                /* of the TC_ byte that introduced it */
+    uint64_t length;
+    uint8_t type;                   /* TC_OBJECT, TC_ARRAY, TC_STRING, TC_CLASSDESC, ... */
+    uint32_t class_handle;          /* class descriptor of an object, array, enum or
+                                     * class, superclass of a descriptor, or JSO_NONE */
+    /* * strings: the modified UTF-8 bytes, 'count' of them
+     * arrays: the elements, 'count' of them of 'element_type'
+     * objects: the class data, superclass first
+     * */
+    uint64_t body;
+    uint64_t count;
+    char element_type;              /* B C D F I J S Z, L or [ */
+    /* class descriptors only, name is not NUL terminated */
+    const char *name;
+    uint16_t name_length;
+    uint8_t flags;                  /* classDescFlags, SC_* */
+    uint16_t n_fields;
+};
+
+/* * Callbacks of Jso_Visit, any of them may be NULL. Returning nonzero
+ * stops the walk and Jso_Visit returns that value.
+ * */
+struct JsoVisitor {
+    int (*record_begin)(void *context, const JsoRecord *record);
+    int (*handle)(void *context, const JsoHandle *handle);
+    int (*record_end)(void *context, const JsoRecord *record);
+};
+
+/* a primitive field: B C I J S Z in 'i', F and D in 'd' */
+struct JsoValue {
+    int64_t i;
+    double d;
+};
+
+/* * Callbacks of Jso_Walk, a SAX-style walk over the values of a stream.
+ * Any of them may be NULL, and returning nonzero stops the walk with
+ * that value. Class descriptors are passed as their JsoHandle; names
+ * and strings point into the input and are not NUL terminated, they
+ * are modified UTF-8 as the stream has them.
+ *
+ * Content, wherever a value can be an object, is one of
+ *
+ *     null, reference       a back reference to a handle already walked
+ *     string
+ *     object_begin          then for each class of the object, superclass
+ *                           first: class_data, a field event per field
+ *                           (object fields are followed by their content),
+ *                           and annotation_begin ... annotation_end for a
+ *                           class that wrote one; then object_end
+ *     array_begin           then the elements as content, or one
+ *                           primitive_array event, then array_end
+ *     enum_constant, class_value
+ *     block_data            in annotations and between records
+ *
+ * Every top-level record is record_begin, its content and record_end,
+ * and the walk finishes with end.
+ * */
+struct JsoEvents {
+    int (*record_begin)(void *context, const JsoRecord *record);
+    int (*record_end)(void *context, const JsoRecord *record);
+    int (*object_begin)(void *context, const JsoHandle *classdesc, uint32_t handle);
+    int (*class_data)(void *context, const JsoHandle *classdesc);
+    int (*field)(void *context, const char *name, size_t name_length, char type,
+                 const JsoValue *value);    /* NULL value for object fields */
+    int (*annotation_begin)(void *context, const JsoHandle *classdesc);
+    int (*annotation_end)(void *context, const JsoHandle *classdesc);
+    int (*object_end)(void *context, uint32_t handle);
+    int (*array_begin)(void *context, char type, size_t n_elements, uint32_t handle);
+    int (*primitive_array)(void *context, char type, const void *big_endian,
+                           size_t n_elements);
+    int (*array_end)(void *context, uint32_t handle);
+    int (*string)(void *context, const char *chars, size_t length, uint32_t handle);
+    int (*null)(void *context);
+    int (*reference)(void *context, uint32_t handle);
+    int (*enum_constant)(void *context, const JsoHandle *classdesc, const char *name,
+                         size_t name_length, uint32_t handle);
+    int (*class_value)(void *context, const JsoHandle *classdesc, uint32_t handle);
+    int (*block_data)(void *context, const void *data, size_t length);
+    int (*end)(void *context);
+};
+
+/* * Open and index a .ser file. Returns NULL with errno set if the file
+ * can't be read; a stream that fails to parse is still returned, with
+ * Jso_Error set.
+ * */
+JsoStream *
+Jso_Open(const char *filename, int flags);
+
+/* the same over 'length' bytes the caller keeps alive until Jso_Close */
+JsoStream *
+Jso_OpenBuffer(const void *buffer, size_t length, int flags);
+
+void
+Jso_Close(JsoStream *stream);
+
+/* NULL for a valid stream, else a static message and the offset it applies to */
+const char *
+Jso_Error(const JsoStream *stream, size_t *offset);
+
+/* the input, magic number included */
+const unsigned char *
+Jso_Data(const JsoStream *stream, size_t *length);
+
+size_t
+Jso_RecordCount(const JsoStream *stream);
+
+/* returns 0, or -1 if 'i' is out of range */
+int
+Jso_GetRecord(const JsoStream *stream, size_t i, JsoRecord *record);
+
+size_t
+Jso_HandleCount(const JsoStream *stream);
+
+/* * returns 0, or -1 if 'i' is out of range or the handle was issued by
+ * the record a failed scan stopped in, which only happens with Jso_Error set
+ * */
+int
+Jso_GetHandle(const JsoStream *stream, size_t i, JsoHandle *handle);
+
+/* * Every record in stream order: record_begin, then handle for each
+ * handle the record issued, then record_end. Only records the scan
+ * finished are visited. Returns 0, what a callback returned to stop it,
+ * or -1 if a handle can't be read.
+ * */
+int
+Jso_Visit(const JsoStream *stream, const JsoVisitor *visitor, void *context);
+
+/* * Walk every value of a valid stream in order. Without JSO_TAPE the
+ * stream is scanned again for the walk. Returns 0, what a callback
+ * returned to stop it, or -1 for a stream with an error or no memory.
+ * */
+int
+Jso_Walk(const JsoStream *stream, const JsoEvents *events, void *context);
+
+/* * Decode 'n_elements' big endian elements of java type 'typecode'
+ * (B C D F I J S Z) from 'src' into host order at 'dst', 1 to 8 bytes
+ * each, booleans as 0 or 1. Returns the bytes read, 0 for a bad typecode.
+ * */
+size_t
+Jso_DecodeArray(char typecode, void *dst, const void *src, size_t n_elements);
+
+#endif /* JSO_H */
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jso_arena.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#define HAVE_MMAP 1
+#endif
+
+/* block header rounded up so the data that follows it is aligned */
+#define BLOCK_HEADER ((sizeof(ArenaBlock) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+static ArenaBlock *
+block_new(size_t size)
+{
+    ArenaBlock *block = NULL;
+    size_t n_bytes = BLOCK_HEADER + size;
+
+#ifdef HAVE_MMAP
+    if (size >= ARENA_HUGE_BLOCK) {
+        void *map;
+
+        map = mmap(NULL, n_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            madvise(map, n_bytes, MADV_HUGEPAGE);
+#endif
+            block = (ArenaBlock *)map;
+            block->is_mapped = 1;
+        }
+    }
+#endif
+    if (block == NULL) {
+        block = (ArenaBlock *)malloc(n_bytes);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->is_mapped = 0;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->unused = 0;
+    return block;
+}
+
+static void
+block_free(ArenaBlock *block)
+{
+#ifdef HAVE_MMAP
+    if (block->is_mapped) {
+        munmap(block, BLOCK_HEADER + block->size);
+        return;
+    }
+#endif
+    free(block);
+}
+
+Arena *
+Arena_New(size_t size_hint)
+{
+    /* * The first block is sized from the stream: descriptors and
+     * strings take roughly a quarter of the wire size.
+     * */
+    Arena *arena;
+    size_t first_block;
+
+    arena = (Arena *)malloc(sizeof(Arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    first_block = size_hint / 4;
+    if (first_block < ARENA_MIN_BLOCK) {
+        first_block = ARENA_MIN_BLOCK;
+    }
+    if (first_block > ARENA_MAX_BLOCK) {
+        first_block = ARENA_MAX_BLOCK;
+    }
+
+    arena->head = NULL;
+    arena->pos = NULL;
+    arena->end = NULL;
+    arena->next_block = first_block;
+    arena->total = 0;
+    return arena;
+}
+
+void *
+Arena_AllocBlock(Arena *arena, size_t n_bytes)
+{
+    ArenaBlock *block;
+    size_t size;
+
+    size = arena->next_block;
+    if (size < n_bytes) {
+        size = n_bytes;
+    }
+
+    block = block_new(size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = arena->head;
+    arena->head = block;
+    arena->total += size;
+
+    arena->pos = (char *)block + BLOCK_HEADER + n_bytes;
+    arena->end = (char *)block + BLOCK_HEADER + size;
+
+    if (arena->next_block < ARENA_MAX_BLOCK) {
+        arena->next_block *= 2;
+    }
+
+    return (char *)block + BLOCK_HEADER;
+}
+
+void
+Arena_Reset(Arena *arena)
+{
+    ArenaBlock *block;
+    ArenaBlock *next;
+
+    if (arena->head == NULL) {
+        return;
+    }
+    for (block = arena->head->next; block != NULL; block = next) {
+        next = block->next;
+        block_free(block);
+    }
+    arena->head->next = NULL;
+    arena->pos = (char *)arena->head + BLOCK_HEADER;
+    arena->total = arena->head->size;
+}
+
+void
+Arena_Destruct(Arena *arena)
+{
+    ArenaBlock *block;
+    ArenaBlock *next;
+
+    if (arena == NULL) {
+        return;
+    }
+    for (block = arena->head; block != NULL; block = next) {
+        next = block->next;
+        block_free(block);
+    }
+    free(arena);
+}
@@ -0,0 +1,89 @@
+#ifndef JSO_ARENA_H
+#define JSO_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* * An Arena is a bump allocator that owns every native node and string
+ * made during one parse (JavaType_Type descriptors, class and field
+ * names, string handles, field tables). Nothing allocated from it is
+ * freed on its own; Arena_Destruct releases all of it at once.
+ *
+ * Blocks start at a size estimated from the stream length and double up
+ * to ARENA_MAX_BLOCK. Blocks of ARENA_HUGE_BLOCK bytes or more are mapped
+ * anonymously and advised for transparent huge pages where the platform
+ * supports it, which only happens for big streams.
+ * */
+
+#define ARENA_MIN_BLOCK ((size_t)16 << 10)
+#define ARENA_MAX_BLOCK ((size_t)64 << 20)
+#define ARENA_HUGE_BLOCK ((size_t)2 << 20)
+
+typedef struct ArenaBlock ArenaBlock;
+typedef struct Arena Arena;
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t size;                /* usable bytes in 'data' */
+    uint8_t is_mapped:1;
+    uint8_t unused:7;
+    /* data follows, aligned to ARENA_ALIGN */
+};
+
+struct Arena {
+    ArenaBlock *head;           /* block being bumped */
+    char *pos;
+    char *end;
+    size_t next_block;          /* size of the next block to allocate */
+    size_t total;               /* bytes reserved from the system */
+};
+
+/* 'size_hint' is the length of the stream the arena will back */
+Arena *
+Arena_New(size_t size_hint);
+
+void
+Arena_Destruct(Arena *arena);
+
+/* forget every allocation, keeping the newest (largest) block for reuse */
+void
+Arena_Reset(Arena *arena);
+
+/* slow path of Arena_Alloc, allocates a new block */
+void *
+Arena_AllocBlock(Arena *arena, size_t n_bytes);
+
+#define ARENA_ALIGN 16
+
+static inline void *
+Arena_Alloc(Arena *arena, size_t n_bytes)
+{
+    /* n_bytes rounded up so every allocation stays aligned */
+    char *p;
+
+    n_bytes = (n_bytes + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1);
+    if ((size_t)(arena->end - arena->pos) < n_bytes) {
+        return Arena_AllocBlock(arena, n_bytes);
+    }
+    p = arena->pos;
+    arena->pos += n_bytes;
+    return p;
+}
+
+static inline char *
+Arena_StrDup(Arena *arena, const void *src, size_t length)
+{
+    /* copy of 'length' bytes with a terminating null */
+    char *str = (char *)Arena_Alloc(arena, length + 1);
+
+    if (str != NULL) {
+        if (length != 0) {
+            memcpy(str, src, length);
+        }
+        str[length] = 0;
+    }
+    return str;
+}
+
+#endif /* JSO_ARENA_H */
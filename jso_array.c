@@ -0,0 +1,385 @@
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+#include "jso_array.h"
+#include "jso_stream.h"
+#include "jso_bswap.h"
+
+static const char *
+java_to_format(char typecode, Py_ssize_t *itemsize)
+{
+    switch (typecode) {
+        case 'B': *itemsize = 1; return "b";
+        case 'C': *itemsize = 2; return "H";
+        case 'D': *itemsize = 8; return "d";
+        case 'F': *itemsize = 4; return "f";
+        case 'I': *itemsize = 4; return "i";
+        case 'J': *itemsize = 8; return "q";
+        case 'S': *itemsize = 2; return "h";
+        case 'Z': *itemsize = 1; return "?";
+        default:  *itemsize = 0; return NULL;
+    }
+}
+
+static PrimitiveArrayObject *
+array_alloc(char typecode, int ndim, const Py_ssize_t *shape)
+{
+    /* new array object with shape and strides filled in, but no data */
+    PrimitiveArrayObject *self;
+    const char *format;
+    Py_ssize_t itemsize;
+    Py_ssize_t length;
+    int i;
+
+    format = java_to_format(typecode, &itemsize);
+    if (format == NULL) {
+        PyErr_Format(PyExc_ValueError, "not a primitive typecode: 0x%x", typecode);
+        return NULL;
+    }
+    if (ndim < 1 || ndim > PRIMITIVE_ARRAY_MAX_DIMS) {
+        PyErr_Format(PyExc_ValueError, "unsupported number of dimensions: %d", ndim);
+        return NULL;
+    }
+
+    length = 1;
+    for (i = 0; i < ndim; i++) {
+        if (shape[i] < 0 || (shape[i] != 0 && length > PY_SSIZE_T_MAX / itemsize / shape[i])) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        length *= shape[i];
+    }
+
+    self = PyObject_New(PrimitiveArrayObject, &PrimitiveArray_Type);
+    if (self == NULL) {
+        return NULL;
+    }
+    self->typecode = typecode;
+    self->format[0] = format[0];
+    self->format[1] = 0;
+    self->ndim = ndim;
+    self->itemsize = itemsize;
+    self->length = length;
+    self->data = NULL;
+    self->base = NULL;
+
+    /* C order: the last dimension is contiguous */
+    for (i = ndim - 1; i >= 0; i--) {
+        self->shape[i] = shape[i];
+        self->strides[i] = (i == ndim - 1) ? itemsize : self->strides[i + 1] * shape[i + 1];
+    }
+
+    return self;
+}
+
+PyObject *
+PrimitiveArray_NewShaped(char typecode, int ndim, const Py_ssize_t *shape)
+{
+    PrimitiveArrayObject *self;
+
+    self = array_alloc(typecode, ndim, shape);
+    if (self == NULL) {
+        return NULL;
+    }
+    /* never a NULL buffer, even for empty arrays */
+    self->data = (char *)PyMem_Malloc(self->length * self->itemsize + 1);
+    if (self->data == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+
+    return (PyObject *)self;
+}
+
+PyObject *
+PrimitiveArray_New(char typecode, Py_ssize_t length)
+{
+    return PrimitiveArray_NewShaped(typecode, 1, &length);
+}
+
+void
+PrimitiveArray_Decode(char typecode, void *dst, const unsigned char *src, Py_ssize_t length)
+{
+    Py_ssize_t itemsize;
+    Py_ssize_t i;
+
+    if (typecode == 'Z') {
+        /* bool format only allows 0 and 1 */
+        for (i = 0; i < length; i++) {
+            ((char *)dst)[i] = src[i] != 0;
+        }
+        return;
+    }
+    java_to_format(typecode, &itemsize);
+    Bswap_Copy(dst, src, (size_t)length, (size_t)itemsize);
+}
+
+PyObject *
+PrimitiveArray_FromBigEndian(char typecode, const unsigned char *src, Py_ssize_t length)
+{
+    PrimitiveArrayObject *self;
+
+    self = (PrimitiveArrayObject *)PrimitiveArray_New(typecode, length);
+    if (self == NULL) {
+        return NULL;
+    }
+
+    PrimitiveArray_Decode(typecode, self->data, src, length);
+
+    return (PyObject *)self;
+}
+
+PyObject *
+PrimitiveArray_View(PyObject *base, Py_ssize_t offset, int ndim)
+{
+    PrimitiveArrayObject *owner = (PrimitiveArrayObject *)base;
+    PrimitiveArrayObject *self;
+
+    assert(PrimitiveArray_Check(base));
+    assert(0 < ndim && ndim <= owner->ndim);
+
+    self = array_alloc(owner->typecode, ndim, owner->shape + (owner->ndim - ndim));
+    if (self == NULL) {
+        return NULL;
+    }
+    assert(offset + self->length <= owner->length);
+
+    /* views always point at the object that owns the memory */
+    self->base = owner->base != NULL ? owner->base : base;
+    Py_INCREF(self->base);
+    self->data = owner->data + offset * owner->itemsize;
+
+    return (PyObject *)self;
+}
+
+static PyObject *
+scalar_item(PrimitiveArrayObject *self, const char *p)
+{
+    /* elements come back as the same python types the list output uses */
+    switch (self->typecode) {
+        case 'B':
+            return PyBytes_FromStringAndSize(p, 1);
+        case 'C':
+            return PyUnicode_FromOrdinal(*(const uint16_t *)p);
+        case 'D':
+            return PyFloat_FromDouble(*(const double *)p);
+        case 'F':
+            return PyFloat_FromDouble((double)*(const float *)p);
+        case 'I':
+            return PyLong_FromLong((long)*(const int32_t *)p);
+        case 'J':
+            return PyLong_FromLongLong((long long)*(const int64_t *)p);
+        case 'S':
+            return PyLong_FromLong((long)*(const int16_t *)p);
+        case 'Z':
+            return PyBool_FromLong((long)*p);
+        default:
+            Py_UNREACHABLE();
+    }
+}
+
+static PyObject *
+array_item(PrimitiveArrayObject *self, Py_ssize_t i)
+{
+    if (i < 0 || i >= self->shape[0]) {
+        PyErr_SetString(PyExc_IndexError, "PrimitiveArray index out of range");
+        return NULL;
+    }
+    if (self->ndim > 1) {
+        /* rows of multi-dimensional arrays are views */
+        return PrimitiveArray_View((PyObject *)self, i * (self->strides[0] / self->itemsize),
+                                   self->ndim - 1);
+    }
+    return scalar_item(self, self->data + i * self->itemsize);
+}
+
+static Py_ssize_t
+array_length(PrimitiveArrayObject *self)
+{
+    return self->shape[0];
+}
+
+static PyObject *
+tolist_dim(PrimitiveArrayObject *self, int dim, const char *p)
+{
+    /* nested lists for dimensions dim.., starting at p */
+    PyObject *list;
+    PyObject *item;
+    Py_ssize_t i;
+
+    list = PyList_New(self->shape[dim]);
+    if (list == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < self->shape[dim]; i++, p += self->strides[dim]) {
+        if (dim == self->ndim - 1) {
+            item = scalar_item(self, p);
+        }
+        else {
+            item = tolist_dim(self, dim + 1, p);
+        }
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+static PyObject *
+array_tolist(PrimitiveArrayObject *self, PyObject *Py_UNUSED(ignored))
+{
+    return tolist_dim(self, 0, self->data);
+}
+
+static int
+array_getbuffer(PrimitiveArrayObject *self, Py_buffer *view, int flags)
+{
+    /* the data is always C-contiguous, so any request can be served */
+    view->obj = (PyObject *)self;
+    Py_INCREF(self);
+    view->buf = self->data;
+    view->len = self->length * self->itemsize;
+    view->readonly = 0;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
+static PyObject *
+array_repr(PrimitiveArrayObject *self)
+{
+    PyObject *shape;
+    PyObject *repr;
+
+    shape = PyObject_GetAttrString((PyObject *)self, "shape");
+    if (shape == NULL) {
+        return NULL;
+    }
+    repr = PyUnicode_FromFormat("PrimitiveArray(typecode='%c', shape=%R)",
+                                self->typecode, shape);
+    Py_DECREF(shape);
+    return repr;
+}
+
+static void
+array_dealloc(PrimitiveArrayObject *self)
+{
+    if (self->base != NULL) {
+        Py_DECREF(self->base);
+    }
+    else {
+        PyMem_Free(self->data);
+    }
+    PyObject_Free(self);
+}
+
+static PyObject *
+dims_to_tuple(const Py_ssize_t *dims, int ndim)
+{
+    PyObject *tuple;
+    PyObject *item;
+    int i;
+
+    tuple = PyTuple_New(ndim);
+    if (tuple == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < ndim; i++) {
+        item = PyLong_FromSsize_t(dims[i]);
+        if (item == NULL) {
+            Py_DECREF(tuple);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(tuple, i, item);
+    }
+    return tuple;
+}
+
+static PyObject *
+array_get_shape(PrimitiveArrayObject *self, void *closure)
+{
+    return dims_to_tuple(self->shape, self->ndim);
+}
+
+static PyObject *
+array_get_strides(PrimitiveArrayObject *self, void *closure)
+{
+    return dims_to_tuple(self->strides, self->ndim);
+}
+
+static PyObject *
+array_get_ndim(PrimitiveArrayObject *self, void *closure)
+{
+    return PyLong_FromLong(self->ndim);
+}
+
+static PyObject *
+array_get_typecode(PrimitiveArrayObject *self, void *closure)
+{
+    return PyUnicode_FromStringAndSize(&self->typecode, 1);
+}
+
+static PyObject *
+array_get_format(PrimitiveArrayObject *self, void *closure)
+{
+    return PyUnicode_FromString(self->format);
+}
+
+static PyObject *
+array_get_itemsize(PrimitiveArrayObject *self, void *closure)
+{
+    return PyLong_FromSsize_t(self->itemsize);
+}
+
+static PyObject *
+array_get_nbytes(PrimitiveArrayObject *self, void *closure)
+{
+    return PyLong_FromSsize_t(self->length * self->itemsize);
+}
+
+static PyGetSetDef array_getset[] = {
+    {"typecode", (getter)array_get_typecode, NULL, "java element typecode", NULL},
+    {"format", (getter)array_get_format, NULL, "buffer protocol format string", NULL},
+    {"itemsize", (getter)array_get_itemsize, NULL, "bytes per element", NULL},
+    {"nbytes", (getter)array_get_nbytes, NULL, "size of the data in bytes", NULL},
+    {"shape", (getter)array_get_shape, NULL, "size of each dimension", NULL},
+    {"strides", (getter)array_get_strides, NULL, "bytes to step in each dimension", NULL},
+    {"ndim", (getter)array_get_ndim, NULL, "number of dimensions", NULL},
+    {NULL}
+};
+
+static PyMethodDef array_methods[] = {
+    {"tolist", (PyCFunction)array_tolist, METH_NOARGS, "elements as a list of python objects"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PySequenceMethods array_as_sequence = {
+    .sq_length = (lenfunc)array_length,
+    .sq_item = (ssizeargfunc)array_item,
+};
+
+static PyBufferProcs array_as_buffer = {
+    .bf_getbuffer = (getbufferproc)array_getbuffer,
+    .bf_releasebuffer = NULL,
+};
+
+PyTypeObject PrimitiveArray_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "jso_reader.PrimitiveArray",
+    .tp_basicsize = sizeof(PrimitiveArrayObject),
+    .tp_dealloc = (destructor)array_dealloc,
+    .tp_repr = (reprfunc)array_repr,
+    .tp_as_sequence = &array_as_sequence,
+    .tp_as_buffer = &array_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "contiguous native-endian java primitive array",
+    .tp_methods = array_methods,
+    .tp_getset = array_getset,
+};
@@ -0,0 +1,66 @@
+#ifndef JSO_ARRAY_H
+#define JSO_ARRAY_H
+
+#include <Python.h>
+
+/* * PrimitiveArray is the typed output for java primitive arrays. The
+ * elements live in one contiguous native-endian buffer that is exported
+ * through the buffer protocol with a struct module format string, so
+ * memoryview, array.array and numpy can use it without a copy.
+ *
+ *     java  format  c type
+ *     ----  ------  ------
+ *      B      b     int8_t
+ *      C      H     uint16_t
+ *      D      d     double
+ *      F      f     float
+ *      I      i     int32_t
+ *      J      q     int64_t
+ *      S      h     int16_t
+ *      Z      ?     bool (one byte, 0 or 1)
+ *
+ * Rectangular multi-dimensional arrays (double[][], int[][][], ...) are
+ * a single C-contiguous block with a shape and strides. Indexing one of
+ * those gives a view that shares the block with its base.
+ * */
+
+#define PRIMITIVE_ARRAY_MAX_DIMS 8
+
+typedef struct {
+    PyObject_HEAD
+    char typecode;          /* java typecode */
+    char format[2];         /* buffer protocol format */
+    int ndim;
+    Py_ssize_t itemsize;
+    Py_ssize_t length;      /* total number of elements */
+    Py_ssize_t shape[PRIMITIVE_ARRAY_MAX_DIMS];
+    Py_ssize_t strides[PRIMITIVE_ARRAY_MAX_DIMS];
+    char *data;
+    PyObject *base;         /* owner of 'data' for views, NULL otherwise */
+} PrimitiveArrayObject;
+
+extern PyTypeObject PrimitiveArray_Type;
+
+#define PrimitiveArray_Check(op) PyObject_TypeCheck(op, &PrimitiveArray_Type)
+
+/* new one dimensional array of 'length' uninitialized elements */
+PyObject *
+PrimitiveArray_New(char typecode, Py_ssize_t length);
+
+/* new C-contiguous array of the given shape, uninitialized */
+PyObject *
+PrimitiveArray_NewShaped(char typecode, int ndim, const Py_ssize_t *shape);
+
+/* new array decoded from 'length' big endian elements at 'src' */
+PyObject *
+PrimitiveArray_FromBigEndian(char typecode, const unsigned char *src, Py_ssize_t length);
+
+/* view of the trailing 'ndim' dimensions of 'base' starting at element 'offset' */
+PyObject *
+PrimitiveArray_View(PyObject *base, Py_ssize_t offset, int ndim);
+
+/* decode 'length' big endian elements at 'src' into native order at 'dst' */
+void
+PrimitiveArray_Decode(char typecode, void *dst, const unsigned char *src, Py_ssize_t length);
+
+#endif /* JSO_ARRAY_H */
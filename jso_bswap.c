@@ -0,0 +1,246 @@
+#include <stdint.h>
+#include <string.h>
+#include "jso_bswap.h"
+#include "jso_stream.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BSWAP_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BSWAP_HOST_BIG_ENDIAN 1
+#endif
+
+typedef void (*bswap_kernel)(void *dst, const void *src, size_t n);
+
+static struct {
+    bswap_kernel lane16;
+    bswap_kernel lane32;
+    bswap_kernel lane64;
+    const char *name;
+} kernels;
+
+/* scalar kernels, also used for the tails of the vector kernels */
+
+static void
+bswap16_scalar(void *dst, const void *src, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    uint16_t *d = (uint16_t *)dst;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        d[i] = load_be16(s + 2*i);
+    }
+}
+
+static void
+bswap32_scalar(void *dst, const void *src, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    uint32_t *d = (uint32_t *)dst;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        d[i] = load_be32(s + 4*i);
+    }
+}
+
+static void
+bswap64_scalar(void *dst, const void *src, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    uint64_t *d = (uint64_t *)dst;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        d[i] = load_be64(s + 8*i);
+    }
+}
+
+#ifdef BSWAP_X86
+
+/* pshufb masks reversing the bytes of every 2, 4 and 8 byte lane */
+#define MASK16 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+#define MASK32 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define MASK64 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+
+#define DEFINE_SSSE3_KERNEL(bits, mask)                                     \
+__attribute__((target("ssse3"))) static void                                \
+bswap##bits##_ssse3(void *dst, const void *src, size_t n)                   \
+{                                                                           \
+    const size_t per_vector = 16 / (bits / 8);                              \
+    const __m128i shuffle = _mm_setr_epi8(mask);                            \
+    const unsigned char *s = (const unsigned char *)src;                    \
+    unsigned char *d = (unsigned char *)dst;                                \
+    size_t i = 0;                                                           \
+                                                                            \
+    for (; i + per_vector <= n; i += per_vector) {                          \
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i * (bits / 8))); \
+        _mm_storeu_si128((__m128i *)(d + i * (bits / 8)),                   \
+                         _mm_shuffle_epi8(v, shuffle));                     \
+    }                                                                       \
+    bswap##bits##_scalar(d + i * (bits / 8), s + i * (bits / 8), n - i);    \
+}
+
+#define DEFINE_AVX2_KERNEL(bits, mask)                                      \
+__attribute__((target("avx2"))) static void                                 \
+bswap##bits##_avx2(void *dst, const void *src, size_t n)                    \
+{                                                                           \
+    const size_t per_vector = 32 / (bits / 8);                              \
+    /* vpshufb shuffles within each 128 bit half, so the mask repeats */    \
+    const __m256i shuffle = _mm256_setr_epi8(mask, mask);                   \
+    const unsigned char *s = (const unsigned char *)src;                    \
+    unsigned char *d = (unsigned char *)dst;                                \
+    size_t i = 0;                                                           \
+                                                                            \
+    for (; i + 2 * per_vector <= n; i += 2 * per_vector) {                  \
+        const unsigned char *p = s + i * (bits / 8);                        \
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);                 \
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));          \
+        _mm256_storeu_si256((__m256i *)(d + i * (bits / 8)),                \
+                            _mm256_shuffle_epi8(a, shuffle));               \
+        _mm256_storeu_si256((__m256i *)(d + i * (bits / 8) + 32),           \
+                            _mm256_shuffle_epi8(b, shuffle));               \
+    }                                                                       \
+    for (; i + per_vector <= n; i += per_vector) {                          \
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i * (bits / 8))); \
+        _mm256_storeu_si256((__m256i *)(d + i * (bits / 8)),                \
+                            _mm256_shuffle_epi8(v, shuffle));               \
+    }                                                                       \
+    bswap##bits##_scalar(d + i * (bits / 8), s + i * (bits / 8), n - i);    \
+}
+
+DEFINE_SSSE3_KERNEL(16, MASK16)
+DEFINE_SSSE3_KERNEL(32, MASK32)
+DEFINE_SSSE3_KERNEL(64, MASK64)
+DEFINE_AVX2_KERNEL(16, MASK16)
+DEFINE_AVX2_KERNEL(32, MASK32)
+DEFINE_AVX2_KERNEL(64, MASK64)
+
+#endif /* BSWAP_X86 */
+
+#ifdef BSWAP_HOST_BIG_ENDIAN
+static void
+copy16(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n * 2);
+}
+
+static void
+copy32(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n * 4);
+}
+
+static void
+copy64(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n * 8);
+}
+#endif
+
+void
+Bswap_Init(void)
+{
+    /* idempotent, the same kernels are chosen on every call */
+#if defined(BSWAP_HOST_BIG_ENDIAN)
+    kernels.lane16 = copy16;
+    kernels.lane32 = copy32;
+    kernels.lane64 = copy64;
+    kernels.name = "memcpy";
+    return;
+#else
+    kernels.lane16 = bswap16_scalar;
+    kernels.lane32 = bswap32_scalar;
+    kernels.lane64 = bswap64_scalar;
+    kernels.name = "scalar";
+
+#ifdef BSWAP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.lane16 = bswap16_avx2;
+        kernels.lane32 = bswap32_avx2;
+        kernels.lane64 = bswap64_avx2;
+        kernels.name = "avx2";
+    }
+    else if (__builtin_cpu_supports("ssse3")) {
+        kernels.lane16 = bswap16_ssse3;
+        kernels.lane32 = bswap32_ssse3;
+        kernels.lane64 = bswap64_ssse3;
+        kernels.name = "ssse3";
+    }
+#endif
+#endif
+}
+
+void
+Bswap_Copy(void *dst, const void *src, size_t n_elements, size_t element_size)
+{
+    if (kernels.name == NULL) {
+        Bswap_Init();
+    }
+
+    switch (element_size) {
+        case 1:
+            memcpy(dst, src, n_elements);
+            break;
+        case 2:
+            kernels.lane16(dst, src, n_elements);
+            break;
+        case 4:
+            kernels.lane32(dst, src, n_elements);
+            break;
+        case 8:
+            kernels.lane64(dst, src, n_elements);
+            break;
+    }
+}
+
+int
+Bswap_Select(const char *name)
+{
+    /* * Force a specific kernel family, for tests and benchmarks.
+     * Returns -1 if it doesn't exist or the CPU can't run it.
+     * */
+#ifndef BSWAP_HOST_BIG_ENDIAN
+    if (strcmp(name, "scalar") == 0) {
+        kernels.lane16 = bswap16_scalar;
+        kernels.lane32 = bswap32_scalar;
+        kernels.lane64 = bswap64_scalar;
+        kernels.name = "scalar";
+        return 0;
+    }
+#ifdef BSWAP_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "ssse3") == 0 && __builtin_cpu_supports("ssse3")) {
+        kernels.lane16 = bswap16_ssse3;
+        kernels.lane32 = bswap32_ssse3;
+        kernels.lane64 = bswap64_ssse3;
+        kernels.name = "ssse3";
+        return 0;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        kernels.lane16 = bswap16_avx2;
+        kernels.lane32 = bswap32_avx2;
+        kernels.lane64 = bswap64_avx2;
+        kernels.name = "avx2";
+        return 0;
+    }
+#endif
+#endif
+    if (kernels.name == NULL) {
+        Bswap_Init();
+    }
+    return strcmp(name, kernels.name) == 0 ? 0 : -1;
+}
+
+const char *
+Bswap_KernelName(void)
+{
+    if (kernels.name == NULL) {
+        Bswap_Init();
+    }
+    return kernels.name;
+}
@@ -0,0 +1,30 @@
+#ifndef JSO_BSWAP_H
+#define JSO_BSWAP_H
+
+#include <stddef.h>
+
+/* * Bulk big endian to host order conversion for primitive array
+ * payloads. Bswap_Copy converts 'n_elements' lanes of 'element_size'
+ * bytes (1, 2, 4 or 8) from 'src' into 'dst'; neither pointer has to be
+ * aligned and they must not overlap.
+ *
+ * On x86 the 16/32/64 bit lanes go through SSSE3 or AVX2 shuffle kernels
+ * with a scalar tail, picked once from the CPU features at runtime. Every
+ * other host uses the scalar loop (or a plain memcpy on big endian hosts).
+ * */
+
+void
+Bswap_Init(void);
+
+void
+Bswap_Copy(void *dst, const void *src, size_t n_elements, size_t element_size);
+
+/* force a kernel by name, returns -1 if it can't run here */
+int
+Bswap_Select(const char *name);
+
+/* "avx2", "ssse3", "scalar" or "memcpy" */
+const char *
+Bswap_KernelName(void);
+
+#endif /* JSO_BSWAP_H */
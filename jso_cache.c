@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "jso_cache.h"
+#include "jso_stream.h"
+#include "jso_arena.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK cache_lock;
+#define cache_lock_init(l) InitializeSRWLock(l)
+#define cache_lock_free(l) ((void)(l))
+#define cache_lock_acquire(l) AcquireSRWLockExclusive(l)
+#define cache_lock_release(l) ReleaseSRWLockExclusive(l)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t cache_lock;
+#define cache_lock_init(l) pthread_mutex_init(l, NULL)
+#define cache_lock_free(l) pthread_mutex_destroy(l)
+#define cache_lock_acquire(l) pthread_mutex_lock(l)
+#define cache_lock_release(l) pthread_mutex_unlock(l)
+#endif
+
+struct ClassCache {
+    cache_lock lock;
+    Arena *arena;           /* owns every entry, freed with the cache */
+    ClassCacheEntry *buckets[CLASS_CACHE_BUCKETS];
+    size_t entries;
+    size_t hits;
+    size_t misses;
+};
+
+static uint64_t
+descriptor_hash(const unsigned char *classname, size_t length, uint64_t suid)
+{
+    /* FNV-1a over the class name, with the suid folded in */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash = (hash ^ classname[i]) * 0x100000001b3ULL;
+    }
+    hash ^= suid;
+    hash *= 0x100000001b3ULL;
+    return hash ^ (hash >> 32);
+}
+
+ClassCache *
+ClassCache_New(void)
+{
+    ClassCache *cache;
+
+    cache = (ClassCache *)calloc(1, sizeof(ClassCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->arena = Arena_New(0);
+    if (cache->arena == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache_lock_init(&cache->lock);
+    return cache;
+}
+
+void
+ClassCache_Destruct(ClassCache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    cache_lock_free(&cache->lock);
+    Arena_Destruct(cache->arena);
+    free(cache);
+}
+
+const ClassCacheEntry *
+ClassCache_Find(ClassCache *cache, const unsigned char *p, size_t remaining)
+{
+    /* * 'p' points at the class name length of a TC_CLASSDESC. Only
+     * the name and suid are read to hash; the rest is compared against
+     * the bytes of each candidate.
+     * */
+    const ClassCacheEntry *entry;
+    size_t length;
+    uint64_t hash;
+
+    if (remaining < 2) {
+        return NULL;
+    }
+    length = load_be16(p);
+    if (remaining < 2 + length + 8) {
+        return NULL;
+    }
+    hash = descriptor_hash(p + 2, length, load_be64(p + 2 + length));
+
+    cache_lock_acquire(&cache->lock);
+    for (entry = cache->buckets[hash % CLASS_CACHE_BUCKETS]; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->body_length <= remaining
+            && memcmp(entry->body, p, entry->body_length) == 0) {
+            break;
+        }
+    }
+    if (entry != NULL) {
+        cache->hits++;
+    }
+    else {
+        cache->misses++;
+    }
+    cache_lock_release(&cache->lock);
+
+    return entry;
+}
+
+static JavaType_Type *
+copy_field(Arena *arena, const JavaType_Type *field)
+{
+    /* field descriptors only carry names and typecodes */
+    JavaType_Type *copy;
+
+    copy = JavaType_New(arena, (char)field->jt_type);
+    if (copy == NULL) {
+        return NULL;
+    }
+    copy->prim_typecode = field->prim_typecode;
+    copy->obj_typecode = field->obj_typecode;
+    copy->is_primitive = field->is_primitive;
+    copy->is_object = field->is_object;
+    /* the keys are immutable and shared with the parse that made them */
+    copy->key = field->key;
+    Py_XINCREF(copy->key);
+    copy->super_key = field->super_key;
+    Py_XINCREF(copy->super_key);
+    copy->fieldname = Arena_StrDup(arena, field->fieldname, strlen(field->fieldname));
+    if (copy->fieldname == NULL) {
+        return NULL;
+    }
+    if (field->classname != NULL) {
+        copy->classname = Arena_StrDup(arena, field->classname, strlen(field->classname));
+        if (copy->classname == NULL) {
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+static int
+scan_ref_handles(const unsigned char *body, size_t body_length, uint32_t *ref_handles)
+{
+    /* * Walk the field list of descriptor bytes that already parsed
+     * once, noting which field class names were back references.
+     * */
+    Stream stream;
+    uint16_t n_fields;
+    size_t i;
+
+    Stream_Init(&stream, body, body_length);
+    stream.pos += 2 + load_be16(stream.pos) + 8 + 1;
+    n_fields = Stream_BE16(&stream);
+
+    for (i = 0; i < n_fields; i++) {
+        char field_tc = (char)Stream_U8(&stream);
+
+        stream.pos += 2 + load_be16(stream.pos);
+        ref_handles[i] = 0;
+        if (field_tc != 'L' && field_tc != '[') {
+            continue;
+        }
+        switch (Stream_U8(&stream)) {
+            case TC_STRING:
+                stream.pos += 2 + load_be16(stream.pos);
+                break;
+            case TC_LONGSTRING:
+                stream.pos += 8 + load_be64(stream.pos);
+                break;
+            case TC_REFERENCE:
+                ref_handles[i] = Stream_BE32(&stream);
+                break;
+            default:
+                return -1;
+        }
+    }
+    return stream.pos == stream.end ? 0 : -1;
+}
+
+void
+ClassCache_Insert(ClassCache *cache, const unsigned char *body, size_t body_length,
+                  const JavaType_Type *type)
+{
+    /* * Copies 'type' and its fields into the cache. Nothing happens if
+     * the cache is full or an equal entry was inserted in the meantime.
+     * */
+    ClassCacheEntry *entry;
+    ClassCacheEntry **bucket;
+    uint64_t hash;
+    size_t i;
+
+    hash = descriptor_hash(body + 2, load_be16(body), type->serial_version_uid);
+
+    cache_lock_acquire(&cache->lock);
+    if (cache->entries >= CLASS_CACHE_MAX_ENTRIES) {
+        goto done;
+    }
+    bucket = &cache->buckets[hash % CLASS_CACHE_BUCKETS];
+    for (entry = *bucket; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->body_length == body_length
+            && memcmp(entry->body, body, body_length) == 0) {
+            goto done;
+        }
+    }
+
+    /* a failed allocation just leaves the entry out; the arena keeps
+     * whatever was bumped, which is bounded by the entry limit */
+    entry = (ClassCacheEntry *)Arena_Alloc(cache->arena, sizeof(ClassCacheEntry));
+    if (entry == NULL) {
+        goto done;
+    }
+    entry->hash = hash;
+    entry->body = (const unsigned char *)Arena_StrDup(cache->arena, body, body_length);
+    entry->body_length = body_length;
+    entry->classname = Arena_StrDup(cache->arena, type->classname, strlen(type->classname));
+    entry->serial_version_uid = type->serial_version_uid;
+    memcpy(&entry->flags, &type->flags, 1);
+    entry->class_kind = type->class_kind;
+    entry->n_fields = type->n_fields;
+    entry->fields = (JavaType_Type **)Arena_Alloc(cache->arena,
+                                                  sizeof(void *) * (type->n_fields + 1));
+    entry->ref_handles = (uint32_t *)Arena_Alloc(cache->arena,
+                                                 sizeof(uint32_t) * (type->n_fields + 1));
+    if (entry->body == NULL || entry->classname == NULL
+        || entry->fields == NULL || entry->ref_handles == NULL) {
+        goto done;
+    }
+    for (i = 0; i < type->n_fields; i++) {
+        entry->fields[i] = copy_field(cache->arena, type->fields[i]);
+        if (entry->fields[i] == NULL) {
+            goto done;
+        }
+    }
+    if (scan_ref_handles(entry->body, body_length, entry->ref_handles) < 0) {
+        assert(0);
+        goto done;
+    }
+
+    entry->next = *bucket;
+    *bucket = entry;
+    cache->entries++;
+
+done:
+    cache_lock_release(&cache->lock);
+}
+
+void
+ClassCache_Stats(ClassCache *cache, ClassCacheStats *stats)
+{
+    cache_lock_acquire(&cache->lock);
+    stats->entries = cache->entries;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    cache_lock_release(&cache->lock);
+}
@@ -0,0 +1,65 @@
+#ifndef JSO_CACHE_H
+#define JSO_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "javatype.h"
+
+/* * A ClassCache remembers class descriptors across streams, keyed by
+ * class name, serialVersionUID and field signature. An entry holds the
+ * raw bytes of the descriptor from the class name length through the
+ * last field, so a lookup is a hash of (name, suid) and a memcmp of the
+ * stream against those bytes. On a hit the parser reuses the cached
+ * field table instead of parsing the fields again.
+ *
+ * Entries are immutable once inserted and live as long as the cache, so
+ * pointers returned by ClassCache_Find stay valid without holding the
+ * lock. Lookups and inserts are serialized by a mutex and the cache can
+ * be shared between threads.
+ * */
+
+#define CLASS_CACHE_BUCKETS 1024
+#define CLASS_CACHE_MAX_ENTRIES 4096
+
+typedef struct ClassCacheEntry ClassCacheEntry;
+typedef struct ClassCache ClassCache;
+
+struct ClassCacheEntry {
+    ClassCacheEntry *next;
+    uint64_t hash;
+    const unsigned char *body;      /* descriptor bytes, class name through fields */
+    size_t body_length;
+    char *classname;
+    uint64_t serial_version_uid;
+    uint8_t flags;                  /* raw classDescFlags byte */
+    ClassKind class_kind;
+    size_t n_fields;
+    JavaType_Type **fields;         /* shared, read only field descriptors */
+    uint32_t *ref_handles;          /* wire handle of a referenced field class name, 0 otherwise */
+};
+
+typedef struct {
+    size_t entries;
+    size_t hits;
+    size_t misses;
+} ClassCacheStats;
+
+ClassCache *
+ClassCache_New(void);
+
+void
+ClassCache_Destruct(ClassCache *cache);
+
+/* entry matching the descriptor bytes at 'p', or NULL */
+const ClassCacheEntry *
+ClassCache_Find(ClassCache *cache, const unsigned char *p, size_t remaining);
+
+/* remember 'type', parsed from the 'body_length' descriptor bytes at 'body' */
+void
+ClassCache_Insert(ClassCache *cache, const unsigned char *body, size_t body_length,
+                  const JavaType_Type *type);
+
+void
+ClassCache_Stats(ClassCache *cache, ClassCacheStats *stats);
+
+#endif /* JSO_CACHE_H */
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jso.h"
+#include "jso_internal.h"
+#include "jso_stream.h"
+
+/* * Jso_Walk: the values of a stream as JsoEvents, from the content tape
+ * of its ScanIndex. The scan has validated and resolved everything, so
+ * the walk only steps through the nodes and reads values where they lie.
+ * The one thing the tape leaves out is field names; they are read from
+ * the descriptors once, before the walk.
+ * */
+
+typedef struct {
+    const char *name;
+    uint16_t length;
+} FieldName;
+
+typedef struct {
+    const JsoStream *stream;
+    const ScanIndex *index;     /* the stream's, or a scan with a tape for the walk */
+    const unsigned char *input;
+    const JsoEvents *events;
+    void *context;
+    size_t node;                /* next node of the tape */
+    FieldName *names;           /* by the field's position in index->pool */
+} Walker;
+
+/* call an event if the consumer has it */
+#define EMIT(w, event, ...) \
+    ((w)->events->event != NULL ? (w)->events->event((w)->context, __VA_ARGS__) : 0)
+
+static int
+walk_content(Walker *w);
+
+static int
+read_field_names(Walker *w)
+{
+    /* * classDesc: name, serialVersionUID, flags, field count, then per
+     * field a typecode, its name and for object fields a class name,
+     * which is a string or a reference to one.
+     * */
+    const ScanIndex *index = w->index;
+    const ScanHandle *h;
+    const ScanClass *cls;
+    const unsigned char *p;
+    FieldName *name;
+    size_t i;
+    uint16_t j;
+    char tc;
+
+    w->names = (FieldName *)malloc((index->pool_length ? index->pool_length : 1)
+                                   * sizeof(FieldName));
+    if (w->names == NULL) {
+        return -1;
+    }
+    for (i = 0; i < index->n_handles; i++) {
+        h = &index->handles[i];
+        if (h->type != TC_CLASSDESC) {
+            continue;
+        }
+        cls = &index->classes[h->layout];
+        p = w->input + cls->name_offset + cls->name_length + 8 + 1 + 2;
+        for (j = 0; j < cls->n_fields; j++) {
+            name = &w->names[cls->typecodes + j];
+            tc = (char)p[0];
+            name->length = load_be16(p + 1);
+            name->name = (const char *)p + 3;
+            p += 3 + name->length;
+            if (tc != 'L' && tc != '[') {
+                continue;
+            }
+            switch (p[0]) {
+                case TC_STRING:
+                    p += 3 + load_be16(p + 1);
+                    break;
+                case TC_LONGSTRING:
+                    p += 9 + (size_t)load_be64(p + 1);
+                    break;
+                default:
+                    p += 5;     /* TC_REFERENCE */
+            }
+        }
+    }
+    return 0;
+}
+
+static int
+walk_annotation(Walker *w, const JsoHandle *desc)
+{
+    /* the SCAN_ANNOTATION node and the block data and objects it counts */
+    const ScanNode *node = &w->index->nodes[w->node++];
+    size_t end = w->node + node->count;
+    int status;
+
+    if ((status = EMIT(w, annotation_begin, desc)) != 0) {
+        return status;
+    }
+    while (w->node < end) {
+        if (w->index->nodes[w->node].type == TC_ENDBLOCKDATA) {
+            w->node++;
+            continue;
+        }
+        if ((status = walk_content(w)) != 0) {
+            return status;
+        }
+    }
+    return EMIT(w, annotation_end, desc);
+}
+
+static int
+walk_class_data(Walker *w, uint32_t d)
+{
+    /* the values of an instance of 'd', superclass first */
+    const ScanIndex *index = w->index;
+    const ScanClass *cls;
+    const ScanNode *node;
+    const FieldName *name;
+    const unsigned char *p;
+    JsoHandle desc;
+    JsoValue value;
+    size_t i;
+    char tc;
+    int status;
+
+    if (d == SCAN_NONE) {
+        return 0;
+    }
+    if ((status = walk_class_data(w, index->handles[d].class_handle)) != 0) {
+        return status;
+    }
+    cls = &index->classes[index->handles[d].layout];
+    Jso_GetHandle(w->stream, d, &desc);
+    if ((status = EMIT(w, class_data, &desc)) != 0) {
+        return status;
+    }
+    if (!(cls->flags & SC_SERIALIZABLE)) {
+        return cls->flags & SC_EXTERNALIZABLE ? walk_annotation(w, &desc) : 0;
+    }
+
+    for (i = 0; i < cls->n_fields; i++) {
+        tc = index->pool[cls->typecodes + i];
+        name = &w->names[cls->typecodes + i];
+        if (tc == 'L' || tc == '[') {
+            if ((status = EMIT(w, field, name->name, name->length, tc, NULL)) != 0
+                || (status = walk_content(w)) != 0) {
+                return status;
+            }
+            continue;
+        }
+        node = &index->nodes[w->node++];
+        p = w->input + node->value;
+        value.i = 0;
+        value.d = 0;
+        switch (tc) {
+            case 'B': value.i = (int8_t)p[0]; break;
+            case 'Z': value.i = p[0] != 0; break;
+            case 'C': value.i = load_be16(p); break;
+            case 'S': value.i = (int16_t)load_be16(p); break;
+            case 'I': value.i = (int32_t)load_be32(p); break;
+            case 'J': value.i = (int64_t)load_be64(p); break;
+            case 'F': {
+                uint32_t bits = load_be32(p);
+                float f;
+
+                memcpy(&f, &bits, sizeof(f));
+                value.d = f;
+                break;
+            }
+            case 'D': {
+                uint64_t bits = load_be64(p);
+
+                memcpy(&value.d, &bits, sizeof(value.d));
+                break;
+            }
+        }
+        if ((status = EMIT(w, field, name->name, name->length, tc, &value)) != 0) {
+            return status;
+        }
+    }
+    if (cls->flags & SC_WRITE_METHOD) {
+        return walk_annotation(w, &desc);
+    }
+    return 0;
+}
+
+static int
+walk_array(Walker *w, const ScanNode *node)
+{
+    JsoHandle array;
+    uint32_t i;
+    int status;
+
+    w->node++;      /* the class descriptor */
+    Jso_GetHandle(w->stream, node->handle, &array);
+    if ((status = EMIT(w, array_begin, array.element_type, node->count, node->handle)) != 0) {
+        return status;
+    }
+    if (array.element_type == 'L' || array.element_type == '[') {
+        for (i = 0; i < node->count; i++) {
+            if ((status = walk_content(w)) != 0) {
+                return status;
+            }
+        }
+    }
+    else if ((status = EMIT(w, primitive_array, array.element_type, w->input + node->value,
+                            node->count)) != 0) {
+        return status;
+    }
+    return EMIT(w, array_end, node->handle);
+}
+
+static int
+walk_content(Walker *w)
+{
+    const ScanIndex *index = w->index;
+    const ScanNode *node = &index->nodes[w->node++];
+    const ScanHandle *h;
+    JsoHandle desc, name;
+    int status;
+
+    switch (node->type) {
+        case TC_NULL:
+            return w->events->null != NULL ? w->events->null(w->context) : 0;
+        case TC_REFERENCE:
+            return EMIT(w, reference, node->handle);
+        case TC_STRING:
+            h = &index->handles[node->handle];
+            return EMIT(w, string, (const char *)w->input + node->value,
+                        (size_t)(h->offset + h->length - node->value), node->handle);
+        case TC_BLOCKDATA:
+            return EMIT(w, block_data, w->input + node->value, node->count);
+        case TC_CLASSDESC:
+        case TC_PROXYCLASSDESC:
+            /* a descriptor where an object goes, as ObjectInputStream allows */
+            Jso_GetHandle(w->stream, node->handle, &desc);
+            return EMIT(w, class_value, &desc, node->handle);
+        case TC_OBJECT:
+            w->node++;      /* the class descriptor */
+            Jso_GetHandle(w->stream, index->handles[node->handle].class_handle, &desc);
+            if ((status = EMIT(w, object_begin, &desc, node->handle)) != 0
+                || (status = walk_class_data(w, desc.index)) != 0) {
+                return status;
+            }
+            return EMIT(w, object_end, node->handle);
+        case TC_ARRAY:
+            return walk_array(w, node);
+        case TC_ENUM:
+            w->node++;      /* the class descriptor */
+            Jso_GetHandle(w->stream, index->handles[node->handle].class_handle, &desc);
+            /* the constant's name, a new string or a reference to one */
+            Jso_GetHandle(w->stream, index->nodes[w->node++].handle, &name);
+            return EMIT(w, enum_constant, &desc, (const char *)w->input + name.body,
+                        (size_t)name.count, node->handle);
+        case TC_CLASS:
+            w->node++;
+            Jso_GetHandle(w->stream, index->handles[node->handle].class_handle, &desc);
+            return EMIT(w, class_value, &desc, node->handle);
+        default:
+            return 0;
+    }
+}
+
+int
+Jso_Walk(const JsoStream *stream, const JsoEvents *events, void *context)
+{
+    ScanIndex tape;
+    Walker w;
+    JsoRecord record;
+    size_t i;
+    int status = 0;
+
+    if (stream->index.error != NULL) {
+        return -1;
+    }
+    w.stream = stream;
+    w.index = &stream->index;
+    w.input = stream->input;
+    w.events = events;
+    w.context = context;
+    w.names = NULL;
+
+    ScanIndex_Init(&tape);
+    if (!stream->index.with_nodes) {
+        tape.with_nodes = 1;
+        if (Scan_Stream(&tape, stream->input, stream->length) < 0) {
+            ScanIndex_Release(&tape);
+            return -1;
+        }
+        w.index = &tape;
+    }
+    if (read_field_names(&w) < 0) {
+        ScanIndex_Release(&tape);
+        return -1;
+    }
+
+    for (i = 0; status == 0 && i < w.index->n_records; i++) {
+        Jso_GetRecord(stream, i, &record);
+        w.node = w.index->records[i].node;
+        if ((status = EMIT(&w, record_begin, &record)) != 0
+            || (status = walk_content(&w)) != 0) {
+            break;
+        }
+        status = EMIT(&w, record_end, &record);
+    }
+    if (status == 0 && events->end != NULL) {
+        status = events->end(context);
+    }
+
+    free(w.names);
+    ScanIndex_Release(&tape);
+    return status;
+}
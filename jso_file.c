@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "jso_file.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HAVE_MMAP 1
+#endif
+
+/* handed out for empty files so 'buffer' is never NULL */
+static const char empty_file[1] = {0};
+
+static int
+read_whole_file(StreamFile *file, const char *filename)
+{
+    /* * Read a whole file into a heap buffer with a single fread.
+     * */
+    FILE *fd;
+    long file_size;
+    char *buffer;
+    size_t n_bytes;
+
+    fd = fopen(filename, "rb");
+    if (fd == NULL) {
+        return -1;
+    }
+
+    if (fseek(fd, 0, SEEK_END) != 0 || (file_size = ftell(fd)) < 0
+        || fseek(fd, 0, SEEK_SET) != 0) {
+        fclose(fd);
+        return -1;
+    }
+
+    buffer = (char *)malloc((size_t)file_size + 1);
+    if (buffer == NULL) {
+        fclose(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    n_bytes = fread(buffer, 1, (size_t)file_size, fd);
+    fclose(fd);
+    if (n_bytes != (size_t)file_size) {
+        free(buffer);
+        errno = EIO;
+        return -1;
+    }
+
+    file->buffer = buffer;
+    file->length = n_bytes;
+    file->is_mapped = 0;
+    return 0;
+}
+
+#ifdef HAVE_MMAP
+static int
+map_whole_file(StreamFile *file, const char *filename)
+{
+    int fd;
+    struct stat st;
+    void *map;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        /* mmap refuses zero length mappings */
+        close(fd);
+        file->buffer = empty_file;
+        file->length = 0;
+        file->is_mapped = 0;
+        return 0;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* the mapping keeps its own reference to the file */
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    file->buffer = (const char *)map;
+    file->length = (size_t)st.st_size;
+    file->is_mapped = 1;
+    return 0;
+}
+#endif
+
+int
+StreamFile_Open(StreamFile *file, const char *filename, int use_mmap)
+{
+    file->buffer = NULL;
+    file->length = 0;
+    file->is_mapped = 0;
+    file->unused = 0;
+
+#ifdef HAVE_MMAP
+    if (use_mmap) {
+        return map_whole_file(file, filename);
+    }
+#else
+    (void)use_mmap;
+#endif
+    return read_whole_file(file, filename);
+}
+
+void
+StreamFile_Close(StreamFile *file)
+{
+    if (file->buffer == NULL || file->buffer == empty_file) {
+        file->buffer = NULL;
+        return;
+    }
+#ifdef HAVE_MMAP
+    if (file->is_mapped) {
+        munmap((void *)file->buffer, file->length);
+        file->buffer = NULL;
+        return;
+    }
+#endif
+    free((void *)file->buffer);
+    file->buffer = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef JSO_FILE_H
+#define JSO_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* * A StreamFile is the whole contents of a .ser file in one contiguous
+ * block of memory, either read into a heap buffer or memory mapped
+ * read-only. Either way the parser runs a Stream cursor over 'buffer'.
+ *
+ * Mapped files are advised for sequential access so the kernel reads
+ * ahead aggressively and drops pages behind the cursor; a file that is
+ * already in the page cache costs nothing to open beyond the mmap call.
+ * */
+
+typedef struct StreamFile StreamFile;
+
+struct StreamFile {
+    const char *buffer;
+    size_t length;
+    uint8_t is_mapped:1;
+    uint8_t unused:7;
+};
+
+/* returns 0 on success, -1 with errno set on failure */
+int
+StreamFile_Open(StreamFile *file, const char *filename, int use_mmap);
+
+void
+StreamFile_Close(StreamFile *file);
+
+#endif /* JSO_FILE_H */
@@ -0,0 +1,18 @@
+#ifndef JSO_INTERNAL_H
+#define JSO_INTERNAL_H
+
+#include "jso.h"
+#include "jso_file.h"
+#include "jso_scan.h"
+
+/* the JsoStream behind the opaque pointer, shared by jso.c and jso_events.c */
+struct JsoStream {
+    StreamFile file;
+    const unsigned char *input;
+    size_t length;
+    ScanIndex index;
+    uint8_t has_file:1;
+    uint8_t unused:7;
+};
+
+#endif /* JSO_INTERNAL_H */
@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include "jso_pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK pool_lock;
+typedef HANDLE pool_thread;
+#define pool_lock_init(l) InitializeSRWLock(l)
+#define pool_lock_free(l) ((void)(l))
+#define pool_lock_acquire(l) AcquireSRWLockExclusive(l)
+#define pool_lock_release(l) ReleaseSRWLockExclusive(l)
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_mutex_t pool_lock;
+typedef pthread_t pool_thread;
+#define pool_lock_init(l) pthread_mutex_init(l, NULL)
+#define pool_lock_free(l) pthread_mutex_destroy(l)
+#define pool_lock_acquire(l) pthread_mutex_lock(l)
+#define pool_lock_release(l) pthread_mutex_unlock(l)
+#endif
+
+typedef struct Pool Pool;
+typedef struct PoolWorker PoolWorker;
+
+struct PoolWorker {
+    pool_lock lock;
+    size_t next;                /* first task left in the range */
+    size_t end;                 /* one past the last */
+    pool_thread thread;
+    int started;
+    int id;
+    Pool *pool;
+};
+
+struct Pool {
+    PoolWorker *workers;
+    int n_workers;
+    PoolTaskFunc func;
+    void *context;
+};
+
+int
+Pool_DefaultThreads(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)(n < POOL_MAX_THREADS ? n : POOL_MAX_THREADS) : 1;
+#endif
+}
+
+static int
+take(PoolWorker *worker, size_t *task)
+{
+    /* the next task of the worker's own range */
+    int found = 0;
+
+    pool_lock_acquire(&worker->lock);
+    if (worker->next < worker->end) {
+        *task = worker->next++;
+        found = 1;
+    }
+    pool_lock_release(&worker->lock);
+    return found;
+}
+
+static int
+steal(PoolWorker *thief)
+{
+    /* * Move the back half of another worker's range, rounded up, to the
+     * thief. Victims are tried in order starting after the thief, so
+     * thieves spread over the pool. Returns 0 when every range is empty,
+     * which ends the thief: ranges only ever shrink.
+     * */
+    Pool *pool = thief->pool;
+    PoolWorker *victim;
+    size_t middle, end;
+    int i;
+
+    for (i = 1; i < pool->n_workers; i++) {
+        victim = &pool->workers[(thief->id + i) % pool->n_workers];
+        pool_lock_acquire(&victim->lock);
+        if (victim->next < victim->end) {
+            middle = victim->next + (victim->end - victim->next) / 2;
+            end = victim->end;
+            victim->end = middle;
+            pool_lock_release(&victim->lock);
+
+            pool_lock_acquire(&thief->lock);
+            thief->next = middle;
+            thief->end = end;
+            pool_lock_release(&thief->lock);
+            return 1;
+        }
+        pool_lock_release(&victim->lock);
+    }
+    return 0;
+}
+
+static void
+work(PoolWorker *worker)
+{
+    size_t task;
+
+    do {
+        while (take(worker, &task)) {
+            worker->pool->func(worker->pool->context, task);
+        }
+    } while (steal(worker));
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+worker_main(LPVOID arg)
+{
+    work((PoolWorker *)arg);
+    return 0;
+}
+
+static int
+thread_start(PoolWorker *worker)
+{
+    worker->thread = CreateThread(NULL, 0, worker_main, worker, 0, NULL);
+    return worker->thread != NULL ? 0 : -1;
+}
+
+static void
+thread_join(PoolWorker *worker)
+{
+    WaitForSingleObject(worker->thread, INFINITE);
+    CloseHandle(worker->thread);
+}
+#else
+static void *
+worker_main(void *arg)
+{
+    work((PoolWorker *)arg);
+    return NULL;
+}
+
+static int
+thread_start(PoolWorker *worker)
+{
+    return pthread_create(&worker->thread, NULL, worker_main, worker) == 0 ? 0 : -1;
+}
+
+static void
+thread_join(PoolWorker *worker)
+{
+    pthread_join(worker->thread, NULL);
+}
+#endif
+
+int
+Pool_Run(size_t n_tasks, int n_threads, PoolTaskFunc func, void *context)
+{
+    Pool pool;
+    PoolWorker *worker;
+    size_t per_worker, extra, next;
+    int i;
+
+    if (n_threads <= 0) {
+        n_threads = Pool_DefaultThreads();
+    }
+    if (n_threads > POOL_MAX_THREADS) {
+        n_threads = POOL_MAX_THREADS;
+    }
+    if ((size_t)n_threads > n_tasks) {
+        n_threads = n_tasks > 0 ? (int)n_tasks : 1;
+    }
+
+    pool.workers = (PoolWorker *)calloc((size_t)n_threads, sizeof(PoolWorker));
+    if (pool.workers == NULL) {
+        return -1;
+    }
+    pool.n_workers = n_threads;
+    pool.func = func;
+    pool.context = context;
+
+    /* even ranges, the first 'extra' workers get one task more */
+    per_worker = n_tasks / (size_t)n_threads;
+    extra = n_tasks % (size_t)n_threads;
+    next = 0;
+    for (i = 0; i < n_threads; i++) {
+        worker = &pool.workers[i];
+        pool_lock_init(&worker->lock);
+        worker->next = next;
+        next += per_worker + ((size_t)i < extra ? 1 : 0);
+        worker->end = next;
+        worker->id = i;
+        worker->pool = &pool;
+    }
+
+    /* worker 0 is the calling thread */
+    for (i = 1; i < n_threads; i++) {
+        pool.workers[i].started = thread_start(&pool.workers[i]) == 0;
+    }
+    work(&pool.workers[0]);
+    for (i = 1; i < n_threads; i++) {
+        if (pool.workers[i].started) {
+            thread_join(&pool.workers[i]);
+        }
+    }
+
+    for (i = 0; i < n_threads; i++) {
+        pool_lock_free(&pool.workers[i].lock);
+    }
+    free(pool.workers);
+    return 0;
+}
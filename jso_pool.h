@@ -0,0 +1,36 @@
+#ifndef JSO_POOL_H
+#define JSO_POOL_H
+
+#include <stddef.h>
+
+/* * Pool_Run runs 'n_tasks' independent tasks, numbered 0 to n_tasks - 1,
+ * on a set of native threads and returns when all of them are done.
+ *
+ * The tasks are split into one contiguous range per worker up front.
+ * A worker takes tasks from the front of its own range, and once that
+ * is empty steals the back half of the range of another worker, so a
+ * few slow tasks (a large file, a cold disk) don't leave the other
+ * threads idle. Each range has its own lock, which is only contended
+ * when a thief shows up.
+ *
+ * The calling thread is one of the workers. Nothing here depends on
+ * Python; a task that needs the GIL has to take it itself.
+ * */
+
+#define POOL_MAX_THREADS 256
+
+typedef void (*PoolTaskFunc)(void *context, size_t task);
+
+/* number of online processors, at least 1 */
+int
+Pool_DefaultThreads(void);
+
+/* * Run 'func(context, task)' for every task on up to 'n_threads' threads,
+ * or Pool_DefaultThreads() if it is 0 or less. Threads that fail to start
+ * are made up for by the others. Returns 0, or -1 if the worker table
+ * couldn't be allocated, in which case no task has run.
+ * */
+int
+Pool_Run(size_t n_tasks, int n_threads, PoolTaskFunc func, void *context);
+
+#endif /* JSO_POOL_H */
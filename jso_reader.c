@@ -21,6 +21,9 @@
  *     java.util.LinkedList
  *     java.util.PriorityQueue
  * 
+ * Any other class can be read by registering a readObject handler for it,
+ * in C or python (register_reader, see jso_registry.h).
+ * 
  * */
 
 
@@ -28,13 +31,17 @@
 #include <time.h>
 
 /* static global - set where ever the reader entry point is */
-static uint8_t little_endian;
 static PyObject *collection_value;
+static PyObject *StreamError;
+/* class descriptors seen by any parse in this process */
+static ClassCache *class_cache;
+/* two phase reads that fell back to the one pass reader, see tape_diverged */
+static size_t tape_divergences;
 
  
 
 static PyObject *
-java_stream_reader(PyObject *self, PyObject *args)
+java_stream_reader(PyObject *self, PyObject *args, PyObject *kwargs)
 {
     /* these assertions can be removed once I know more about
      * handling different system architecture */
@@ -44,102 +51,2947 @@ java_stream_reader(PyObject *self, PyObject *args)
     assert(sizeof(uint16_t) == 2);
     assert(sizeof(long long) == 8);
 
-
-    /* test endianness big_endian -> 0x0001, little_endian ->0x0100*/
-    uint8_t i = 0x0001;
-    little_endian = *((char *)&i);
-
     /* get rid of this. I don't like this at all */
-    collection_value = PyUnicode_FromString("value");
+    if (collection_value == NULL) {
+        collection_value = PyUnicode_FromString("value");
+    }
 
+    static char *kwlist[] = {"filename", "mmap", "typed_arrays", "lazy", "fields", NULL};
     char *filename;
+    int use_mmap = 0;
+    int typed_arrays = 0;
+    int lazy = 0;
+    PyObject *fields = Py_None;
+    PyObject *projection = NULL;
+    StreamFile file;
+    Reader reader;
+    LazyStreamObject *context;
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|pppO", kwlist, &filename, 
+                                     &use_mmap, &typed_arrays, &lazy, &fields)) {
+        return NULL;
+    }
+    if (fields != Py_None) {
+        projection = build_projection(fields);
+        if (projection == NULL) {
+            return NULL;
+        }
+    }
 
-    if (!PyArg_ParseTuple(args, "s", &filename)) {
+    if (lazy) {
+        /* the proxies decode from the file, so it stays open with them */
+        context = LazyStream_New();
+        if (context == NULL) {
+            Py_XDECREF(projection);
+            return NULL;
+        }
+        if (StreamFile_Open(&context->file, filename, use_mmap) < 0) {
+            Py_DECREF(context);
+            Py_XDECREF(projection);
+            return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+        }
+        context->has_file = 1;
+        context->reader.typed_arrays = typed_arrays;
+        context->reader.projection = projection;
+        PyObject *data = read_lazy_stream(context, context->file.buffer, context->file.length);
+        context->reader.projection = NULL;
+        Py_DECREF(context);
+        Py_XDECREF(projection);
+        return data;
+    }
+
+    /* the whole file is either pulled into memory with one read or
+     * mapped, and the parser runs on a cursor over it in place */
+    Py_BEGIN_ALLOW_THREADS
+    status = StreamFile_Open(&file, filename, use_mmap);
+    Py_END_ALLOW_THREADS
+    if (status < 0) {
+        Py_XDECREF(projection);
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+    }
+
+    PyObject *data;
+
+    Reader_Init(&reader);
+    reader.typed_arrays = typed_arrays;
+    reader.owns_input = 1;
+    reader.projection = projection;
+
+    /* nothing in the returned objects points into the file buffer */
+    if (projection == NULL) {
+        data = read_stream_native(file.buffer, file.length, &reader);
+    }
+    else {
+        data = read_stream(file.buffer, file.length, &reader);
+    }
+
+    StreamFile_Close(&file);
+    Py_XDECREF(projection);
+    return data;
+}
+
+static PyObject *
+java_stream_reader_bytes(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    /* * Parse a stream held by any object exporting the buffer protocol
+     * (bytes, bytearray, memoryview, mmap, ...). The buffer is parsed in
+     * place and the export is held until the parse is done, so the
+     * exporter can't be resized or freed underneath the cursor.
+     * */
+    static char *kwlist[] = {"buffer", "typed_arrays", "lazy", "fields", NULL};
+    Py_buffer view;
+    int typed_arrays = 0;
+    int lazy = 0;
+    PyObject *fields = Py_None;
+    PyObject *projection = NULL;
+    Reader reader;
+    LazyStreamObject *context;
+    PyObject *data;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|ppO", kwlist, &view,
+                                     &typed_arrays, &lazy, &fields)) {
+        return NULL;
+    }
+    if (fields != Py_None) {
+        projection = build_projection(fields);
+        if (projection == NULL) {
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+    }
+
+    if (lazy) {
+        /* the export moves to the context and is held as long as the proxies */
+        context = LazyStream_New();
+        if (context == NULL) {
+            PyBuffer_Release(&view);
+            Py_XDECREF(projection);
+            return NULL;
+        }
+        context->view = view;
+        context->has_view = 1;
+        context->reader.typed_arrays = typed_arrays;
+        context->reader.projection = projection;
+        data = read_lazy_stream(context, (const char *)view.buf, (size_t)view.len);
+        context->reader.projection = NULL;
+        Py_DECREF(context);
+        Py_XDECREF(projection);
+        return data;
+    }
+
+    Reader_Init(&reader);
+    reader.typed_arrays = typed_arrays;
+    reader.owns_input = 1;
+    reader.projection = projection;
+
+    if (projection == NULL) {
+        data = read_stream_native((const char *)view.buf, (size_t)view.len, &reader);
+    }
+    else {
+        data = read_stream((const char *)view.buf, (size_t)view.len, &reader);
+    }
+
+    PyBuffer_Release(&view);
+    Py_XDECREF(projection);
+    return data;
+}
+
+static PyObject *
+stream_read_many(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    /* * Read many files on a native thread pool, see jso_pool.h. The
+     * results come back in the order of 'paths'; a file that can't be
+     * opened or decoded gives its exception instance in its slot, the
+     * other files are still read.
+     * */
+    static char *kwlist[] = {"paths", "threads", "mmap", "typed_arrays", NULL};
+    PyObject *paths, *seq, *encoded, *path;
+    int n_threads = 0;
+    int use_mmap = 0;
+    int typed_arrays = 0;
+    ReadManyContext context;
+    Py_ssize_t i, n;
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ipp", kwlist, &paths,
+                                     &n_threads, &use_mmap, &typed_arrays)) {
+        return NULL;
+    }
+    seq = PySequence_Fast(paths, "paths must be an iterable of filenames");
+    if (seq == NULL) {
+        return NULL;
+    }
+    n = PySequence_Fast_GET_SIZE(seq);
+
+    /* the workers only see the encoded names, 'encoded' keeps them alive */
+    encoded = PyList_New(n);
+    context.paths = (const char **)PyMem_Malloc((size_t)(n > 0 ? n : 1) * sizeof(char *));
+    if (encoded == NULL || context.paths == NULL) {
+        Py_XDECREF(encoded);
+        PyMem_Free(context.paths);
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < n; i++) {
+        if (!PyUnicode_FSConverter(PySequence_Fast_GET_ITEM(seq, i), &path)) {
+            Py_DECREF(encoded);
+            PyMem_Free(context.paths);
+            Py_DECREF(seq);
+            return NULL;
+        }
+        PyList_SET_ITEM(encoded, i, path);
+        context.paths[i] = PyBytes_AS_STRING(path);
+    }
+    Py_DECREF(seq);
+
+    context.results = PyList_New(n);
+    if (context.results == NULL) {
+        Py_DECREF(encoded);
+        PyMem_Free(context.paths);
+        return NULL;
+    }
+    context.use_mmap = use_mmap;
+    context.typed_arrays = typed_arrays;
+
+    /* the calling thread is one of the workers, it takes the GIL per file too */
+    Py_BEGIN_ALLOW_THREADS
+    status = Pool_Run((size_t)n, n_threads, read_many_task, &context);
+    Py_END_ALLOW_THREADS
+
+    Py_DECREF(encoded);
+    PyMem_Free(context.paths);
+    if (status < 0) {
+        Py_DECREF(context.results);
+        return PyErr_NoMemory();
+    }
+    return context.results;
+}
+
+static void
+read_many_task(void *context, size_t task)
+{
+    /* * One file of stream_read_many, on a pool thread without the GIL.
+     * The file is read and scanned without it; the GIL is only held
+     * while the python objects are built.
+     * */
+    ReadManyContext *many = (ReadManyContext *)context;
+    const char *filename = many->paths[task];
+    PyGILState_STATE gil;
+    PyObject *data, *type, *value, *traceback;
+    StreamFile file;
+    Reader reader;
+    int status, error;
+
+    status = StreamFile_Open(&file, filename, many->use_mmap);
+    error = errno;
+
+    gil = PyGILState_Ensure();
+    if (status < 0) {
+        errno = error;
+        data = PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+    }
+    else {
+        Reader_Init(&reader);
+        reader.typed_arrays = many->typed_arrays;
+        reader.owns_input = 1;
+        data = read_stream_native(file.buffer, file.length, &reader);
+        StreamFile_Close(&file);
+    }
+
+    if (data == NULL) {
+        PyErr_Fetch(&type, &value, &traceback);
+        PyErr_NormalizeException(&type, &value, &traceback);
+        if (value != NULL && traceback != NULL) {
+            PyException_SetTraceback(value, traceback);
+        }
+        Py_XDECREF(type);
+        Py_XDECREF(traceback);
+        if (value == NULL) {
+            Py_INCREF(Py_None);
+            value = Py_None;
+        }
+        data = value;
+    }
+    PyList_SET_ITEM(many->results, (Py_ssize_t)task, data);
+    PyGILState_Release(gil);
+}
+
+static int
+open_source(PyObject *source, StreamFile *file, Py_buffer *view)
+{
+    /* * A filename (str or os.PathLike), mapped for sequential reading,
+     * or any object exporting the buffer protocol. Returns 1 when 'file'
+     * was opened, 0 when 'view' was filled in and -1 on error.
+     * */
+    PyObject *path;
+
+    if (PyUnicode_Check(source) || (!PyBytes_Check(source) && !PyObject_CheckBuffer(source))) {
+        if (!PyUnicode_FSConverter(source, &path)) {
+            return -1;
+        }
+        if (StreamFile_Open(file, PyBytes_AS_STRING(path), 1) < 0) {
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, source);
+            Py_DECREF(path);
+            return -1;
+        }
+        Py_DECREF(path);
+        return 1;
+    }
+    return PyObject_GetBuffer(source, view, PyBUF_SIMPLE) < 0 ? -1 : 0;
+}
+
+static PyObject *
+scan_column(char typecode, size_t n, const void *items, size_t item_size, size_t offset)
+{
+    /* one member of an array of structs as a PrimitiveArray */
+    PrimitiveArrayObject *column;
+    const char *p = (const char *)items + offset;
+    size_t i;
+
+    column = (PrimitiveArrayObject *)PrimitiveArray_New(typecode, (Py_ssize_t)n);
+    if (column == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < n; i++, p += item_size) {
+        switch (typecode) {
+            case 'J':
+                ((int64_t *)column->data)[i] = (int64_t)*(const uint64_t *)p;
+                break;
+            case 'I':
+                ((int32_t *)column->data)[i] = (int32_t)*(const uint32_t *)p;
+                break;
+            default:
+                ((int16_t *)column->data)[i] = (int16_t)*(const uint8_t *)p;
+        }
+    }
+    return (PyObject *)column;
+}
+
+static PyObject *
+scan_result(const ScanIndex *index, const unsigned char *input)
+{
+    /* * {"handles": {...}, "records": {...}, "classes": {...}} with one
+     * PrimitiveArray per column; SCAN_NONE comes out as -1.
+     * */
+    PyObject *result, *handles, *records, *classes, *name, *key;
+    const ScanHandle *h;
+    size_t i;
+
+    result = Py_BuildValue("{s:{s:N,s:N,s:N,s:N},s:{s:N,s:N,s:N,s:N},s:{}}",
+        "handles",
+        "offset", scan_column('J', index->n_handles, index->handles, sizeof(ScanHandle),
+                              offsetof(ScanHandle, offset)),
+        "length", scan_column('J', index->n_handles, index->handles, sizeof(ScanHandle),
+                              offsetof(ScanHandle, length)),
+        "type", scan_column('S', index->n_handles, index->handles, sizeof(ScanHandle),
+                            offsetof(ScanHandle, type)),
+        "class", scan_column('I', index->n_handles, index->handles, sizeof(ScanHandle),
+                             offsetof(ScanHandle, class_handle)),
+        "records",
+        "offset", scan_column('J', index->n_records, index->records, sizeof(ScanRecord),
+                              offsetof(ScanRecord, offset)),
+        "length", scan_column('J', index->n_records, index->records, sizeof(ScanRecord),
+                              offsetof(ScanRecord, length)),
+        "type", scan_column('S', index->n_records, index->records, sizeof(ScanRecord),
+                            offsetof(ScanRecord, type)),
+        "handle", scan_column('I', index->n_records, index->records, sizeof(ScanRecord),
+                              offsetof(ScanRecord, handle)),
+        "classes");
+    if (result == NULL) {
+        return NULL;
+    }
+    handles = PyDict_GetItemString(result, "handles");
+    records = PyDict_GetItemString(result, "records");
+    classes = PyDict_GetItemString(result, "classes");
+    assert(handles != NULL && records != NULL && classes != NULL);
+
+    /* names of the class descriptors, by handle index */
+    for (i = 0; i < index->n_handles; i++) {
+        h = &index->handles[i];
+        if (h->type != TC_CLASSDESC) {
+            continue;
+        }
+        name = PyUnicode_DecodeUTF8((const char *)input + index->classes[h->layout].name_offset,
+                                    index->classes[h->layout].name_length, "replace");
+        key = PyLong_FromSize_t(i);
+        if (name == NULL || key == NULL || PyDict_SetItem(classes, key, name) < 0) {
+            Py_XDECREF(name);
+            Py_XDECREF(key);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(name);
+        Py_DECREF(key);
+    }
+    return result;
+}
+
+static PyObject *
+scan_stream(PyObject *self, PyObject *source)
+{
+    /* * Index a stream without decoding it. The scan itself runs
+     * without the GIL, it touches no python object.
+     * */
+    ScanIndex index;
+    StreamFile file;
+    Py_buffer view;
+    const unsigned char *input;
+    size_t length;
+    PyObject *result = NULL;
+    int is_file, status;
+
+    is_file = open_source(source, &file, &view);
+    if (is_file < 0) {
+        return NULL;
+    }
+    input = is_file ? (const unsigned char *)file.buffer : (const unsigned char *)view.buf;
+    length = is_file ? file.length : (size_t)view.len;
+
+    ScanIndex_Init(&index);
+    Py_BEGIN_ALLOW_THREADS
+    status = Scan_Stream(&index, input, length);
+    Py_END_ALLOW_THREADS
+
+    if (status < 0) {
+        PyErr_Format(StreamError, "%s at offset %zu", index.error, index.error_offset);
+    }
+    else {
+        result = scan_result(&index, input);
+    }
+
+    ScanIndex_Release(&index);
+    if (is_file) {
+        StreamFile_Close(&file);
+    }
+    else {
+        PyBuffer_Release(&view);
+    }
+    return result;
+}
+
+/* * walk_stream(): the JsoEvents of libjso as method calls on a python
+ * handler. The methods are looked up once; a missing one is skipped.
+ * */
+enum {
+    WALK_RECORD_BEGIN, WALK_RECORD_END, WALK_OBJECT_BEGIN, WALK_CLASS_DATA, WALK_FIELD,
+    WALK_ANNOTATION_BEGIN, WALK_ANNOTATION_END, WALK_OBJECT_END, WALK_ARRAY_BEGIN,
+    WALK_PRIMITIVE_ARRAY, WALK_ARRAY_END, WALK_STRING, WALK_NULL, WALK_REFERENCE,
+    WALK_ENUM_CONSTANT, WALK_CLASS_VALUE, WALK_BLOCK_DATA, WALK_END, WALK_N_EVENTS
+};
+
+/* the handler method of each event and its callback in JsoEvents, by WALK_* */
+static const struct {
+    const char *name;
+    size_t offset;
+} walk_events[WALK_N_EVENTS] = {
+    {"record_begin", offsetof(JsoEvents, record_begin)},
+    {"record_end", offsetof(JsoEvents, record_end)},
+    {"object_begin", offsetof(JsoEvents, object_begin)},
+    {"class_data", offsetof(JsoEvents, class_data)},
+    {"field", offsetof(JsoEvents, field)},
+    {"annotation_begin", offsetof(JsoEvents, annotation_begin)},
+    {"annotation_end", offsetof(JsoEvents, annotation_end)},
+    {"object_end", offsetof(JsoEvents, object_end)},
+    {"array_begin", offsetof(JsoEvents, array_begin)},
+    {"primitive_array", offsetof(JsoEvents, primitive_array)},
+    {"array_end", offsetof(JsoEvents, array_end)},
+    {"string", offsetof(JsoEvents, string)},
+    {"null", offsetof(JsoEvents, null)},
+    {"reference", offsetof(JsoEvents, reference)},
+    {"enum_constant", offsetof(JsoEvents, enum_constant)},
+    {"class_value", offsetof(JsoEvents, class_value)},
+    {"block_data", offsetof(JsoEvents, block_data)},
+    {"end", offsetof(JsoEvents, end)},
+};
+
+/* what a callback returns when the handler raised */
+#define WALK_RAISED 1
+
+typedef struct {
+    PyObject *methods[WALK_N_EVENTS];
+} WalkHandler;
+
+static int
+walk_call(void *context, int event, const char *format, ...)
+{
+    WalkHandler *walk = (WalkHandler *)context;
+    PyObject *args, *result;
+    va_list va;
+
+    va_start(va, format);
+    args = Py_VaBuildValue(format, va);
+    va_end(va);
+    if (args == NULL) {
+        return WALK_RAISED;
+    }
+    result = PyObject_CallObject(walk->methods[event], args);
+    Py_DECREF(args);
+    if (result == NULL) {
+        return WALK_RAISED;
+    }
+    Py_DECREF(result);
+    return 0;
+}
+
+static PyObject *
+decode_modified_utf8(const char *chars, size_t length)
+{
+    /* * Java's modified utf-8 differs from utf-8 in NUL, written as C0 80,
+     * and in characters outside the BMP, written as two 3 byte surrogates.
+     * Without either it is plain utf-8; otherwise it is decoded into the
+     * UTF-16 units it stands for, and the codec pairs the surrogates up.
+     * Anything else malformed goes to the utf-8 codec for its error.
+     * */
+    const unsigned char *p = (const unsigned char *)chars;
+    const unsigned char *end = p + length;
+    unsigned char *units, *u;
+    PyObject *text;
+    unsigned int c;
+    int byteorder = 1;
+
+    if (memchr(chars, 0xc0, length) == NULL && memchr(chars, 0xed, length) == NULL) {
+        return PyUnicode_DecodeUTF8(chars, (Py_ssize_t)length, NULL);
+    }
+    units = (unsigned char *)PyMem_Malloc(length * 2);
+    if (units == NULL) {
+        return PyErr_NoMemory();
+    }
+    for (u = units; p < end; u += 2) {
+        if (p[0] < 0x80) {
+            c = *p++;
+        }
+        else if ((p[0] & 0xe0) == 0xc0 && end - p >= 2 && (p[1] & 0xc0) == 0x80) {
+            c = ((unsigned int)(p[0] & 0x1f) << 6) | (p[1] & 0x3f);
+            p += 2;
+        }
+        else if ((p[0] & 0xf0) == 0xe0 && end - p >= 3 && (p[1] & 0xc0) == 0x80
+                 && (p[2] & 0xc0) == 0x80) {
+            c = ((unsigned int)(p[0] & 0x0f) << 12) | ((unsigned int)(p[1] & 0x3f) << 6)
+                | (p[2] & 0x3f);
+            p += 3;
+        }
+        else {
+            PyMem_Free(units);
+            return PyUnicode_DecodeUTF8(chars, (Py_ssize_t)length, NULL);
+        }
+        u[0] = (unsigned char)(c >> 8);
+        u[1] = (unsigned char)c;
+    }
+    text = PyUnicode_DecodeUTF16((const char *)units, u - units, "surrogatepass", &byteorder);
+    PyMem_Free(units);
+    return text;
+}
+
+static PyObject *
+walk_text(const char *chars, size_t length)
+{
+    /* names and strings, passed with "N" so a failure ends the call */
+    return decode_modified_utf8(chars, length);
+}
+
+static int
+walk_record_begin(void *context, const JsoRecord *record)
+{
+    return walk_call(context, WALK_RECORD_BEGIN, "(K)", (unsigned long long)record->offset);
+}
+
+static int
+walk_record_end(void *context, const JsoRecord *record)
+{
+    return walk_call(context, WALK_RECORD_END, "()");
+}
+
+static int
+walk_object_begin(void *context, const JsoHandle *classdesc, uint32_t handle)
+{
+    return walk_call(context, WALK_OBJECT_BEGIN, "(NI)",
+                     walk_text(classdesc->name, classdesc->name_length), handle);
+}
+
+static int
+walk_class_data(void *context, const JsoHandle *classdesc)
+{
+    return walk_call(context, WALK_CLASS_DATA, "(N)",
+                     walk_text(classdesc->name, classdesc->name_length));
+}
+
+static int
+walk_field(void *context, const char *name, size_t name_length, char type,
+           const JsoValue *value)
+{
+    PyObject *v;
+
+    if (value == NULL) {
+        Py_INCREF(Py_None);
+        v = Py_None;
+    }
+    else if (type == 'F' || type == 'D') {
+        v = PyFloat_FromDouble(value->d);
+    }
+    else if (type == 'Z') {
+        v = PyBool_FromLong((long)value->i);
+    }
+    else {
+        v = PyLong_FromLongLong(value->i);
+    }
+    if (v == NULL) {
+        return WALK_RAISED;
+    }
+    return walk_call(context, WALK_FIELD, "(NCN)", walk_text(name, name_length), (int)type, v);
+}
+
+static int
+walk_annotation_begin(void *context, const JsoHandle *classdesc)
+{
+    return walk_call(context, WALK_ANNOTATION_BEGIN, "(N)",
+                     walk_text(classdesc->name, classdesc->name_length));
+}
+
+static int
+walk_annotation_end(void *context, const JsoHandle *classdesc)
+{
+    return walk_call(context, WALK_ANNOTATION_END, "(N)",
+                     walk_text(classdesc->name, classdesc->name_length));
+}
+
+static int
+walk_object_end(void *context, uint32_t handle)
+{
+    return walk_call(context, WALK_OBJECT_END, "(I)", handle);
+}
+
+static int
+walk_array_begin(void *context, char type, size_t n_elements, uint32_t handle)
+{
+    return walk_call(context, WALK_ARRAY_BEGIN, "(CnI)", (int)type, (Py_ssize_t)n_elements,
+                     handle);
+}
+
+static int
+walk_primitive_array(void *context, char type, const void *big_endian, size_t n_elements)
+{
+    PrimitiveArrayObject *array;
+
+    array = (PrimitiveArrayObject *)PrimitiveArray_New(type, (Py_ssize_t)n_elements);
+    if (array == NULL) {
+        return WALK_RAISED;
+    }
+    Jso_DecodeArray(type, array->data, big_endian, n_elements);
+    return walk_call(context, WALK_PRIMITIVE_ARRAY, "(CN)", (int)type, (PyObject *)array);
+}
+
+static int
+walk_array_end(void *context, uint32_t handle)
+{
+    return walk_call(context, WALK_ARRAY_END, "(I)", handle);
+}
+
+static int
+walk_string(void *context, const char *chars, size_t length, uint32_t handle)
+{
+    return walk_call(context, WALK_STRING, "(NI)", walk_text(chars, length), handle);
+}
+
+static int
+walk_null(void *context)
+{
+    return walk_call(context, WALK_NULL, "()");
+}
+
+static int
+walk_reference(void *context, uint32_t handle)
+{
+    return walk_call(context, WALK_REFERENCE, "(I)", handle);
+}
+
+static int
+walk_enum_constant(void *context, const JsoHandle *classdesc, const char *name,
+                   size_t name_length, uint32_t handle)
+{
+    return walk_call(context, WALK_ENUM_CONSTANT, "(NNI)",
+                     walk_text(classdesc->name, classdesc->name_length),
+                     walk_text(name, name_length), handle);
+}
+
+static int
+walk_class_value(void *context, const JsoHandle *classdesc, uint32_t handle)
+{
+    return walk_call(context, WALK_CLASS_VALUE, "(NI)",
+                     walk_text(classdesc->name, classdesc->name_length), handle);
+}
+
+static int
+walk_block_data(void *context, const void *data, size_t length)
+{
+    return walk_call(context, WALK_BLOCK_DATA, "(N)",
+                     PyBytes_FromStringAndSize((const char *)data, (Py_ssize_t)length));
+}
+
+static int
+walk_end(void *context)
+{
+    return walk_call(context, WALK_END, "()");
+}
+
+static PyObject *
+walk_stream(PyObject *self, PyObject *args)
+{
+    /* * Walk a stream as events, without building any value. The stream
+     * is indexed with its tape first, then every event is a method call;
+     * events the handler has no method for stay native.
+     * */
+    static const JsoEvents all_events = {
+        walk_record_begin, walk_record_end, walk_object_begin, walk_class_data, walk_field,
+        walk_annotation_begin, walk_annotation_end, walk_object_end, walk_array_begin,
+        walk_primitive_array, walk_array_end, walk_string, walk_null, walk_reference,
+        walk_enum_constant, walk_class_value, walk_block_data, walk_end
+    };
+    WalkHandler walk;
+    JsoEvents events = all_events;
+    JsoStream *stream = NULL;
+    StreamFile file;
+    Py_buffer view;
+    PyObject *source, *handler, *result = NULL;
+    const char *error;
+    size_t offset;
+    int is_file, status, i;
+
+    if (!PyArg_ParseTuple(args, "OO", &source, &handler)) {
+        return NULL;
+    }
+    memset(&walk, 0, sizeof(WalkHandler));
+    for (i = 0; i < WALK_N_EVENTS; i++) {
+        walk.methods[i] = PyObject_GetAttrString(handler, walk_events[i].name);
+        if (walk.methods[i] == NULL) {
+            if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+                goto done;
+            }
+            PyErr_Clear();
+            memset((char *)&events + walk_events[i].offset, 0, sizeof(events.end));
+        }
+    }
+
+    is_file = open_source(source, &file, &view);
+    if (is_file < 0) {
+        goto done;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    stream = Jso_OpenBuffer(is_file ? file.buffer : view.buf,
+                            is_file ? file.length : (size_t)view.len, JSO_TAPE);
+    Py_END_ALLOW_THREADS
+
+    if (stream == NULL) {
+        PyErr_NoMemory();
+    }
+    else if ((error = Jso_Error(stream, &offset)) != NULL) {
+        PyErr_Format(StreamError, "%s at offset %zu", error, offset);
+    }
+    else if ((status = Jso_Walk(stream, &events, &walk)) < 0) {
+        PyErr_NoMemory();
+    }
+    else if (status != WALK_RAISED) {
         Py_INCREF(Py_None);
-        return Py_None;
+        result = Py_None;
+    }
+
+    Jso_Close(stream);
+    if (is_file) {
+        StreamFile_Close(&file);
+    }
+    else {
+        PyBuffer_Release(&view);
+    }
+done:
+    for (i = 0; i < WALK_N_EVENTS; i++) {
+        Py_XDECREF(walk.methods[i]);
+    }
+    return result;
+}
+
+static PyObject *
+iter_stream(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    /* * Iterate over the top-level objects of a stream written by many
+     * writeObject() calls on one ObjectOutputStream. Files are memory
+     * mapped for sequential access, so only the pages around the cursor
+     * need to be resident.
+     * */
+    static char *kwlist[] = {"source", "typed_arrays", NULL};
+    StreamIteratorObject *it;
+    PyObject *source;
+    int typed_arrays = 0;
+    int is_file;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|p", kwlist, &source, &typed_arrays)) {
+        return NULL;
+    }
+
+    it = PyObject_New(StreamIteratorObject, &StreamIterator_Type);
+    if (it == NULL) {
+        return NULL;
+    }
+    it->has_file = 0;
+    it->has_view = 0;
+    it->done = 0;
+    it->unused = 0;
+    Reader_Init(&it->reader);
+    it->reader.typed_arrays = typed_arrays;
+    it->reader.drop_arrays = 1;
+
+    is_file = open_source(source, &it->file, &it->view);
+    if (is_file < 0) {
+        Py_DECREF(it);
+        return NULL;
+    }
+    if (is_file) {
+        it->has_file = 1;
+        Stream_Init(&it->stream, it->file.buffer, it->file.length);
+    }
+    else {
+        it->has_view = 1;
+        Stream_Init(&it->stream, it->view.buf, (size_t)it->view.len);
+    }
+
+    if (read_stream_header(&it->stream) < 0
+        || Reader_Begin(&it->reader, Stream_Remaining(&it->stream)) < 0) {
+        Py_DECREF(it);
+        return NULL;
+    }
+    return (PyObject *)it;
+}
+
+static PyObject *
+read_records(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    /* * Every top-level record of a stream as a list, the same values as
+     * list(iter_stream(source)), in three steps:
+     *
+     *     1. a scan of the whole stream without the GIL, which validates
+     *        it and finds the record boundaries and the handle table
+     *        generation at each
+     *     2. the records' strings, primitive fields and primitive arrays
+     *        decoded natively by 'threads' pool workers, each over a run
+     *        of whole records; they only read the input and the index
+     *     3. the python objects of the records, built in stream order
+     *        under the GIL from the tape and what step 2 decoded; back
+     *        references resolve against the one handle table the records
+     *        share
+     *
+     * Steps 2 and 3 take turns over windows of TAPE_WINDOW bytes of
+     * records, so the native copies never hold more than one window.
+     * With typed_arrays the byte swaps of arrays of 64KB and more go
+     * straight into the arrays after step 3, on the same pool. Streams
+     * the tape can't build are read again by the one pass reader.
+     * */
+    static char *kwlist[] = {"source", "threads", "typed_arrays", NULL};
+    PyObject *source;
+    int n_threads = 0;
+    int typed_arrays = 0;
+    ScanIndex index;
+    TapeBuilder builder;
+    TapeWindow window;
+    Reader reader;
+    StreamFile file;
+    Py_buffer view;
+    const char *input;
+    size_t length;
+    PyObject *data = NULL;
+    int is_file, status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ip", kwlist, &source, &n_threads,
+                                     &typed_arrays)) {
+        return NULL;
+    }
+    is_file = open_source(source, &file, &view);
+    if (is_file < 0) {
+        return NULL;
+    }
+    input = is_file ? file.buffer : (const char *)view.buf;
+    length = is_file ? file.length : (size_t)view.len;
+
+    ScanIndex_Init(&index);
+    index.with_nodes = 1;
+    Py_BEGIN_ALLOW_THREADS
+    status = Scan_Stream(&index, input, length);
+    Py_END_ALLOW_THREADS
+
+    Reader_Init(&reader);
+    reader.typed_arrays = typed_arrays;
+    reader.owns_input = 1;
+    if (status == 0 && Reader_Begin(&reader, length) == 0) {
+        TapeBuilder_Init(&builder, &index, &reader, input, length);
+        builder.defer = 1;
+        builder.threads = n_threads;
+        memset(&window, 0, sizeof(TapeWindow));
+        builder.window = &window;
+        data = build_records(&builder);
+        release_window(&builder);
+        PyMem_Free(window.values);
+        PyMem_Free(window.tasks);
+        PyMem_Free(builder.deferred);
+        Reader_Release(&reader);
+        if (data == NULL && (!builder.diverged || PyErr_Occurred())) {
+            stream_failure(&builder.stream);
+        }
+    }
+    ScanIndex_Release(&index);
+
+    if (data == NULL && !PyErr_Occurred()) {
+        data = read_records_one_pass(input, length, &reader);
+    }
+    if (is_file) {
+        StreamFile_Close(&file);
+    }
+    else {
+        PyBuffer_Release(&view);
+    }
+    return data;
+}
+
+static PyObject *
+read_records_one_pass(const char *buffer, size_t buffer_length, Reader *reader)
+{
+    /* read_records without a tape, the way iter_stream reads */
+    Stream stream;
+    PyObject *records, *ob;
+    int tc, status;
+
+    Stream_Init(&stream, buffer, buffer_length);
+    if (read_stream_header(&stream) < 0 || Reader_Begin(reader, buffer_length) < 0) {
+        return NULL;
+    }
+    records = PyList_New(0);
+    while (records != NULL && (tc = Stream_Peek(&stream)) >= 0) {
+        if (tc == TC_RESET) {
+            Stream_U8(&stream);
+            if (Reader_Reset(reader) < 0) {
+                Py_CLEAR(records);
+            }
+            continue;
+        }
+        ob = parse_top_level(&stream, reader);
+        if (ob == NULL) {
+            stream_failure(&stream);
+            Py_CLEAR(records);
+            break;
+        }
+        status = PyList_Append(records, ob);
+        Py_DECREF(ob);
+        if (status < 0) {
+            Py_CLEAR(records);
+        }
+    }
+    Reader_Release(reader);
+    return records;
+}
+
+static PyObject *
+parse_top_level(Stream *stream, Reader *reader)
+{
+    /* * One record of a stream: an object, or block data written with
+     * the DataOutput methods of the ObjectOutputStream itself, which
+     * comes back as bytes.
+     * */
+    size_t length;
+    int tc;
+
+    tc = Stream_Peek(stream);
+    if (tc != TC_BLOCKDATA && tc != TC_BLOCKDATALONG) {
+        return parse_stream(stream, reader);
+    }
+
+    Stream_U8(stream);
+    if (tc == TC_BLOCKDATA) {
+        length = Stream_Require(stream, 1) ? Stream_U8(stream) : 0;
+    }
+    else {
+        length = Stream_Require(stream, 4) ? Stream_BE32(stream) : 0;
+    }
+    if (!Stream_Require(stream, length)) {
+        return NULL;
+    }
+    return PyBytes_FromStringAndSize((const char *)Stream_Take(stream, length),
+                                     (Py_ssize_t)length);
+}
+
+static void
+StreamIterator_Close(StreamIteratorObject *self)
+{
+    /* release the parse state and the input as soon as the stream ends */
+    Reader_Release(&self->reader);
+    if (self->has_file) {
+        StreamFile_Close(&self->file);
+        self->has_file = 0;
+    }
+    if (self->has_view) {
+        PyBuffer_Release(&self->view);
+        self->has_view = 0;
+    }
+    Stream_Init(&self->stream, NULL, 0);
+    self->done = 1;
+}
+
+static void
+drop_record_arrays(Handles *handles, size_t first)
+{
+    /* * Let go of the primitive arrays the handles from 'first' on hold.
+     * The record they went into keeps them for as long as the caller
+     * does, and a later reference decodes them again from the input
+     * (decode_skipped), so a long stream doesn't pile up its arrays
+     * until the next TC_RESET.
+     * */
+    JavaType_Type *node;
+    size_t i;
+
+    for (i = first; i < handles->size; i++) {
+        node = handles->stream[i].ob;
+        if (node->jt_type == TC_ARRAY && node->skipped != NULL) {
+            Py_CLEAR(node->value);
+        }
+    }
+}
+
+static PyObject *
+StreamIterator_Next(StreamIteratorObject *self)
+{
+    /* the next top-level object; TC_RESET between records clears the handle table */
+    Stream *stream = &self->stream;
+    PyObject *ob;
+    size_t first;
+    int tc;
+
+    if (self->done) {
+        return NULL;
+    }
+    for (;;) {
+        tc = Stream_Peek(stream);
+        if (tc < 0) {
+            StreamIterator_Close(self);
+            return NULL;
+        }
+        if (tc != TC_RESET) {
+            break;
+        }
+        Stream_U8(stream);
+        if (Reader_Reset(&self->reader) < 0) {
+            StreamIterator_Close(self);
+            return NULL;
+        }
+    }
+
+    first = Handles_Position(self->reader.handles);
+    ob = parse_top_level(stream, &self->reader);
+    if (ob == NULL) {
+        stream_failure(stream);
+        StreamIterator_Close(self);
+        return NULL;
+    }
+    drop_record_arrays(self->reader.handles, first);
+    return ob;
+}
+
+static void
+StreamIterator_Dealloc(StreamIteratorObject *self)
+{
+    if (!self->done) {
+        StreamIterator_Close(self);
+    }
+    PyObject_Free(self);
+}
+
+static PyTypeObject StreamIterator_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "jso_reader.StreamIterator",
+    .tp_basicsize = sizeof(StreamIteratorObject),
+    .tp_dealloc = (destructor)StreamIterator_Dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "top-level objects of a java serialization stream, see iter_stream",
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)StreamIterator_Next,
+};
+
+static PyObject *
+StreamParser_New(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"typed_arrays", NULL};
+    StreamParserObject *self;
+    int typed_arrays = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p", kwlist, &typed_arrays)) {
+        return NULL;
+    }
+    self = (StreamParserObject *)type->tp_alloc(type, 0);
+    if (self == NULL) {
+        return NULL;
+    }
+    Reader_Init(&self->reader);
+    ScanIndex_Init(&self->scan);
+    self->buffer = NULL;
+    self->length = 0;
+    self->reserved = 0;
+    self->wanted = 0;
+    self->has_header = 0;
+    self->failed = 0;
+    self->typed_arrays = typed_arrays;
+    return (PyObject *)self;
+}
+
+static void
+StreamParser_Dealloc(StreamParserObject *self)
+{
+    Reader_Release(&self->reader);
+    ScanIndex_Release(&self->scan);
+    PyMem_Free(self->buffer);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int
+StreamParser_Append(StreamParserObject *self, const void *data, size_t length)
+{
+    /* buffer 'length' more bytes of input, growing by doubling */
+    unsigned char *buffer;
+    size_t reserved;
+
+    if (length > self->reserved - self->length) {
+        reserved = self->reserved < 4096 ? 4096 : self->reserved;
+        while (reserved - self->length < length) {
+            if (reserved > PY_SSIZE_T_MAX / 2) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            reserved *= 2;
+        }
+        buffer = (unsigned char *)PyMem_Realloc(self->buffer, reserved);
+        if (buffer == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->buffer = buffer;
+        self->reserved = reserved;
+    }
+    memcpy(self->buffer + self->length, data, length);
+    self->length += length;
+    return 0;
+}
+
+static PyObject *
+StreamParser_Feed(StreamParserObject *self, PyObject *data)
+{
+    /* * Decodes every record the input received so far completes and
+     * keeps the rest for the next call.
+     *
+     * Whether the pending record is complete is settled by the native
+     * scanner, which keeps the descriptors and handles of the records
+     * before it but no values. A scan that runs out of input takes back
+     * what it added and says how many bytes it needs, and the next scan
+     * waits for them, so a large array split over many chunks is scanned
+     * twice. Only a complete record is decoded: readObject handlers run
+     * once per object and the arena never holds an abandoned attempt.
+     * */
+    Py_buffer view;
+    Stream stream;
+    PyObject *records;
+    PyObject *ob;
+    size_t start = 0;
+    size_t used;
+    int tc, status;
+
+    if (self->failed) {
+        PyErr_SetString(StreamError, "feed() on a closed or failed StreamParser");
+        return NULL;
+    }
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) < 0) {
+        return NULL;
+    }
+    if (StreamParser_Append(self, view.buf, (size_t)view.len) < 0) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    PyBuffer_Release(&view);
+
+    records = PyList_New(0);
+    if (records == NULL) {
+        return NULL;
+    }
+
+    if (!self->has_header) {
+        if (self->length < 4) {
+            return records;
+        }
+        Stream_Init(&stream, self->buffer, 4);
+        if (read_stream_header(&stream) < 0 || Reader_Begin(&self->reader, 0) < 0) {
+            goto fail;
+        }
+        self->reader.typed_arrays = self->typed_arrays;
+        self->has_header = 1;
+        start = 4;
+    }
+
+    while (self->length - start >= self->wanted) {
+        Stream_Init(&stream, self->buffer + start, self->length - start);
+        tc = Stream_Peek(&stream);
+        if (tc < 0) {
+            break;
+        }
+        if (tc == TC_RESET) {
+            if (Reader_Reset(&self->reader) < 0) {
+                goto fail;
+            }
+            /* nothing after the reset can refer to what the scan holds */
+            self->scan.n_handles = 0;
+            self->scan.n_classes = 0;
+            self->scan.pool_length = 0;
+            start++;
+            continue;
+        }
+
+        status = Scan_Record(&self->scan, self->buffer + start, self->length - start, &used);
+        if (status < 0) {
+            PyErr_Format(StreamError, "%s at offset %zu", self->scan.error,
+                         self->scan.error_offset);
+            goto fail;
+        }
+        if (status == 0) {
+            /* the record is incomplete, scan again when the bytes are there */
+            self->wanted = used;
+            break;
+        }
+        /* the scan only needs descriptors and handles from here on */
+        self->scan.n_records = 0;
+        self->scan.n_nodes = 0;
+
+        Stream_Init(&stream, self->buffer + start, used);
+        ob = parse_top_level(&stream, &self->reader);
+        if (ob == NULL) {
+            stream_failure(&stream);
+            goto fail;
+        }
+        if (PyList_Append(records, ob) < 0) {
+            Py_DECREF(ob);
+            goto fail;
+        }
+        Py_DECREF(ob);
+        start += used;
+        self->wanted = 0;
+    }
+
+    /* records hold no pointers into the input, so it can move */
+    self->length -= start;
+    memmove(self->buffer, self->buffer + start, self->length);
+    return records;
+
+fail:
+    self->failed = 1;
+    Py_DECREF(records);
+    return NULL;
+}
+
+static PyObject *
+StreamParser_Close(StreamParserObject *self, PyObject *unused)
+{
+    /* end of input: anything still buffered is a truncated record */
+    size_t pending = self->length;
+
+    Reader_Release(&self->reader);
+    ScanIndex_Release(&self->scan);
+    PyMem_Free(self->buffer);
+    self->buffer = NULL;
+    self->length = 0;
+    self->reserved = 0;
+    if (pending != 0 && !self->failed) {
+        self->failed = 1;
+        PyErr_Format(StreamError, "stream ended inside a record, %zu bytes "
+                     "left undecoded", pending);
+        return NULL;
+    }
+    self->failed = 1;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef StreamParser_Methods[] = {
+    {"feed", (PyCFunction)StreamParser_Feed, METH_O,
+     "feed(data) -> list\n\n"
+     "add the next chunk of the stream and return the top-level objects it\n"
+     "completes, in order."},
+    {"close", (PyCFunction)StreamParser_Close, METH_NOARGS,
+     "close()\n\n"
+     "end the stream, raising StreamError if it stopped inside a record."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject StreamParser_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "jso_reader.StreamParser",
+    .tp_basicsize = sizeof(StreamParserObject),
+    .tp_dealloc = (destructor)StreamParser_Dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "StreamParser(typed_arrays=False)\n\n"
+              "incremental reader for a stream that arrives in chunks, see feed()",
+    .tp_methods = StreamParser_Methods,
+    .tp_new = StreamParser_New,
+};
+
+static LazyStreamObject *
+LazyStream_New(void)
+{
+    LazyStreamObject *self;
+
+    self = PyObject_GC_New(LazyStreamObject, &LazyStream_Type);
+    if (self == NULL) {
+        return NULL;
+    }
+    Reader_Init(&self->reader);
+    self->has_file = 0;
+    self->has_view = 0;
+    self->unused = 0;
+    PyObject_GC_Track(self);
+    return self;
+}
+
+static int
+LazyStream_Traverse(LazyStreamObject *self, visitproc visit, void *arg)
+{
+    /* the handles hold the proxies, which hold the context */
+    Handles *handles = self->reader.handles;
+    size_t i;
+
+    if (handles != NULL) {
+        for (i = 0; i < handles->size; i++) {
+            Py_VISIT(handles->stream[i].ob->value);
+        }
+    }
+    Py_VISIT(self->reader.owned);
+    return 0;
+}
+
+static int
+LazyStream_Clear(LazyStreamObject *self)
+{
+    if (self->reader.handles != NULL) {
+        Handles_ClearValues(self->reader.handles);
+    }
+    return 0;
+}
+
+static void
+LazyStream_Dealloc(LazyStreamObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    Reader_Release(&self->reader);
+    if (self->has_file) {
+        StreamFile_Close(&self->file);
+    }
+    if (self->has_view) {
+        PyBuffer_Release(&self->view);
+    }
+    PyObject_GC_Del(self);
+}
+
+static PyTypeObject LazyStream_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "jso_reader.LazyStream",
+    .tp_basicsize = sizeof(LazyStreamObject),
+    .tp_dealloc = (destructor)LazyStream_Dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .tp_traverse = (traverseproc)LazyStream_Traverse,
+    .tp_clear = (inquiry)LazyStream_Clear,
+};
+
+static PyObject *
+read_lazy_stream(LazyStreamObject *context, const char *buffer, size_t buffer_length)
+{
+    /* * Scan the first object of the stream into proxies. The parse
+     * state isn't released at the end, it belongs to 'context' and goes
+     * with the last proxy.
+     * */
+    Stream stream;
+    PyObject *data;
+
+    Stream_Init(&stream, buffer, buffer_length);
+    if (read_stream_header(&stream) < 0
+        || Reader_Begin(&context->reader, buffer_length) < 0) {
+        return NULL;
+    }
+    context->reader.lazy_context = (PyObject *)context;
+
+    data = parse_stream(&stream, &context->reader);
+    if (data == NULL) {
+        return stream_failure(&stream);
+    }
+    return data;
+}
+
+static int
+read_lazy_field(Stream *stream, Reader *reader, LazySlot *slot)
+{
+    /* * Strings, objects and arrays, and references to them, are kept as
+     * their handle, so nothing is made until the field is read. Objects
+     * and arrays are stepped over by skip_object and decoded by the same
+     * replay a projection uses (decode_skipped). Enums, classes and null
+     * are decoded as usual.
+     * */
+    JavaType_Type *node;
+    uint32_t handle;
+    size_t length;
+    int tc;
+
+    tc = Stream_Peek(stream);
+    if (tc == TC_STRING || tc == TC_LONGSTRING) {
+        Stream_U8(stream);
+        length = tc == TC_STRING ? get_size(stream) : (size_t)get_unsigned_long_long(stream);
+        if (stream->error) {
+            return -1;
+        }
+        slot->string = read_tc_string(stream, reader, length);
+        return slot->string != NULL ? 0 : -1;
+    }
+    if (tc == TC_REFERENCE && Stream_Remaining(stream) >= 5) {
+        handle = load_be32(stream->pos + 1);
+        node = Handles_Find(reader->handles, handle);
+        if (node != NULL && node->jt_type == TC_STRING) {
+            Stream_Take(stream, 5);
+            slot->string = node;
+            return 0;
+        }
+        if (node != NULL && (node->jt_type == TC_OBJECT || node->jt_type == TC_ARRAY)) {
+            Stream_Take(stream, 5);
+            slot->handle = handle;
+            return 0;
+        }
+    }
+    if (tc == TC_OBJECT || tc == TC_ARRAY) {
+        return skip_object(stream, reader, &slot->handle) != NULL ? 0 : -1;
+    }
+    slot->value = parse_stream(stream, reader);
+    return slot->value != NULL ? 0 : -1;
+}
+
+static PyObject *
+LazyObject_Scan(Stream *stream, Reader *reader, JavaType_Type *class_desc)
+{
+    /* * Step over the field values of an instance of 'class_desc',
+     * whose plan is_plain, noting where each one is.
+     * */
+    const DecodePlan *plan = class_desc->plan;
+    const PlanField *op;
+    const unsigned char *run = NULL;
+    LazyObjectObject *self;
+    LazySlot *slot;
+    size_t i, j;
+
+    self = PyObject_GC_New(LazyObjectObject, &LazyObject_Type);
+    if (self == NULL) {
+        return NULL;
+    }
+    Py_INCREF(reader->lazy_context);
+    self->context = reader->lazy_context;
+    self->class_desc = class_desc;
+    self->values = NULL;
+    self->n_slots = plan->n_fields;
+    self->slots = (LazySlot *)Arena_Alloc(reader->arena, sizeof(LazySlot) * (plan->n_fields + 1));
+    if (self->slots == NULL) {
+        self->n_slots = 0;
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    memset(self->slots, 0, sizeof(LazySlot) * plan->n_fields);
+    PyObject_GC_Track(self);
+
+    slot = self->slots;
+    for (i = 0; i < plan->n_levels; i++) {
+        for (j = 0; j < plan->levels[i].n_fields; j++, slot++) {
+            op = &plan->levels[i].fields[j];
+            if (op->run_length != 0) {
+                if (!Stream_Require(stream, op->run_length)) {
+                    Py_DECREF(self);
+                    return NULL;
+                }
+                run = Stream_Take(stream, op->run_length);
+            }
+            if (op->typecode == 'L' || op->typecode == '[') {
+                if (read_lazy_field(stream, reader, slot) < 0) {
+                    Py_DECREF(self);
+                    return NULL;
+                }
+            }
+            else {
+                slot->p = run + op->offset;
+            }
+        }
+    }
+    return (PyObject *)self;
+}
+
+static PyObject *
+lazy_resolve(LazyStreamObject *context, uint32_t handle)
+{
+    /* a field kept as a handle, decoded from the input the context holds */
+    Stream stream;
+
+    if (context->has_file) {
+        Stream_Init(&stream, context->file.buffer, context->file.length);
+    }
+    else {
+        Stream_Init(&stream, context->view.buf, (size_t)context->view.len);
+    }
+    return resolve_handle(&stream, &context->reader, handle);
+}
+
+static PyObject *
+LazyObject_Values(LazyObjectObject *self)
+{
+    /* * The field dict, decoded on first use exactly as the eager path
+     * would have: level by level, superclass values merged into their
+     * subclass. Returns a borrowed reference.
+     * */
+    const DecodePlan *plan;
+    const PlanLevel *level;
+    const PlanField *op;
+    LazySlot *slot;
+    PyObject *data, *value;
+    PyObject *super = NULL;
+    size_t i, j;
+    int status;
+
+    if (self->values != NULL) {
+        return self->values;
+    }
+    if (self->slots == NULL) {
+        PyErr_SetString(PyExc_ReferenceError, "the stream of this LazyObject is gone");
+        return NULL;
+    }
+
+    plan = self->class_desc->plan;
+    slot = self->slots;
+    for (i = 0; i < plan->n_levels; i++) {
+        level = &plan->levels[i];
+        data = PyDict_New();
+        if (data == NULL) {
+            Py_XDECREF(super);
+            return NULL;
+        }
+        for (j = 0; j < level->n_fields; j++, slot++) {
+            op = &level->fields[j];
+            if (op->typecode != 'L' && op->typecode != '[') {
+                value = unpack_primitive(slot->p, op->typecode);
+            }
+            else if (slot->string != NULL) {
+                value = PyUnicode_FromStringAndSize(slot->string->string, slot->string->n_chars);
+            }
+            else if (slot->handle != 0) {
+                value = lazy_resolve((LazyStreamObject *)self->context, slot->handle);
+            }
+            else {
+                value = slot->value;
+                Py_INCREF(value);
+            }
+            if (value == NULL || PyDict_SetItem(data, op->field->key, value) < 0) {
+                Py_XDECREF(value);
+                Py_DECREF(data);
+                Py_XDECREF(super);
+                return NULL;
+            }
+            Py_DECREF(value);
+        }
+        if (super != NULL) {
+            status = merge_super(level, data, super);
+            Py_CLEAR(super);
+            if (status < 0) {
+                Py_DECREF(data);
+                return NULL;
+            }
+        }
+        super = data;
+    }
+
+    /* the dict holds the values from here on */
+    self->values = super;
+    for (i = 0; i < self->n_slots; i++) {
+        Py_CLEAR(self->slots[i].value);
+    }
+    self->slots = NULL;
+    return self->values;
+}
+
+static int
+LazyObject_Traverse(LazyObjectObject *self, visitproc visit, void *arg)
+{
+    size_t i;
+
+    if (self->slots != NULL) {
+        for (i = 0; i < self->n_slots; i++) {
+            Py_VISIT(self->slots[i].value);
+        }
+    }
+    Py_VISIT(self->values);
+    Py_VISIT(self->context);
+    return 0;
+}
+
+static int
+LazyObject_Clear(LazyObjectObject *self)
+{
+    /* the slots live in the context's arena, so they go first */
+    size_t i;
+
+    if (self->slots != NULL) {
+        for (i = 0; i < self->n_slots; i++) {
+            Py_CLEAR(self->slots[i].value);
+        }
+        self->slots = NULL;
+    }
+    Py_CLEAR(self->values);
+    Py_CLEAR(self->context);
+    return 0;
+}
+
+static void
+LazyObject_Dealloc(LazyObjectObject *self)
+{
+    PyObject_GC_UnTrack(self);
+    LazyObject_Clear(self);
+    PyObject_GC_Del(self);
+}
+
+static Py_ssize_t
+LazyObject_Length(LazyObjectObject *self)
+{
+    PyObject *values = LazyObject_Values(self);
+
+    return values != NULL ? PyDict_Size(values) : -1;
+}
+
+static PyObject *
+LazyObject_Subscript(LazyObjectObject *self, PyObject *key)
+{
+    PyObject *values = LazyObject_Values(self);
+    PyObject *value;
+
+    if (values == NULL) {
+        return NULL;
+    }
+    value = PyDict_GetItemWithError(values, key);
+    if (value == NULL) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetObject(PyExc_KeyError, key);
+        }
+        return NULL;
+    }
+    Py_INCREF(value);
+    return value;
+}
+
+static int
+LazyObject_Contains(LazyObjectObject *self, PyObject *key)
+{
+    PyObject *values = LazyObject_Values(self);
+
+    return values != NULL ? PyDict_Contains(values, key) : -1;
+}
+
+static PyObject *
+LazyObject_Iter(LazyObjectObject *self)
+{
+    PyObject *values = LazyObject_Values(self);
+
+    return values != NULL ? PyObject_GetIter(values) : NULL;
+}
+
+static PyObject *
+LazyObject_RichCompare(LazyObjectObject *self, PyObject *other, int op)
+{
+    /* compares equal to the dict the eager path would have made */
+    PyObject *values;
+
+    if ((op != Py_EQ && op != Py_NE)
+        || (!PyDict_Check(other) && !PyObject_TypeCheck(other, &LazyObject_Type))) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    values = LazyObject_Values(self);
+    if (values == NULL) {
+        return NULL;
+    }
+    if (PyObject_TypeCheck(other, &LazyObject_Type)) {
+        other = LazyObject_Values((LazyObjectObject *)other);
+        if (other == NULL) {
+            return NULL;
+        }
+    }
+    return PyObject_RichCompare(values, other, op);
+}
+
+static PyObject *
+LazyObject_Repr(LazyObjectObject *self)
+{
+    /* doesn't decode anything */
+    return PyUnicode_FromFormat("<LazyObject %s>", self->class_desc->classname);
+}
+
+static PyObject *
+lazy_forward(LazyObjectObject *self, const char *name, PyObject *args)
+{
+    /* call the dict method 'name' on the decoded fields */
+    PyObject *values = LazyObject_Values(self);
+    PyObject *method, *result;
+
+    if (values == NULL) {
+        return NULL;
+    }
+    method = PyObject_GetAttrString(values, name);
+    if (method == NULL) {
+        return NULL;
+    }
+    result = PyObject_Call(method, args, NULL);
+    Py_DECREF(method);
+    return result;
+}
+
+static PyObject *
+LazyObject_Keys(LazyObjectObject *self, PyObject *args)
+{
+    return lazy_forward(self, "keys", args);
+}
+
+static PyObject *
+LazyObject_Items(LazyObjectObject *self, PyObject *args)
+{
+    return lazy_forward(self, "items", args);
+}
+
+static PyObject *
+LazyObject_ValuesMethod(LazyObjectObject *self, PyObject *args)
+{
+    return lazy_forward(self, "values", args);
+}
+
+static PyObject *
+LazyObject_Get(LazyObjectObject *self, PyObject *args)
+{
+    return lazy_forward(self, "get", args);
+}
+
+static PyObject *
+LazyObject_ToDict(LazyObjectObject *self, PyObject *Py_UNUSED(ignored))
+{
+    PyObject *values = LazyObject_Values(self);
+
+    return values != NULL ? PyDict_Copy(values) : NULL;
+}
+
+static PyObject *
+LazyObject_GetClassname(LazyObjectObject *self, void *closure)
+{
+    return PyUnicode_FromString(self->class_desc->classname);
+}
+
+static PyObject *
+LazyObject_GetDecoded(LazyObjectObject *self, void *closure)
+{
+    return PyBool_FromLong(self->values != NULL);
+}
+
+static PyMethodDef LazyObject_Methods[] = {
+    {"keys", (PyCFunction)LazyObject_Keys, METH_VARARGS, "field names"},
+    {"items", (PyCFunction)LazyObject_Items, METH_VARARGS, "(field name, value) pairs"},
+    {"values", (PyCFunction)LazyObject_ValuesMethod, METH_VARARGS, "field values"},
+    {"get", (PyCFunction)LazyObject_Get, METH_VARARGS, "get(name, default=None)"},
+    {"to_dict", (PyCFunction)LazyObject_ToDict, METH_NOARGS,
+     "the fields as a dict, nested objects stay lazy"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef LazyObject_GetSet[] = {
+    {"classname", (getter)LazyObject_GetClassname, NULL, "java class name", NULL},
+    {"decoded", (getter)LazyObject_GetDecoded, NULL, "whether the fields were decoded", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyMappingMethods LazyObject_AsMapping = {
+    .mp_length = (lenfunc)LazyObject_Length,
+    .mp_subscript = (binaryfunc)LazyObject_Subscript,
+};
+
+static PySequenceMethods LazyObject_AsSequence = {
+    .sq_contains = (objobjproc)LazyObject_Contains,
+};
+
+static PyTypeObject LazyObject_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "jso_reader.LazyObject",
+    .tp_basicsize = sizeof(LazyObjectObject),
+    .tp_dealloc = (destructor)LazyObject_Dealloc,
+    .tp_repr = (reprfunc)LazyObject_Repr,
+    .tp_as_sequence = &LazyObject_AsSequence,
+    .tp_as_mapping = &LazyObject_AsMapping,
+    .tp_hash = PyObject_HashNotImplemented,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .tp_doc = "an object of a lazy parse, a read only mapping of its fields\n"
+              "that decodes them on first access",
+    .tp_traverse = (traverseproc)LazyObject_Traverse,
+    .tp_clear = (inquiry)LazyObject_Clear,
+    .tp_richcompare = (richcmpfunc)LazyObject_RichCompare,
+    .tp_iter = (getiterfunc)LazyObject_Iter,
+    .tp_methods = LazyObject_Methods,
+    .tp_getset = LazyObject_GetSet,
+};
+
+static void
+Reader_Init(Reader *reader)
+{
+    /* default options: everything comes back as plain python objects */
+    reader->handles = NULL;
+    reader->arena = NULL;
+    reader->class_cache = class_cache;
+    reader->owned = NULL;
+    reader->lazy_context = NULL;
+    reader->projection = NULL;
+    reader->typed_arrays = 0;
+    reader->owns_input = 0;
+    reader->drop_arrays = 0;
+    reader->unused = 0;
+}
+
+static void
+Reader_Release(Reader *reader)
+{
+    /* * Frees everything the parse allocated. The handles let go of
+     * their python objects first, since the nodes holding them live in
+     * the arena.
+     * */
+    if (reader->handles != NULL) {
+        Handles_ClearValues(reader->handles);
+        Handles_Destruct(reader->handles);
+        reader->handles = NULL;
+    }
+    Arena_Destruct(reader->arena);
+    reader->arena = NULL;
+    Py_CLEAR(reader->owned);
+}
+
+static int
+Reader_Begin(Reader *reader, size_t buffer_length)
+{
+    /* allocate the per parse state for a stream of 'buffer_length' bytes */
+    reader->handles = Handles_New(100); /* change to estimate based on 'buffer_length' */
+    reader->arena = Arena_New(buffer_length);
+    reader->owned = PyList_New(0);
+    if (reader->handles == NULL || reader->arena == NULL || reader->owned == NULL) {
+        Reader_Release(reader);
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+static int
+Reader_Reset(Reader *reader)
+{
+    /* * TC_RESET: every handle issued so far is forgotten, so the
+     * descriptors and strings behind them can go as well.
+     * */
+    Handles_Truncate(reader->handles, 0);
+    Arena_Reset(reader->arena);
+    return PyList_SetSlice(reader->owned, 0, PyList_GET_SIZE(reader->owned), NULL);
+}
+
+static int
+read_stream_header(Stream *stream)
+{
+    uint16_t magic_number;
+    uint16_t version;
+
+    /* validate stream header */
+    magic_number = get_unsigned_short(stream);
+    version = get_unsigned_short(stream);
+    if (stream->error || magic_number != 0xaced || version != 0x0005) {
+        PyErr_Format(StreamError, "Invalid stream header for java object serialization"
+        " stream protocol. First 4 bytes must read 0xaced0005, "
+        "instead read 0x%04x%04x", magic_number, version);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+read_stream(const char *buffer, size_t buffer_length, Reader *reader)
+{
+    Stream stream;
+    PyObject *data;
+
+    Stream_Init(&stream, buffer, buffer_length);
+    if (read_stream_header(&stream) < 0) {
+        return NULL;
+    }
+
+    if (Reader_Begin(reader, buffer_length) < 0) {
+        return NULL;
+    }
+    data = parse_stream(&stream, reader);
+    Reader_Release(reader);
+    if (data == NULL) {
+        return stream_failure(&stream);
+    }
+
+    return data;
+
+}
+
+static PyObject *
+stream_failure(Stream *stream)
+{
+    /* * Called when a parse function gave back NULL. Python API failures
+     * and content errors already have an exception set; running out of
+     * bytes only latches the cursor, so it gets reported here.
+     * */
+    if (!PyErr_Occurred()) {
+        if (stream->error == STREAM_EOF) {
+            PyErr_Format(StreamError, "unexpected end of stream at offset %zu "
+                         "(%zu bytes total)", Stream_Tell(stream),
+                         (size_t)(stream->end - stream->start));
+        }
+        else {
+            PyErr_Format(StreamError, "failed to parse stream at offset %zu",
+                         Stream_Tell(stream));
+        }
+    }
+    return NULL;
+}
+
+static PyObject *
+read_stream_native(const char *buffer, size_t buffer_length, Reader *reader)
+{
+    /* * Two phase read of the first object of a stream. The stream is
+     * scanned into a tape of ScanNodes with the GIL released, which
+     * validates it, walks the grammar and resolves every handle, and the
+     * python objects are built from the tape afterwards. Streams the scan
+     * rejects go to read_stream, which reports them the usual way.
+     * */
+    ScanIndex index;
+    TapeBuilder builder;
+    PyObject *data = NULL;
+    int status;
+
+    ScanIndex_Init(&index);
+    index.with_nodes = 1;
+    index.max_records = 1;
+
+    Py_BEGIN_ALLOW_THREADS
+    status = Scan_Stream(&index, buffer, buffer_length);
+    Py_END_ALLOW_THREADS
+
+    if (status == 0 && index.n_records == 1) {
+        if (Reader_Begin(reader, buffer_length) < 0) {
+            ScanIndex_Release(&index);
+            return NULL;
+        }
+        TapeBuilder_Init(&builder, &index, reader, buffer, buffer_length);
+        builder.node = index.records[0].node;
+
+        data = build_content(&builder);
+        Reader_Release(reader);
+        if (data == NULL && (!builder.diverged || PyErr_Occurred())) {
+            ScanIndex_Release(&index);
+            return stream_failure(&builder.stream);
+        }
+    }
+    ScanIndex_Release(&index);
+
+    if (data == NULL) {
+        data = read_stream(buffer, buffer_length, reader);
+    }
+    return data;
+}
+
+static void
+TapeBuilder_Init(TapeBuilder *b, const ScanIndex *index, Reader *reader,
+                 const char *buffer, size_t buffer_length)
+{
+    b->index = index;
+    b->node = 0;
+    b->reader = reader;
+    b->diverged = 0;
+    b->generation = 0;
+    b->deferred = NULL;
+    b->n_deferred = 0;
+    b->reserved_deferred = 0;
+    b->defer = 0;
+    b->threads = 0;
+    b->window = NULL;
+    Stream_Init(&b->stream, buffer, buffer_length);
+}
+
+static PyObject *
+build_records(TapeBuilder *b)
+{
+    /* * Every top-level record of the tape, in order. A record after a
+     * TC_RESET starts over with an empty handle table, as iter_stream
+     * does; the scan numbers its handles from the record's generation.
+     * */
+    const ScanIndex *index = b->index;
+    const ScanRecord *record;
+    const ScanNode *node;
+    PyObject *records, *ob;
+    size_t i;
+    int status;
+
+    records = PyList_New(0);
+    if (records == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < index->n_records; i++) {
+        if (b->window != NULL && i == b->window->end && predecode_window(b, i) < 0) {
+            goto fail;
+        }
+        record = &index->records[i];
+        if (record->generation != b->generation) {
+            if (Reader_Reset(b->reader) < 0) {
+                goto fail;
+            }
+            b->generation = record->generation;
+        }
+        b->node = record->node;
+        node = &index->nodes[b->node];
+        if (record->type == TC_BLOCKDATA || record->type == TC_BLOCKDATALONG) {
+            b->node++;
+            ob = PyBytes_FromStringAndSize((const char *)b->stream.start + node->value,
+                                           node->count);
+        }
+        else {
+            ob = build_content(b);
+        }
+        if (ob == NULL) {
+            goto fail;
+        }
+        status = PyList_Append(records, ob);
+        Py_DECREF(ob);
+        if (status < 0) {
+            goto fail;
+        }
+    }
+    decode_deferred(b);
+    return records;
+
+fail:
+    /* the arrays the deferred decodes point at go with the records */
+    b->n_deferred = 0;
+    Py_DECREF(records);
+    return NULL;
+}
+
+static void
+decode_deferred_task(void *context, size_t task)
+{
+    const DeferredDecode *d = &((TapeBuilder *)context)->deferred[task];
+
+    PrimitiveArray_Decode(d->typecode, d->dst, d->src, (Py_ssize_t)d->n_elements);
+}
+
+static void
+decode_deferred(TapeBuilder *b)
+{
+    /* * Byte swap the typed arrays built so far on the pool, with the GIL
+     * released. The arrays aren't reachable from outside the read yet.
+     * */
+    size_t i;
+
+    if (b->n_deferred == 0) {
+        return;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    if (Pool_Run(b->n_deferred, b->threads, decode_deferred_task, b) < 0) {
+        for (i = 0; i < b->n_deferred; i++) {
+            decode_deferred_task(b, i);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    b->n_deferred = 0;
+}
+
+static int
+predecode_window(TapeBuilder *b, size_t first)
+{
+    /* * Decode the records from 'first' on, up to TAPE_WINDOW bytes of
+     * them, on the pool with the GIL released, for build_records to pick
+     * up. The records are split into runs of whole records, a few per
+     * thread, and the workers steal from each other's runs.
+     * */
+    const ScanIndex *index = b->index;
+    TapeWindow *w = b->window;
+    uint64_t n_bytes = 0, task_bytes, run = 0;
+    size_t end = first, last_node, reserved, i;
+    int n_threads, status;
+    void *p;
+
+    release_window(b);
+    while (end < index->n_records && n_bytes < TAPE_WINDOW) {
+        n_bytes += index->records[end++].length;
+    }
+    last_node = end < index->n_records ? index->records[end].node : index->n_nodes;
+
+    /* one task boundary per record at most, plus the window's end */
+    if (end - first + 1 > w->reserved_tasks) {
+        reserved = end - first + 1;
+        p = PyMem_Realloc(w->tasks, reserved * sizeof(size_t));
+        if (p == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        w->tasks = (size_t *)p;
+        w->reserved_tasks = reserved;
+    }
+    if (last_node - index->records[first].node > w->reserved_values) {
+        reserved = last_node - index->records[first].node;
+        p = PyMem_Realloc(w->values, reserved * sizeof(TapeValue));
+        if (p == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        w->values = (TapeValue *)p;
+        w->reserved_values = reserved;
+    }
+
+    n_threads = b->threads > 0 ? b->threads : Pool_DefaultThreads();
+    task_bytes = n_bytes / ((uint64_t)n_threads * 4);
+    if (task_bytes < TAPE_TASK_MIN) {
+        task_bytes = TAPE_TASK_MIN;
+    }
+    w->n_tasks = 0;
+    w->tasks[0] = first;
+    for (i = first; i < end; i++) {
+        run += index->records[i].length;
+        if (run >= task_bytes && i + 1 < end) {
+            w->tasks[++w->n_tasks] = i + 1;
+            run = 0;
+        }
+    }
+    w->tasks[++w->n_tasks] = end;
+    w->end = end;
+    w->first_node = index->records[first].node;
+    w->n_values = last_node - w->first_node;
+    memset(w->values, 0, w->n_values * sizeof(TapeValue));
+
+    Py_BEGIN_ALLOW_THREADS
+    status = Pool_Run(w->n_tasks, b->threads, predecode_task, b);
+    if (status < 0) {
+        for (i = 0; i < w->n_tasks; i++) {
+            predecode_task(b, i);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    return 0;
+}
+
+static void
+predecode_task(void *context, size_t task)
+{
+    /* * One run of records of the window, without the GIL. Annotations
+     * are left alone, read_annotation reads them from the input.
+     * */
+    const TapeBuilder *b = (const TapeBuilder *)context;
+    const ScanIndex *index = b->index;
+    const TapeWindow *w = b->window;
+    size_t end = w->tasks[task + 1];
+    size_t i = index->records[w->tasks[task]].node;
+    size_t last = end < index->n_records ? index->records[end].node : index->n_nodes;
+
+    for (; i < last; i++) {
+        if (index->nodes[i].type == SCAN_ANNOTATION) {
+            i += index->nodes[i].count;
+            continue;
+        }
+        predecode_node(b, &index->nodes[i], &w->values[i - w->first_node]);
+    }
+}
+
+static void
+predecode_node(const TapeBuilder *b, const ScanNode *node, TapeValue *v)
+{
+    /* a node that can't be decoded here is left to the builder */
+    const ScanIndex *index = b->index;
+    const unsigned char *p = b->stream.start + node->value;
+    const ScanHandle *handle;
+    const ScanClass *cls;
+    size_t size;
+
+    switch (node->type) {
+        case TC_STRING:
+            handle = &index->handles[node->handle];
+            size = (size_t)(handle->offset + handle->length - node->value);
+            if (size <= UINT32_MAX) {
+                predecode_string(p, size, v);
+            }
+            break;
+        case TC_ARRAY:
+            cls = &index->classes[index->handles[index->handles[node->handle].class_handle].layout];
+            size = primitive_size(cls->element) * node->count;
+            /* big typed arrays are swapped straight into place, see build_primitive_array */
+            if (size == 0 || (b->reader->typed_arrays && size >= TAPE_UNLOCKED_DECODE)) {
+                break;
+            }
+            v->u.data = malloc(size);
+            if (v->u.data != NULL) {
+                PrimitiveArray_Decode(cls->element, v->u.data, p, (Py_ssize_t)node->count);
+                v->ready = 1;
+            }
+            break;
+        default:
+            if (primitive_size((char)node->type) != 0) {
+                PrimitiveArray_Decode((char)node->type, &v->u, p, 1);
+                v->ready = 1;
+            }
+            break;
+    }
+}
+
+static int
+utf8_next(const unsigned char *p, size_t n_bytes, size_t *i, uint32_t *c)
+{
+    /* * The code point at p[*i], for strict utf-8 as PyUnicode_DecodeUTF8
+     * takes it: no overlong forms, surrogates or code points past 10FFFF.
+     * */
+    size_t at = *i, length, k;
+    unsigned char lo = 0x80, hi = 0xbf;
+
+    if (p[at] < 0x80) {
+        *c = p[at];
+        *i = at + 1;
+        return 0;
+    }
+    if (p[at] >= 0xc2 && p[at] <= 0xdf) {
+        length = 2;
+        *c = p[at] & 0x1f;
+    }
+    else if (p[at] >= 0xe0 && p[at] <= 0xef) {
+        length = 3;
+        *c = p[at] & 0x0f;
+        lo = p[at] == 0xe0 ? 0xa0 : 0x80;
+        hi = p[at] == 0xed ? 0x9f : 0xbf;
+    }
+    else if (p[at] >= 0xf0 && p[at] <= 0xf4) {
+        length = 4;
+        *c = p[at] & 0x07;
+        lo = p[at] == 0xf0 ? 0x90 : 0x80;
+        hi = p[at] == 0xf4 ? 0x8f : 0xbf;
+    }
+    else {
+        return -1;
+    }
+    if (n_bytes - at < length || p[at + 1] < lo || p[at + 1] > hi) {
+        return -1;
+    }
+    for (k = 1; k < length; k++) {
+        if ((p[at + k] & 0xc0) != 0x80) {
+            return -1;
+        }
+        *c = (*c << 6) | (p[at + k] & 0x3f);
+    }
+    *i = at + length;
+    return 0;
+}
+
+static int
+predecode_string(const unsigned char *p, size_t n_bytes, TapeValue *v)
+{
+    /* * The chars of a string as PyUnicode_New lays them out, in two
+     * passes: one to check them and find the width, one to fill it.
+     * Strings the codec would reject are left to it, for its error.
+     * */
+    uint32_t c, maxchar = 0, length = 0;
+    size_t i = 0, k;
+    int kind;
+
+    while (i < n_bytes) {
+        if (utf8_next(p, n_bytes, &i, &c) < 0) {
+            return -1;
+        }
+        if (c > maxchar) {
+            maxchar = c;
+        }
+        length++;
+    }
+    v->length = length;
+    v->maxchar = maxchar;
+    v->u.data = NULL;
+    if (maxchar >= 0x80) {
+        kind = maxchar < 0x100 ? 1 : maxchar < 0x10000 ? 2 : 4;
+        v->u.data = malloc((size_t)length * kind);
+        if (v->u.data == NULL) {
+            return -1;
+        }
+        for (i = 0, k = 0; i < n_bytes; k++) {
+            utf8_next(p, n_bytes, &i, &c);
+            if (kind == 1) {
+                ((uint8_t *)v->u.data)[k] = (uint8_t)c;
+            }
+            else if (kind == 2) {
+                ((uint16_t *)v->u.data)[k] = (uint16_t)c;
+            }
+            else {
+                ((uint32_t *)v->u.data)[k] = c;
+            }
+        }
+    }
+    v->ready = 1;
+    return 0;
+}
+
+static void
+release_window(TapeBuilder *b)
+{
+    /* free what the builder didn't take of the window */
+    TapeWindow *w = b->window;
+    uint8_t type;
+    size_t i;
+
+    for (i = 0; i < w->n_values; i++) {
+        type = b->index->nodes[w->first_node + i].type;
+        if (w->values[i].ready && (type == TC_STRING || type == TC_ARRAY)) {
+            free(w->values[i].u.data);
+        }
+    }
+    w->n_values = 0;
+}
+
+static TapeValue *
+tape_value(TapeBuilder *b, size_t node)
+{
+    /* what predecode_window made of 'node', or NULL */
+    TapeWindow *w = b->window;
+    TapeValue *v;
+
+    if (w == NULL || node < w->first_node || node - w->first_node >= w->n_values) {
+        return NULL;
+    }
+    v = &w->values[node - w->first_node];
+    return v->ready ? v : NULL;
+}
+
+static PyObject *
+tape_diverged(TapeBuilder *b)
+{
+    /* * The tape and what the one pass code made of the same bytes don't
+     * line up, which only happens for streams it reads differently from
+     * the protocol. The whole stream is read again by that code, and
+     * the fallback is counted for _tape_info.
+     * */
+    if (!b->diverged) {
+        tape_divergences++;
+    }
+    b->diverged = 1;
+    return NULL;
+}
+
+static int
+tape_check_handle(TapeBuilder *b, uint32_t handle)
+{
+    /* the handle a node issues has to be the next one of the reader */
+    if (Handles_Position(b->reader->handles) != (size_t)handle - b->generation) {
+        tape_diverged(b);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+tape_skip(TapeBuilder *b)
+{
+    /* step the cursor over one content node and everything under it */
+    const ScanIndex *index = b->index;
+    const ScanNode *node = &index->nodes[b->node++];
+    const ScanClass *cls;
+    uint32_t i;
+    int tc;
+
+    switch (node->type) {
+        case TC_OBJECT:
+            tape_skip(b);
+            tape_skip_class_data(b, index->handles[node->handle].class_handle);
+            break;
+        case TC_ARRAY:
+            tape_skip(b);
+            cls = &index->classes[index->handles[index->handles[node->handle].class_handle].layout];
+            tc = b->stream.start[cls->name_offset + 1];
+            if (tc == 'L' || tc == '[') {
+                for (i = 0; i < node->count; i++) {
+                    tape_skip(b);
+                }
+            }
+            break;
+        case TC_ENUM:
+            tape_skip(b);
+            tape_skip(b);
+            break;
+        case TC_CLASS:
+            tape_skip(b);
+            break;
+        case SCAN_ANNOTATION:
+            b->node += node->count;
+            break;
+        default:
+            /* null, references, strings, descriptors, primitives and block data */
+            break;
+    }
+}
+
+static void
+tape_skip_class_data(TapeBuilder *b, uint32_t desc)
+{
+    /* the field and annotation nodes of an instance of 'desc' */
+    const ScanIndex *index = b->index;
+    const ScanClass *cls;
+    size_t i;
+
+    if (desc == SCAN_NONE) {
+        return;
+    }
+    tape_skip_class_data(b, index->handles[desc].class_handle);
+    cls = &index->classes[index->handles[desc].layout];
+    if (cls->flags & SC_SERIALIZABLE) {
+        for (i = 0; i < cls->n_fields; i++) {
+            tape_skip(b);
+        }
+        if (cls->flags & SC_WRITE_METHOD) {
+            tape_skip(b);
+        }
+    }
+    else if (cls->flags & SC_EXTERNALIZABLE) {
+        tape_skip(b);
+    }
+}
+
+static int
+tape_native_class_desc(TapeBuilder *b, size_t node)
+{
+    /* a new class descriptor or a reference to one, not a proxy or null */
+    const ScanNode *n = &b->index->nodes[node];
+
+    return n->type == TC_CLASSDESC
+        || (n->type == TC_REFERENCE && b->index->handles[n->handle].type == TC_CLASSDESC);
+}
+
+static PyObject *
+build_content(TapeBuilder *b)
+{
+    /* the python object of the content node at the cursor */
+    const ScanNode *node = &b->index->nodes[b->node];
+
+    switch (node->type) {
+        case TC_NULL:
+            b->node++;
+            Py_RETURN_NONE;
+        case TC_STRING:
+            b->node++;
+            return build_string(b, node);
+        case TC_OBJECT:
+            return build_object(b);
+        case TC_ARRAY:
+            return build_array(b);
+        case TC_REFERENCE:
+        case TC_CLASSDESC:
+        case TC_PROXYCLASSDESC:
+        case TC_ENUM:
+        case TC_CLASS:
+            return build_from_stream(b);
+        default:
+            /* block data, or a reset, where an object should be */
+            return tape_diverged(b);
+    }
+}
+
+static PyObject *
+build_from_stream(TapeBuilder *b)
+{
+    /* * Decode the content at the cursor with parse_stream, from where it
+     * starts in the input, and step over its nodes. It issues the same
+     * handles the tape has, so the two can take turns.
+     * */
+    const ScanIndex *index = b->index;
+    const ScanNode *node = &index->nodes[b->node];
+    uint64_t start, end;
+    PyObject *ob;
+
+    if (node->type == TC_NULL || node->type == TC_REFERENCE) {
+        start = node->value;
+        end = start + (node->type == TC_NULL ? 1 : 5);
+    }
+    else {
+        start = index->handles[node->handle].offset;
+        end = start + index->handles[node->handle].length;
+    }
+
+    if (node->type != TC_NULL && node->type != TC_REFERENCE) {
+        /* registered handlers may look at the arrays built so far */
+        decode_deferred(b);
+    }
+    b->stream.pos = b->stream.start + start;
+    ob = parse_stream(&b->stream, b->reader);
+    if (ob == NULL) {
+        return NULL;
+    }
+    if ((uint64_t)Stream_Tell(&b->stream) != end) {
+        /* a reference to a class descriptor reads values after it */
+        Py_DECREF(ob);
+        return tape_diverged(b);
+    }
+    tape_skip(b);
+    return ob;
+}
+
+static PyObject *
+build_string(TapeBuilder *b, const ScanNode *node)
+{
+    /* parse_tc_string at the string's chars, the tape has their length */
+    const ScanHandle *handle = &b->index->handles[node->handle];
+    TapeValue *v = tape_value(b, (size_t)(node - b->index->nodes));
+    size_t length = (size_t)(handle->offset + handle->length - node->value);
+    PyObject *ob;
+
+    if (tape_check_handle(b, node->handle) < 0) {
+        return NULL;
+    }
+    b->stream.pos = b->stream.start + node->value;
+    if (v == NULL) {
+        return parse_tc_string(&b->stream, b->reader, NULL, length);
+    }
+
+    /* the handle as parse_tc_string makes it, the chars as a worker decoded them */
+    if (read_tc_string(&b->stream, b->reader, length) == NULL) {
+        return NULL;
+    }
+    ob = PyUnicode_New((Py_ssize_t)v->length, (Py_UCS4)v->maxchar);
+    if (ob != NULL) {
+        memcpy(PyUnicode_DATA(ob), v->u.data != NULL ? v->u.data : b->stream.start + node->value,
+               (size_t)v->length * PyUnicode_KIND(ob));
+    }
+    free(v->u.data);
+    v->ready = 0;
+    return ob;
+}
+
+static JavaType_Type *
+build_class_desc(TapeBuilder *b)
+{
+    /* * The class descriptor node at the cursor, checked by the caller
+     * with tape_native_class_desc. New descriptors are decoded from their
+     * bytes, so they go through the class cache like any other.
+     * */
+    const ScanNode *node = &b->index->nodes[b->node++];
+    JavaType_Type *class_desc;
+
+    if (node->type == TC_REFERENCE) {
+        class_desc = Handles_Find(b->reader->handles,
+                                  BASE_WIRE_HANDLE + (uint32_t)(node->handle - b->generation));
+        if (class_desc == NULL || class_desc->jt_type != TC_CLASSDESC) {
+            tape_diverged(b);
+            return NULL;
+        }
+        return class_desc;
+    }
+    if (tape_check_handle(b, node->handle) < 0) {
+        return NULL;
+    }
+    b->stream.pos = b->stream.start + b->index->handles[node->handle].offset + 1;
+    class_desc = JavaType_New(b->reader->arena, TC_CLASSDESC);
+    if (class_desc == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    if (parse_tc_classdesc(&b->stream, b->reader, class_desc) < 0) {
+        return NULL;
+    }
+    return class_desc;
+}
+
+static PyObject *
+build_object(TapeBuilder *b)
+{
+    const ScanNode *node = &b->index->nodes[b->node];
+    JavaType_Type *ob;
+    JavaType_Type *class_desc;
+    DecodePlan *plan;
+    PyObject *data = NULL;
+    size_t i;
+
+    if (!tape_native_class_desc(b, b->node + 1)) {
+        return build_from_stream(b);
+    }
+    b->node++;
+    class_desc = build_class_desc(b);
+    if (class_desc == NULL || tape_check_handle(b, node->handle) < 0) {
+        return NULL;
+    }
+
+    ob = JavaType_New(b->reader->arena, TC_OBJECT);
+    if (ob == NULL) {
+        return PyErr_NoMemory();
+    }
+    ob->class_descriptor = class_desc;
+    class_desc->ref_count++;
+    if (Handles_Append(b->reader->handles, ob) < 0) {
+        return PyErr_NoMemory();
+    }
+
+    plan = class_desc->plan;
+    if (plan == NULL) {
+        plan = compile_decode_plan(b->reader, class_desc);
+        if (plan == NULL) {
+            return NULL;
+        }
+    }
+    for (i = 0; i < plan->n_levels; i++) {
+        data = build_plan_level(b, &plan->levels[i], data);
+        if (data == NULL) {
+            return NULL;
+        }
+    }
+
+    Py_INCREF(data);
+    ob->value = data;
+    return data;
+}
+
+static PyObject *
+build_plan_level(TapeBuilder *b, const PlanLevel *level, PyObject *super)
+{
+    /* read_plan_level over the tape, steals 'super' */
+    JavaType_Type *class_desc = level->class_desc;
+    PyObject *data, *value;
+    size_t i;
+    int status;
+
+    if (!class_desc->flags.sc_serializable) {
+        Py_XDECREF(super);
+        if (class_desc->flags.sc_externalizable) {
+            /* the one pass reader doesn't step over external data */
+            return tape_diverged(b);
+        }
+        return PyDict_New();
+    }
+    if (level->is_boxed) {
+        Py_XDECREF(super);
+        if (class_desc->flags.sc_write_method) {
+            return tape_diverged(b);
+        }
+        return build_field(b, &level->fields[0]);
+    }
+
+    data = PyDict_New();
+    if (data == NULL) {
+        Py_XDECREF(super);
+        return NULL;
+    }
+    for (i = 0; i < level->n_fields; i++) {
+        value = build_field(b, &level->fields[i]);
+        if (value == NULL) {
+            Py_DECREF(data);
+            Py_XDECREF(super);
+            return NULL;
+        }
+        status = PyDict_SetItem(data, level->fields[i].field->key, value);
+        Py_DECREF(value);
+        if (status < 0) {
+            Py_DECREF(data);
+            Py_XDECREF(super);
+            return NULL;
+        }
+    }
+    if (super != NULL) {
+        status = merge_super(level, data, super);
+        Py_DECREF(super);
+        if (status < 0) {
+            Py_DECREF(data);
+            return NULL;
+        }
+    }
+
+    if (class_desc->flags.sc_write_method) {
+        return build_annotation(b, class_desc, data);
+    }
+    return data;
+}
+
+static PyObject *
+build_field(TapeBuilder *b, const PlanField *op)
+{
+    const ScanNode *node = &b->index->nodes[b->node];
+    TapeValue *v;
+
+    if (op->typecode == 'L' || op->typecode == '[') {
+        return build_content(b);
+    }
+    if (node->type != (uint8_t)op->typecode) {
+        return tape_diverged(b);
+    }
+    v = tape_value(b, b->node++);
+    if (v != NULL) {
+        return unpack_host(&v->u, op->typecode);
+    }
+    return unpack_primitive(b->stream.start + node->value, op->typecode);
+}
+
+static PyObject *
+build_annotation(TapeBuilder *b, JavaType_Type *class_desc, PyObject *data)
+{
+    /* * The annotation of one class of an instance, collections and
+     * registered handlers included: read_annotation at the annotation's
+     * offset, then the cursor steps over its nodes. Steals 'data'.
+     * */
+    const ScanNode *node = &b->index->nodes[b->node];
+    size_t end = b->node + 1 + node->count;
+
+    if (node->type != SCAN_ANNOTATION) {
+        Py_DECREF(data);
+        return tape_diverged(b);
+    }
+
+    decode_deferred(b);
+    b->stream.pos = b->stream.start + node->value;
+    data = read_annotation(&b->stream, b->reader, class_desc, data);
+    if (data == NULL) {
+        return NULL;
+    }
+    if ((uint64_t)Stream_Tell(&b->stream) != b->index->nodes[end - 1].value + 1) {
+        Py_DECREF(data);
+        return tape_diverged(b);
+    }
+    b->node = end;
+    return data;
+}
+
+static PyObject *
+build_array(TapeBuilder *b)
+{
+    const ScanIndex *index = b->index;
+    const ScanNode *node = &index->nodes[b->node];
+    const ScanClass *cls;
+    JavaType_Type *array;
+    JavaType_Type *class_desc;
+    PyObject *python_array, *element;
+    const unsigned char *p;
+    TapeValue *v = tape_value(b, b->node);
+    size_t size;
+    uint32_t i;
+    char array_type;
+
+    cls = &index->classes[index->handles[index->handles[node->handle].class_handle].layout];
+    if (!tape_native_class_desc(b, b->node + 1)
+        || (b->reader->typed_arrays && b->stream.start[cls->name_offset + 1] == '[')) {
+        /* typed multi-dimensional arrays are laid out by parse_tc_array */
+        return build_from_stream(b);
+    }
+    b->node++;
+    class_desc = build_class_desc(b);
+    if (class_desc == NULL || tape_check_handle(b, node->handle) < 0) {
+        return NULL;
+    }
+
+    array = JavaType_New(b->reader->arena, TC_ARRAY);
+    if (array == NULL) {
+        return PyErr_NoMemory();
+    }
+    array->class_descriptor = class_desc;
+    class_desc->ref_count++;
+    if (Handles_Append(b->reader->handles, array) < 0) {
+        return PyErr_NoMemory();
+    }
+
+    array_type = class_desc->classname[1];
+    if (array_type == 'L' || array_type == '[') {
+        python_array = PyList_New(0);
+        if (python_array == NULL) {
+            return NULL;
+        }
+        for (i = 0; i < node->count; i++) {
+            element = build_content(b);
+            if (element == NULL) {
+                Py_DECREF(python_array);
+                return NULL;
+            }
+            /* null elements are left out, as in parse_tc_array */
+            if (element != Py_None && PyList_Append(python_array, element) < 0) {
+                Py_DECREF(element);
+                Py_DECREF(python_array);
+                return NULL;
+            }
+            Py_DECREF(element);
+        }
+    }
+    else if ((size = primitive_size(array_type)) != 0 && v != NULL) {
+        if (b->reader->typed_arrays) {
+            python_array = PrimitiveArray_New(array_type, node->count);
+            if (python_array != NULL) {
+                memcpy(((PrimitiveArrayObject *)python_array)->data, v->u.data,
+                       size * node->count);
+            }
+        }
+        else {
+            python_array = host_list(array_type, v->u.data, node->count);
+        }
+        free(v->u.data);
+        v->ready = 0;
+        if (python_array == NULL) {
+            return NULL;
+        }
+    }
+    else if (size != 0) {
+        p = b->stream.start + node->value;
+        if (b->reader->typed_arrays) {
+            python_array = build_primitive_array(b, array_type, p, node->count);
+        }
+        else {
+            python_array = primitive_list(array_type, p, node->count);
+        }
+        if (python_array == NULL) {
+            return NULL;
+        }
+    }
+    else {
+        PyErr_Format(StreamError, "unknown array type %s", class_desc->classname);
+        return NULL;
     }
 
-    FILE *fd = fopen(filename, "rb");
-    assert(fd != NULL);
-
-    uint16_t magic_number = get_unsigned_short(fd);
-    uint16_t version = get_unsigned_short(fd);
-
-    /* validate magic number and version are correct  */
-    assert(magic_number == 0xaced);
-    assert(version == 0x0005);
-
-    Handles *handles = Handles_New(DEFAULT_REFERENCE_SIZE);
-
-    PyObject *data;
-
-    data = parse_stream(fd, handles);
-    
-    fclose(fd);
-    // Handles_Destruct(handles);
-    handles = NULL;
-    free(handles);
-    return data;
+    Py_INCREF(python_array);
+    array->value = python_array;
+    return python_array;
 }
 
 static PyObject *
-read_stream(const char *stream, size_t buffer_length)
+build_primitive_array(TapeBuilder *b, char typecode, const unsigned char *p, uint32_t n_elements)
 {
-    FILE *fd;
-    PyObject *data;
-    Handles *handles;
-    uint16_t magic_number;
-    uint16_t version;
-
-    fd = fmemopen((void *)stream, buffer_length, "r");
-    /* validate stream header */
-    magic_number = get_unsigned_short(fd);
-    version = get_unsigned_short(fd);
-    if (magic_number != 0xaced || version != 0x0005) {
-        fprintf(stderr, "Invalid stream header for java object serialization"
-        " stream protocol.\n\t First 8 bytes must read 0xaced0005.\n\t"
-        "First 8 bytes instead read 0x%x%x", magic_number, version);
-        exit(EXIT_FAILURE);
+    /* * PrimitiveArray_FromBigEndian, with the byte swap of big arrays
+     * done without the GIL: nothing else can see the new array yet.
+     * A builder that defers leaves it to decode_deferred, one entry
+     * per PARALLEL_DECODE_CHUNK bytes so giant arrays spread over the pool.
+     * */
+    PrimitiveArrayObject *array;
+    DeferredDecode *d;
+    size_t size = primitive_size(typecode);
+    size_t per_chunk = PARALLEL_DECODE_CHUNK / size;
+    size_t n_chunks = ((size_t)n_elements + per_chunk - 1) / per_chunk;
+    size_t reserved, i;
+
+    if ((size_t)n_elements * size < TAPE_UNLOCKED_DECODE) {
+        return PrimitiveArray_FromBigEndian(typecode, p, n_elements);
     }
+    array = (PrimitiveArrayObject *)PrimitiveArray_New(typecode, n_elements);
+    if (array == NULL) {
+        return NULL;
+    }
+    if (b->defer && b->n_deferred + n_chunks > b->reserved_deferred) {
+        reserved = b->reserved_deferred ? 2 * b->reserved_deferred : 16;
+        if (reserved < b->n_deferred + n_chunks) {
+            reserved = b->n_deferred + n_chunks;
+        }
+        d = (DeferredDecode *)PyMem_Realloc(b->deferred, reserved * sizeof(DeferredDecode));
+        if (d != NULL) {
+            b->deferred = d;
+            b->reserved_deferred = reserved;
+        }
+    }
+    if (b->defer && b->n_deferred + n_chunks <= b->reserved_deferred) {
+        for (i = 0; i < n_chunks; i++) {
+            d = &b->deferred[b->n_deferred++];
+            d->typecode = typecode;
+            d->dst = array->data + i * per_chunk * size;
+            d->src = p + i * per_chunk * size;
+            d->n_elements = i + 1 < n_chunks ? per_chunk : n_elements - i * per_chunk;
+        }
+        return (PyObject *)array;
+    }
+    decode_unlocked(b->reader, typecode, array->data, p, n_elements);
+    return (PyObject *)array;
+}
 
-    handles = Handles_New(100); /* change to estimate based on 'buffer_length' */
-    data = parse_stream(fd, handles);
-
-    return data;
+static void
+decode_chunk_task(void *context, size_t task)
+{
+    /* PARALLEL_DECODE_CHUNK bytes of the array of a decode_unlocked */
+    const DeferredDecode *d = (const DeferredDecode *)context;
+    size_t size = primitive_size(d->typecode);
+    size_t per_chunk = PARALLEL_DECODE_CHUNK / size;
+    size_t first = task * per_chunk;
+    size_t n = d->n_elements - first < per_chunk ? d->n_elements - first : per_chunk;
+
+    PrimitiveArray_Decode(d->typecode, (char *)d->dst + first * size, d->src + first * size,
+                          (Py_ssize_t)n);
+}
 
+static void
+decode_unlocked(const Reader *reader, char typecode, void *dst, const unsigned char *src,
+                size_t n_elements)
+{
+    /* * Decode a new array, split into chunks over the pool once it
+     * reaches PARALLEL_DECODE_MIN bytes. Called with the GIL held, by the
+     * owner of the only reference to 'dst'. The GIL is only released for
+     * a reader that owns its input: an iterator, a StreamParser or a lazy
+     * object can be reached from another thread, which could advance the
+     * same reader or move the buffer 'src' points into.
+     * */
+    DeferredDecode whole;
+    size_t n_bytes = n_elements * primitive_size(typecode);
+    int status = -1;
+    PyThreadState *save = NULL;
+
+    whole.typecode = typecode;
+    whole.dst = dst;
+    whole.src = src;
+    whole.n_elements = n_elements;
+
+    if (reader->owns_input) {
+        save = PyEval_SaveThread();
+    }
+    if (n_bytes >= PARALLEL_DECODE_MIN) {
+        status = Pool_Run((n_bytes + PARALLEL_DECODE_CHUNK - 1) / PARALLEL_DECODE_CHUNK, 0,
+                          decode_chunk_task, &whole);
+    }
+    if (status < 0) {
+        PrimitiveArray_Decode(typecode, dst, src, (Py_ssize_t)n_elements);
+    }
+    if (save != NULL) {
+        PyEval_RestoreThread(save);
+    }
 }
 
 static PyObject *
-parse_stream(FILE *fd, Handles *handles)
+parse_stream(Stream *stream, Reader *reader)
 {
     char tc_typecode;
 
-    tc_typecode = get_and_validate_stream_typecode(fd);
+    tc_typecode = get_and_validate_stream_typecode(stream);
+    if (stream->error) {
+        return NULL;
+    }
     PyObject *ob = Py_None;
 
     if (tc_typecode == TC_ARRAY) {
-        ob = parse_tc_array(fd, handles);
+        ob = parse_tc_array(stream, reader);
     }
     else if (tc_typecode == TC_LONGSTRING){
         /* the NULL field is so a char buffer can be passed in 
         and the original string can be returned along with the 
         PyUnicode object */
-        ob = parse_tc_longstring(fd, handles, NULL);
+        ob = parse_tc_longstring(stream, reader, NULL);
     }
     else if (tc_typecode == TC_STRING) {
         /* the NULL field is so a char buffer can be passed in 
         and the original string can be returned along with the 
         PyUnicode object */
-        ob = parse_tc_shortstring(fd, handles, NULL);
+        ob = parse_tc_shortstring(stream, reader, NULL);
     }
     else if (tc_typecode == TC_OBJECT) {
-        ob = parse_tc_object(fd, handles);
+        ob = parse_tc_object(stream, reader);
     }
     else if (tc_typecode == TC_CLASSDESC) {
         /* TODO: i hate the way this is written */
-        JavaType_Type *type = JavaType_New(TC_CLASSDESC);
-        parse_tc_classdesc(fd, handles, type);
-        ob = get_values_class_desc(fd, handles, type); 
+        JavaType_Type *type = JavaType_New(reader->arena, TC_CLASSDESC);
+        if (type == NULL) {
+            return PyErr_NoMemory();
+        }
+        if (parse_tc_classdesc(stream, reader, type) < 0) {
+            return NULL;
+        }
+        ob = get_values_class_desc(stream, reader, type); 
     }
     else if (tc_typecode == TC_NULL) {
         /* TODO: fix this shit. This should return null instead of Py_None and 
@@ -148,18 +3000,19 @@ parse_stream(FILE *fd, Handles *handles)
         Py_INCREF(ob);
     }
     else if (tc_typecode == TC_REFERENCE) {
-        ob = parse_tc_reference(fd, handles);
+        ob = parse_tc_reference(stream, reader);
     }
     else {
-        fprintf(stderr, "NOT TYPECODE IMPLEMENTATION: 0x%x, %d\n", tc_typecode, __LINE__);
-        exit(1);
+        /* enums, classes and proxies are not decoded yet */
+        invalid_typecode(stream, tc_typecode, "an object");
+        return NULL;
     }
 
     return ob;
 }
 
 static PyObject *
-parse_tc_reference(FILE *fd, Handles *handles)
+parse_tc_reference(Stream *stream, Reader *reader)
 {
     /* * parse_tc_refernce parses a stream following a typecode of 0x77.
      * the first position in the stream should be the java int (4 bytes) 
@@ -167,68 +3020,126 @@ parse_tc_reference(FILE *fd, Handles *handles)
      * 
      * returns
      * -------
-     *     PyObject *ob: pyobject value that the stream is referencing. 
+     *     PyObject *ob: new reference to the value that the stream is referencing. 
      * */
     uint32_t handle;
 
-    handle = get_handle(fd);
+    handle = get_handle(stream);
+    if (stream->error) {
+        return NULL;
+    }
+    return resolve_handle(stream, reader, handle);
+}
 
+static PyObject *
+resolve_handle(Stream *stream, Reader *reader, uint32_t handle)
+{
+    /* * The value of wire handle 'handle', a new reference. Content that
+     * was stepped over is decoded from 'stream', which spans the input.
+     * */
     JavaType_Type *obj = NULL;
     PyObject *ob;
-    obj = Handles_Find(handles, handle);
-    assert(obj != NULL);
+
+    obj = Handles_Find(reader->handles, handle);
+    if (obj == NULL) {
+        PyErr_Format(StreamError, "reference to unknown handle 0x%x", handle);
+        return NULL;
+    }
     
     if (obj->jt_type == TC_CLASSDESC) {
         assert(obj->classname != NULL);
-        ob = get_values_class_desc(fd, handles, obj);
+        ob = get_values_class_desc(stream, reader, obj);
     }
     else if (obj->jt_type == TC_STRING) {
         assert(obj->string != NULL);
-        assert(obj->n_chars != 0);
-        ob = PyUnicode_FromString(obj->string);
+        ob = PyUnicode_FromStringAndSize(obj->string, obj->n_chars);
+    }
+    else if ((obj->jt_type == TC_OBJECT || obj->jt_type == TC_ARRAY)
+             && obj->value == NULL && obj->skipped != NULL) {
+        /* stepped over by a projection or a lazy scan the first time round */
+        ob = decode_skipped(stream, reader, obj);
+    }
+    else if (obj->jt_type == TC_ARRAY && obj->value == NULL && obj->array_base != NULL) {
+        /* sub-array of a flattened multi-dimensional array */
+        assert(obj->array_base->value != NULL);
+        ob = PrimitiveArray_View(obj->array_base->value, (Py_ssize_t)obj->array_offset,
+                                 (int)strspn(obj->class_descriptor->classname, "["));
+        if (ob == NULL) {
+            return NULL;
+        }
+        Py_INCREF(ob);
+        obj->value = ob;
     }
-    else if (obj->jt_type == TC_OBJECT) {
-        assert(obj->value != NULL);
+    else if ((obj->jt_type == TC_OBJECT || obj->jt_type == TC_ARRAY) && obj->value != NULL) {
         assert(obj->class_descriptor != NULL);
         ob = obj->value;
+        Py_INCREF(ob);
     }
     else {
-        fprintf(stderr, "NO TYPECODE IMPLEMENTATION: 0x%x, %d\n", obj->jt_type, __LINE__);
-        exit(EXIT_FAILURE); 
+        /* an object referring back to itself, or to one that contains it */
+        PyErr_Format(StreamError, "reference to handle 0x%x, which is still being "
+                     "decoded (cycles are not supported)", handle);
+        return NULL;
     }
 
     return ob;
 }
 
-static PyObject *
-parse_tc_string(FILE *fd, Handles *handles, char *dest, size_t length)
+static JavaType_Type *
+read_tc_string(Stream *stream, Reader *reader, size_t length)
 {
-
+    /* * Reads 'length' bytes of modified utf-8 from the stream into
+     * a new TC_STRING handle. The whole string is bounds checked once
+     * and copied straight out of the buffer.
+     * */
     JavaType_Type *str = NULL;
-    size_t n_bytes;
 
-    str = JavaType_New(TC_STRING);
-    assert(str != NULL);
+    if (!Stream_Require(stream, length)) {
+        return NULL;
+    }
+
+    str = JavaType_New(reader->arena, TC_STRING);
+    if (str == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    char *string = Arena_StrDup(reader->arena, Stream_Take(stream, length), length);
+    if (string == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
 
-    char *string = (char *)malloc(length + 1);
-    assert(string != NULL);
-    string[length] = 0;
-    
     str->string = string;
     str->n_chars = length;
 
-    Handles_Append(handles, str);
+    if (Handles_Append(reader->handles, str) < 0) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    return str;
+}
 
-    n_bytes = fread(string, 1, length, fd);
-    assert(n_bytes == length);
+static PyObject *
+parse_tc_string(Stream *stream, Reader *reader, char **dest, size_t length)
+{
+    JavaType_Type *str;
+
+    str = read_tc_string(stream, reader, length);
+    if (str == NULL) {
+        return NULL;
+    }
 
-    dest = string;
+    if (dest != NULL) {
+        *dest = str->string;
+    }
 
-    return PyUnicode_FromString(string);
+    return PyUnicode_FromStringAndSize(str->string, str->n_chars);
 }
 
 static PyObject *
-parse_tc_longstring(FILE *fd, Handles *handles, char *dest)
+parse_tc_longstring(Stream *stream, Reader *reader, char **dest)
 {
     /* the casting at the botton to size_t won't work I 
      * think unless the size of a long on the machine is
@@ -236,125 +3147,284 @@ parse_tc_longstring(FILE *fd, Handles *handles, char *dest)
      */
     uint64_t len;
 
-    len = get_unsigned_long_long(fd);
-    return parse_tc_string(fd, handles, dest, (size_t)len);
+    len = get_unsigned_long_long(stream);
+    if (stream->error) {
+        return NULL;
+    }
+    return parse_tc_string(stream, reader, dest, (size_t)len);
 }
 
 static PyObject *
-parse_tc_shortstring(FILE *fd, Handles *handles, char *dest)
+parse_tc_shortstring(Stream *stream, Reader *reader, char **dest)
 {
     /* read 2 bytes from the stream followed by a string
      * and a python unicode object.
      * */
-    return parse_tc_string(fd, handles, dest, get_size(fd));
+    size_t len;
+
+    len = get_size(stream);
+    if (stream->error) {
+        return NULL;
+    }
+    return parse_tc_string(stream, reader, dest, len);
 }
 
-static PyObject *
-get_value(FILE *fd, Handles *handles, char tc_num)
+static size_t
+primitive_size(char tc_num)
 {
-    PyObject *ob; /* return object */
-    size_t n_bytes; /* number of bytes read from the stream */
+    /* number of bytes a primitive field typecode takes in the stream */
+    switch (tc_num) {
+        case 'B':
+        case 'Z':
+            return 1;
+        case 'C':
+        case 'S':
+            return 2;
+        case 'F':
+        case 'I':
+            return 4;
+        case 'D':
+        case 'J':
+            return 8;
+        default:
+            return 0;
+    }
+}
 
-    if (tc_num == 'B'){
-        uint8_t value;
-        n_bytes = fread(&value, 1, 1, fd);
-        assert(n_bytes == sizeof(uint8_t));
+static PyObject *
+unpack_primitive(const unsigned char *p, char tc_num)
+{
+    /* * Build the python value for one primitive starting at 'p'.
+     * The caller is responsible for having bounds checked
+     * primitive_size(tc_num) bytes.
+     * */
+    switch (tc_num) {
+        case 'B':
+            return PyBytes_FromStringAndSize((const char *)p, 1);
+        case 'C':
+            /* java chars are single utf-16 code units */
+            return PyUnicode_FromOrdinal(load_be16(p));
+        case 'D':
+            return PyFloat_FromDouble(load_be_double(p));
+        case 'F':
+            return PyFloat_FromDouble((double)load_be_float(p));
+        case 'I':
+            return PyLong_FromLong((long)(int32_t)load_be32(p));
+        case 'J':
+            return PyLong_FromLongLong((long long)(int64_t)load_be64(p));
+        case 'S':
+            return PyLong_FromLong((long)(int16_t)load_be16(p));
+        case 'Z':
+            return PyBool_FromLong((long)(p[0] != 0));
+        default:
+            PyErr_Format(StreamError, "not a primitive typecode: 0x%x", tc_num);
+            return NULL;
+    }
+}
 
-        ob = PyBytes_FromStringAndSize((char *)&value, 1);
+static PyObject *
+primitive_list(char typecode, const unsigned char *p, uint32_t n_elements)
+{
+    /* a primitive array payload as a list of python numbers */
+    size_t size = primitive_size(typecode);
+    PyObject *list, *ob;
+    uint32_t i;
+
+    list = PyList_New(n_elements);
+    if (list == NULL) {
+        return NULL;
     }
-    else if (tc_num == 'C'){
-        uint32_t value;
-        n_bytes = fread(&value, 1, 2, fd);
-        if (little_endian) {
-            uint16_reverse_bytes(n_bytes);
+    for (i = 0; i < n_elements; i++, p += size) {
+        ob = unpack_primitive(p, typecode);
+        if (ob == NULL) {
+            Py_DECREF(list);
+            return NULL;
         }
-        assert(0 <= value && value <= 65353 && n_bytes == 2);
-        ob = PyUnicode_FromStringAndSize((char *)&value, 2);
-    }
-    else if (tc_num == 'D'){
-        ob = get_double_value(fd);
+        PyList_SET_ITEM(list, (Py_ssize_t)i, ob);
     }
-    else if (tc_num == 'F'){
-        ob = get_float_value(fd);
-    }
-    else if (tc_num == 'I'){
-        ob = get_signed_integer_value(fd);
+    return list;
+}
+
+static PyObject *
+unpack_host(const void *p, char tc_num)
+{
+    /* unpack_primitive for a value PrimitiveArray_Decode put in host order */
+    switch (tc_num) {
+        case 'B':
+            return PyBytes_FromStringAndSize((const char *)p, 1);
+        case 'C':
+            return PyUnicode_FromOrdinal(*(const uint16_t *)p);
+        case 'D':
+            return PyFloat_FromDouble(*(const double *)p);
+        case 'F':
+            return PyFloat_FromDouble((double)*(const float *)p);
+        case 'I':
+            return PyLong_FromLong((long)*(const int32_t *)p);
+        case 'J':
+            return PyLong_FromLongLong((long long)*(const int64_t *)p);
+        case 'S':
+            return PyLong_FromLong((long)*(const int16_t *)p);
+        case 'Z':
+            return PyBool_FromLong((long)*(const uint8_t *)p);
+        default:
+            PyErr_Format(StreamError, "not a primitive typecode: 0x%x", tc_num);
+            return NULL;
     }
-    else if (tc_num == 'J'){
-        ob = get_signed_long_value(fd);
+}
+
+static PyObject *
+host_list(char typecode, const void *data, uint32_t n_elements)
+{
+    /* primitive_list over elements already in host order */
+    size_t size = primitive_size(typecode);
+    const char *p = (const char *)data;
+    PyObject *list, *ob;
+    uint32_t i;
+
+    list = PyList_New(n_elements);
+    if (list == NULL) {
+        return NULL;
     }
-    else if (tc_num == 'S'){
-        ob = get_signed_short_value(fd);
+    for (i = 0; i < n_elements; i++, p += size) {
+        ob = unpack_host(p, typecode);
+        if (ob == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, ob);
     }
-    else if (tc_num == 'Z'){
-        uint8_t value;
-        n_bytes = fread(&value, 1, 1, fd);
-        assert(n_bytes == 1);
-        assert(value == 1 || value == 0);
+    return list;
+}
+
+static PyObject *
+get_value(Stream *stream, Reader *reader, char tc_num)
+{
+    PyObject *ob; /* return object */
+    size_t n_bytes; /* number of bytes the primitive takes in the stream */
 
-        ob = PyBool_FromLong((long)value);
+    if (tc_num == '[' || tc_num == 'L'){
+        ob = parse_stream(stream, reader);
     }
-    else if (tc_num == '[' || tc_num == 'L'){
-        ob = parse_stream(fd, handles);
+    else if ((n_bytes = primitive_size(tc_num)) != 0) {
+        if (!Stream_Require(stream, n_bytes)) {
+            return NULL;
+        }
+        ob = unpack_primitive(Stream_Take(stream, n_bytes), tc_num);
     }
     else {
-        fprintf(stderr, "Not Implemented for typecode: 0x%x. line(%d) "
-                    "file(%s)\n", tc_num, __LINE__, __FILE__);
-        exit(1); 
+        PyErr_Format(StreamError, "not a field typecode: 0x%x", tc_num);
+        return NULL;
     }
 
     return ob;
 }
 
+static int
+make_field_keys(Reader *reader, JavaType_Type *field)
+{
+    /* * Build the dict keys of a field once per descriptor, so decoding
+     * an instance never allocates or hashes a key. Both are interned
+     * and owned by the reader until the end of the parse (or by the
+     * class cache, which keeps its own reference).
+     * */
+    field->key = PyUnicode_InternFromString(field->fieldname);
+    if (field->key == NULL) {
+        return -1;
+    }
+    if (PyList_Append(reader->owned, field->key) < 0) {
+        Py_CLEAR(field->key);
+        return -1;
+    }
+    Py_DECREF(field->key);
+
+    field->super_key = PyUnicode_FromFormat("super.%U", field->key);
+    if (field->super_key == NULL) {
+        return -1;
+    }
+    PyUnicode_InternInPlace(&field->super_key);
+    if (PyList_Append(reader->owned, field->super_key) < 0) {
+        Py_CLEAR(field->super_key);
+        return -1;
+    }
+    Py_DECREF(field->super_key);
+    return 0;
+}
+
 static JavaType_Type *
-get_field_descriptor(FILE *fd, Handles *handles)
+get_field_descriptor(Stream *stream, Reader *reader)
 {
     JavaType_Type *field = NULL;
 
-    size_t n_bytes;
     char field_tc;
     char *fieldname;
     char *classname;
 
-    field_tc = get_and_validate_field_typecode(fd);
+    field_tc = get_and_validate_field_typecode(stream);
+    if (stream->error) {
+        return NULL;
+    }
+    fieldname = get_size_and_string(stream, reader->arena);
+    if (fieldname == NULL) {
+        return NULL;
+    }
     
-    field = JavaType_New(0);
-    assert(field != NULL);
-
-    fieldname = get_size_and_string(fd);
+    field = JavaType_New(reader->arena, 0);
+    if (field == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
 
     field->fieldname = fieldname;
+    if (make_field_keys(reader, field) < 0) {
+        return NULL;
+    }
 
     switch(field_tc){
         case '[':
         case 'L': {
             char classname_tc;
-            n_bytes = fread(&classname_tc, 1, 1, fd); 
-            assert(n_bytes == 1);
+            classname_tc = get_byte(stream);
+            if (stream->error) {
+                return NULL;
+            }
 
-            assert(classname_tc == TC_STRING 
-            || classname_tc == TC_LONGSTRING 
-            || classname_tc == TC_REFERENCE);
+            if (classname_tc != TC_STRING && classname_tc != TC_LONGSTRING
+                && classname_tc != TC_REFERENCE) {
+                invalid_typecode(stream, classname_tc, "a field class name");
+                return NULL;
+            }
 
-            PyObject *str;
+            JavaType_Type *str;
             classname = NULL;
             if (classname_tc == TC_STRING) {
-                str = parse_tc_shortstring(fd, handles, classname);
-                Py_DECREF(str); /* I don't need these values */
+                /* no python object is needed for the type string */
+                str = read_tc_string(stream, reader, get_size(stream));
+                if (str == NULL) {
+                    return NULL;
+                }
+                classname = str->string;
             }
             else if (classname_tc == TC_LONGSTRING) {
-                str = parse_tc_longstring(fd, handles, classname);
-                Py_DECREF(str); /* I don't need these values */
+                str = read_tc_string(stream, reader, (size_t)get_unsigned_long_long(stream));
+                if (str == NULL) {
+                    return NULL;
+                }
+                classname = str->string;
             } 
             else if (classname_tc == TC_REFERENCE) {
                 JavaType_Type *ref_string;
                 uint32_t handle;
 
-                handle = get_handle(fd);
+                handle = get_handle(stream);
+                if (stream->error) {
+                    return NULL;
+                }
 
-                ref_string = Handles_Find(handles, handle);
-                assert(ref_string != NULL);
-                assert(ref_string->jt_type == TC_STRING || ref_string->jt_type == TC_LONGSTRING);
+                ref_string = Handles_Find(reader->handles, handle);
+                if (ref_string == NULL || ref_string->string == NULL) {
+                    PyErr_Format(StreamError, "handle 0x%x is not a string", handle);
+                    return NULL;
+                }
 
                 classname = ref_string->string;
             }
@@ -380,232 +3450,850 @@ get_field_descriptor(FILE *fd, Handles *handles)
             field->is_primitive = 1;
             break;
         }
-        default:
-            fprintf(stderr, "Error. Unknown field typecode 0x%x\n", field_tc);
-            exit(1);
+        default:
+            /* get_and_validate_field_typecode only lets the above through */
+            assert(0);
+    }
+
+    return field;
+}
+
+static PyObject *
+get_values_class_desc(Stream *stream, Reader *reader, JavaType_Type *class_desc)
+{
+    /* * Decode the field values of one instance of 'class_desc'. The
+     * class hierarchy is compiled into a DecodePlan on the first
+     * instance, and every instance after that just runs the plan.
+     * Each level is decoded superclass first and merged into the next.
+     * */
+    DecodePlan *plan = class_desc->plan;
+    PyObject *data = NULL;
+    size_t i;
+
+    if (plan == NULL) {
+        plan = compile_decode_plan(reader, class_desc);
+        if (plan == NULL) {
+            return NULL;
+        }
+    }
+    if (reader->lazy_context != NULL && plan->is_plain && reader->projection == NULL) {
+        return LazyObject_Scan(stream, reader, class_desc);
+    }
+
+    for (i = 0; i < plan->n_levels; i++) {
+        data = read_plan_level(stream, reader, &plan->levels[i], data);
+        if (data == NULL) {
+            return NULL;
+        }
+    }
+    return data;
+}
+
+static int
+is_boxed_class(JavaType_Type *class_desc)
+{
+    /* java.lang wrappers that decode to their single 'value' field */
+    return Class_IsBoxed(class_desc->class_kind)
+        && class_desc->n_fields == 1
+        && strcmp(class_desc->fields[0]->fieldname, "value") == 0;
+}
+
+static int
+resolve_handler(Reader *reader, JavaType_Type *class_desc)
+{
+    /* * Look up the registered readObject handler of a class once per
+     * descriptor. The reader keeps the callback alive for the rest of
+     * the parse, even if it is unregistered in the meantime.
+     * */
+    ReadObjectHandler handler;
+    int status;
+
+    if (class_desc->handler_resolved) {
+        return 0;
+    }
+    status = Registry_Find(class_desc->classname, &handler);
+    if (status < 0) {
+        return -1;
+    }
+    if (status == 1) {
+        if (handler.callback != NULL) {
+            status = PyList_Append(reader->owned, handler.callback);
+            Py_DECREF(handler.callback);
+            if (status < 0) {
+                return -1;
+            }
+        }
+        class_desc->handler = (ReadObjectHandler *)Arena_Alloc(reader->arena,
+                                                               sizeof(ReadObjectHandler));
+        if (class_desc->handler == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        *class_desc->handler = handler;
+    }
+    class_desc->handler_resolved = 1;
+    return 0;
+}
+
+static DecodePlan *
+compile_decode_plan(Reader *reader, JavaType_Type *class_desc)
+{
+    /* * Flatten the hierarchy of 'class_desc' into a DecodePlan stored
+     * on the descriptor. The plan lives in the parse arena along with
+     * the descriptor.
+     * */
+    DecodePlan *plan;
+    PlanLevel *level;
+    PlanField *op;
+    JavaType_Type *desc;
+    size_t n_levels = 0;
+    size_t i, j;
+    size_t run;                 /* index of the field starting the current run */
+    size_t size;
+
+    for (desc = class_desc; desc != NULL; desc = desc->super) {
+        n_levels++;
+    }
+
+    plan = (DecodePlan *)Arena_Alloc(reader->arena, sizeof(DecodePlan));
+    if (plan == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    plan->n_levels = n_levels;
+    plan->n_fields = 0;
+    plan->is_plain = 1;
+    plan->unused = 0;
+    plan->levels = (PlanLevel *)Arena_Alloc(reader->arena, sizeof(PlanLevel) * n_levels);
+    if (plan->levels == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    /* the descriptor chain runs from the class to its supers */
+    for (desc = class_desc, i = n_levels; desc != NULL; desc = desc->super) {
+        level = &plan->levels[--i];
+        level->class_desc = desc;
+        level->n_fields = desc->n_fields;
+        level->is_boxed = desc->flags.sc_serializable && is_boxed_class(desc);
+        level->unused = 0;
+        level->fields = (PlanField *)Arena_Alloc(reader->arena,
+                                                 sizeof(PlanField) * (desc->n_fields + 1));
+        if (level->fields == NULL) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        if (desc->flags.sc_write_method && resolve_handler(reader, desc) < 0) {
+            return NULL;
+        }
+        plan->n_fields += desc->n_fields;
+        if (!desc->flags.sc_serializable || desc->flags.sc_write_method || level->is_boxed) {
+            plan->is_plain = 0;
+        }
+
+        run = 0;
+        for (j = 0; j < desc->n_fields; j++) {
+            op = &level->fields[j];
+            op->field = desc->fields[j];
+            op->typecode = (char)desc->fields[j]->jt_type;
+            op->run_length = 0;
+            op->offset = 0;
+            assert(strchr("BCDFIJSZL[", op->typecode) != NULL);
+
+            size = primitive_size(op->typecode);
+            if (size == 0) {
+                continue;
+            }
+            if (j == 0 || primitive_size(level->fields[j - 1].typecode) == 0) {
+                /* first primitive after an object field starts a run */
+                run = j;
+            }
+            else {
+                op->offset = level->fields[run].run_length;
+            }
+            level->fields[run].run_length += (uint32_t)size;
+        }
+    }
+
+    class_desc->plan = plan;
+    return plan;
+}
+
+static int
+merge_super(const PlanLevel *level, PyObject *data, PyObject *super)
+{
+    /* * Add the values of the superclasses into 'data', which holds
+     * only the fields of 'level' at this point. A superclass value
+     * whose name collides with one of those fields goes in under the
+     * field's "super." key.
+     * */
+    PyObject *key, *item;
+    Py_ssize_t position = 0;
+    size_t i;
+    int status;
+
+    if (!PyDict_Check(super)) {
+        return 0;
+    }
+    while (PyDict_Next(super, &position, &key, &item)) {
+        /* key and item are borrowed from super */
+        status = PyDict_Contains(data, key);
+        if (status < 0) {
+            return -1;
+        }
+        if (status == 1) {
+            for (i = 0; i < level->n_fields; i++) {
+                if (level->fields[i].field->key == key
+                    || PyUnicode_Compare(level->fields[i].field->key, key) == 0) {
+                    key = level->fields[i].field->super_key;
+                    break;
+                }
+            }
+            assert(i < level->n_fields);
+        }
+        if (PyDict_SetItem(data, key, item) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static PyObject *
+read_plan_level(Stream *stream, Reader *reader, const PlanLevel *level, PyObject *super)
+{
+    /* * Decode the fields of one class of an instance and merge in
+     * 'super', the values of its superclasses (or NULL). Steals the
+     * reference to 'super'.
+     * */
+    JavaType_Type *class_desc = level->class_desc;
+    char sc_write_method = class_desc->flags.sc_write_method;
+    char sc_serializable = class_desc->flags.sc_serializable;
+    const unsigned char *run = NULL;
+    PyObject *projection = reader->projection;
+    const PlanField *op;
+    PyObject *data, *value, *path;
+    size_t i;
+
+    data = PyDict_New();
+    if (data == NULL) {
+        Py_XDECREF(super);
+        return NULL;
+    }
+
+    if (sc_serializable) {
+        if (level->is_boxed) {
+            Py_DECREF(data); /* clear data */
+            Py_XDECREF(super);
+            return get_value(stream, reader, level->fields[0].typecode);
+        }
+        else {
+            for (i = 0; i < level->n_fields; i++) {
+                op = &level->fields[i];
+
+                if (op->run_length != 0) {
+                    /* one bounds check for the whole primitive run */
+                    if (!Stream_Require(stream, op->run_length)) {
+                        Py_DECREF(data);
+                        Py_XDECREF(super);
+                        return NULL;
+                    }
+                    run = Stream_Take(stream, op->run_length);
+                }
+
+                /* * With a projection only the requested fields are
+                 * decoded, each with its own subtree of the paths. The
+                 * fields of classes with a readObject() all go to the
+                 * reader, and the paths apply to what it reads instead.
+                 * */
+                path = NULL;
+                if (projection != NULL && !sc_write_method) {
+                    path = PyDict_GetItemWithError(projection, op->field->key);
+                    if (path == NULL) {
+                        if (PyErr_Occurred() || ((op->typecode == 'L' || op->typecode == '[')
+                                                 && skip_content(stream, reader) < 0)) {
+                            Py_DECREF(data);
+                            Py_XDECREF(super);
+                            return NULL;
+                        }
+                        continue;
+                    }
+                }
+                if (op->typecode == 'L' || op->typecode == '[') {
+                    reader->projection = path != Py_None ? path : NULL;
+                    value = parse_stream(stream, reader);
+                    reader->projection = projection;
+                }
+                else {
+                    value = unpack_primitive(run + op->offset, op->typecode);
+                }
+                if (value == NULL) {
+                    Py_DECREF(data);
+                    Py_XDECREF(super);
+                    return NULL;
+                }
+
+                /* check if key is in data because of super */
+                if (PyDict_SetItem(data, op->field->key, value) < 0) {
+                    Py_DECREF(value);
+                    Py_DECREF(data);
+                    Py_XDECREF(super);
+                    return NULL;
+                }
+
+                Py_DECREF(value); /* dictionary owns the value */
+
+            }
+
+            /* add in super */
+            if (super != NULL) {
+                int status = merge_super(level, data, super);
+
+                Py_CLEAR(super);
+                if (status < 0) {
+                    Py_DECREF(data);
+                    return NULL;
+                }
+            }
+        }
+
+        if (sc_write_method) {
+            return read_annotation(stream, reader, class_desc, data);
+        }
+
     }
+    Py_XDECREF(super);
+    return data; 
 
-    return field;
 }
 
 static PyObject *
-get_values_class_desc(FILE *fd, Handles *handles, JavaType_Type *class_desc)
+read_annotation(Stream *stream, Reader *reader, JavaType_Type *class_desc, PyObject *data)
 {
+    /* * What the writeObject() of 'class_desc' wrote after its fields, up
+     * to and including the TC_ENDBLOCKDATA. Steals 'data', the field
+     * values, and returns what replaces them.
+     * */
+    PyObject *value;
 
+    /* java.util.BitSet isn't tagged with the 0x77 Block data tag */
+    if (class_desc->class_kind == Class_BitSet) {
+        PyObject *bit_set;
 
-    char sc_write_method = class_desc->flags.sc_write_method;
-    char sc_serializable = class_desc->flags.sc_serializable;
-    // char sc_externalizable = class_desc->flags.sc_externalizable;
-    // char sc_block_data = class_desc->flags.sc_block_data;
-    char c;
-    PyObject *data, *value, *super;
-    JavaType_Type *field = NULL;
-    
-    data = PyDict_New();
-    
-    /* I think superclass descriptors come first in this scenario because
-    the would have been the last item parsed from the stream. */
-
-    if (class_desc->super != NULL){
-        /* update won't be good enough. It should be, but incase a programmer used
-         * private member variables that they rewrote in the child class, this could 
-         * drop data on the floor
-         *
-         * The best thing to do would probably be to iterate over the returned super
-         * class dictionary and add everything into 'data' one at a time checking to see
-         * if the field is already in the dictionary. If it is, it should just go in as 
-         * Class.field. The only issue that this might create is if there is a parent class
-         * two levels update that merges its value into its child class (the parent class of
-         * this class) and then the names conflict at that merge, at which point we would
-         * have already lost the parent class name.
-         * 
-         * possible solutions
-         * ------------------
-         *     <classname>.<fieldname> for collisions: won't work for a collision between a parents parent class
-         *     super.<fieldname>: kind of ugly, but a no fail solution.
-         * 
-         * Bottom line is if using this reader to just pull data, the data is better when it's flatter
-         *
-         * */
-        super = get_values_class_desc(fd, handles, class_desc->super);
-        
-        /* needs to be broken out into a function because 
-        it will also have to be done for the regular part of the class */
+        bit_set = BitSet_ReadObject(stream, reader, data);
+        Py_DECREF(data); /* clear data */
+        if (bit_set == NULL) {
+            return NULL;
+        }
+
+        if (get_byte(stream) != TC_ENDBLOCKDATA) {
+            Py_DECREF(bit_set);
+            return NULL;
+        }
+        return bit_set;
     }
-    else {
-        super = NULL;
+    if (Stream_Peek(stream) != TC_ENDBLOCKDATA
+        && class_desc->handler != NULL && class_desc->handler->callback != NULL) {
+        /* python handlers read the whole annotation themselves */
+        value = Registry_Call(class_desc->handler->callback, stream, reader, data);
+        Py_DECREF(data);
+        if (value == NULL) {
+            return NULL;
+        }
+        data = value;
     }
-
-    if (sc_serializable) {
-        if (class_desc->n_fields == 1 
-            && !strncmp(class_desc->fields[0]->fieldname, "value", 5)
-            && (!strncmp(class_desc->classname, "java.lang.Boolean", 17)
-                || !strncmp(class_desc->classname, "java.lang.Byte", 14)
-                || !strncmp(class_desc->classname, "java.lang.Character", 19)
-                || !strncmp(class_desc->classname, "java.lang.Float", 15)
-                || !strncmp(class_desc->classname, "java.lang.Integer", 17)
-                || !strncmp(class_desc->classname, "java.lang.Long", 14)
-                || !strncmp(class_desc->classname, "java.lang.Short", 15)
-                || !strncmp(class_desc->classname, "java.lang.Double", 16)
-            )){
-            Py_DECREF(data); /* clear data */
-             /* ref count should only be 1 from get_value */
-            assert(strchr("BCDFIJSZL[", class_desc->fields[0]->jt_type) != NULL);
-            return get_value(fd, handles, class_desc->fields[0]->jt_type);
+    else if (Stream_Peek(stream) != TC_ENDBLOCKDATA) {
+        /* block data from classes that override writeObject() */
+        if (get_byte(stream) != TC_BLOCKDATA) {
+            Py_DECREF(data);
+            if (!stream->error) {
+                PyErr_Format(StreamError, "expected TC_BLOCKDATA for %s "
+                             "at offset %zu", class_desc->classname,
+                             Stream_Tell(stream) - 1);
+            }
+            return NULL;
         }
-        else {
-            size_t i;
-
-            for (i = 0; i < class_desc->n_fields; i++) {
-                field = class_desc->fields[i];
+        data = parse_block_data(stream, reader, class_desc, data);
+        if (data == NULL) {
+            return NULL;
+        }
+    }
+    if (get_byte(stream) != TC_ENDBLOCKDATA) {
+        Py_DECREF(data);
+        if (!stream->error) {
+            PyErr_Format(StreamError, "expected TC_ENDBLOCKDATA for %s "
+                         "at offset %zu", class_desc->classname,
+                         Stream_Tell(stream) - 1);
+        }
+        return NULL;
+    }
+    return data;
+}
 
-                assert(strchr("BCDFIJSZL[", field->jt_type) != NULL); 
-                value = get_value(fd, handles, field->jt_type);
+static PyObject *
+build_projection(PyObject *paths)
+{
+    /* * Turn the fields= paths into a tree of dicts keyed by field name.
+     * A name maps to the dict of the paths below it, or to None when
+     * the whole value is wanted. "[*]" steps into the elements of an
+     * array or collection, which are decoded with the projection of
+     * their container anyway, so it is accepted and dropped:
+     * "items[*].price" and "items.price" are the same path.
+     * */
+    PyObject *root = NULL, *seq = NULL, *parts = NULL;
+    PyObject *star = NULL, *empty = NULL, *dot = NULL;
+    PyObject *node, *child, *name;
+    Py_ssize_t i, j, n_parts, last;
+
+    seq = PySequence_Fast(paths, "fields must be a sequence of field paths");
+    star = PyUnicode_FromString("[*]");
+    empty = PyUnicode_FromString("");
+    dot = PyUnicode_FromString(".");
+    root = PyDict_New();
+    if (seq == NULL || star == NULL || empty == NULL || dot == NULL || root == NULL) {
+        goto fail;
+    }
 
-                /* check if key is in data because of super */
-                PyDict_SetItemString(data, field->fieldname, value);
+    for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        PyObject *path = PySequence_Fast_GET_ITEM(seq, i);
 
-                Py_DECREF(value); /* dictionary owns the value */
+        if (!PyUnicode_Check(path)) {
+            PyErr_Format(PyExc_TypeError, "field paths must be str, not %.100s",
+                         Py_TYPE(path)->tp_name);
+            goto fail;
+        }
+        path = PyUnicode_Replace(path, star, empty, -1);
+        if (path == NULL) {
+            goto fail;
+        }
+        parts = PyUnicode_Split(path, dot, -1);
+        Py_DECREF(path);
+        if (parts == NULL) {
+            goto fail;
+        }
 
+        /* the last non-empty name is the leaf */
+        n_parts = PyList_GET_SIZE(parts);
+        for (last = n_parts - 1; last >= 0; last--) {
+            if (PyUnicode_GET_LENGTH(PyList_GET_ITEM(parts, last)) != 0) {
+                break;
             }
+        }
+        if (last < 0) {
+            PyErr_Format(PyExc_ValueError, "empty field path %R",
+                         PySequence_Fast_GET_ITEM(seq, i));
+            goto fail;
+        }
 
-            /* add in super */
-            PyObject *key, *item;
-            Py_ssize_t position = 0;
-            if (super != NULL){
-                while(PyDict_Next(super, &position, &key, &item)){
-
-                    switch(PyDict_Contains(data, key)){
-                    case 1: {/* contains key */
-                        PyObject *_super = PyUnicode_FromString("super.");
-                        PyObject *k = PyUnicode_Concat(_super, key);
-                        PyObject_Print(k, stderr, 0); printf("\n");
-                        PyDict_SetItem(data, k, item);
-                        Py_DECREF(_super);
-                        Py_DECREF(key);
-                        Py_DECREF(k);
-                        break;
-                    }
-                    case -1: /* -1 means error, so I don't know */
-                    case  0: {
-                        PyDict_SetItem(data, key, item);
-                        Py_DECREF(key);
-                        Py_DECREF(item);
-                        break;
-                    }}
+        node = root;
+        for (j = 0; j <= last; j++) {
+            name = PyList_GET_ITEM(parts, j);
+            if (PyUnicode_GET_LENGTH(name) == 0) {
+                continue;
+            }
+            child = PyDict_GetItemWithError(node, name);
+            if (child == NULL && PyErr_Occurred()) {
+                goto fail;
+            }
+            if (child == Py_None) {
+                /* a shorter path already asks for all of it */
+                break;
+            }
+            if (j == last) {
+                if (PyDict_SetItem(node, name, Py_None) < 0) {
+                    goto fail;
                 }
+                break;
             }
+            if (child == NULL) {
+                child = PyDict_New();
+                if (child == NULL || PyDict_SetItem(node, name, child) < 0) {
+                    Py_XDECREF(child);
+                    goto fail;
+                }
+                Py_DECREF(child); /* node owns it */
+            }
+            node = child;
         }
+        Py_CLEAR(parts);
+    }
 
-        if (sc_write_method) {
-            /* java.util.BitSet isn't tagged with the 0x77 Block data tag */
-
-            if (!strncmp(class_desc->classname, "java.util.BitSet", 16)){
-                PyObject *bit_set;
-
-                Py_INCREF(data);
-                bit_set = BitSet_ReadObject(fd, handles, data);
-                Py_DECREF(data);
+    Py_DECREF(seq);
+    Py_DECREF(star);
+    Py_DECREF(empty);
+    Py_DECREF(dot);
+    return root;
+
+fail:
+    Py_XDECREF(parts);
+    Py_XDECREF(seq);
+    Py_XDECREF(star);
+    Py_XDECREF(empty);
+    Py_XDECREF(dot);
+    Py_XDECREF(root);
+    return NULL;
+}
 
-                assert(fgetc(fd) == TC_ENDBLOCKDATA); 
-                if (bit_set != NULL) {
-                    Py_DECREF(data); /* clear data */
-                    return bit_set;
-                } else {
-                    fprintf(stderr, "something got fucked up with bitset restructure.\n");
-                    exit(1);
-                }
+static int
+skip_content(Stream *stream, Reader *reader)
+{
+    /* * Step over one value without making any python object. Handles
+     * are issued exactly as decoding would issue them, and objects and
+     * arrays note where they started so a later TC_REFERENCE to one of
+     * them can still decode it (decode_skipped). Anything that isn't
+     * plain data is decoded and dropped.
+     * */
+    PyObject *ob;
+    uint32_t handle;
+    size_t length;
+    int tc;
+
+    tc = Stream_Peek(stream);
+    switch (tc) {
+        case TC_NULL:
+            Stream_U8(stream);
+            return 0;
+        case TC_REFERENCE:
+            Stream_U8(stream);
+            handle = get_handle(stream);
+            if (stream->error) {
+                return -1;
             }
-            c = fgetc(fd);
-            if (c == TC_ENDBLOCKDATA){
-
-                /* java.util.BitSet will go down this path */
-                assert(c == ungetc(c, fd));
+            if (Handles_Find(reader->handles, handle) == NULL) {
+                PyErr_Format(StreamError, "reference to unknown handle 0x%x", handle);
+                return -1;
+            }
+            return 0;
+        case TC_STRING:
+        case TC_LONGSTRING:
+            Stream_U8(stream);
+            length = tc == TC_STRING ? get_size(stream) : (size_t)get_unsigned_long_long(stream);
+            if (stream->error) {
+                return -1;
             }
-            else { /* block data from classes that override writeObject() */
+            return read_tc_string(stream, reader, length) != NULL ? 0 : -1;
+        case TC_OBJECT:
+        case TC_ARRAY:
+            return skip_object(stream, reader, &handle) != NULL ? 0 : -1;
+        case -1:
+            Stream_Require(stream, 1);
+            return -1;
+        default:
+            ob = parse_stream(stream, reader);
+            if (ob == NULL) {
+                return -1;
+            }
+            Py_DECREF(ob);
+            return 0;
+    }
+}
 
-                assert(c == TC_BLOCKDATA);
-                data = parse_block_data(fd, handles, class_desc, data);
+static JavaType_Type *
+skip_object(Stream *stream, Reader *reader, uint32_t *handle)
+{
+    /* * Step over a new object or array the way skip_content does and
+     * return its handle node, noting its wire handle in '*handle'.
+     * */
+    const unsigned char *start = stream->pos;
+    size_t first_handle = Handles_Position(reader->handles);
+    JavaType_Type *class_desc, *node;
+    uint32_t n_elements, i;
+    size_t size;
+    int tc;
+
+    tc = get_byte(stream);
+    if (stream->error) {
+        return NULL;
+    }
+    class_desc = parse_class_ref(stream, reader);
+    if (class_desc == NULL) {
+        return NULL;
+    }
+    node = JavaType_New(reader->arena, (char)tc);
+    if (node == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    node->class_descriptor = class_desc;
+    class_desc->ref_count++;
+    node->skipped = start;
+    node->skipped_handle = first_handle;
+    *handle = BASE_WIRE_HANDLE + (uint32_t)Handles_Position(reader->handles);
+    if (Handles_Append(reader->handles, node) < 0) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    if (tc == TC_OBJECT) {
+        return skip_class_data(stream, reader, class_desc) < 0 ? NULL : node;
+    }
 
+    n_elements = get_unsigned_long(stream);
+    if (stream->error) {
+        return NULL;
+    }
+    if (class_desc->classname[0] != '[' || class_desc->classname[1] == 0) {
+        PyErr_Format(StreamError, "array of class %s", class_desc->classname);
+        return NULL;
+    }
+    size = primitive_size(class_desc->classname[1]);
+    if (size != 0) {
+        if (!Stream_RequireArray(stream, n_elements, size)) {
+            return NULL;
+        }
+        Stream_Take(stream, (size_t)n_elements * size);
+        return node;
+    }
+    for (i = 0; i < n_elements; i++) {
+        if (skip_content(stream, reader) < 0) {
+            return NULL;
+        }
+    }
+    return node;
+}
 
-                c = fgetc(fd);
+static JavaType_Type *
+parse_class_ref(Stream *stream, Reader *reader)
+{
+    /* the class descriptor of an object or array, new or a back reference */
+    JavaType_Type *class_desc;
+    uint32_t handle;
+    int tc;
 
+    tc = get_byte(stream);
+    if (stream->error) {
+        return NULL;
+    }
+    if (tc == TC_CLASSDESC) {
+        class_desc = JavaType_New(reader->arena, TC_CLASSDESC);
+        if (class_desc == NULL) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        return parse_tc_classdesc(stream, reader, class_desc) < 0 ? NULL : class_desc;
+    }
+    if (tc == TC_REFERENCE) {
+        handle = get_handle(stream);
+        if (stream->error) {
+            return NULL;
+        }
+        class_desc = Handles_Find(reader->handles, handle);
+        if (class_desc == NULL || class_desc->jt_type != TC_CLASSDESC) {
+            PyErr_Format(StreamError, "handle 0x%x is not a class descriptor", handle);
+            return NULL;
+        }
+        return class_desc;
+    }
+    PyErr_Format(StreamError, "expected a class descriptor at offset %zu, found 0x%x",
+                 Stream_Tell(stream) - 1, tc);
+    return NULL;
+}
 
-                ungetc(c, fd);
+static int
+skip_class_data(Stream *stream, Reader *reader, JavaType_Type *class_desc)
+{
+    /* * Step over the field values of an instance, superclass first,
+     * and the writeObject() data of classes that have any. Primitive
+     * runs are taken whole, like read_plan_level does.
+     * */
+    const DecodePlan *plan = class_desc->plan;
+    const PlanLevel *level;
+    const PlanField *op;
+    size_t i, j;
+
+    if (plan == NULL) {
+        plan = compile_decode_plan(reader, class_desc);
+        if (plan == NULL) {
+            return -1;
+        }
+    }
+    for (i = 0; i < plan->n_levels; i++) {
+        level = &plan->levels[i];
+        if (!level->class_desc->flags.sc_serializable) {
+            continue;
+        }
+        for (j = 0; j < level->n_fields; j++) {
+            op = &level->fields[j];
+            if (op->run_length != 0) {
+                if (!Stream_Require(stream, op->run_length)) {
+                    return -1;
+                }
+                Stream_Take(stream, op->run_length);
             }
-            assert(fgetc(fd) == TC_ENDBLOCKDATA);
-            return data;
+            if ((op->typecode == 'L' || op->typecode == '[')
+                && skip_content(stream, reader) < 0) {
+                return -1;
+            }
+        }
+        if (level->class_desc->flags.sc_write_method && skip_annotation(stream, reader) < 0) {
+            return -1;
         }
+    }
+    return 0;
+}
 
+static int
+skip_annotation(Stream *stream, Reader *reader)
+{
+    /* block data and objects up to and including the TC_ENDBLOCKDATA */
+    size_t length;
+    int tc;
+
+    for (;;) {
+        tc = Stream_Peek(stream);
+        if (tc == TC_ENDBLOCKDATA) {
+            Stream_U8(stream);
+            return 0;
+        }
+        if (tc == TC_BLOCKDATA || tc == TC_BLOCKDATALONG) {
+            if (!Stream_Require(stream, tc == TC_BLOCKDATA ? 2 : 5)) {
+                return -1;
+            }
+            Stream_U8(stream);
+            length = tc == TC_BLOCKDATA ? Stream_U8(stream) : Stream_BE32(stream);
+            if (!Stream_Require(stream, length)) {
+                return -1;
+            }
+            Stream_Take(stream, length);
+        }
+        else if (skip_content(stream, reader) < 0) {
+            return -1;
+        }
     }
-    return data; 
+}
+
+static PyObject *
+decode_skipped(Stream *stream, Reader *reader, JavaType_Type *node)
+{
+    /* * Decode content skip_content stepped over, for a reference that
+     * wants it after all. The replay takes the same handles as the
+     * first pass, so references inside it still line up, and it runs
+     * with the projection of the referring field.
+     * */
+    Stream replay;
+    PyObject *ob;
+    size_t saved;
 
+    Stream_Init(&replay, stream->start, (size_t)(stream->end - stream->start));
+    replay.pos = node->skipped;
+
+    saved = Handles_BeginReplay(reader->handles, node->skipped_handle);
+    ob = parse_stream(&replay, reader);
+    Handles_EndReplay(reader->handles, saved);
+    if (ob == NULL) {
+        return stream_failure(&replay);
+    }
+    return ob;
 }
 
 static PyObject *
-parse_tc_object(FILE *fd, Handles *handles)
+parse_tc_object(Stream *stream, Reader *reader)
 {
 
     JavaType_Type *ob = NULL;
     JavaType_Type *class_desc = NULL;
     PyObject *data;
-    char next_typecode;
 
-    next_typecode = fgetc(fd);
-    assert(next_typecode == TC_REFERENCE 
-          || next_typecode == TC_PROXYCLASSDESC
-          || next_typecode == TC_CLASSDESC 
-          || next_typecode == TC_NULL);
+    /* proxies and null descriptors are rejected here */
+    class_desc = parse_class_ref(stream, reader);
+    if (class_desc == NULL) {
+        return NULL;
+    }
 
-    ob = JavaType_New(TC_OBJECT);
+    ob = JavaType_New(reader->arena, TC_OBJECT);
+    if (ob == NULL) {
+        return PyErr_NoMemory();
+    }
+    ob->class_descriptor = class_desc;
+    class_desc->ref_count++;
+    if (Handles_Append(reader->handles, ob) < 0) {
+        return PyErr_NoMemory();
+    }
 
-    switch(next_typecode){
-        case TC_REFERENCE:
-        case TC_CLASSDESC: {
-            if (next_typecode == TC_CLASSDESC) {
-                class_desc = JavaType_New(next_typecode);
-                parse_tc_classdesc(fd, handles, class_desc);
-            }
-            else {
-                uint32_t handle = get_handle(fd);
-                class_desc = Handles_Find(handles, handle);
-                assert(class_desc != NULL);
-                assert(class_desc->jt_type == TC_CLASSDESC);
-            }
-            assert(class_desc != NULL);
+    data = get_values_class_desc(stream, reader, class_desc);
+    if (data == NULL) {
+        return NULL;
+    }
+    Py_INCREF(data);
+    ob->value = data;
 
+    return data;
 
-            ob->class_descriptor = class_desc;
-            class_desc->ref_count++;
-            Handles_Append(handles, ob);
+}
 
-            
-            data = get_values_class_desc(fd, handles, class_desc);
-            Py_INCREF(data);
-            ob->value = data;
+static int
+read_cached_classdesc(Stream *stream, Reader *reader, JavaType_Type *type,
+                      const ClassCacheEntry *entry)
+{
+    /* * Fill in the name, suid, flags and fields of 'type' from a cache
+     * entry whose bytes match the stream. Field class names that were
+     * new strings get their handles issued again, and back references
+     * must still point at the same class name.
+     *
+     * returns
+     * -------
+     *     1 if the entry was used, 0 if a reference didn't match and -1
+     *     if the arena is out of memory; then the handles are rewound
+     *     and nothing is consumed
+     * */
+    size_t n_handles = Handles_Position(reader->handles);
+    JavaType_Type *field;
+    JavaType_Type *ref;
+    size_t i;
 
-            // if (ob->class_descriptor->super != NULL && PyDict_Check(data)){
-            //     PyObject *super;
-            //     super = get_values_class_desc(fd, handles, class_desc->super);
-            //     PyDict_SetItemString(data, class_desc->classname, super);
-            // }
-            break;
-        }
-        default:
-            fprintf(stderr, "Typecode 0x%x not implemented\n", next_typecode); exit(1);
+    type->classname = entry->classname;
+    type->string = entry->classname;
+    type->serial_version_uid = entry->serial_version_uid;
+    type->class_kind = entry->class_kind;
+    if (Handles_Append(reader->handles, type) < 0) {
+        PyErr_NoMemory();
+        return -1;
     }
 
-    return data;
+    for (i = 0; i < entry->n_fields; i++) {
+        field = entry->fields[i];
+        if (entry->ref_handles[i] != 0) {
+            ref = Handles_Find(reader->handles, entry->ref_handles[i]);
+            if (ref == NULL || ref->jt_type != TC_STRING
+                || strcmp(ref->string, field->classname) != 0) {
+                Handles_Truncate(reader->handles, n_handles);
+                return 0;
+            }
+        }
+        else if (field->is_object) {
+            /* the strings belong to the cache, which outlives the parse */
+            ref = JavaType_New(reader->arena, TC_STRING);
+            if (ref == NULL) {
+                Handles_Truncate(reader->handles, n_handles);
+                PyErr_NoMemory();
+                return -1;
+            }
+            ref->string = field->classname;
+            ref->n_chars = strlen(field->classname);
+            if (Handles_Append(reader->handles, ref) < 0) {
+                Handles_Truncate(reader->handles, n_handles);
+                PyErr_NoMemory();
+                return -1;
+            }
+        }
+    }
 
+    type->n_fields = entry->n_fields;
+    type->fields = entry->fields;
+    memcpy(&type->flags, &entry->flags, 1);
+    stream->pos += entry->body_length;
+    return 1;
 }
 
-static void
-parse_tc_classdesc(FILE *fd, Handles *handles, JavaType_Type *type)
+static int
+parse_classdesc_fields(Stream *stream, Reader *reader, JavaType_Type *type)
 {
-    assert(type != NULL);
-    size_t n_bytes;
-
-    //JavaType_Type *handle_obj;
+    /* * Fill in the name, suid, flags and fields of 'type', the part of
+     * a class descriptor that repeats verbatim from stream to stream.
+     * It comes out of the class cache when the bytes match an entry and
+     * is added to the cache otherwise. Returns 0 on success and -1 if
+     * the stream ran out or was malformed.
+     * */
+    const unsigned char *start = stream->pos;
+    const ClassCacheEntry *entry;
     char *classname;
     uint64_t suid;
     struct {
@@ -617,166 +4305,458 @@ parse_tc_classdesc(FILE *fd, Handles *handles, JavaType_Type *type)
     } flags;
     uint16_t n_fields;
     JavaType_Type **fields = NULL;
+    int status;
+
+    if (reader->class_cache != NULL) {
+        entry = ClassCache_Find(reader->class_cache, stream->pos, Stream_Remaining(stream));
+        if (entry != NULL) {
+            status = read_cached_classdesc(stream, reader, type, entry);
+            if (status != 0) {
+                return status > 0 ? 0 : -1;
+            }
+        }
+    }
+
+    classname = get_size_and_string(stream, reader->arena);
+    if (classname == NULL) {
+        return -1;
+    }
 
-    classname = get_size_and_string(fd);
-    suid = get_unsigned_long_long(fd);
+    /* suid, flags and field count are one fixed size record */
+    if (!Stream_Require(stream, 8 + 1 + 2)) {
+        return -1;
+    }
+    suid = Stream_BE64(stream);
 
     type->classname = classname;
     type->string = classname;
     type->serial_version_uid = suid;
+    type->class_kind = JavaType_Classify(classname, strlen(classname));
 
     /*****NEW HANDLE NEEDS TO GO IN HERE BEFORE THE FIELDS*******/
-    Handles_Append(handles, type);
+    if (Handles_Append(reader->handles, type) < 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
 
     /* flags */
-    n_bytes = fread(&flags, 1, 1, fd);
-    assert(n_bytes == 1);
+    uint8_t raw_flags = Stream_U8(stream);
+    memcpy(&flags, &raw_flags, 1);
 
     /* number of fields */
-    n_fields = get_size(fd);
+    n_fields = Stream_BE16(stream);
 
-    fields = (JavaType_Type **)malloc(sizeof(void *)*n_fields);
-    assert(fields != NULL);
+    fields = (JavaType_Type **)Arena_Alloc(reader->arena, sizeof(void *)*(n_fields + 1));
+    if (fields == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
 
     size_t i;
     for (i = 0; i < n_fields; i++){
-        fields[i] = get_field_descriptor(fd, handles);
+        fields[i] = get_field_descriptor(stream, reader);
+        if (fields[i] == NULL) {
+            type->n_fields = i;
+            type->fields = fields;
+            return -1;
+        }
     }
 
     type->n_fields = n_fields;
     type->fields = fields;
     memcpy(&type->flags, &flags, 1);
-    
- 
+
+    if (reader->class_cache != NULL) {
+        ClassCache_Insert(reader->class_cache, start, (size_t)(stream->pos - start), type);
+    }
+    return 0;
+}
+
+static int
+parse_tc_classdesc(Stream *stream, Reader *reader, JavaType_Type *type)
+{
+    /* * Fill in 'type' from a class descriptor. Returns 0 on success
+     * and -1 if the stream ran out or was malformed.
+     * */
+    assert(type != NULL);
+
+    if (parse_classdesc_fields(stream, reader, type) < 0) {
+        return -1;
+    }
+
     /* PLACEHOLDER FOR CLASS ANNOTATIONS */
-    assert(fgetc(fd) == TC_ENDBLOCKDATA);
+    if (get_byte(stream) != TC_ENDBLOCKDATA) {
+        if (!stream->error) {
+            PyErr_Format(StreamError, "class annotations are not supported "
+                         "(%s, offset %zu)", type->classname, Stream_Tell(stream) - 1);
+        }
+        return -1;
+    }
 
     char c;
-    c = get_and_validate_stream_typecode(fd);
+    c = get_and_validate_stream_typecode(stream);
+    if (stream->error) {
+        return -1;
+    }
     if (c == TC_REFERENCE) {
 
         uint32_t handle;
         
-        handle = get_handle(fd);
+        handle = get_handle(stream);
+        if (stream->error) {
+            return -1;
+        }
 
         JavaType_Type *ref;
 
-        ref = Handles_Find(handles, handle);
-        assert(ref != NULL);
+        ref = Handles_Find(reader->handles, handle);
+        if (ref == NULL) {
+            PyErr_Format(StreamError, "reference to unknown handle 0x%x", handle);
+            return -1;
+        }
         type->super = ref;
         ref->ref_count++;
     }
-    else if (c == TC_PROXYCLASSDESC) {
-        printf("TC_PROXYCLASSDESC not implemented\n");
-        exit(EXIT_FAILURE);
-        type->super = NULL;
-    }
     else if (c == TC_CLASSDESC) {
-        type->super = JavaType_New(c);
-        parse_tc_classdesc(fd, handles, type->super);
+        type->super = JavaType_New(reader->arena, c);
+        if (type->super == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        return parse_tc_classdesc(stream, reader, type->super);
     }
     else if (c == TC_NULL) {
         type->super = NULL;
     }
     else {
-        printf("unknown stream code 0x%x\n", c);
+        /* proxy superclasses are not supported */
+        invalid_typecode(stream, c, "a superclass descriptor");
+        return -1;
     }
 
+    return 0;
 }
 
 static PyObject *
-parse_tc_array(FILE *fd, Handles *handles)
+parse_tc_array(Stream *stream, Reader *reader)
 {
 
     /** Parse stream that starts with TC_ARRAY
      * 
      * arguments
      * ---------
-     *     fd: memory buffer
-     *     handles: references
+     *     stream: memory buffer
+     *     reader: references and output options
      *     type: structure containing information about that ????
      *           ?????? WTF do I do here?????
      * */
     JavaType_Type *array = NULL;
     JavaType_Type *class_desc = NULL;
-    PyObject *python_array;
+    PyObject *python_array = NULL;
+    const unsigned char *start = stream->pos - 1;
+    size_t first_handle = Handles_Position(reader->handles);
 
     uint32_t n_elements;
     char array_type;
-    char next_type;
     char *classname;
     
-    next_type = get_and_validate_stream_typecode(fd);
-
-    array = JavaType_New(TC_ARRAY);
-    if (next_type == TC_REFERENCE){
-        uint32_t handle;
-        
-        handle = get_handle(fd);
-        class_desc = Handles_Find(handles, handle);
-        assert(class_desc != NULL);
-    }
-    else if(next_type == TC_CLASSDESC){ /* next_type == TC_CLASSDESC|TC_PROXYCLASSDESC|TC_REFERENCE */
-        class_desc = JavaType_New(TC_CLASSDESC);
-        /* Arrays have no fields, so this should return no data */
-        parse_tc_classdesc(fd, handles, class_desc);
+    class_desc = parse_class_ref(stream, reader);
+    if (class_desc == NULL) {
+        return NULL;
     }
-    else {
-        fprintf(stderr, "Not implemeneted for typecode 0x%x", next_type);
-        exit(1);
+    if (class_desc->classname[0] != '[' || class_desc->classname[1] == '\0') {
+        PyErr_Format(StreamError, "array of class %s", class_desc->classname);
+        return NULL;
     }
 
-    assert(class_desc != NULL);
+    array = JavaType_New(reader->arena, TC_ARRAY);
+    if (array == NULL) {
+        return PyErr_NoMemory();
+    }
     array->class_descriptor = class_desc;
     class_desc->ref_count++;
-    Handles_Append(handles, array);
+    if (Handles_Append(reader->handles, array) < 0) {
+        return PyErr_NoMemory();
+    }
 
     classname = class_desc->classname;
-    assert(classname[0] == '[');
+    if (reader->drop_arrays && primitive_size(classname[1]) != 0) {
+        /* where a later reference can decode it again, see StreamIterator_Next */
+        array->skipped = start;
+        array->skipped_handle = first_handle;
+    }
+
+    n_elements = get_unsigned_long(stream);
+    if (stream->error) {
+        return NULL;
+    }
+
+    
+    /* needs to be decoupled incase a reference is used to get the data */
+    PyObject *element;
+    array_type = classname[1];
+
+    if (reader->typed_arrays && array_type == '[') {
+        /* rectangular primitive arrays become one contiguous block */
+        switch (parse_multi_array(stream, reader, array, n_elements, &python_array)) {
+            case -1:
+                return NULL;
+            case 1:
+                array_type = 0; /* done */
+                break;
+            default:
+                break; /* ragged, rewound to the first element */
+        }
+    }
+
+    switch(array_type){
+        case 0:
+            break;
+        case 'L':
+        case '[': {
+            Py_ssize_t i;
+            python_array = PyList_New(0);
+            if (python_array == NULL) {
+                return NULL;
+            }
+            for (i = 0; i < (Py_ssize_t)n_elements; i++) {
+                element = parse_stream(stream, reader);
+                if (element == NULL) {
+                    Py_DECREF(python_array);
+                    return NULL;
+                }
+                if (element != Py_None){
+                    if (PyList_Append(python_array, element) < 0) {
+                        Py_DECREF(element);
+                        Py_DECREF(python_array);
+                        return NULL;
+                    }
+                }
+                Py_DECREF(element);
+            }
+            break;
+        }
+        case 'B':
+        case 'C':
+        case 'D':
+        case 'F':
+        case 'I':
+        case 'J':
+        case 'S':
+        case 'Z': {
+            size_t size = primitive_size(array_type);
+            const unsigned char *p;
+
+            /* one bounds check for the whole array payload */
+            if (!Stream_RequireArray(stream, n_elements, size)) {
+                return NULL;
+            }
+            p = Stream_Take(stream, (size_t)n_elements * size);
+
+            if (reader->typed_arrays && (size_t)n_elements * size < TAPE_UNLOCKED_DECODE) {
+                python_array = PrimitiveArray_FromBigEndian(array_type, p, n_elements);
+                if (python_array == NULL) {
+                    return NULL;
+                }
+                break;
+            }
+            if (reader->typed_arrays) {
+                python_array = PrimitiveArray_New(array_type, n_elements);
+                if (python_array == NULL) {
+                    return NULL;
+                }
+                decode_unlocked(reader, array_type,
+                                ((PrimitiveArrayObject *)python_array)->data, p, n_elements);
+                break;
+            }
+
+            python_array = primitive_list(array_type, p, n_elements);
+            if (python_array == NULL) {
+                return NULL;
+            }
+            break;
+        }
+        default:
+            PyErr_Format(StreamError, "unknown array type %s", classname);
+            return NULL;
+    }
+
+    /* arrays can be the target of a TC_REFERENCE later in the stream */
+    Py_INCREF(python_array);
+    array->value = python_array;
+
+    return python_array;
+}
+
+static int
+fill_multi_array(Stream *stream, Reader *reader, MultiArray *m, int depth)
+{
+    /* * Reads the shape[depth] sub-arrays of one array at 'depth' straight
+     * into m->array. The first sub-array seen at each depth fixes that
+     * dimension, every later one has to match it.
+     * 
+     * returns
+     * -------
+     *     1 when the subtree was rectangular, 0 when it wasn't (null rows,
+     *     shared rows or mismatched lengths) and -1 on a stream error.
+     * */
+    uint32_t i;
+    size_t size = primitive_size(m->typecode);
+
+    for (i = 0; i < (uint32_t)m->shape[depth]; i++) {
+        JavaType_Type *class_desc;
+        JavaType_Type *sub;
+        uint32_t length;
+        unsigned char next_type;
+
+        if (get_byte(stream) != TC_ARRAY) {
+            return stream->error ? -1 : 0;
+        }
+
+        next_type = get_byte(stream);
+        if (next_type == TC_REFERENCE) {
+            uint32_t handle = get_handle(stream);
+            if (stream->error) {
+                return -1;
+            }
+            class_desc = Handles_Find(reader->handles, handle);
+            if (class_desc == NULL || class_desc->jt_type != TC_CLASSDESC) {
+                return 0;
+            }
+        }
+        else if (next_type == TC_CLASSDESC) {
+            class_desc = JavaType_New(reader->arena, TC_CLASSDESC);
+            if (class_desc == NULL) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            if (parse_tc_classdesc(stream, reader, class_desc) < 0) {
+                return -1;
+            }
+        }
+        else {
+            return stream->error ? -1 : 0;
+        }
+        if (strcmp(class_desc->classname, m->classname + depth + 1) != 0) {
+            return 0;
+        }
 
-    n_elements = get_unsigned_long(fd);
+        length = get_unsigned_long(stream);
+        if (stream->error) {
+            return -1;
+        }
+        if (depth + 1 == m->known) {
+            m->shape[depth + 1] = length;
+            m->known++;
+        }
+        else if (m->shape[depth + 1] != (Py_ssize_t)length) {
+            return 0;
+        }
 
-    
-    /* needs to be decoupled incase a reference is used to get the data */
-    PyObject *element;
-    array_type = classname[1];
-    switch(array_type){
-        case 'L':
-        case '[': {
-            Py_ssize_t i;
-            python_array = PyList_New(0);
-            for (i = 0; i < (Py_ssize_t)n_elements; i++) {
-                element = parse_stream(fd, handles);
-                if (element != Py_None){
-                    assert(PyList_Append(python_array, element) == 0);
-                    Py_DECREF(element);
+        /* sub-arrays still take a handle, a later TC_REFERENCE to one
+         * of them resolves to a view of the flattened block */
+        sub = JavaType_New(reader->arena, TC_ARRAY);
+        if (sub == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        sub->class_descriptor = class_desc;
+        class_desc->ref_count++;
+        sub->array_base = m->base;
+        sub->array_offset = (size_t)m->offset;
+        sub->array_size = length;
+        if (Handles_Append(reader->handles, sub) < 0) {
+            PyErr_NoMemory();
+            return -1;
+        }
 
+        if (depth + 1 == m->ndim - 1) {
+            /* the first leaf is only reached once every dimension is known */
+            if (!Stream_RequireArray(stream, length, size)) {
+                return -1;
+            }
+            if (m->array == NULL) {
+                m->array = (PrimitiveArrayObject *)PrimitiveArray_NewShaped(
+                    m->typecode, m->ndim, m->shape);
+                if (m->array == NULL) {
+                    return -1;
                 }
             }
-            break;
+            PrimitiveArray_Decode(m->typecode, m->array->data + m->offset * m->array->itemsize,
+                                  Stream_Take(stream, (size_t)length * size), length);
+            m->offset += length;
         }
-        case 'B':
-        case 'C':
-        case 'D':
-        case 'F':
-        case 'I':
-        case 'J':
-        case 'S':
-        case 'Z': {
-            Py_ssize_t i;
-            python_array = PyList_New(n_elements);
-            for (i = 0; i < (Py_ssize_t)n_elements; i++){
-                PyObject *ob = get_value(fd, handles, array_type);
-                assert(PyList_SetItem(python_array, i, ob) == 0);
+        else {
+            int status = fill_multi_array(stream, reader, m, depth + 1);
+            if (status <= 0) {
+                return status;
             }
-            break;
         }
     }
-    return python_array;
+    return 1;
+}
+
+static int
+parse_multi_array(Stream *stream, Reader *reader, JavaType_Type *array,
+                  uint32_t n_elements, PyObject **out)
+{
+    /* * Speculatively decode a multi-dimensional primitive array (the
+     * header of the outermost array has already been read) into a single
+     * C-contiguous PrimitiveArray. If the array turns out to be ragged the
+     * stream and the handle table are rewound to where they were, so the
+     * caller can parse the elements as nested arrays instead.
+     * 
+     * returns
+     * -------
+     *     1 with *out set, 0 when the caller should fall back, -1 on error
+     * */
+    MultiArray m;
+    const unsigned char *start = stream->pos;
+    size_t n_handles = Handles_Position(reader->handles);
+    int status;
+    int i;
+
+    m.base = array;
+    m.classname = array->class_descriptor->classname;
+    m.ndim = (int)strspn(m.classname, "[");
+    m.typecode = m.classname[m.ndim];
+    if (m.ndim > PRIMITIVE_ARRAY_MAX_DIMS || primitive_size(m.typecode) == 0
+        || m.classname[m.ndim + 1] != 0) {
+        /* object leaves or too many dimensions */
+        return 0;
+    }
+
+    m.shape[0] = n_elements;
+    for (i = 1; i < m.ndim; i++) {
+        /* dimensions after an empty one are never seen and stay 0 */
+        m.shape[i] = 0;
+    }
+    m.known = 1;
+    m.array = NULL;
+    m.offset = 0;
+
+    status = fill_multi_array(stream, reader, &m, 0);
+    if (status == 1 && m.array == NULL) {
+        m.array = (PrimitiveArrayObject *)PrimitiveArray_NewShaped(m.typecode, m.ndim, m.shape);
+        if (m.array == NULL) {
+            return -1;
+        }
+    }
+    if (status == 1) {
+        *out = (PyObject *)m.array;
+        return 1;
+    }
+
+    Py_XDECREF(m.array);
+    if (status == 0) {
+        stream->pos = start;
+        Handles_Truncate(reader->handles, n_handles);
+    }
+    return status;
 }
 
 static PyObject *
-parse_block_data(FILE *fd, Handles *handles, JavaType_Type *class_desc, PyObject *data)
+parse_block_data(Stream *stream, Reader *reader, JavaType_Type *class_desc, PyObject *data)
 {
 
     /* follows the class descriptor in the values part of the 
@@ -795,44 +4775,97 @@ parse_block_data(FILE *fd, Handles *handles, JavaType_Type *class_desc, PyObject
     PyObject *ob;
 
     ob = Py_None; /* temporary */
-    if (!strncmp(class_desc->classname, "java.util.ArrayDeque", 20)
-         || !strncmp(class_desc->classname, "java.util.ArrayList", 19)
-         || !strncmp(class_desc->classname, "java.util.LinkedList", 19) 
-    ) {
-        ob = List_ReadObject(fd, handles, class_desc);
+    if (class_desc->handler != NULL && class_desc->handler->func != NULL) {
+        ob = class_desc->handler->func(stream, reader, class_desc);
+    }
+    else {
+        switch (class_desc->class_kind) {
+            case Class_ArrayDeque:
+            case Class_ArrayList:
+            case Class_LinkedList:
+                ob = List_ReadObject(stream, reader, class_desc);
+                break;
+            case Class_HashMap:
+                ob = HashMap_ReadObject(stream, reader, class_desc);
+                break;
+            case Class_HashSet:
+                ob = HashSet_ReadObject(stream, reader, class_desc);
+                break;
+            case Class_PriorityQueue:
+                ob = PriorityQueue_ReadObject(stream, reader, class_desc);
+                break;
+            case Class_BitSet:
+            case Class_Calendar:
+            case Class_Collections:
+            case Class_Date:
+            case Class_EnumMap:
+            case Class_Hashtable:
+            case Class_IdentityHashMap:
+                break;
+            default:
+                PyErr_Format(StreamError, "no readObject handler for %s, which writes "
+                             "its own data (see register_reader)", class_desc->classname);
+                ob = NULL;
+        }
     }
-    else if (!strncmp(class_desc->classname, "java.util.BitSet", 16)) {}
-    else if (!strncmp(class_desc->classname, "java.util.Calendar", 18)) {}
-    else if (!strncmp(class_desc->classname, "java.util.Collections", 21)) {}
-    else if (!strncmp(class_desc->classname, "java.util.Date", 14)) {}
-    else if (!strncmp(class_desc->classname, "java.util.EnumMap", 17)) {}
-    else if (!strncmp(class_desc->classname, "java.util.HashMap", 17)) {
-
 
-        ob = HashMap_ReadObject(fd, handles, class_desc);
+    if (ob != Py_None) {
+        /* the collection reader replaces the default field data */
+        Py_DECREF(data);
+        return ob;
     }
-    else if (!strncmp(class_desc->classname, "java.util.HashSet", 17)) {
+    return data;
+}
 
+static int
+read_block_header(Stream *stream, unsigned char expected_length)
+{
+    /* * The block data written by the collection writeObject methods
+     * starts with a short block whose length byte (the byte after
+     * TC_BLOCKDATA) is fixed for each collection.
+     * */
+    unsigned char length;
 
-        ob = HashSet_ReadObject(fd, handles, class_desc);
+    length = get_byte(stream);
+    if (stream->error) {
+        return -1;
     }
-    else if (!strncmp(class_desc->classname, "java.util.Hashtable", 19)) {}
-    else if (!strncmp(class_desc->classname, "java.util.IdentityHashMap", 25)) {}
-    else if (!strncmp(class_desc->classname, "java.util.PriorityQueue", 23)) {
-        ob = PriorityQueue_ReadObject(fd, handles, class_desc);
+    if (length != expected_length) {
+        PyErr_Format(StreamError, "unexpected block data length %u (expected %u) "
+                     "at offset %zu", length, expected_length, Stream_Tell(stream) - 1);
+        return -1;
     }
-    else {
-       Py_INCREF(Py_None);
-       fprintf(stderr, "classname not found %s\n", class_desc->classname); 
-       exit(EXIT_FAILURE); 
+    return 0;
+}
+
+static PyObject *
+read_list_elements(Stream *stream, Reader *reader, uint32_t size)
+{
+    /* reads 'size' objects from the stream into a new list */
+    PyObject *list;
+    PyObject *element;
+
+    list = PyList_New(size);
+    if (list == NULL) {
+        return NULL;
     }
 
-    return ob;
+    size_t i;
+    for (i = 0; i < size; i++){
+        element = parse_stream(stream, reader);
+        if (element == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, element); /* PyList 'steals' */
+    }  
+
+    return list;
 }
 
 /* referenced functions */
 static PyObject *
-List_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc)
+List_ReadObject(Stream *stream, Reader *reader, JavaType_Type *class_desc)
 {
 
     /* assume that the default write object operation has happened and
@@ -846,58 +4879,62 @@ List_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc)
      */
 
     uint32_t size;
-    unsigned char first_byte;
-    PyObject *list;
-    PyObject *element;
 
     assert(class_desc->flags.sc_write_method == 1);
 
-    first_byte = get_byte(fd);
-    assert(first_byte == 4);
+    if (read_block_header(stream, 4) < 0) {
+        return NULL;
+    }
 
     /* LinkedList writeObject writes a java int to the stream for the size of the list */
-    size = get_unsigned_long(fd);
-
-    list = PyList_New(size);
-    assert(list != NULL);
-
-    size_t i;
-    for (i = 0; i < size; i++){
-        element = parse_stream(fd, handles);
-        PyList_SetItem(list, (Py_ssize_t)i, element); /* PyList 'steals' */
-    }  
+    size = get_unsigned_long(stream);
+    if (stream->error) {
+        return NULL;
+    }
 
-    return list;
+    return read_list_elements(stream, reader, size);
 }
 
 
 static PyObject *
-BitSet_ReadObject(FILE *fd, Handles *handles, PyObject *data) {
+BitSet_ReadObject(Stream *stream, Reader *reader, PyObject *data) {
 
     /* change data to set */
-    PyObject *bits, *list, *element, *bit_set, *bit;
+    PyObject *list, *element, *bit_set, *bit, *set;
     unsigned long l_bits;
 
 
-    bits = PyUnicode_FromString("bits");
-    assert(PyDict_Contains(data, bits));
-
     list = PyDict_GetItemString(data, "bits");
-    assert(PyList_Check(list));
+    if (list == NULL) {
+        PyErr_SetString(StreamError, "java.util.BitSet without a 'bits' long[]");
+        return NULL;
+    }
 
-    /* should be a list of longs */
+    /* should be a list of longs, or a PrimitiveArray with typed_arrays */
+    list = PySequence_Fast(list, "java.util.BitSet 'bits' is not a sequence");
+    if (list == NULL) {
+        return NULL;
+    }
 
     bit_set = PyList_New(0);
+    if (bit_set == NULL) {
+        Py_DECREF(list);
+        return NULL;
+    }
     Py_ssize_t i;
     Py_ssize_t j;
-    for (i = 0; i < PyList_Size(list); i++){
-        element = PyList_GetItem(list, i);
-        assert(PyLong_Check(element));
+    for (i = 0; i < PySequence_Fast_GET_SIZE(list); i++){
+        element = PySequence_Fast_GET_ITEM(list, i);
+        if (!PyLong_Check(element)) {
+            PyErr_SetString(StreamError, "java.util.BitSet 'bits' is not a long[]");
+            Py_DECREF(bit_set);
+            Py_DECREF(list);
+            return NULL;
+        }
         
         l_bits = (unsigned long)PyLong_AsLong(element);
 
         for (j = 63; j >= 0; j--){
-
             if ((l_bits & 1) == 1) {
 
                 bit = PyLong_FromLong(63 - j + i*64); 
@@ -909,37 +4946,54 @@ BitSet_ReadObject(FILE *fd, Handles *handles, PyObject *data) {
         }    
     }
 
-    Py_DECREF(data);
-    return PySet_New(bit_set);
+    set = PySet_New(bit_set);
+    Py_DECREF(bit_set);
+    Py_DECREF(list);
+    return set;
 
 }
 
 static PyObject *
-HashMap_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc)
+HashMap_ReadObject(Stream *stream, Reader *reader, JavaType_Type *class_desc)
 {
 
     uint32_t buckets;
     uint32_t size;
-    unsigned char first_byte;
     PyObject *dict;
     PyObject *item;
     PyObject *key;
 
-    assert(strncmp(class_desc->classname, "java.util.HashMap", 17) == 0);
-
-    first_byte = get_byte(fd);
-    assert(first_byte == 8);
+    assert(class_desc->class_kind == Class_HashMap);
 
-    buckets = get_unsigned_long(fd);
-    size = get_unsigned_long(fd);
+    if (read_block_header(stream, 8) < 0) {
+        return NULL;
+    }
 
-    assert(size < buckets);
+    /* buckets and size are a single 8 byte record */
+    if (!Stream_Require(stream, 8)) {
+        return NULL;
+    }
+    buckets = Stream_BE32(stream);
+    size = Stream_BE32(stream);
+    (void)buckets;
 
     dict = PyDict_New();
+    if (dict == NULL) {
+        return NULL;
+    }
     size_t i;
     for (i = 0; i < size; i++){
-        key = parse_stream(fd, handles);
-        item = parse_stream(fd, handles);
+        key = parse_stream(stream, reader);
+        if (key == NULL) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+        item = parse_stream(stream, reader);
+        if (item == NULL) {
+            Py_DECREF(key);
+            Py_DECREF(dict);
+            return NULL;
+        }
         PyDict_SetItem(dict, key, item);
         Py_DECREF(key);
         Py_DECREF(item);
@@ -949,45 +5003,41 @@ HashMap_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc)
 }
 
 static PyObject *
-HashSet_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc)
+HashSet_ReadObject(Stream *stream, Reader *reader, JavaType_Type *class_desc)
 {
 
-    assert(!strncmp(class_desc->classname, "java.util.HashSet", 17));
+    assert(class_desc->class_kind == Class_HashSet);
     assert(class_desc->flags.sc_write_method);
 
-    uint8_t first_byte;
-    uint32_t capacity;
     uint32_t size;
-    float load_factor;
     PyObject *list;
-    PyObject *element;
 
-    first_byte = get_byte(fd);
-    assert(first_byte == 12);
-
-    capacity = get_unsigned_long(fd);
-    load_factor = get_signed_float(fd);
-    size = get_unsigned_long(fd);
+    if (read_block_header(stream, 12) < 0) {
+        return NULL;
+    }
 
-    list = PyList_New(size);
+    /* capacity (int), load factor (float), size (int) */
+    if (!Stream_Require(stream, 12)) {
+        return NULL;
+    }
+    Stream_Take(stream, 8);
+    size = Stream_BE32(stream);
 
-    size_t i;
-    for (i = 0; i < size; i++) {
-        element = parse_stream(fd, handles);
-        assert(element != NULL);
-        PyList_SetItem(list, (Py_ssize_t)i, element);
+    list = read_list_elements(stream, reader, size);
+    if (list == NULL) {
+        return NULL;
     }
     
     PyObject *set;
     set = PySet_New(list);
-    assert(set != NULL);
+    Py_DECREF(list);
 
     return set;
 }
 
 
 static PyObject *
-PriorityQueue_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc)
+PriorityQueue_ReadObject(Stream *stream, Reader *reader, JavaType_Type *class_desc)
 {
 
     /** priority queue saves max(2, size + 1) for the size when writing it to the stream, 
@@ -995,185 +5045,136 @@ PriorityQueue_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc)
      * read to get the actual number
      * */
 
-    assert(!strncmp(class_desc->classname, "java.util.PriorityQueue", 23));
+    assert(class_desc->class_kind == Class_PriorityQueue);
     assert(class_desc->flags.sc_write_method == 1);
 
     uint32_t size;
-    unsigned char first_byte;
-    PyObject *list;
-    PyObject *element;
 
-    first_byte = get_byte(fd);
-    assert(first_byte == 4);
+    if (read_block_header(stream, 4) < 0) {
+        return NULL;
+    }
 
     /* LinkedList writeObject writes a java int to the stream for the size of the list */
-    size = get_unsigned_long(fd) - 1;
-
-    list = PyList_New(size);
-    assert(list != NULL);
-
-    size_t i;
-    for (i = 0; i < size; i++){
-        element = parse_stream(fd, handles);
-        PyList_SetItem(list, (Py_ssize_t)i, element);
-    }  
+    size = get_unsigned_long(stream);
+    if (stream->error) {
+        return NULL;
+    }
 
-    return list;
+    return read_list_elements(stream, reader, size - 1);
 }
 
 static PyObject *
-__test_parse_primitive_array(PyObject *self, PyObject *args)
-{  
-    int i = 0x0001;
-    little_endian = *((char *)&i);
-
+__test_parse_file(PyObject *args)
+{
+    /* shared body of the _test_* entry points: read the file, check
+     * the stream header and parse the first object */
     char *filename;
-    uint32_t stream_head;
-    size_t n_bytes;
-    FILE *fd; 
+    StreamFile file;
+    Stream stream;
+    PyObject *data;
 
     if (!PyArg_ParseTuple(args, "s", &filename)) {
-        return Py_None;
+        return NULL;
+    }
+
+    if (StreamFile_Open(&file, filename, 0) < 0) {
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
     }
 
-    fd = fopen(filename, "rb");
-    assert(fd != NULL);
+    Stream_Init(&stream, file.buffer, file.length);
+    if (read_stream_header(&stream) < 0) {
+        StreamFile_Close(&file);
+        return NULL;
+    }
 
-    n_bytes = fread(&stream_head, 1, 4, fd);
-    assert(n_bytes == 4 && stream_head == uint32_switch(0xaced0005));
+    Reader reader;
+    Reader_Init(&reader);
+    if (Reader_Begin(&reader, file.length) < 0) {
+        StreamFile_Close(&file);
+        return NULL;
+    }
 
-    Handles *handles = Handles_New(DEFAULT_REFERENCE_SIZE);
-    assert(handles != NULL);
+    data = parse_stream(&stream, &reader);
+    Reader_Release(&reader);
+    if (data == NULL) {
+        stream_failure(&stream);
+    }
+    StreamFile_Close(&file);
+    return data;
+}
 
-    return parse_stream(fd, handles);
-     
+static PyObject *
+__test_parse_primitive_array(PyObject *self, PyObject *args)
+{  
+    return __test_parse_file(args);
 }
 
 static PyObject *
 __test_parse_class_descriptor(PyObject *self, PyObject *args)
 {
-    int i = 0x0001;
-    little_endian = *((char *)&i);
-    
- 
-    char *filename;
-    uint32_t stream_head;
-    size_t n_bytes;
-    FILE *fd; 
-
-    if (!PyArg_ParseTuple(args, "s", &filename)) {
-        return Py_None;
-    }
-
-    fd = fopen(filename, "rb");
-    assert(fd != NULL);
-
-    n_bytes = fread(&stream_head, 1, 4, fd);
-    assert(n_bytes == 4 && stream_head == uint32_switch(0xaced0005));
-
-    Handles *handles = Handles_New(DEFAULT_REFERENCE_SIZE);
-    assert(handles != NULL);
- 
-    return parse_stream(fd, handles);
-
+    return __test_parse_file(args);
 }
 
 static char *
-get_string(FILE *fd, size_t len)
+get_string(Stream *stream, Arena *arena, size_t len)
 {   
-    /* * get_string(fd, len) reads a string of
-     * bytes of length len and allocate those bytes
-     * to the heap. The caller of this function will
-     * be responsible for freeing the memory
+    /* * get_string(stream, arena, len) reads a string of
+     * bytes of length len and copies those bytes into
+     * the parse arena. The string lives until the arena
+     * is destructed at the end of the parse
      * 
      * arguments
      * ---------
-     *     fd: file descriptor for the file stream
+     *     stream: cursor over the byte stream
+     *     arena: allocator of the current parse
      *     len: number of bytes to read from the stream
      * 
      * returns
      * -------
-     *     str: null terminated string allocated on the heap
+     *     str: null terminated string allocated in the arena,
+     *          or NULL if the stream is too short or, with MemoryError
+     *          set, the arena is out of memory
      * */
-    size_t n_bytes; 
     char *str;
     
-    str = (char *)malloc(len + 1);
-    assert(str != NULL);
-    str[len] = 0;
+    if (!Stream_Require(stream, len)) {
+        return NULL;
+    }
 
-    n_bytes = fread(str, sizeof(char), len, fd);
+    str = Arena_StrDup(arena, Stream_Take(stream, len), len);
+    if (str == NULL) {
+        PyErr_NoMemory();
+    }
 
     return str;
 }
 
 static uint32_t
-get_unsigned_long(FILE *fd)
+get_unsigned_long(Stream *stream)
 {
     /* * Read a 4-byte unsigned integer from the stream.
      * 
      * */
-
-    uint32_t value;
-    size_t n_bytes;
-    
-    n_bytes = fread(&value, sizeof(char), sizeof(uint32_t), fd);
-    assert(n_bytes == sizeof(uint32_t));
-
-    if (little_endian){
-        uint32_reverse_bytes(value);
+    if (!Stream_Require(stream, sizeof(uint32_t))) {
+        return 0;
     }
     
-    return value;
-}
-
-static PyObject *
-get_signed_integer_value(FILE *fd)
-{
-    PyObject *ob;
-    long value;
-
-    value = (long)(int32_t)get_unsigned_long(fd);
-    ob = PyLong_FromLong(value);
-
-    return ob;
-
+    return Stream_BE32(stream);
 }
 
 static uint16_t
-get_unsigned_short(FILE *fd)
+get_unsigned_short(Stream *stream)
 {
-    uint16_t value;
-    size_t n_bytes;
-
-    n_bytes = fread(&value, 1, sizeof(uint16_t), fd);
-    assert(n_bytes == sizeof(uint16_t));
-    
-    if (little_endian){
-        uint16_reverse_bytes(value);
+    if (!Stream_Require(stream, sizeof(uint16_t))) {
+        return 0;
     }
-    return value;
-}
-
-static int16_t
-get_signed_short(FILE *fd)
-{
-    return (int16_t)get_unsigned_short(fd);
-}
 
-static PyObject *
-get_signed_short_value(FILE *fd)
-{
-    int16_t value;
-
-    value = get_signed_short(fd);
-    /* possible unsafe cast */
-    return PyLong_FromLong((long)value);
+    return Stream_BE16(stream);
 }
 
 
 static size_t 
-get_size(FILE *fd)
+get_size(Stream *stream)
 { 
     /* *return 2 byte unsigned int from the file stream.
      * Several objects from the stream require the size of an 
@@ -1185,202 +5186,226 @@ get_size(FILE *fd)
      *     number of fields
      * */
 
-    return (size_t)get_unsigned_short(fd);
+    return (size_t)get_unsigned_short(stream);
 }
 
 static char *
-get_size_and_string(FILE *fd)
+get_size_and_string(Stream *stream, Arena *arena)
 {
     /** Reads the size of a string from the byte stream
      * and then the string itself. 
      * 
      * arguments
      * ---------
-     *     fd: file descriptor/byte stream
+     *     stream: cursor over the byte stream
+     *     arena: allocator of the current parse
      * 
      * returns
      * -------
-     *     str: a null terminated string allocated to the heap
+     *     str: a null terminated string allocated in the arena
      * */
 
     size_t num_chars;
     char *str;
 
-    num_chars = get_size(fd); 
-    str = get_string(fd, num_chars);
+    num_chars = get_size(stream); 
+    str = get_string(stream, arena, num_chars);
 
     return str;
 }
 
-static double
-get_signed_double(FILE *fd)
+static int64_t 
+get_signed_long_long(Stream *stream)
 {
-    /* * Read a signed double from the file stream. 
-     * Big to Little endian conversion has to be done
-     * as shown below because bitwise shifting isn't 
-     * allowed for floating point values.
-     * 
-     * */
-    double value;
-    size_t n_bytes;
-
-    n_bytes = fread(&value, 1, sizeof(double), fd);
-    assert(n_bytes == sizeof(double));
-
-    if (little_endian)  {
-        double copy = value;
-        char *ptr = (char *)&value;
-        char *cpy = (char *)&copy;
-
-        ptr[7] = cpy[0];
-        ptr[6] = cpy[1];
-        ptr[5] = cpy[2];
-        ptr[4] = cpy[3];
-        ptr[3] = cpy[4];
-        ptr[2] = cpy[5];
-        ptr[1] = cpy[6];
-        ptr[0] = cpy[7];
+    if (!Stream_Require(stream, sizeof(int64_t))) {
+        return 0;
     }
 
-    return value;
+    return (int64_t)Stream_BE64(stream);
 }
 
-static PyObject *
-get_double_value(FILE *fd)
+static uint64_t 
+get_unsigned_long_long(Stream *stream)
 {
-    double value;
-    PyObject *ob;
-
-    value = get_signed_double(fd);
-    ob = PyFloat_FromDouble(value);
 
-    return ob;
+    return (uint64_t)get_signed_long_long(stream);
 }
 
-static float
-get_signed_float(FILE *fd)
+static unsigned char
+get_byte(Stream *stream)
 {
-    size_t n_bytes;
-    float value;
-
-    n_bytes = fread(&value, 1, sizeof(float), fd);
-    assert(n_bytes == 4);
-
-    if (little_endian){
-
-        float copy = value;
-
-        char *cpy = (char *)&copy;
-        char *ptr = (char *)&value;
-
-        ptr[0] = cpy[3];
-        ptr[1] = cpy[2];
-        ptr[2] = cpy[1];
-        ptr[3] = cpy[0]; 
-
+    if (!Stream_Require(stream, 1)) {
+        return 0;
     }
 
-    return value; 
+    return Stream_U8(stream);
 }
 
-static PyObject *
-get_float_value(FILE *fd)
+static void
+invalid_typecode(Stream *stream, unsigned char typecode, const char *expected)
 {
-    double value;
-    PyObject *ob;
-
-    value = (double)get_signed_float(fd);
-    ob = PyFloat_FromDouble(value);
-
-    return ob;
+    /* * The byte just read can't start what the caller expected. Raises
+     * StreamError and latches the cursor, so the callers that only test
+     * stream->error stop as they would at the end of the input.
+     * */
+    if (stream->error == STREAM_OK) {
+        PyErr_Format(StreamError, "unexpected typecode 0x%02x for %s at offset %zu",
+                     typecode, expected, Stream_Tell(stream) - 1);
+        stream->error = STREAM_INVALID;
+    }
 }
 
-static int64_t 
-get_signed_long_long(FILE *fd)
+static unsigned char 
+get_and_validate_field_typecode(Stream *stream)
 {
-    int64_t value;
-    size_t n_bytes;
+    unsigned char typecode = get_byte(stream);
 
-    n_bytes = fread(&value, 1, sizeof(int64_t), fd);
-    assert(n_bytes == sizeof(int64_t));
-
-    if (little_endian) {
-        uint64_reverse_bytes(value);
+    if (!stream->error && (typecode == 0 || strchr("BCDFIJSZL[", typecode) == NULL)) {
+        invalid_typecode(stream, typecode, "a field");
     }
-
-    return value;
+    return typecode;
 }
 
-static uint64_t 
-get_unsigned_long_long(FILE *fd)
+static unsigned char 
+get_and_validate_stream_typecode(Stream *stream)
 {
+    unsigned char typecode = get_byte(stream);
 
-    return (uint64_t)get_signed_long_long(fd);
+    if (!stream->error && !(TC_NULL <= typecode && typecode <= TC_ENUM)) {
+        invalid_typecode(stream, typecode, "content");
+    }
+    return typecode;
 }
 
-static PyObject *
-get_signed_long_value(FILE *fd)
+static uint32_t
+get_handle(Stream *stream)
 {
-    int64_t value;
-    PyObject *ob;
-
-    value = get_signed_long_long(fd);
-    ob = PyLong_FromLongLong(value);
-
-    return ob;
+    /* handles below BASE_WIRE_HANDLE are never issued, Handles_Find says so */
+    return get_unsigned_long(stream);
 }
 
-static unsigned char
-get_byte(FILE *fd)
+static PyObject *
+__bswap_kernel(PyObject *self, PyObject *args)
 {
-    size_t n_bytes;
-    char bbyte;
+    /* report, or with an argument force, the byte swap kernel in use */
+    const char *name = NULL;
 
-    n_bytes = fread(&bbyte, 1, 1, fd);
-    assert(n_bytes == 1);
-
-    return bbyte;
+    if (!PyArg_ParseTuple(args, "|s", &name)) {
+        return NULL;
+    }
+    if (name != NULL && Bswap_Select(name) < 0) {
+        PyErr_Format(PyExc_ValueError, "byte swap kernel '%s' is not available", name);
+        return NULL;
+    }
+    return PyUnicode_FromString(Bswap_KernelName());
 }
 
-static unsigned char 
-get_and_validate_field_typecode(FILE *fd)
+static PyObject *
+register_reader(PyObject *self, PyObject *args)
 {
-    unsigned char typecode = get_byte(fd);
-    assert(strchr("BCDFIJSZL[", typecode) != NULL);
+    PyObject *classname;
+    PyObject *handler;
 
-    return typecode;
+    if (!PyArg_ParseTuple(args, "UO", &classname, &handler)) {
+        return NULL;
+    }
+    if (Registry_AddCallback(classname, handler) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
-static unsigned char 
-get_and_validate_stream_typecode(FILE *fd)
+static PyObject *
+unregister_reader(PyObject *self, PyObject *classname)
 {
-    unsigned char typecode = get_byte(fd);
-    assert(0x70 <= typecode && typecode <= 0x7E);
-
-    return typecode;
+    if (Registry_Remove(classname) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
-static uint32_t
-get_handle(FILE *fd)
+static PyObject *
+__class_cache_info(PyObject *self, PyObject *Py_UNUSED(ignored))
 {
-    uint32_t value;
-
-    value = get_unsigned_long(fd);
-    assert(0x7e0000 <= value);
+    /* entry count and lookup statistics of the class descriptor cache */
+    ClassCacheStats stats;
 
-    return value;
+    ClassCache_Stats(class_cache, &stats);
+    return Py_BuildValue("{s:n,s:n,s:n}", "entries", (Py_ssize_t)stats.entries,
+                         "hits", (Py_ssize_t)stats.hits, "misses", (Py_ssize_t)stats.misses);
 }
 
-static uint64_t
-get_serial_version_uid(FILE *fd)
+static PyObject *
+__tape_info(PyObject *self, PyObject *Py_UNUSED(ignored))
 {
-    return 0;
+    /* how often a two phase read had to read its stream again */
+    return Py_BuildValue("{s:n}", "divergences", (Py_ssize_t)tape_divergences);
 }
 
 static PyMethodDef ReaderMethods[] = {
-    {"stream_read", java_stream_reader, METH_VARARGS, "read serialized java stream data"},
+    {"stream_read", (PyCFunction)(void(*)(void))java_stream_reader, METH_VARARGS | METH_KEYWORDS,
+     "stream_read(filename, mmap=False, typed_arrays=False, lazy=False, fields=None)\n\n"
+     "read serialized java stream data. With mmap=True the file is memory\n"
+     "mapped for sequential access and parsed in place. With typed_arrays=True\n"
+     "primitive arrays come back as PrimitiveArray buffers instead of lists.\n"
+     "With lazy=True objects of default serialized classes come back as\n"
+     "LazyObject mappings that decode their fields on first access; arrays,\n"
+     "collections and other objects in those fields wait until then too.\n"
+     "fields takes dotted field paths such as 'order.items[*].price'; only\n"
+     "those fields are decoded and the rest of the stream is skipped."},
+    {"stream_read_bytes", (PyCFunction)(void(*)(void))java_stream_reader_bytes, METH_VARARGS | METH_KEYWORDS,
+     "stream_read_bytes(buffer, typed_arrays=False, lazy=False, fields=None)\n\n"
+     "read serialized java stream data from a bytes-like object without copying it.\n"
+     "A lazy parse holds the buffer until its last LazyObject is gone."},
+    {"stream_read_many", (PyCFunction)(void(*)(void))stream_read_many, METH_VARARGS | METH_KEYWORDS,
+     "stream_read_many(paths, threads=0, mmap=False, typed_arrays=False) -> list\n\n"
+     "read many files on a native thread pool, 'threads' of them or one per\n"
+     "processor. Results are in the order of 'paths'; a file that fails gives\n"
+     "the exception it raised (OSError, StreamError, ...) instead of a value."},
     {"_test_parse_primitive_array", __test_parse_primitive_array, METH_VARARGS, "test case for primitive type integer array"},
     {"_test_parse_class_descriptor", __test_parse_class_descriptor, METH_VARARGS, "test case for class descriptor"},
+    {"iter_stream", (PyCFunction)(void(*)(void))iter_stream, METH_VARARGS | METH_KEYWORDS,
+     "iter_stream(source, typed_arrays=False)\n\n"
+     "iterate over the top-level objects of a stream, from a filename or a\n"
+     "bytes-like object. Back references and class descriptors carry over from\n"
+     "one object to the next until the writer sends a reset. Primitive arrays\n"
+     "aren't kept between objects: one referenced again by a later object is\n"
+     "decoded again, equal to the first but not the same python object."},
+    {"read_records", (PyCFunction)(void(*)(void))read_records, METH_VARARGS | METH_KEYWORDS,
+     "read_records(source, threads=0, typed_arrays=False) -> list\n\n"
+     "every top-level object of a stream, from a filename or a bytes-like\n"
+     "object; the same values as list(iter_stream(source)). The stream is\n"
+     "indexed and validated without the GIL first. Then 'threads' native\n"
+     "threads, or one per processor, decode the strings, primitive fields and\n"
+     "primitive arrays of the records in parallel, and the records are built\n"
+     "from that in order."},
+    {"scan_stream", scan_stream, METH_O,
+     "scan_stream(source) -> dict\n\n"
+     "validate a stream from a filename or a bytes-like object and index its\n"
+     "structure without decoding any value. 'handles' and 'records' hold one\n"
+     "PrimitiveArray per column (offset, length, type, and the class or handle\n"
+     "index, -1 for none) and 'classes' maps descriptor handle indexes to names."},
+    {"walk_stream", walk_stream, METH_VARARGS,
+     "walk_stream(source, handler)\n\n"
+     "walk a stream from a filename or a bytes-like object as events, without\n"
+     "building its values: record_begin(offset), object_begin(classname, handle),\n"
+     "class_data(classname), field(name, type, value), object_end(handle),\n"
+     "array_begin(type, n, handle), primitive_array(type, array), array_end(handle),\n"
+     "string(s, handle), null(), reference(handle), enum_constant(classname, name,\n"
+     "handle), class_value(classname, handle), annotation_begin(classname),\n"
+     "annotation_end(classname), block_data(bytes), record_end() and end() are\n"
+     "called on 'handler' where it has them. Object fields pass None as their\n"
+     "value, the content follows as events."},
+    {"register_reader", register_reader, METH_VARARGS,
+     "register_reader(classname, handler)\n\n"
+     "decode the writeObject() data of 'classname' with handler(block, fields).\n"
+     "'block' is a BlockReader over the data and 'fields' the dict of the\n"
+     "default fields; the return value becomes the decoded object."},
+    {"unregister_reader", unregister_reader, METH_O,
+     "unregister_reader(classname)\n\nremove the handler registered for 'classname'"},
+    {"_bswap_kernel", __bswap_kernel, METH_VARARGS, "name of the bulk byte swap kernel, optionally forcing one"},
+    {"_class_cache_info", __class_cache_info, METH_NOARGS, "entries, hits and misses of the class descriptor cache"},
+    {"_tape_info", __tape_info, METH_NOARGS, "two phase reads that fell back to the one pass reader"},
  
     {NULL, NULL, 0, NULL}
 };
@@ -1397,5 +5422,92 @@ static struct PyModuleDef jsoreadermodule = {
 PyMODINIT_FUNC
 PyInit_jso_reader(void)
 {
-    return PyModule_Create(&jsoreadermodule);
+    PyObject *module;
+    PyObject *capsule;
+
+    module = PyModule_Create(&jsoreadermodule);
+    if (module == NULL) {
+        return NULL;
+    }
+
+    Bswap_Init();
+
+    if (class_cache == NULL) {
+        class_cache = ClassCache_New();
+        if (class_cache == NULL) {
+            Py_DECREF(module);
+            return PyErr_NoMemory();
+        }
+    }
+
+    if (PyType_Ready(&PrimitiveArray_Type) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    Py_INCREF(&PrimitiveArray_Type);
+    if (PyModule_AddObject(module, "PrimitiveArray", (PyObject *)&PrimitiveArray_Type) < 0) {
+        Py_DECREF(&PrimitiveArray_Type);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    /* raised for truncated or malformed streams */
+    StreamError = PyErr_NewException("jso_reader.StreamError", PyExc_ValueError, NULL);
+    if (StreamError == NULL) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    Py_INCREF(StreamError);
+    if (PyModule_AddObject(module, "StreamError", StreamError) < 0) {
+        Py_DECREF(StreamError);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    if (PyType_Ready(&StreamIterator_Type) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    if (PyType_Ready(&LazyStream_Type) < 0 || PyType_Ready(&LazyObject_Type) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    Py_INCREF(&LazyObject_Type);
+    if (PyModule_AddObject(module, "LazyObject", (PyObject *)&LazyObject_Type) < 0) {
+        Py_DECREF(&LazyObject_Type);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    if (PyType_Ready(&StreamParser_Type) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    Py_INCREF(&StreamParser_Type);
+    if (PyModule_AddObject(module, "StreamParser", (PyObject *)&StreamParser_Type) < 0) {
+        Py_DECREF(&StreamParser_Type);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    /* readObject handlers, and the C API other extensions register through */
+    if (Registry_Init(parse_stream, StreamError) < 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    Py_INCREF(&BlockReader_Type);
+    if (PyModule_AddObject(module, "BlockReader", (PyObject *)&BlockReader_Type) < 0) {
+        Py_DECREF(&BlockReader_Type);
+        Py_DECREF(module);
+        return NULL;
+    }
+    capsule = Registry_CapsuleNew();
+    if (capsule == NULL || PyModule_AddObject(module, "_C_API", capsule) < 0) {
+        Py_XDECREF(capsule);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
 }
\ No newline at end of file
@@ -5,141 +5,554 @@
 #include <stdlib.h>
 #include <wchar.h>
 #include "javatype.h"
-
-#define TC_NULL 0x70
-#define TC_REFERENCE 0x71
-#define TC_CLASSDESC 0x72
-#define TC_OBJECT 0x73
-#define TC_STRING 0x74
-#define TC_ARRAY 0x75
-#define TC_CLASS 0x76
-#define TC_BLOCKDATA 0x77
-#define TC_ENDBLOCKDATA 0x78
-#define TC_RESET 0x79
-#define TC_EXCEPTION 0x7B
-#define TC_LONGSTRING 0x7C
-#define TC_PROXYCLASSDESC 0x7D
-#define TC_ENUM 0x7E 
+#include "jso_stream.h"
+#include "jso_file.h"
+#include "jso_array.h"
+#include "jso_bswap.h"
+#include "jso_cache.h"
+#include "jso_registry.h"
+#include "jso_scan.h"
+#include "jso_pool.h"
+#include "jso.h"
 
 /* const dict keys */
 
-#define uint16_switch(a) (((a) & 0xFF00) >> 8 | ((a) & 0x00FF) << 8)
-#define uint32_switch(a) \
-   (((a) & 0xFF000000) >> 24 \
-  | ((a) & 0x00FF0000) >>  8 \
-  | ((a) & 0x0000FF00) <<  8 \
-  | ((a) & 0x000000FF) << 24)
-#define uint64_switch(a) \
-	  (((a) & 0xFF00000000000000) >> 56 \
-   | ((a) & 0x00FF000000000000) >> 40 \
-   | ((a) & 0x0000FF0000000000) >> 24 \
-   | ((a) & 0x000000FF00000000) >>  8 \
-   | ((a) & 0x00000000FF000000) <<  8 \
-   | ((a) & 0x0000000000FF0000) << 24 \
-   | ((a) & 0x000000000000FF00) << 40 \
-   | ((a) & 0x00000000000000FF) << 56)
-
-#define uint64_reverse_bytes(a) a = uint64_switch(a)
-#define uint32_reverse_bytes(a) a = uint32_switch(a)
-#define uint16_reverse_bytes(a) a = uint16_switch(a)
+typedef struct Reader Reader;
+
+struct Reader {
+    /* per parse state, threaded through every parse function */
+    Handles *handles;
+    Arena *arena;               /* owns every JavaType_Type and string of the parse */
+    ClassCache *class_cache;    /* descriptors shared across parses, may be NULL */
+    PyObject *owned;            /* list owning the python objects descriptors point at */
+    PyObject *lazy_context;     /* borrowed LazyStream in lazy mode, NULL otherwise */
+    PyObject *projection;       /* borrowed field path tree of the value being decoded,
+                                 * NULL decodes all of it, see build_projection */
+    uint8_t typed_arrays:1;     /* primitive arrays as PrimitiveArray */
+    uint8_t owns_input:1;       /* the call owns the reader and its input, so it may
+                                 * release the GIL mid-parse, see decode_unlocked */
+    uint8_t drop_arrays:1;      /* primitive arrays can be decoded again from the input,
+                                 * see StreamIterator_Next */
+    uint8_t unused:5;
+};
+
+typedef struct {
+    /* iter_stream(): decodes one top-level object per __next__ */
+    PyObject_HEAD
+    Stream stream;
+    Reader reader;              /* handles and descriptors live across records */
+    StreamFile file;
+    Py_buffer view;
+    uint8_t has_file:1;         /* iterating a mapped file */
+    uint8_t has_view:1;         /* iterating a buffer export */
+    uint8_t done:1;
+    uint8_t unused:5;
+} StreamIteratorObject;
+
+static PyTypeObject StreamIterator_Type;
+
+typedef struct {
+    /* StreamParser: decodes a stream that arrives in chunks */
+    PyObject_HEAD
+    Reader reader;
+    ScanIndex scan;             /* structure of the records so far, no values */
+    unsigned char *buffer;      /* input not yet decoded, starting at a record */
+    size_t length;
+    size_t reserved;
+    size_t wanted;              /* buffered bytes the last scan needed */
+    uint8_t has_header:1;
+    uint8_t failed:1;
+    uint8_t typed_arrays:1;
+    uint8_t unused:5;
+} StreamParserObject;
+
+static PyTypeObject StreamParser_Type;
+
+typedef struct {
+    /* stream_read_many(): shared by the pool workers, one task per path */
+    const char **paths;         /* filesystem encoded, owned by the caller */
+    PyObject *results;          /* list the tasks fill in, slot by slot */
+    uint8_t use_mmap:1;
+    uint8_t typed_arrays:1;
+    uint8_t unused:6;
+} ReadManyContext;
+
+typedef struct {
+    /* * LazyStream: the input and parse state behind the LazyObjects of
+     * one lazy parse. Every LazyObject holds a reference to it, so the
+     * input and the arena stay alive until the last proxy goes.
+     * */
+    PyObject_HEAD
+    Reader reader;
+    StreamFile file;
+    Py_buffer view;
+    uint8_t has_file:1;
+    uint8_t has_view:1;
+    uint8_t unused:6;
+} LazyStreamObject;
+
+static PyTypeObject LazyStream_Type;
+
+typedef struct {
+    /* one field of a LazyObject, at most one member is set */
+    const unsigned char *p;     /* primitive: its bytes in the input */
+    JavaType_Type *string;      /* string handle, decoded on access */
+    uint32_t handle;            /* object or array: its wire handle, decoded on access */
+    PyObject *value;            /* anything else, decoded while scanning */
+} LazySlot;
+
+typedef struct {
+    /* * LazyObject: an instance whose fields are decoded on first access.
+     * The scan that builds it only notes where each field is, issuing
+     * handles for the objects it passes over as usual.
+     * */
+    PyObject_HEAD
+    PyObject *context;          /* LazyStream */
+    JavaType_Type *class_desc;
+    LazySlot *slots;            /* one per field, superclass first; NULL once decoded */
+    size_t n_slots;
+    PyObject *values;           /* field dict once decoded */
+} LazyObjectObject;
+
+static PyTypeObject LazyObject_Type;
+
+typedef struct MultiArray MultiArray;
+
+struct MultiArray {
+    /* state of one speculative multi-dimensional array decode */
+    JavaType_Type *base;        /* handle of the outermost array */
+    const char *classname;      /* classname of the outermost array, [[..X */
+    char typecode;              /* element typecode */
+    int ndim;
+    int known;                  /* leading dimensions seen so far */
+    Py_ssize_t shape[PRIMITIVE_ARRAY_MAX_DIMS];
+    PrimitiveArrayObject *array;
+    Py_ssize_t offset;          /* elements written so far */
+};
+
+typedef struct {
+    /* a typed array whose byte swap was left for the pool, see read_records */
+    char typecode;
+    void *dst;                  /* data of the PrimitiveArray */
+    const unsigned char *src;
+    size_t n_elements;
+} DeferredDecode;
+
+typedef struct {
+    /* * One tape node decoded by a pool worker before the python objects
+     * are built, see predecode_window:
+     *
+     *     primitive fields    the value in host order in 'u'
+     *     strings             'length' code points of at most 'maxchar' at
+     *                         'u.data', in the width PyUnicode_New picks;
+     *                         NULL for ascii, whose chars are the input's
+     *     primitive arrays    the elements in host order at 'u.data'
+     *
+     * 'u.data' is malloc'ed by the worker and freed by whoever takes it.
+     * */
+    union {
+        int64_t i;
+        double d;
+        void *data;
+    } u;
+    uint32_t length;
+    uint32_t maxchar;
+    uint8_t ready;              /* 0 for nodes left to the builder */
+} TapeValue;
+
+typedef struct {
+    /* the records read_records pre-decodes on the pool in one go */
+    size_t end;                 /* first record after the window */
+    size_t first_node;          /* node of values[0] */
+    TapeValue *values;
+    size_t n_values;
+    size_t reserved_values;
+    size_t *tasks;              /* first record of each task, then 'end' */
+    size_t n_tasks;
+    size_t reserved_tasks;
+} TapeWindow;
+
+typedef struct {
+    /* * Second phase of a two phase read: builds the python objects of
+     * a ScanIndex tape, see read_stream_native.
+     * */
+    const ScanIndex *index;
+    size_t node;                /* next node of the tape */
+    Stream stream;              /* over the whole input, for the one pass code */
+    Reader *reader;
+    int diverged;               /* the one pass code and the tape disagree */
+    size_t generation;          /* scan handle of the reader's first handle */
+    DeferredDecode *deferred;   /* big typed arrays not decoded yet */
+    size_t n_deferred;
+    size_t reserved_deferred;
+    int defer;                  /* leave big typed arrays to the pool */
+    int threads;                /* pool threads, 0 for one per processor */
+    TapeWindow *window;         /* pre-decoded values, or NULL */
+} TapeBuilder;
+
+/* typed arrays of at least this many bytes are byte swapped without the GIL,
+ * when the reader owns its input */
+#define TAPE_UNLOCKED_DECODE (64 * 1024)
+/* and from this many on, in chunks of PARALLEL_DECODE_CHUNK on the pool */
+#define PARALLEL_DECODE_MIN (8 * 1024 * 1024)
+#define PARALLEL_DECODE_CHUNK (1024 * 1024)
+/* read_records pre-decodes this much input at a time, in tasks of at least
+ * TAPE_TASK_MIN bytes of whole records */
+#define TAPE_WINDOW (64 * 1024 * 1024)
+#define TAPE_TASK_MIN (16 * 1024)
+
+typedef struct PlanField PlanField;
+typedef struct PlanLevel PlanLevel;
+
+/* * A DecodePlan is a class hierarchy flattened for decoding instances.
+ * There is one level per class, superclass first. Consecutive primitive
+ * fields of a level form a run that is bounds checked and taken from the
+ * stream as one block; object fields are recursion points.
+ * */
+
+struct PlanField {
+    JavaType_Type *field;
+    char typecode;              /* field typecode, 'L' and '[' recurse */
+    uint32_t offset;            /* byte offset of a primitive inside its run */
+    uint32_t run_length;        /* bytes in the run on its first field, 0 otherwise */
+};
+
+struct PlanLevel {
+    JavaType_Type *class_desc;
+    PlanField *fields;
+    size_t n_fields;
+    uint8_t is_boxed:1;         /* java.lang wrapper, decodes to its value */
+    uint8_t unused:7;
+};
+
+struct DecodePlan {
+    PlanLevel *levels;
+    size_t n_levels;
+    size_t n_fields;            /* over all levels */
+    uint8_t is_plain:1;         /* only default serialized levels, can be lazy */
+    uint8_t unused:7;
+};
 
 /* function declarations */
 
 static PyObject *
-java_stream_reader(PyObject *self, PyObject *args);
+java_stream_reader(PyObject *self, PyObject *args, PyObject *kwargs);
+
+static PyObject *
+java_stream_reader_bytes(PyObject *self, PyObject *args, PyObject *kwargs);
+
+static PyObject *
+stream_read_many(PyObject *self, PyObject *args, PyObject *kwargs);
+
+static void
+read_many_task(void *context, size_t task);
+
+static PyObject *
+iter_stream(PyObject *self, PyObject *args, PyObject *kwargs);
+
+static PyObject *
+read_records(PyObject *self, PyObject *args, PyObject *kwargs);
+
+static PyObject *
+read_records_one_pass(const char *buffer, size_t buffer_length, Reader *reader);
+
+static int
+open_source(PyObject *source, StreamFile *file, Py_buffer *view);
+
+static PyObject *
+scan_column(char typecode, size_t n, const void *items, size_t item_size, size_t offset);
+
+static PyObject *
+scan_result(const ScanIndex *index, const unsigned char *input);
+
+static PyObject *
+scan_stream(PyObject *self, PyObject *source);
+
+static PyObject *
+parse_top_level(Stream *stream, Reader *reader);
+
+static PyObject *
+StreamIterator_Next(StreamIteratorObject *self);
+
+static LazyStreamObject *
+LazyStream_New(void);
+
+static PyObject *
+read_lazy_stream(LazyStreamObject *context, const char *buffer, size_t buffer_length);
+
+static PyObject *
+LazyObject_Scan(Stream *stream, Reader *reader, JavaType_Type *class_desc);
+
+static int
+read_lazy_field(Stream *stream, Reader *reader, LazySlot *slot);
+
+static PyObject *
+LazyObject_Values(LazyObjectObject *self);
 
 static PyObject *
-read_stream(const char *stream, size_t buffer_length);
+build_projection(PyObject *paths);
+
+static int
+skip_content(Stream *stream, Reader *reader);
+
+static JavaType_Type *
+skip_object(Stream *stream, Reader *reader, uint32_t *handle);
+
+static JavaType_Type *
+parse_class_ref(Stream *stream, Reader *reader);
+
+static int
+skip_class_data(Stream *stream, Reader *reader, JavaType_Type *class_desc);
+
+static int
+skip_annotation(Stream *stream, Reader *reader);
 
 static PyObject *
-parse_stream(FILE *fd, Handles *handles);
+decode_skipped(Stream *stream, Reader *reader, JavaType_Type *node);
+
+static int
+StreamParser_Append(StreamParserObject *self, const void *data, size_t length);
 
 static PyObject *
-parse_tc_object(FILE *fd, Handles *handles);
+StreamParser_Feed(StreamParserObject *self, PyObject *data);
 
 static PyObject *
-parse_tc_string(FILE *fd, Handles *handles, char *dest, size_t string_length);
+StreamParser_Close(StreamParserObject *self, PyObject *unused);
+
+static void
+StreamIterator_Close(StreamIteratorObject *self);
+
+static void
+Reader_Init(Reader *reader);
+
+static void
+Reader_Release(Reader *reader);
+
+static int
+Reader_Begin(Reader *reader, size_t buffer_length);
+
+static int
+Reader_Reset(Reader *reader);
+
+static int
+read_stream_header(Stream *stream);
 
 static PyObject *
-parse_tc_longstring(FILE *fd, Handles *handles, char *dest);
+read_stream(const char *buffer, size_t buffer_length, Reader *reader);
+
+static PyObject *
+read_stream_native(const char *buffer, size_t buffer_length, Reader *reader);
+
+static void
+TapeBuilder_Init(TapeBuilder *b, const ScanIndex *index, Reader *reader,
+                 const char *buffer, size_t buffer_length);
+
+static PyObject *
+build_records(TapeBuilder *b);
+
+static void
+decode_deferred_task(void *context, size_t task);
+
+static void
+decode_deferred(TapeBuilder *b);
+
+static int
+predecode_window(TapeBuilder *b, size_t first);
+
+static void
+predecode_task(void *context, size_t task);
+
+static void
+predecode_node(const TapeBuilder *b, const ScanNode *node, TapeValue *v);
+
+static int
+utf8_next(const unsigned char *p, size_t n_bytes, size_t *i, uint32_t *c);
+
+static int
+predecode_string(const unsigned char *p, size_t n_bytes, TapeValue *v);
+
+static void
+release_window(TapeBuilder *b);
+
+static TapeValue *
+tape_value(TapeBuilder *b, size_t node);
 
 static PyObject *
-parse_tc_shortstring(FILE *fd, Handles *handles, char *dest);
+tape_diverged(TapeBuilder *b);
+
+static int
+tape_check_handle(TapeBuilder *b, uint32_t handle);
+
+static void
+tape_skip(TapeBuilder *b);
 
 static void
-parse_tc_classdesc(FILE *fd, Handles *handles, JavaType_Type *type);
+tape_skip_class_data(TapeBuilder *b, uint32_t desc);
+
+static int
+tape_native_class_desc(TapeBuilder *b, size_t node);
 
 static PyObject *
-parse_tc_reference(FILE *fd, Handles *handles);
+build_content(TapeBuilder *b);
 
 static PyObject *
-parse_tc_array(FILE *fd, Handles *handles);
+build_from_stream(TapeBuilder *b);
 
 static PyObject *
-get_value(FILE *fd, Handles *handles, char tc_num);
+build_string(TapeBuilder *b, const ScanNode *node);
 
 static JavaType_Type *
-get_field_descriptor(FILE *fd, Handles *handles);
+build_class_desc(TapeBuilder *b);
 
 static PyObject *
-get_values_class_desc(FILE *fd, Handles *handles, JavaType_Type *class_desc);
+build_object(TapeBuilder *b);
 
-static char *
-get_string(FILE *fd, size_t len);
+static PyObject *
+build_plan_level(TapeBuilder *b, const PlanLevel *level, PyObject *super);
 
-static uint32_t 
-get_unsigned_long(FILE *fd);
+static PyObject *
+build_field(TapeBuilder *b, const PlanField *op);
 
 static PyObject *
-get_signed_integer_value(FILE *fd);
+build_annotation(TapeBuilder *b, JavaType_Type *class_desc, PyObject *data);
 
-static uint16_t
-get_unsigned_short(FILE *fd);
+static PyObject *
+build_array(TapeBuilder *b);
 
-static int16_t 
-get_signed_short(FILE *fd);
+static PyObject *
+build_primitive_array(TapeBuilder *b, char typecode, const unsigned char *p, uint32_t n_elements);
+
+static void
+decode_chunk_task(void *context, size_t task);
+
+static void
+decode_unlocked(const Reader *reader, char typecode, void *dst, const unsigned char *src,
+                size_t n_elements);
 
 static PyObject *
-get_signed_short_value(FILE *fd);
+parse_stream(Stream *stream, Reader *reader);
 
-static size_t 
-get_size(FILE *fd);
+static PyObject *
+parse_tc_object(Stream *stream, Reader *reader);
 
-static char *
-get_size_and_string(FILE *fd);
+static JavaType_Type *
+read_tc_string(Stream *stream, Reader *reader, size_t string_length);
 
-static double
-get_signed_double(FILE *fd);
+static PyObject *
+parse_tc_string(Stream *stream, Reader *reader, char **dest, size_t string_length);
 
 static PyObject *
-get_double_value(FILE *fd);
+parse_tc_longstring(Stream *stream, Reader *reader, char **dest);
 
-static float
-get_signed_float(FILE *fd);
+static PyObject *
+parse_tc_shortstring(Stream *stream, Reader *reader, char **dest);
+
+static int
+parse_tc_classdesc(Stream *stream, Reader *reader, JavaType_Type *type);
+
+static int
+parse_classdesc_fields(Stream *stream, Reader *reader, JavaType_Type *type);
+
+static int
+read_cached_classdesc(Stream *stream, Reader *reader, JavaType_Type *type,
+                      const ClassCacheEntry *entry);
 
 static PyObject *
-get_float_value(FILE *fd);
+parse_tc_reference(Stream *stream, Reader *reader);
 
-static int64_t
-get_signed_long_long(FILE *fd);
+static PyObject *
+resolve_handle(Stream *stream, Reader *reader, uint32_t handle);
 
-static uint64_t 
-get_unsigned_long_long(FILE *fd);
+static PyObject *
+parse_tc_array(Stream *stream, Reader *reader);
+
+static int
+parse_multi_array(Stream *stream, Reader *reader, JavaType_Type *array,
+                  uint32_t n_elements, PyObject **out);
+
+static int
+fill_multi_array(Stream *stream, Reader *reader, MultiArray *m, int depth);
+
+static PyObject *
+get_value(Stream *stream, Reader *reader, char tc_num);
+
+static PyObject *
+unpack_primitive(const unsigned char *p, char tc_num);
+
+static PyObject *
+primitive_list(char typecode, const unsigned char *p, uint32_t n_elements);
+
+static PyObject *
+unpack_host(const void *p, char tc_num);
+
+static PyObject *
+host_list(char typecode, const void *data, uint32_t n_elements);
+
+static size_t
+primitive_size(char tc_num);
+
+static JavaType_Type *
+get_field_descriptor(Stream *stream, Reader *reader);
+
+static PyObject *
+get_values_class_desc(Stream *stream, Reader *reader, JavaType_Type *class_desc);
+
+static DecodePlan *
+compile_decode_plan(Reader *reader, JavaType_Type *class_desc);
 
 static PyObject *
-get_signed_long_value(FILE *fd);
+read_plan_level(Stream *stream, Reader *reader, const PlanLevel *level, PyObject *super);
+
+static PyObject *
+read_annotation(Stream *stream, Reader *reader, JavaType_Type *class_desc, PyObject *data);
+
+static int
+merge_super(const PlanLevel *level, PyObject *data, PyObject *super);
+
+static int
+make_field_keys(Reader *reader, JavaType_Type *field);
+
+static int
+resolve_handler(Reader *reader, JavaType_Type *class_desc);
+
+static char *
+get_string(Stream *stream, Arena *arena, size_t len);
+
+static uint32_t 
+get_unsigned_long(Stream *stream);
+
+static uint16_t
+get_unsigned_short(Stream *stream);
+
+static size_t 
+get_size(Stream *stream);
+
+static char *
+get_size_and_string(Stream *stream, Arena *arena);
+
+static int64_t
+get_signed_long_long(Stream *stream);
+
+static uint64_t 
+get_unsigned_long_long(Stream *stream);
 
 static unsigned char
-get_byte(FILE *fd);
+get_byte(Stream *stream);
+
+static void
+invalid_typecode(Stream *stream, unsigned char typecode, const char *expected);
 
 static unsigned char
-get_and_validate_field_typecode(FILE *fd);
+get_and_validate_field_typecode(Stream *stream);
 
 static unsigned char 
-get_and_validate_stream_typecode(FILE *fd);
+get_and_validate_stream_typecode(Stream *stream);
 
 static uint32_t 
-get_handle(FILE *fd);
+get_handle(Stream *stream);
+
+static PyObject *
+stream_failure(Stream *stream);
 
 
 
@@ -152,6 +565,20 @@ __test_parse_primitive_array(PyObject *self, PyObject *args);
 static PyObject *
 __test_parse_class_descriptor(PyObject *self, PyObject *args);
 
+static PyObject *
+__bswap_kernel(PyObject *self, PyObject *args);
+
+static PyObject *
+__class_cache_info(PyObject *self, PyObject *ignored);
+
+/* readObject registry */
+
+static PyObject *
+register_reader(PyObject *self, PyObject *args);
+
+static PyObject *
+unregister_reader(PyObject *self, PyObject *classname);
+
  /* java.util collections */
 
  /* Java Containers implements their own write methods
@@ -245,31 +672,31 @@ LinkedListBlock {
 
 /* referenced functions */
 static PyObject *
-List_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc);
+List_ReadObject(Stream *stream, Reader *reader, JavaType_Type *class_desc);
 
 static PyObject *
-parse_block_data(FILE *fd, Handles *handles, JavaType_Type *, PyObject *data);
+parse_block_data(Stream *stream, Reader *reader, JavaType_Type *, PyObject *data);
 
 static PyObject *
-BitSet_ReadObject(FILE *fd, Handles *handles, PyObject *dict);
+BitSet_ReadObject(Stream *stream, Reader *reader, PyObject *dict);
 
 static PyObject *
-Date_ReadObject(FILE *fd);
+Date_ReadObject(Stream *stream);
 
 static PyObject *
-EnumMap_ReadObject(FILE *fd);
+EnumMap_ReadObject(Stream *stream);
 
 static PyObject *
-HashMap_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc);
+HashMap_ReadObject(Stream *stream, Reader *reader, JavaType_Type *class_desc);
 
 static PyObject *
-HashSet_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_des);
+HashSet_ReadObject(Stream *stream, Reader *reader, JavaType_Type *class_des);
 
 static PyObject *
-HashTable_ReadObject(FILE *fd);
+HashTable_ReadObject(Stream *stream);
 
 static PyObject *
-IdentityHashMap_ReadObject(FILE *fd);
+IdentityHashMap_ReadObject(Stream *stream);
 
 static PyObject *
-PriorityQueue_ReadObject(FILE *fd, Handles *handles, JavaType_Type *class_desc);
\ No newline at end of file
+PriorityQueue_ReadObject(Stream *stream, Reader *reader, JavaType_Type *class_desc);
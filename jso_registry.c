@@ -0,0 +1,396 @@
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+#include "jso_registry.h"
+
+#define NATIVE_CAPSULE_NAME "jso_reader.ReadObjectFunc"
+
+/* class name -> callable or capsule holding a ReadObjectFunc */
+static PyObject *handlers;
+static ReadContentFunc read_content;
+static PyObject *StreamError;
+
+int
+Registry_Init(ReadContentFunc content_func, PyObject *stream_error)
+{
+    read_content = content_func;
+    StreamError = stream_error;
+    if (handlers == NULL) {
+        handlers = PyDict_New();
+        if (handlers == NULL) {
+            return -1;
+        }
+    }
+    return PyType_Ready(&BlockReader_Type);
+}
+
+int
+Registry_AddNative(const char *classname, ReadObjectFunc func)
+{
+    PyObject *capsule;
+    int status;
+
+    capsule = PyCapsule_New((void *)func, NATIVE_CAPSULE_NAME, NULL);
+    if (capsule == NULL) {
+        return -1;
+    }
+    status = PyDict_SetItemString(handlers, classname, capsule);
+    Py_DECREF(capsule);
+    return status;
+}
+
+int
+Registry_AddCallback(PyObject *classname, PyObject *callback)
+{
+    if (!PyUnicode_Check(classname)) {
+        PyErr_SetString(PyExc_TypeError, "classname must be a str");
+        return -1;
+    }
+    if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "handler must be callable");
+        return -1;
+    }
+    return PyDict_SetItem(handlers, classname, callback);
+}
+
+int
+Registry_Remove(PyObject *classname)
+{
+    return PyDict_DelItem(handlers, classname);
+}
+
+int
+Registry_Find(const char *classname, ReadObjectHandler *handler)
+{
+    PyObject *entry;
+
+    handler->func = NULL;
+    handler->callback = NULL;
+    if (PyDict_GET_SIZE(handlers) == 0) {
+        return 0;
+    }
+
+    entry = PyDict_GetItemString(handlers, classname);
+    if (entry == NULL) {
+        return 0;
+    }
+    if (PyCapsule_IsValid(entry, NATIVE_CAPSULE_NAME)) {
+        handler->func = (ReadObjectFunc)PyCapsule_GetPointer(entry, NATIVE_CAPSULE_NAME);
+    }
+    else {
+        Py_INCREF(entry);
+        handler->callback = entry;
+    }
+    return 1;
+}
+
+/* BlockReader */
+
+typedef struct {
+    PyObject_HEAD
+    Stream *stream;             /* NULL once the handler has returned */
+    Reader *reader;
+    size_t remaining;           /* unread bytes of the current block */
+} BlockReaderObject;
+
+static int
+block_check(BlockReaderObject *self)
+{
+    if (self->stream == NULL) {
+        PyErr_SetString(PyExc_ValueError, "BlockReader used outside of its handler");
+        return -1;
+    }
+    return 0;
+}
+
+static int
+block_truncated(BlockReaderObject *self)
+{
+    /* latch the cursor too, in case the handler swallows the exception */
+    Stream_Require(self->stream, 1);
+    PyErr_Format(StreamError, "unexpected end of stream at offset %zu",
+                 Stream_Tell(self->stream));
+    return -1;
+}
+
+static int
+block_next(BlockReaderObject *self)
+{
+    /* * Move on to the next block of data. Returns 1 when there is one,
+     * 0 at an object or the end of the annotation, -1 on error.
+     * */
+    Stream *stream = self->stream;
+    size_t length;
+    int tc;
+
+    while (self->remaining == 0) {
+        tc = Stream_Peek(stream);
+        if (tc == TC_BLOCKDATA) {
+            if (!Stream_Require(stream, 2)) {
+                return block_truncated(self);
+            }
+            Stream_U8(stream);
+            length = Stream_U8(stream);
+        }
+        else if (tc == TC_BLOCKDATALONG) {
+            if (!Stream_Require(stream, 5)) {
+                return block_truncated(self);
+            }
+            Stream_U8(stream);
+            length = Stream_BE32(stream);
+        }
+        else if (tc < 0) {
+            return block_truncated(self);
+        }
+        else {
+            return 0;
+        }
+        /* the whole block is checked up front, reads inside it can't fail */
+        if (!Stream_Require(stream, length)) {
+            return block_truncated(self);
+        }
+        self->remaining = length;
+    }
+    return 1;
+}
+
+static int
+block_read(BlockReaderObject *self, void *dst, size_t n_bytes)
+{
+    /* read 'n_bytes' of block data, which may span several blocks */
+    unsigned char *p = (unsigned char *)dst;
+    size_t chunk;
+    int status;
+
+    if (block_check(self) < 0) {
+        return -1;
+    }
+    while (n_bytes > 0) {
+        status = block_next(self);
+        if (status <= 0) {
+            if (status == 0) {
+                PyErr_SetString(PyExc_EOFError, "end of block data");
+            }
+            return -1;
+        }
+        chunk = n_bytes < self->remaining ? n_bytes : self->remaining;
+        memcpy(p, Stream_Take(self->stream, chunk), chunk);
+        self->remaining -= chunk;
+        p += chunk;
+        n_bytes -= chunk;
+    }
+    return 0;
+}
+
+static int
+block_skip_rest(BlockReaderObject *self)
+{
+    /* * Skip whatever the handler didn't read, up to the TC_ENDBLOCKDATA
+     * that closes the annotation. Objects are decoded and dropped so the
+     * handles they take stay in step with the stream.
+     * */
+    PyObject *ob;
+    int status;
+
+    for (;;) {
+        if (self->remaining != 0) {
+            Stream_Take(self->stream, self->remaining);
+            self->remaining = 0;
+        }
+        status = block_next(self);
+        if (status < 0) {
+            return -1;
+        }
+        if (status == 1) {
+            continue;
+        }
+        if (Stream_Peek(self->stream) == TC_ENDBLOCKDATA) {
+            return 0;
+        }
+        ob = read_content(self->stream, self->reader);
+        if (ob == NULL) {
+            return -1;
+        }
+        Py_DECREF(ob);
+    }
+}
+
+#define DEFINE_BLOCK_READ(name, size, expr)                             \
+static PyObject *                                                       \
+block_##name(BlockReaderObject *self, PyObject *Py_UNUSED(ignored))    \
+{                                                                       \
+    unsigned char p[size];                                              \
+                                                                        \
+    if (block_read(self, p, size) < 0) {                                \
+        return NULL;                                                    \
+    }                                                                   \
+    return expr;                                                        \
+}
+
+DEFINE_BLOCK_READ(read_byte, 1, PyLong_FromLong((long)(int8_t)p[0]))
+DEFINE_BLOCK_READ(read_unsigned_byte, 1, PyLong_FromLong((long)p[0]))
+DEFINE_BLOCK_READ(read_boolean, 1, PyBool_FromLong((long)(p[0] != 0)))
+DEFINE_BLOCK_READ(read_short, 2, PyLong_FromLong((long)(int16_t)load_be16(p)))
+DEFINE_BLOCK_READ(read_unsigned_short, 2, PyLong_FromLong((long)load_be16(p)))
+DEFINE_BLOCK_READ(read_char, 2, PyUnicode_FromOrdinal(load_be16(p)))
+DEFINE_BLOCK_READ(read_int, 4, PyLong_FromLong((long)(int32_t)load_be32(p)))
+DEFINE_BLOCK_READ(read_long, 8, PyLong_FromLongLong((long long)(int64_t)load_be64(p)))
+DEFINE_BLOCK_READ(read_float, 4, PyFloat_FromDouble((double)load_be_float(p)))
+DEFINE_BLOCK_READ(read_double, 8, PyFloat_FromDouble(load_be_double(p)))
+
+static PyObject *
+block_read_bytes(BlockReaderObject *self, PyObject *arg)
+{
+    Py_ssize_t n_bytes;
+    PyObject *bytes;
+
+    n_bytes = PyLong_AsSsize_t(arg);
+    if (n_bytes == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    if (n_bytes < 0) {
+        PyErr_SetString(PyExc_ValueError, "negative length");
+        return NULL;
+    }
+    bytes = PyBytes_FromStringAndSize(NULL, n_bytes);
+    if (bytes == NULL) {
+        return NULL;
+    }
+    if (block_read(self, PyBytes_AS_STRING(bytes), (size_t)n_bytes) < 0) {
+        Py_DECREF(bytes);
+        return NULL;
+    }
+    return bytes;
+}
+
+static PyObject *
+block_read_utf(BlockReaderObject *self, PyObject *Py_UNUSED(ignored))
+{
+    /* DataOutput.writeUTF: a 2 byte length and modified utf-8 */
+    unsigned char p[2];
+    char buffer[256];
+    char *text = buffer;
+    PyObject *string;
+    size_t length;
+
+    if (block_read(self, p, 2) < 0) {
+        return NULL;
+    }
+    length = load_be16(p);
+    if (length > sizeof(buffer)) {
+        text = (char *)PyMem_Malloc(length);
+        if (text == NULL) {
+            return PyErr_NoMemory();
+        }
+    }
+    if (block_read(self, text, length) < 0) {
+        string = NULL;
+    }
+    else {
+        string = PyUnicode_DecodeUTF8(text, (Py_ssize_t)length, "surrogatepass");
+    }
+    if (text != buffer) {
+        PyMem_Free(text);
+    }
+    return string;
+}
+
+static PyObject *
+block_read_object(BlockReaderObject *self, PyObject *Py_UNUSED(ignored))
+{
+    /* ObjectInput.readObject: the next object of the annotation */
+    int tc;
+
+    if (block_check(self) < 0) {
+        return NULL;
+    }
+    if (self->remaining != 0) {
+        PyErr_Format(StreamError, "%zu bytes of block data left before the object",
+                     self->remaining);
+        return NULL;
+    }
+    tc = Stream_Peek(self->stream);
+    if (tc == TC_ENDBLOCKDATA) {
+        PyErr_SetString(PyExc_EOFError, "end of block data");
+        return NULL;
+    }
+    if (tc == TC_BLOCKDATA || tc == TC_BLOCKDATALONG) {
+        PyErr_Format(StreamError, "expected an object, found block data at offset %zu",
+                     Stream_Tell(self->stream));
+        return NULL;
+    }
+    if (tc < 0) {
+        block_truncated(self);
+        return NULL;
+    }
+    return read_content(self->stream, self->reader);
+}
+
+PyObject *
+Registry_Call(PyObject *callback, Stream *stream, Reader *reader, PyObject *fields)
+{
+    BlockReaderObject *block;
+    PyObject *result;
+
+    block = PyObject_New(BlockReaderObject, &BlockReader_Type);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->stream = stream;
+    block->reader = reader;
+    block->remaining = 0;
+
+    result = PyObject_CallFunctionObjArgs(callback, (PyObject *)block, fields, NULL);
+    if (result != NULL && block_skip_rest(block) < 0) {
+        Py_CLEAR(result);
+    }
+
+    /* the block reader may outlive the call, but not the stream */
+    block->stream = NULL;
+    block->reader = NULL;
+    Py_DECREF(block);
+    return result;
+}
+
+static JsoReader_CAPI capi;
+
+PyObject *
+Registry_CapsuleNew(void)
+{
+    capi.register_native = Registry_AddNative;
+    capi.read_content = read_content;
+    return PyCapsule_New(&capi, JSO_READER_CAPI_NAME, NULL);
+}
+
+static void
+block_dealloc(BlockReaderObject *self)
+{
+    PyObject_Free(self);
+}
+
+static PyMethodDef block_methods[] = {
+    {"read_byte", (PyCFunction)block_read_byte, METH_NOARGS, "DataInput.readByte"},
+    {"read_unsigned_byte", (PyCFunction)block_read_unsigned_byte, METH_NOARGS, "DataInput.readUnsignedByte"},
+    {"read_boolean", (PyCFunction)block_read_boolean, METH_NOARGS, "DataInput.readBoolean"},
+    {"read_short", (PyCFunction)block_read_short, METH_NOARGS, "DataInput.readShort"},
+    {"read_unsigned_short", (PyCFunction)block_read_unsigned_short, METH_NOARGS, "DataInput.readUnsignedShort"},
+    {"read_char", (PyCFunction)block_read_char, METH_NOARGS, "DataInput.readChar"},
+    {"read_int", (PyCFunction)block_read_int, METH_NOARGS, "DataInput.readInt"},
+    {"read_long", (PyCFunction)block_read_long, METH_NOARGS, "DataInput.readLong"},
+    {"read_float", (PyCFunction)block_read_float, METH_NOARGS, "DataInput.readFloat"},
+    {"read_double", (PyCFunction)block_read_double, METH_NOARGS, "DataInput.readDouble"},
+    {"read_bytes", (PyCFunction)block_read_bytes, METH_O, "read_bytes(n): DataInput.readFully"},
+    {"read_utf", (PyCFunction)block_read_utf, METH_NOARGS, "DataInput.readUTF"},
+    {"read_object", (PyCFunction)block_read_object, METH_NOARGS, "ObjectInput.readObject"},
+    {NULL, NULL, 0, NULL}
+};
+
+PyTypeObject BlockReader_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "jso_reader.BlockReader",
+    .tp_basicsize = sizeof(BlockReaderObject),
+    .tp_dealloc = (destructor)block_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "reads the writeObject() data of a class, valid during its handler",
+    .tp_methods = block_methods,
+};
@@ -0,0 +1,73 @@
+#ifndef JSO_REGISTRY_H
+#define JSO_REGISTRY_H
+
+#include <Python.h>
+#include "javatype.h"
+#include "jso_stream.h"
+
+/* * The readObject registry maps class names to handlers for the data a
+ * class's writeObject() writes after its fields. A handler is either
+ *
+ *     native: a ReadObjectFunc with the same contract as the built in
+ *             collection readers (HashMap_ReadObject, ...). It is called
+ *             with the TC_BLOCKDATA tag already consumed and returns the
+ *             object that replaces the field dict.
+ *
+ *     python: a callable(block, fields) where 'block' is a BlockReader
+ *             over the annotation and 'fields' the dict of the default
+ *             fields. Its return value replaces the field dict. Data the
+ *             callable leaves unread is skipped.
+ *
+ * A registered handler takes precedence over the built in readers. Each
+ * class descriptor looks its handler up once, the first time an instance
+ * of it is decoded.
+ * */
+
+typedef struct Reader Reader;
+
+typedef PyObject *(*ReadObjectFunc)(Stream *stream, Reader *reader, JavaType_Type *class_desc);
+typedef PyObject *(*ReadContentFunc)(Stream *stream, Reader *reader);
+
+struct ReadObjectHandler {
+    ReadObjectFunc func;        /* native handler, or NULL */
+    PyObject *callback;         /* python handler, or NULL */
+};
+
+/* exported in the jso_reader._C_API capsule for other extensions */
+typedef struct {
+    int (*register_native)(const char *classname, ReadObjectFunc func);
+    ReadContentFunc read_content;   /* decode the next object of the stream */
+} JsoReader_CAPI;
+
+#define JSO_READER_CAPI_NAME "jso_reader._C_API"
+
+extern PyTypeObject BlockReader_Type;
+
+/* 'read_content' decodes one object, 'stream_error' is raised on bad data */
+int
+Registry_Init(ReadContentFunc read_content, PyObject *stream_error);
+
+int
+Registry_AddNative(const char *classname, ReadObjectFunc func);
+
+int
+Registry_AddCallback(PyObject *classname, PyObject *callback);
+
+/* returns 0, or -1 with KeyError set if nothing was registered */
+int
+Registry_Remove(PyObject *classname);
+
+/* * Returns 1 and fills in 'handler' if 'classname' has a handler, with a
+ * new reference to the callback, 0 if it hasn't and -1 on error.
+ * */
+int
+Registry_Find(const char *classname, ReadObjectHandler *handler);
+
+/* run a python handler over the annotation at the stream position */
+PyObject *
+Registry_Call(PyObject *callback, Stream *stream, Reader *reader, PyObject *fields);
+
+PyObject *
+Registry_CapsuleNew(void);
+
+#endif /* JSO_REGISTRY_H */
@@ -0,0 +1,739 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jso_scan.h"
+#include "jso_stream.h"
+
+/* most table entries reserved before the scan, about 32MB of handles */
+#define SCAN_RESERVE_MAX ((size_t)1 << 20)
+
+static int
+scan_content(ScanIndex *index, Stream *stream, int depth, uint32_t *handle);
+
+static int
+scan_class_desc(ScanIndex *index, Stream *stream, int depth, uint32_t *handle);
+
+void
+ScanIndex_Init(ScanIndex *index)
+{
+    memset(index, 0, sizeof(ScanIndex));
+}
+
+void
+ScanIndex_Release(ScanIndex *index)
+{
+    free(index->handles);
+    free(index->records);
+    free(index->classes);
+    free(index->pool);
+    free(index->nodes);
+    ScanIndex_Init(index);
+}
+
+static int
+fail(ScanIndex *index, const Stream *stream, const char *message)
+{
+    /* the first error wins, callers up the recursion just pass -1 on */
+    if (index->error == NULL) {
+        index->error = message;
+        index->error_offset = Stream_Tell(stream);
+    }
+    return -1;
+}
+
+static int
+need(ScanIndex *index, Stream *stream, size_t n_bytes)
+{
+    if (!Stream_Require(stream, n_bytes)) {
+        return fail(index, stream, "unexpected end of stream");
+    }
+    return 0;
+}
+
+static int
+grow(void **items, size_t *reserved, size_t needed, size_t item_size)
+{
+    /* make room for 'needed' items, doubling */
+    size_t size = *reserved != 0 ? *reserved : 64;
+    void *p;
+
+    if (needed <= *reserved) {
+        return 0;
+    }
+    while (size < needed) {
+        size *= 2;
+    }
+    p = realloc(*items, size * item_size);
+    if (p == NULL) {
+        return -1;
+    }
+    *items = p;
+    *reserved = size;
+    return 0;
+}
+
+static int
+emit(ScanIndex *index, Stream *stream, uint8_t type, uint32_t handle, uint32_t count,
+     uint64_t value)
+{
+    /* append a node to the tape, if there is one and we're not in a descriptor */
+    ScanNode *node;
+
+    if (!index->with_nodes || index->quiet) {
+        return 0;
+    }
+    if (grow((void **)&index->nodes, &index->reserved_nodes,
+             index->n_nodes + 1, sizeof(ScanNode)) < 0) {
+        return fail(index, stream, "out of memory");
+    }
+    node = &index->nodes[index->n_nodes++];
+    node->value = value;
+    node->handle = handle;
+    node->count = count;
+    node->type = type;
+    return 0;
+}
+
+static uint64_t
+offset_of(const Stream *stream, const unsigned char *p)
+{
+    return (uint64_t)(p - stream->start);
+}
+
+static uint32_t
+new_handle(ScanIndex *index, Stream *stream, uint8_t type, const unsigned char *start)
+{
+    ScanHandle *h;
+
+    if (index->n_handles >= SCAN_NONE - 1
+        || grow((void **)&index->handles, &index->reserved_handles,
+                index->n_handles + 1, sizeof(ScanHandle)) < 0) {
+        fail(index, stream, "out of memory");
+        return SCAN_NONE;
+    }
+    h = &index->handles[index->n_handles];
+    h->offset = (uint64_t)(start - stream->start);
+    h->length = 0;
+    h->class_handle = SCAN_NONE;
+    h->layout = SCAN_NONE;
+    h->type = type;
+    return (uint32_t)index->n_handles++;
+}
+
+static void
+end_handle(ScanIndex *index, Stream *stream, uint32_t handle)
+{
+    ScanHandle *h = &index->handles[handle];
+
+    h->length = (uint64_t)(stream->pos - stream->start) - h->offset;
+}
+
+static uint32_t
+resolve(ScanIndex *index, Stream *stream)
+{
+    /* the handle a 4 byte wire handle refers to, in the current generation */
+    uint32_t wire;
+    size_t i;
+
+    if (need(index, stream, 4) < 0) {
+        return SCAN_NONE;
+    }
+    wire = Stream_BE32(stream);
+    i = index->generation + (size_t)(wire - BASE_WIRE_HANDLE);
+    if (wire < BASE_WIRE_HANDLE || i >= index->n_handles) {
+        fail(index, stream, "reference to an unknown handle");
+        return SCAN_NONE;
+    }
+    return (uint32_t)i;
+}
+
+static int
+skip_utf(ScanIndex *index, Stream *stream, uint64_t *offset, uint16_t *length)
+{
+    /* 2 byte length and modified utf-8, as in class and field names */
+    uint16_t n;
+
+    if (need(index, stream, 2) < 0) {
+        return -1;
+    }
+    n = Stream_BE16(stream);
+    if (need(index, stream, n) < 0) {
+        return -1;
+    }
+    if (offset != NULL) {
+        *offset = (uint64_t)Stream_Tell(stream);
+        *length = n;
+    }
+    Stream_Take(stream, n);
+    return 0;
+}
+
+static int
+scan_annotation(ScanIndex *index, Stream *stream, int depth)
+{
+    /* block data and objects up to and including the TC_ENDBLOCKDATA */
+    uint32_t handle;
+    size_t length;
+    int tc;
+
+    for (;;) {
+        if (need(index, stream, 1) < 0) {
+            return -1;
+        }
+        tc = Stream_Peek(stream);
+        if (tc == TC_ENDBLOCKDATA) {
+            Stream_U8(stream);
+            return emit(index, stream, TC_ENDBLOCKDATA, SCAN_NONE, 0,
+                        offset_of(stream, stream->pos - 1));
+        }
+        if (tc == TC_BLOCKDATA || tc == TC_BLOCKDATALONG) {
+            if (need(index, stream, tc == TC_BLOCKDATA ? 2 : 5) < 0) {
+                return -1;
+            }
+            Stream_U8(stream);
+            length = tc == TC_BLOCKDATA ? Stream_U8(stream) : Stream_BE32(stream);
+            if (need(index, stream, length) < 0
+                || emit(index, stream, TC_BLOCKDATA, SCAN_NONE, (uint32_t)length,
+                        offset_of(stream, stream->pos)) < 0) {
+                return -1;
+            }
+            Stream_Take(stream, length);
+        }
+        else if (scan_content(index, stream, depth + 1, &handle) < 0) {
+            return -1;
+        }
+    }
+}
+
+static int
+scan_object_annotation(ScanIndex *index, Stream *stream, int depth)
+{
+    /* * The annotation of one class of an object, under a SCAN_ANNOTATION
+     * node that counts the nodes in it.
+     * */
+    size_t first = index->n_nodes;
+
+    if (emit(index, stream, SCAN_ANNOTATION, SCAN_NONE, 0, offset_of(stream, stream->pos)) < 0
+        || scan_annotation(index, stream, depth) < 0) {
+        return -1;
+    }
+    if (index->with_nodes && !index->quiet) {
+        if (index->n_nodes - first - 1 > (size_t)UINT32_MAX) {
+            return fail(index, stream, "annotation too large to index");
+        }
+        index->nodes[first].count = (uint32_t)(index->n_nodes - first - 1);
+    }
+    return 0;
+}
+
+static size_t
+field_size(int typecode)
+{
+    /* bytes of a primitive field, 0 for object fields and -1 if invalid */
+    switch (typecode) {
+        case 'B': case 'Z': return 1;
+        case 'C': case 'S': return 2;
+        case 'F': case 'I': return 4;
+        case 'D': case 'J': return 8;
+        case 'L': case '[': return 0;
+        default: return (size_t)-1;
+    }
+}
+
+static int
+scan_fields(ScanIndex *index, Stream *stream, int depth, ScanClass *cls)
+{
+    /* the field table of a TC_CLASSDESC, typecodes go to the pool */
+    uint32_t handle;
+    uint16_t i;
+    int tc;
+
+    if (grow((void **)&index->pool, &index->pool_reserved,
+             index->pool_length + cls->n_fields, 1) < 0) {
+        return fail(index, stream, "out of memory");
+    }
+    cls->typecodes = index->pool_length;
+    index->pool_length += cls->n_fields;
+
+    for (i = 0; i < cls->n_fields; i++) {
+        if (need(index, stream, 1) < 0) {
+            return -1;
+        }
+        tc = Stream_U8(stream);
+        if (field_size(tc) == (size_t)-1) {
+            return fail(index, stream, "invalid field typecode");
+        }
+        index->pool[cls->typecodes + i] = (char)tc;
+        if (skip_utf(index, stream, NULL, NULL) < 0) {
+            return -1;
+        }
+        if (field_size(tc) == 0) {
+            /* * the field's class name, a string or a reference to one;
+             * anything else could refer to the class still being defined
+             * */
+            if (need(index, stream, 1) < 0) {
+                return -1;
+            }
+            tc = Stream_Peek(stream);
+            if (tc != TC_STRING && tc != TC_LONGSTRING && tc != TC_REFERENCE) {
+                return fail(index, stream, "field class name is not a string");
+            }
+            if (scan_content(index, stream, depth + 1, &handle) < 0) {
+                return -1;
+            }
+            if (handle == SCAN_NONE || index->handles[handle].type != TC_STRING) {
+                return fail(index, stream, "field class name is not a string");
+            }
+        }
+    }
+    return 0;
+}
+
+static uint32_t
+new_class(ScanIndex *index, Stream *stream, uint64_t name_offset, uint16_t name_length,
+          uint8_t flags, uint16_t n_fields)
+{
+    ScanClass *cls;
+
+    if (grow((void **)&index->classes, &index->reserved_classes,
+             index->n_classes + 1, sizeof(ScanClass)) < 0) {
+        fail(index, stream, "out of memory");
+        return SCAN_NONE;
+    }
+    cls = &index->classes[index->n_classes];
+    cls->name_offset = name_offset;
+    cls->name_length = name_length;
+    cls->flags = flags;
+    cls->element = name_length >= 2 && stream->start[name_offset] == '['
+        ? (char)stream->start[name_offset + 1] : 0;
+    cls->n_fields = n_fields;
+    cls->typecodes = index->pool_length;
+    return (uint32_t)index->n_classes++;
+}
+
+static int
+scan_class_desc(ScanIndex *index, Stream *stream, int depth, uint32_t *handle)
+{
+    /* * classDesc: a new descriptor, a proxy descriptor, null or a
+     * reference to one. '*handle' is the descriptor or SCAN_NONE.
+     * */
+    const unsigned char *start = stream->pos;
+    uint64_t name_offset;
+    uint16_t name_length;
+    uint32_t h, layout, super, i, n_interfaces;
+    uint8_t flags;
+    uint16_t n_fields;
+    int tc;
+
+    if (depth > SCAN_MAX_DEPTH) {
+        return fail(index, stream, "nesting too deep");
+    }
+    if (need(index, stream, 1) < 0) {
+        return -1;
+    }
+    tc = Stream_U8(stream);
+    switch (tc) {
+        case TC_NULL:
+            *handle = SCAN_NONE;
+            return emit(index, stream, TC_NULL, SCAN_NONE, 0, offset_of(stream, start));
+        case TC_REFERENCE:
+            h = resolve(index, stream);
+            if (h == SCAN_NONE) {
+                return -1;
+            }
+            if (index->handles[h].type != TC_CLASSDESC
+                && index->handles[h].type != TC_PROXYCLASSDESC) {
+                return fail(index, stream, "reference to a class descriptor that isn't one");
+            }
+            *handle = h;
+            return emit(index, stream, TC_REFERENCE, h, 0, offset_of(stream, start));
+        case TC_CLASSDESC:
+            if (skip_utf(index, stream, &name_offset, &name_length) < 0
+                || need(index, stream, 8 + 1 + 2) < 0) {
+                return -1;
+            }
+            Stream_BE64(stream);    /* serialVersionUID */
+            h = new_handle(index, stream, TC_CLASSDESC, start);
+            if (h == SCAN_NONE || emit(index, stream, TC_CLASSDESC, h, 0, 0) < 0) {
+                return -1;
+            }
+            index->quiet++;
+            flags = Stream_U8(stream);
+            n_fields = Stream_BE16(stream);
+            layout = new_class(index, stream, name_offset, name_length, flags, n_fields);
+            if (layout == SCAN_NONE) {
+                return -1;
+            }
+            /* the descriptor is usable by the time anything can refer to it */
+            index->handles[h].layout = layout;
+            if (scan_fields(index, stream, depth, &index->classes[layout]) < 0) {
+                return -1;
+            }
+            break;
+        case TC_PROXYCLASSDESC:
+            h = new_handle(index, stream, TC_PROXYCLASSDESC, start);
+            if (h == SCAN_NONE || emit(index, stream, TC_PROXYCLASSDESC, h, 0, 0) < 0
+                || need(index, stream, 4) < 0) {
+                return -1;
+            }
+            index->quiet++;
+            n_interfaces = Stream_BE32(stream);
+            for (i = 0; i < n_interfaces; i++) {
+                if (skip_utf(index, stream, NULL, NULL) < 0) {
+                    return -1;
+                }
+            }
+            layout = new_class(index, stream, 0, 0, SC_SERIALIZABLE, 0);
+            if (layout == SCAN_NONE) {
+                return -1;
+            }
+            index->handles[h].layout = layout;
+            break;
+        default:
+            stream->pos--;
+            return fail(index, stream, "expected a class descriptor");
+    }
+
+    /* classAnnotation and superClassDesc */
+    if (scan_annotation(index, stream, depth) < 0
+        || scan_class_desc(index, stream, depth + 1, &super) < 0) {
+        return -1;
+    }
+    index->quiet--;
+    index->handles[h].class_handle = super;
+    end_handle(index, stream, h);
+    *handle = h;
+    return 0;
+}
+
+static int
+scan_class_data(ScanIndex *index, Stream *stream, int depth, uint32_t desc)
+{
+    /* * classdata of an instance of 'desc': the values of each class in
+     * the hierarchy, superclass first.
+     * */
+    const ScanClass *cls;
+    uint32_t handle;
+    size_t i, size;
+    int tc;
+
+    if (depth > SCAN_MAX_DEPTH) {
+        return fail(index, stream, "nesting too deep");
+    }
+    if (index->handles[desc].class_handle != SCAN_NONE
+        && scan_class_data(index, stream, depth + 1, index->handles[desc].class_handle) < 0) {
+        return -1;
+    }
+
+    /* 'classes' may move while the fields recurse, so index it each time */
+    if (index->classes[index->handles[desc].layout].flags & SC_SERIALIZABLE) {
+        for (i = 0; i < index->classes[index->handles[desc].layout].n_fields; i++) {
+            cls = &index->classes[index->handles[desc].layout];
+            tc = index->pool[cls->typecodes + i];
+            size = field_size(tc);
+            if (size != 0) {
+                if (need(index, stream, size) < 0
+                    || emit(index, stream, (uint8_t)tc, SCAN_NONE, 0,
+                            offset_of(stream, stream->pos)) < 0) {
+                    return -1;
+                }
+                Stream_Take(stream, size);
+            }
+            else if (scan_content(index, stream, depth + 1, &handle) < 0) {
+                return -1;
+            }
+        }
+        cls = &index->classes[index->handles[desc].layout];
+        if (cls->flags & SC_WRITE_METHOD) {
+            return scan_object_annotation(index, stream, depth);
+        }
+        return 0;
+    }
+    cls = &index->classes[index->handles[desc].layout];
+    if (cls->flags & SC_EXTERNALIZABLE) {
+        if (!(cls->flags & SC_BLOCK_DATA)) {
+            return fail(index, stream, "externalizable data written with protocol 1");
+        }
+        return scan_object_annotation(index, stream, depth);
+    }
+    return 0;
+}
+
+static int
+scan_array(ScanIndex *index, Stream *stream, int depth, uint32_t array, size_t node)
+{
+    const ScanClass *cls;
+    uint32_t n_elements, i, handle;
+    size_t size;
+    int tc;
+
+    cls = &index->classes[index->handles[index->handles[array].class_handle].layout];
+    if (cls->element == 0) {
+        return fail(index, stream, "array with a class that isn't an array class");
+    }
+    tc = cls->element;
+    size = field_size(tc);
+    if (size == (size_t)-1) {
+        return fail(index, stream, "invalid array element type");
+    }
+    if (need(index, stream, 4) < 0) {
+        return -1;
+    }
+    n_elements = Stream_BE32(stream);
+    if (index->with_nodes && !index->quiet) {
+        index->nodes[node].count = n_elements;
+        index->nodes[node].value = offset_of(stream, stream->pos);
+    }
+    if (size != 0) {
+        if (!Stream_RequireArray(stream, n_elements, size)) {
+            return fail(index, stream, "unexpected end of stream");
+        }
+        Stream_Take(stream, (size_t)n_elements * size);
+        return 0;
+    }
+    for (i = 0; i < n_elements; i++) {
+        if (scan_content(index, stream, depth + 1, &handle) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+scan_content(ScanIndex *index, Stream *stream, int depth, uint32_t *handle)
+{
+    /* * One object in an object position: a field value, an array
+     * element, an annotation object or a top-level record. '*handle' is
+     * what it resolves to, SCAN_NONE for null.
+     * */
+    const unsigned char *start = stream->pos;
+    uint32_t h, desc;
+    size_t length, node;
+    int tc;
+
+    if (depth > SCAN_MAX_DEPTH) {
+        return fail(index, stream, "nesting too deep");
+    }
+    if (need(index, stream, 1) < 0) {
+        return -1;
+    }
+    tc = Stream_Peek(stream);
+    switch (tc) {
+        case TC_NULL:
+            Stream_U8(stream);
+            *handle = SCAN_NONE;
+            return emit(index, stream, TC_NULL, SCAN_NONE, 0, offset_of(stream, start));
+        case TC_REFERENCE:
+            Stream_U8(stream);
+            *handle = resolve(index, stream);
+            if (*handle == SCAN_NONE) {
+                return -1;
+            }
+            return emit(index, stream, TC_REFERENCE, *handle, 0, offset_of(stream, start));
+        case TC_CLASSDESC:
+        case TC_PROXYCLASSDESC:
+            return scan_class_desc(index, stream, depth, handle);
+        case TC_STRING:
+        case TC_LONGSTRING:
+            Stream_U8(stream);
+            h = new_handle(index, stream, TC_STRING, start);
+            if (h == SCAN_NONE || need(index, stream, tc == TC_STRING ? 2 : 8) < 0) {
+                return -1;
+            }
+            if (tc == TC_STRING) {
+                length = Stream_BE16(stream);
+            }
+            else {
+                uint64_t long_length = Stream_BE64(stream);
+
+                if (long_length > (uint64_t)(SIZE_MAX - Stream_Tell(stream))) {
+                    return fail(index, stream, "string too long");
+                }
+                length = (size_t)long_length;
+            }
+            if (need(index, stream, length) < 0
+                || emit(index, stream, TC_STRING, h, 0, offset_of(stream, stream->pos)) < 0) {
+                return -1;
+            }
+            Stream_Take(stream, length);
+            break;
+        case TC_OBJECT:
+        case TC_ARRAY:
+        case TC_ENUM:
+        case TC_CLASS:
+            Stream_U8(stream);
+            /* the handle comes after the descriptor, the node before it */
+            node = index->n_nodes;
+            if (emit(index, stream, (uint8_t)tc, SCAN_NONE, 0, 0) < 0
+                || scan_class_desc(index, stream, depth + 1, &desc) < 0) {
+                return -1;
+            }
+            if (desc == SCAN_NONE) {
+                return fail(index, stream, "object without a class descriptor");
+            }
+            h = new_handle(index, stream, (uint8_t)tc, start);
+            if (h == SCAN_NONE) {
+                return -1;
+            }
+            if (index->with_nodes && !index->quiet) {
+                index->nodes[node].handle = h;
+            }
+            index->handles[h].class_handle = desc;
+            if (tc == TC_OBJECT && scan_class_data(index, stream, depth + 1, desc) < 0) {
+                return -1;
+            }
+            if (tc == TC_ARRAY && scan_array(index, stream, depth, h, node) < 0) {
+                return -1;
+            }
+            if (tc == TC_ENUM) {
+                /* the constant's name */
+                uint32_t name;
+
+                if (scan_content(index, stream, depth + 1, &name) < 0) {
+                    return -1;
+                }
+                if (name == SCAN_NONE || index->handles[name].type != TC_STRING) {
+                    return fail(index, stream, "enum constant name is not a string");
+                }
+            }
+            break;
+        case TC_EXCEPTION:
+            return fail(index, stream, "the writer failed and wrote an exception");
+        default:
+            return fail(index, stream, "unexpected typecode");
+    }
+    end_handle(index, stream, h);
+    *handle = h;
+    return 0;
+}
+
+static int
+add_record(ScanIndex *index, Stream *stream, const unsigned char *start, uint8_t type,
+           uint32_t handle)
+{
+    ScanRecord *record;
+
+    if (grow((void **)&index->records, &index->reserved_records,
+             index->n_records + 1, sizeof(ScanRecord)) < 0) {
+        return fail(index, stream, "out of memory");
+    }
+    record = &index->records[index->n_records++];
+    record->offset = (uint64_t)(start - stream->start);
+    record->length = (uint64_t)(stream->pos - start);
+    record->handle = handle;
+    record->type = type;
+    return 0;
+}
+
+static int
+scan_record(ScanIndex *index, Stream *stream)
+{
+    /* one top-level record, block data or TC_RESET */
+    const unsigned char *start = stream->pos;
+    size_t block_length, node, first_handle;
+    uint32_t handle;
+    int tc;
+
+    tc = Stream_Peek(stream);
+    node = index->n_nodes;
+    first_handle = index->n_handles;
+    if (tc == TC_RESET) {
+        Stream_U8(stream);
+        index->generation = index->n_handles;
+        return emit(index, stream, TC_RESET, SCAN_NONE, 0, offset_of(stream, start));
+    }
+    if (tc == TC_BLOCKDATA || tc == TC_BLOCKDATALONG) {
+        /* data written with the DataOutput methods of the stream itself */
+        if (need(index, stream, tc == TC_BLOCKDATA ? 2 : 5) < 0) {
+            return -1;
+        }
+        Stream_U8(stream);
+        block_length = tc == TC_BLOCKDATA ? Stream_U8(stream) : Stream_BE32(stream);
+        if (need(index, stream, block_length) < 0
+            || emit(index, stream, TC_BLOCKDATA, SCAN_NONE, (uint32_t)block_length,
+                    offset_of(stream, stream->pos)) < 0) {
+            return -1;
+        }
+        Stream_Take(stream, block_length);
+        handle = SCAN_NONE;
+    }
+    else if (scan_content(index, stream, 0, &handle) < 0) {
+        return -1;
+    }
+    if (add_record(index, stream, start, (uint8_t)tc, handle) < 0) {
+        return -1;
+    }
+    index->records[index->n_records - 1].node = node;
+    index->records[index->n_records - 1].generation = index->generation;
+    index->records[index->n_records - 1].first_handle = first_handle;
+    index->records[index->n_records - 1].n_handles = index->n_handles - first_handle;
+    return 0;
+}
+
+int
+Scan_Stream(ScanIndex *index, const void *buffer, size_t length)
+{
+    Stream stream;
+    size_t estimate;
+
+    Stream_Init(&stream, buffer, length);
+    /* * reserve for a typical object stream up front: growing the tables
+     * while they interleave on the heap costs more than the scan itself.
+     * Only a hint, capped so a giant array file doesn't ask for several
+     * times its size; the tables grow from there as needed.
+     * */
+    estimate = length / 16 + 1;
+    grow((void **)&index->handles, &index->reserved_handles,
+         estimate < SCAN_RESERVE_MAX ? estimate : SCAN_RESERVE_MAX, sizeof(ScanHandle));
+    if (index->with_nodes) {
+        estimate = length / 8 + 1;
+        grow((void **)&index->nodes, &index->reserved_nodes,
+             estimate < SCAN_RESERVE_MAX ? estimate : SCAN_RESERVE_MAX, sizeof(ScanNode));
+    }
+    if (need(index, &stream, 4) < 0) {
+        return -1;
+    }
+    if (Stream_BE32(&stream) != 0xaced0005) {
+        stream.pos -= 4;
+        return fail(index, &stream, "not a java serialization stream");
+    }
+
+    while (Stream_Peek(&stream) >= 0
+           && (index->max_records == 0 || index->n_records < index->max_records)) {
+        if (scan_record(index, &stream) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+Scan_Record(ScanIndex *index, const void *buffer, size_t length, size_t *used)
+{
+    /* * A record cut short takes back everything it added, so the next
+     * attempt starts from the same tables.
+     * */
+    Stream stream;
+    size_t n_handles = index->n_handles;
+    size_t n_records = index->n_records;
+    size_t n_classes = index->n_classes;
+    size_t pool_length = index->pool_length;
+    size_t n_nodes = index->n_nodes;
+
+    Stream_Init(&stream, buffer, length);
+    if (scan_record(index, &stream) == 0) {
+        *used = Stream_Tell(&stream);
+        return 1;
+    }
+    if (stream.error != STREAM_EOF) {
+        return -1;
+    }
+    *used = Stream_Tell(&stream) + stream.missing;
+    index->n_handles = n_handles;
+    index->n_records = n_records;
+    index->n_classes = n_classes;
+    index->pool_length = pool_length;
+    index->n_nodes = n_nodes;
+    index->quiet = 0;
+    index->error = NULL;
+    return 0;
+}
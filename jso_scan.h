@@ -0,0 +1,141 @@
+#ifndef JSO_SCAN_H
+#define JSO_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* * A ScanIndex is the structure of a whole stream without any of its
+ * values: where every handle and every top-level record starts, how
+ * long it is, what it is and which class it belongs to. Scan_Stream
+ * builds one in a single pass over the grammar that only steps the
+ * cursor and appends to flat arrays, so it runs close to the speed of
+ * reading the input, and it doubles as a full validation of the stream.
+ *
+ * Nothing here depends on Python. Class and field names are kept as
+ * offsets into the input, which the caller keeps alive with the index.
+ *
+ * Handles are numbered by their index in 'handles'. A TC_RESET starts
+ * a new generation: later wire handles resolve against the handles
+ * issued since the reset, but the index keeps every handle it saw.
+ *
+ * With 'with_nodes' set the scan also writes the content as a tape of
+ * ScanNodes in stream order, the native tree a reader materializes
+ * without walking the grammar again:
+ *
+ *     TC_NULL, TC_REFERENCE   value is the offset of the typecode
+ *     TC_STRING               a new string, value is the offset of its chars
+ *     TC_OBJECT               the class descriptor node, then the field
+ *                             nodes of each class, superclass first, and
+ *                             the SCAN_ANNOTATION of classes that write one
+ *     TC_ARRAY                the class descriptor node, then 'count'
+ *                             element nodes, or the elements at 'value'
+ *                             for primitive arrays
+ *     TC_ENUM                 the class descriptor node and the name node
+ *     TC_CLASS                the class descriptor node
+ *     TC_CLASSDESC,           a whole descriptor: its fields, annotation
+ *     TC_PROXYCLASSDESC       and superclasses have no nodes of their own
+ *     'B', 'C', ... 'Z'       a primitive field, value is its offset
+ *     SCAN_ANNOTATION         'count' nodes of block data and objects up to
+ *                             and including the TC_ENDBLOCKDATA, value is
+ *                             the offset of the annotation
+ *     TC_BLOCKDATA            'count' bytes of data at 'value'
+ *     TC_ENDBLOCKDATA         value is its offset
+ *     TC_RESET                between top-level records
+ * */
+
+#define SCAN_NONE ((uint32_t)-1)
+#define SCAN_MAX_DEPTH 4096
+#define SCAN_ANNOTATION 0x01
+
+typedef struct ScanHandle ScanHandle;
+typedef struct ScanRecord ScanRecord;
+typedef struct ScanClass ScanClass;
+typedef struct ScanNode ScanNode;
+typedef struct ScanIndex ScanIndex;
+
+struct ScanHandle {
+    uint64_t offset;            /* of the TC_ byte that introduced it */
+    uint64_t length;            /* bytes up to the end of its content */
+    uint32_t class_handle;      /* class descriptor of an object, array, enum or
+                                 * class, superclass of a descriptor, or SCAN_NONE */
+    uint32_t layout;            /* index into 'classes' for descriptors, else SCAN_NONE */
+    uint8_t type;               /* TC_OBJECT, TC_STRING, TC_CLASSDESC, ... */
+};
+
+struct ScanRecord {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t handle;            /* handle the record resolves to, or SCAN_NONE for
+                                 * null and block data */
+    uint8_t type;               /* TC_ code the record starts with */
+    size_t node;                /* first node of the record */
+    size_t generation;          /* handle table at the record: the first handle
+                                 * since the last TC_RESET before it */
+    size_t first_handle;        /* and its size, the first handle the record issues */
+    size_t n_handles;           /* handles the record issues */
+};
+
+struct ScanClass {
+    uint64_t name_offset;       /* class name bytes in the input */
+    uint16_t name_length;
+    uint8_t flags;              /* classDescFlags, SC_* */
+    char element;               /* element typecode of an array class, else 0 */
+    uint16_t n_fields;
+    size_t typecodes;           /* offset of the n_fields field typecodes in 'pool' */
+};
+
+struct ScanNode {
+    uint64_t value;             /* an offset into the input, see above */
+    uint32_t handle;            /* handle the node issues or refers to, or SCAN_NONE */
+    uint32_t count;             /* array elements, block data bytes, annotation nodes */
+    uint8_t type;
+};
+
+struct ScanIndex {
+    ScanHandle *handles;
+    size_t n_handles;
+    size_t reserved_handles;
+    ScanRecord *records;
+    size_t n_records;
+    size_t reserved_records;
+    ScanClass *classes;
+    size_t n_classes;
+    size_t reserved_classes;
+    char *pool;                 /* field typecodes of every class */
+    size_t pool_length;
+    size_t pool_reserved;
+    ScanNode *nodes;
+    size_t n_nodes;
+    size_t reserved_nodes;
+    int with_nodes;             /* set by the caller to build the tape */
+    int quiet;                  /* inside a class descriptor, no nodes */
+    size_t max_records;         /* stop after this many records, 0 for all */
+    size_t generation;          /* first handle since the last TC_RESET */
+    const char *error;          /* static message when Scan_Stream fails */
+    size_t error_offset;
+};
+
+void
+ScanIndex_Init(ScanIndex *index);
+
+void
+ScanIndex_Release(ScanIndex *index);
+
+/* * Index the whole stream in 'buffer', magic number included. Returns
+ * 0, or -1 with 'error' and 'error_offset' set. The partial index up to
+ * the failure is kept.
+ * */
+int
+Scan_Stream(ScanIndex *index, const void *buffer, size_t length);
+
+/* * Index the one top-level record, block data or TC_RESET at the start
+ * of 'buffer', continuing from the records before it, which may have
+ * been scanned from other buffers; offsets in what it adds are relative
+ * to 'buffer'. Returns 1 with '*used' its length; 0 when the buffer ends
+ * inside it, with the index as it was and '*used' the bytes the scan
+ * needs before it can get further; or -1 with 'error' set.
+ * */
+int
+Scan_Record(ScanIndex *index, const void *buffer, size_t length, size_t *used);
+
+#endif /* JSO_SCAN_H */
@@ -0,0 +1,206 @@
+#ifndef JSO_STREAM_H
+#define JSO_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* * A Stream is a read cursor over one contiguous, read-only block of
+ * memory holding a serialized java object stream. Every multi-byte value
+ * in the stream is big endian, and the loads below assemble values with
+ * shifts so the same code is correct on any host without an endianness
+ * test (compilers lower the shifts to a single bswap).
+ *
+ * Bounds are checked once per record: a reader calls Stream_Require with
+ * the full size of what it is about to decode and then uses the unchecked
+ * Stream_* loads for the rest of that record. A failed check leaves the
+ * cursor where it was and latches 'error', so callers only need to test
+ * the flag at the points where they would otherwise act on the data.
+ * 'missing' then says how many more bytes the failed check wanted, which
+ * lets an incremental reader wait for at least that much input.
+ * */
+
+#define STREAM_OK 0
+#define STREAM_EOF 1
+#define STREAM_INVALID 2    /* rejected content, the reader has set an exception */
+
+/* stream element typecodes */
+#define TC_NULL 0x70
+#define TC_REFERENCE 0x71
+#define TC_CLASSDESC 0x72
+#define TC_OBJECT 0x73
+#define TC_STRING 0x74
+#define TC_ARRAY 0x75
+#define TC_CLASS 0x76
+#define TC_BLOCKDATA 0x77
+#define TC_ENDBLOCKDATA 0x78
+#define TC_RESET 0x79
+#define TC_BLOCKDATALONG 0x7A
+#define TC_EXCEPTION 0x7B
+#define TC_LONGSTRING 0x7C
+#define TC_PROXYCLASSDESC 0x7D
+#define TC_ENUM 0x7E
+
+/* first handle of a stream and after every TC_RESET */
+#define BASE_WIRE_HANDLE 0x7e0000
+
+/* classDescFlags */
+#define SC_WRITE_METHOD 0x01
+#define SC_SERIALIZABLE 0x02
+#define SC_EXTERNALIZABLE 0x04
+#define SC_BLOCK_DATA 0x08
+#define SC_ENUM 0x10
+
+typedef struct Stream Stream;
+
+struct Stream {
+    const unsigned char *start;
+    const unsigned char *pos;
+    const unsigned char *end;
+    int error;
+    size_t missing;             /* bytes short at the failed check */
+};
+
+static inline void
+Stream_Init(Stream *stream, const void *buffer, size_t length)
+{
+    stream->start = (const unsigned char *)buffer;
+    stream->pos = stream->start;
+    stream->end = stream->start + length;
+    stream->error = STREAM_OK;
+    stream->missing = 0;
+}
+
+static inline size_t
+Stream_Remaining(const Stream *stream)
+{
+    return (size_t)(stream->end - stream->pos);
+}
+
+static inline size_t
+Stream_Tell(const Stream *stream)
+{
+    return (size_t)(stream->pos - stream->start);
+}
+
+static inline int
+Stream_Require(Stream *stream, size_t n_bytes)
+{
+    if (stream->error != STREAM_OK) {
+        return 0;
+    }
+    if (Stream_Remaining(stream) < n_bytes) {
+        stream->error = STREAM_EOF;
+        stream->missing = n_bytes - Stream_Remaining(stream);
+        return 0;
+    }
+    return 1;
+}
+
+static inline int
+Stream_RequireArray(Stream *stream, size_t n_elements, size_t element_size)
+{
+    /* same as Stream_Require, but guards the multiplication */
+    if (element_size != 0 && n_elements > Stream_Remaining(stream) / element_size) {
+        if (stream->error == STREAM_OK) {
+            stream->error = STREAM_EOF;
+            stream->missing = n_elements > SIZE_MAX / element_size ? SIZE_MAX
+                : n_elements * element_size - Stream_Remaining(stream);
+        }
+        return 0;
+    }
+    return Stream_Require(stream, n_elements * element_size);
+}
+
+/* big endian loads from an arbitrary (possibly unaligned) address */
+
+static inline uint16_t
+load_be16(const unsigned char *p)
+{
+    return (uint16_t)((uint16_t)p[0] << 8 | (uint16_t)p[1]);
+}
+
+static inline uint32_t
+load_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+         | (uint32_t)p[2] <<  8 | (uint32_t)p[3];
+}
+
+static inline uint64_t
+load_be64(const unsigned char *p)
+{
+    return (uint64_t)load_be32(p) << 32 | (uint64_t)load_be32(p + 4);
+}
+
+static inline float
+load_be_float(const unsigned char *p)
+{
+    uint32_t bits = load_be32(p);
+    float value;
+
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+static inline double
+load_be_double(const unsigned char *p)
+{
+    uint64_t bits = load_be64(p);
+    double value;
+
+    memcpy(&value, &bits, sizeof(double));
+    return value;
+}
+
+/* unchecked cursor loads, only valid after Stream_Require */
+
+static inline unsigned char
+Stream_U8(Stream *stream)
+{
+    return *stream->pos++;
+}
+
+static inline uint16_t
+Stream_BE16(Stream *stream)
+{
+    uint16_t value = load_be16(stream->pos);
+    stream->pos += 2;
+    return value;
+}
+
+static inline uint32_t
+Stream_BE32(Stream *stream)
+{
+    uint32_t value = load_be32(stream->pos);
+    stream->pos += 4;
+    return value;
+}
+
+static inline uint64_t
+Stream_BE64(Stream *stream)
+{
+    uint64_t value = load_be64(stream->pos);
+    stream->pos += 8;
+    return value;
+}
+
+static inline const unsigned char *
+Stream_Take(Stream *stream, size_t n_bytes)
+{
+    const unsigned char *p = stream->pos;
+    stream->pos += n_bytes;
+    return p;
+}
+
+static inline int
+Stream_Peek(Stream *stream)
+{
+    /* next byte without consuming it, or -1 at the end of the stream */
+    if (stream->pos >= stream->end) {
+        return -1;
+    }
+    return *stream->pos;
+}
+
+#endif /* JSO_STREAM_H */
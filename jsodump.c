@@ -0,0 +1,484 @@
+/** jsodump - index a java serialization stream with libjso and print
+ * what it holds, without a python interpreter. Also the benchmark for
+ * the native side of the reader:
+ *
+ *     jsodump [-m] [-r] [-v] [-c] [-e] [-d] [-n repeat] file.ser...
+ *
+ *     -m    map the files instead of reading them
+ *     -r    one line per top-level record
+ *     -v    and one line per handle under it
+ *     -c    the classes, with how many objects and arrays each has
+ *     -e    every value as an indented tree of Jso_Walk events
+ *     -d    also decode every primitive array payload into host order
+ *     -n N  index (and decode) each file N times and report the best run
+ *
+ * The exit status is 1 if any file couldn't be read or parsed.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "jso.h"
+#include "jso_stream.h"
+
+typedef struct {
+    int use_mmap;
+    int records;
+    int verbose;
+    int classes;
+    int events;
+    int decode;
+    long repeat;
+} Options;
+
+typedef struct {
+    const JsoStream *stream;
+    int depth;                  /* of the event tree */
+} Printer;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static const char *
+type_name(uint8_t type)
+{
+    switch (type) {
+        case TC_NULL: return "null";
+        case TC_REFERENCE: return "reference";
+        case TC_CLASSDESC: return "classdesc";
+        case TC_OBJECT: return "object";
+        case TC_STRING: return "string";
+        case TC_ARRAY: return "array";
+        case TC_CLASS: return "class";
+        case TC_BLOCKDATA: return "blockdata";
+        case TC_BLOCKDATALONG: return "blockdata";
+        case TC_LONGSTRING: return "string";
+        case TC_PROXYCLASSDESC: return "proxyclassdesc";
+        case TC_ENUM: return "enum";
+        default: return "?";
+    }
+}
+
+static void
+print_class_of(const JsoStream *stream, uint32_t class_handle)
+{
+    JsoHandle desc;
+
+    if (class_handle != JSO_NONE && Jso_GetHandle(stream, class_handle, &desc) == 0) {
+        printf("  %.*s", (int)desc.name_length, desc.name);
+    }
+}
+
+static int
+print_record(void *context, const JsoRecord *record)
+{
+    Printer *printer = (Printer *)context;
+    JsoHandle handle;
+
+    printf("record  offset %llu  length %llu  %s", (unsigned long long)record->offset,
+           (unsigned long long)record->length, type_name(record->type));
+    if (record->handle != JSO_NONE) {
+        printf("  handle %u", record->handle);
+        if (Jso_GetHandle(printer->stream, record->handle, &handle) == 0) {
+            print_class_of(printer->stream, handle.class_handle);
+        }
+    }
+    printf("  (%zu handles)\n", record->n_handles);
+    return 0;
+}
+
+static int
+print_handle(void *context, const JsoHandle *handle)
+{
+    Printer *printer = (Printer *)context;
+    size_t length;
+    const unsigned char *data = Jso_Data(printer->stream, &length);
+
+    printf("    %6zu  %-14s offset %llu  length %llu", handle->index, type_name(handle->type),
+           (unsigned long long)handle->offset, (unsigned long long)handle->length);
+    switch (handle->type) {
+        case TC_CLASSDESC:
+        case TC_PROXYCLASSDESC:
+            printf("  %.*s  %u fields", (int)handle->name_length, handle->name, handle->n_fields);
+            break;
+        case TC_STRING:
+            printf("  \"%.*s\"%s", (int)(handle->count < 40 ? handle->count : 40),
+                   (const char *)data + handle->body, handle->count > 40 ? "..." : "");
+            break;
+        case TC_ARRAY:
+            printf("  %c[%llu]", handle->element_type, (unsigned long long)handle->count);
+            print_class_of(printer->stream, handle->class_handle);
+            break;
+        default:
+            print_class_of(printer->stream, handle->class_handle);
+            break;
+    }
+    printf("\n");
+    return 0;
+}
+
+static void
+print_classes(const JsoStream *stream)
+{
+    /* instances per descriptor, in the order the descriptors appear */
+    size_t n = Jso_HandleCount(stream);
+    size_t *instances;
+    JsoHandle handle;
+    size_t i;
+
+    instances = (size_t *)calloc(n ? n : 1, sizeof(size_t));
+    if (instances == NULL) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        if (Jso_GetHandle(stream, i, &handle) < 0) {
+            continue;
+        }
+        if ((handle.type == TC_OBJECT || handle.type == TC_ARRAY)
+            && handle.class_handle != JSO_NONE) {
+            instances[handle.class_handle]++;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (Jso_GetHandle(stream, i, &handle) < 0) {
+            continue;
+        }
+        if (handle.type == TC_CLASSDESC || handle.type == TC_PROXYCLASSDESC) {
+            printf("class  %8zu  %.*s\n", instances[i], (int)handle.name_length, handle.name);
+        }
+    }
+    free(instances);
+}
+
+/* * -e: one line per event, indented by nesting */
+
+static void
+indent(Printer *printer)
+{
+    printf("%*s", printer->depth * 2, "");
+}
+
+static int
+tree_record_begin(void *context, const JsoRecord *record)
+{
+    printf("record @%llu\n", (unsigned long long)record->offset);
+    ((Printer *)context)->depth = 1;
+    return 0;
+}
+
+static int
+tree_object_begin(void *context, const JsoHandle *classdesc, uint32_t handle)
+{
+    Printer *printer = (Printer *)context;
+
+    indent(printer);
+    printf("object #%u %.*s\n", handle, (int)classdesc->name_length, classdesc->name);
+    printer->depth++;
+    return 0;
+}
+
+static int
+tree_class_data(void *context, const JsoHandle *classdesc)
+{
+    indent((Printer *)context);
+    printf("(%.*s)\n", (int)classdesc->name_length, classdesc->name);
+    return 0;
+}
+
+static int
+tree_field(void *context, const char *name, size_t name_length, char type,
+           const JsoValue *value)
+{
+    indent((Printer *)context);
+    printf("%.*s %c", (int)name_length, name, type);
+    if (value == NULL) {
+        printf(" =\n");
+    }
+    else if (type == 'F' || type == 'D') {
+        printf(" = %g\n", value->d);
+    }
+    else {
+        printf(" = %lld\n", (long long)value->i);
+    }
+    return 0;
+}
+
+static int
+tree_annotation_begin(void *context, const JsoHandle *classdesc)
+{
+    Printer *printer = (Printer *)context;
+
+    indent(printer);
+    printf("annotation\n");
+    printer->depth++;
+    return 0;
+}
+
+static int
+tree_annotation_end(void *context, const JsoHandle *classdesc)
+{
+    ((Printer *)context)->depth--;
+    return 0;
+}
+
+static int
+tree_end_nested(void *context, uint32_t handle)
+{
+    ((Printer *)context)->depth--;
+    return 0;
+}
+
+static int
+tree_array_begin(void *context, char type, size_t n_elements, uint32_t handle)
+{
+    Printer *printer = (Printer *)context;
+
+    indent(printer);
+    printf("array #%u %c[%zu]\n", handle, type, n_elements);
+    printer->depth++;
+    return 0;
+}
+
+static int
+tree_primitive_array(void *context, char type, const void *big_endian, size_t n_elements)
+{
+    indent((Printer *)context);
+    printf("%zu elements\n", n_elements);
+    return 0;
+}
+
+static int
+tree_string(void *context, const char *chars, size_t length, uint32_t handle)
+{
+    indent((Printer *)context);
+    printf("string #%u \"%.*s\"%s\n", handle, (int)(length < 40 ? length : 40), chars,
+           length > 40 ? "..." : "");
+    return 0;
+}
+
+static int
+tree_null(void *context)
+{
+    indent((Printer *)context);
+    printf("null\n");
+    return 0;
+}
+
+static int
+tree_reference(void *context, uint32_t handle)
+{
+    indent((Printer *)context);
+    printf("-> #%u\n", handle);
+    return 0;
+}
+
+static int
+tree_enum_constant(void *context, const JsoHandle *classdesc, const char *name,
+                   size_t name_length, uint32_t handle)
+{
+    indent((Printer *)context);
+    printf("enum #%u %.*s.%.*s\n", handle, (int)classdesc->name_length, classdesc->name,
+           (int)name_length, name);
+    return 0;
+}
+
+static int
+tree_class_value(void *context, const JsoHandle *classdesc, uint32_t handle)
+{
+    indent((Printer *)context);
+    printf("class #%u %.*s\n", handle, (int)classdesc->name_length, classdesc->name);
+    return 0;
+}
+
+static int
+tree_block_data(void *context, const void *data, size_t length)
+{
+    indent((Printer *)context);
+    printf("%zu bytes of block data\n", length);
+    return 0;
+}
+
+static const JsoEvents tree_events = {
+    tree_record_begin, NULL, tree_object_begin, tree_class_data, tree_field,
+    tree_annotation_begin, tree_annotation_end, tree_end_nested, tree_array_begin,
+    tree_primitive_array, tree_end_nested, tree_string, tree_null, tree_reference,
+    tree_enum_constant, tree_class_value, tree_block_data, NULL
+};
+
+static size_t
+decode_arrays(const JsoStream *stream, void **scratch, size_t *scratch_size)
+{
+    /* decode every primitive array, returns the payload bytes */
+    const unsigned char *data = Jso_Data(stream, NULL);
+    JsoHandle handle;
+    size_t i, n_bytes, total = 0;
+
+    for (i = 0; i < Jso_HandleCount(stream); i++) {
+        if (Jso_GetHandle(stream, i, &handle) < 0) {
+            continue;
+        }
+        if (handle.type != TC_ARRAY || handle.element_type == 'L'
+            || handle.element_type == '[') {
+            continue;
+        }
+        if (*scratch_size < handle.count * 8) {
+            free(*scratch);
+            *scratch_size = (size_t)handle.count * 8;
+            *scratch = malloc(*scratch_size ? *scratch_size : 1);
+            if (*scratch == NULL) {
+                *scratch_size = 0;
+                return total;
+            }
+        }
+        n_bytes = Jso_DecodeArray(handle.element_type, *scratch, data + handle.body,
+                                  (size_t)handle.count);
+        total += n_bytes;
+    }
+    return total;
+}
+
+static int
+dump(const char *filename, const Options *options)
+{
+    JsoStream *stream, *again;
+    JsoVisitor visitor = {print_record, NULL, NULL};
+    Printer printer;
+    const unsigned char *data;
+    const char *error;
+    size_t length, offset, decoded = 0, scratch_size = 0;
+    void *scratch = NULL;
+    double start, elapsed, best = -1;
+    long run;
+
+    start = now();
+    stream = Jso_Open(filename, options->use_mmap ? JSO_MMAP : 0);
+    if (stream == NULL) {
+        perror(filename);
+        return -1;
+    }
+    error = Jso_Error(stream, &offset);
+    if (error != NULL) {
+        fprintf(stderr, "%s: %s at offset %zu\n", filename, error, offset);
+        Jso_Close(stream);
+        return -1;
+    }
+    if (options->decode) {
+        decoded = decode_arrays(stream, &scratch, &scratch_size);
+    }
+    best = now() - start;
+
+    /* the input stays put, only the index and the decode are timed again */
+    data = Jso_Data(stream, &length);
+    for (run = 1; run < options->repeat; run++) {
+        start = now();
+        again = Jso_OpenBuffer(data, length, 0);
+        if (again == NULL) {
+            break;
+        }
+        if (options->decode) {
+            decode_arrays(again, &scratch, &scratch_size);
+        }
+        elapsed = now() - start;
+        Jso_Close(again);
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    free(scratch);
+
+    printf("%s: %zu bytes, %zu records, %zu handles", filename, length,
+           Jso_RecordCount(stream), Jso_HandleCount(stream));
+    if (options->decode) {
+        printf(", %zu array bytes decoded", decoded);
+    }
+    printf(", %.3f ms", best * 1e3);
+    if (best > 0) {
+        printf(" (%.1f MB/s)", (double)length / best / 1e6);
+    }
+    printf("\n");
+
+    printer.stream = stream;
+    if (options->records || options->verbose) {
+        visitor.handle = options->verbose ? print_handle : NULL;
+        Jso_Visit(stream, &visitor, &printer);
+    }
+    if (options->classes) {
+        print_classes(stream);
+    }
+    if (options->events) {
+        printer.depth = 0;
+        Jso_Walk(stream, &tree_events, &printer);
+    }
+    Jso_Close(stream);
+    return 0;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: jsodump [-m] [-r] [-v] [-c] [-e] [-d] [-n repeat] file.ser...\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    Options options;
+    int i, status = 0, files = 0;
+    const char *arg;
+
+    memset(&options, 0, sizeof(Options));
+    options.repeat = 1;
+
+    for (i = 1; i < argc; i++) {
+        arg = argv[i];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            continue;
+        }
+        if (strcmp(arg, "-n") == 0 && i + 1 < argc) {
+            options.repeat = strtol(argv[++i], NULL, 10);
+            if (options.repeat < 1) {
+                usage();
+                return 2;
+            }
+            continue;
+        }
+        for (arg++; *arg; arg++) {
+            switch (*arg) {
+                case 'm': options.use_mmap = 1; break;
+                case 'r': options.records = 1; break;
+                case 'v': options.verbose = 1; break;
+                case 'c': options.classes = 1; break;
+                case 'e': options.events = 1; break;
+                case 'd': options.decode = 1; break;
+                default:
+                    usage();
+                    return 2;
+            }
+        }
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            if (strcmp(argv[i], "-n") == 0) {
+                i++;
+            }
+            continue;
+        }
+        files++;
+        if (dump(argv[i], &options) < 0) {
+            status = 1;
+        }
+    }
+    if (files == 0) {
+        usage();
+        return 2;
+    }
+    return status;
+}
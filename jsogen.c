@@ -0,0 +1,762 @@
+/** jsogen - write synthetic java serialization streams for benchmarks,
+ * without a JDK. Every record is a tree of bench.Node objects the way
+ * ObjectOutputStream writes it, with the shape set on the command line:
+ *
+ *     jsogen [-s seed] [-n records] [-S size] [-d depth] [-H levels]
+ *            [-a array] [-c collection] [-l string] [-r percent] [-R reset]
+ *            out.ser
+ *
+ *     -s N  seed of the generator, the same seed writes the same bytes (1)
+ *     -n N  top-level records to write (1000)
+ *     -S N  or write records until the file holds N bytes, K M G suffixes
+ *     -d N  nesting depth, each Node holds the next in 'child' (3)
+ *     -H N  superclasses above bench.Node, bench.Level0 to LevelN-1 (2)
+ *     -a N  elements in each int[] and double[] of a Node (64)
+ *     -c N  elements in each ArrayList, HashMap, HashSet and PriorityQueue,
+ *           written by their writeObject() as block data; 0 writes them null (8)
+ *     -l N  characters per string, over 65535 they go as TC_LONGSTRING (16)
+ *     -r N  percent of strings, Integers and children written as a back
+ *           reference to one already in the stream, PriorityQueue elements
+ *           excepted to keep the heap order (10)
+ *     -R N  a TC_RESET every N records, 0 for none (1000)
+ *
+ * "-" writes to standard output.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jso_stream.h"
+
+#define GEN_NONE ((uint32_t)-1)
+#define GEN_POOL 256            /* back reference candidates kept per kind */
+#define GEN_BUFFER (1 << 20)
+
+typedef struct {
+    uint64_t seed;
+    long records;
+    uint64_t size;
+    int depth;
+    int levels;
+    uint32_t array;
+    uint32_t collection;
+    uint32_t string;
+    int refs;
+    long reset;
+} Options;
+
+typedef struct {
+    char type;                  /* B C D F I J S Z, L or [ */
+    const char *name;
+    const char *class_name;     /* of object fields, as a field descriptor */
+} GenField;
+
+typedef struct {
+    char *name;
+    uint64_t suid;
+    uint8_t flags;
+    int n_fields;
+    const GenField *fields;
+    int super;                  /* index in 'classes', or -1 */
+    uint32_t handle;            /* since the last reset, or GEN_NONE */
+} GenClass;
+
+typedef struct {
+    uint32_t handles[GEN_POOL];
+    size_t n;
+} Pool;
+
+typedef struct {
+    const char *name;
+    uint32_t handle;
+} TypeName;
+
+typedef struct {
+    FILE *file;
+    unsigned char *buffer;
+    size_t length;
+    uint64_t written;
+    int failed;
+    uint64_t state;             /* xorshift64* */
+    const Options *options;
+    uint32_t next_handle;       /* handles issued since the last reset */
+    GenClass *classes;
+    int n_classes;
+    int node, integer, array_list, hash_map, hash_set, priority_queue, ints, doubles;
+    TypeName type_names[16];    /* field class names sent since the reset */
+    int n_type_names;
+    Pool strings, integers, nodes;
+    char *text;                 /* scratch for string content */
+} Generator;
+
+/* the fields of bench.Node and of the java.util classes, primitives first */
+static const GenField node_fields[] = {
+    {'I', "depth", NULL},
+    {'L', "child", "Ljava/lang/Object;"},
+    {'[', "counts", "[I"},
+    {'L', "items", "Ljava/util/List;"},
+    {'L', "keys", "Ljava/util/Set;"},
+    {'L', "label", "Ljava/lang/String;"},
+    {'L', "queue", "Ljava/util/PriorityQueue;"},
+    {'[', "samples", "[D"},
+    {'L', "tags", "Ljava/util/Map;"},
+};
+static const GenField base_fields[] = {
+    {'I', "id", NULL},
+    {'J', "stamp", NULL},
+    {'L', "name", "Ljava/lang/String;"},
+};
+static const GenField level_fields[][2] = {
+    {{'Z', "flag1", NULL}, {'D', "weight1", NULL}},
+    {{'Z', "flag2", NULL}, {'D', "weight2", NULL}},
+    {{'Z', "flag3", NULL}, {'D', "weight3", NULL}},
+    {{'Z', "flag4", NULL}, {'D', "weight4", NULL}},
+    {{'Z', "flag5", NULL}, {'D', "weight5", NULL}},
+    {{'Z', "flag6", NULL}, {'D', "weight6", NULL}},
+    {{'Z', "flag7", NULL}, {'D', "weight7", NULL}},
+};
+#define MAX_LEVELS (1 + (int)(sizeof(level_fields) / sizeof(level_fields[0])))
+
+static const GenField integer_fields[] = {{'I', "value", NULL}};
+static const GenField size_fields[] = {{'I', "size", NULL}};
+static const GenField hash_map_fields[] = {{'F', "loadFactor", NULL}, {'I', "threshold", NULL}};
+static const GenField priority_queue_fields[] = {
+    {'I', "size", NULL},
+    {'L', "comparator", "Ljava/util/Comparator;"},
+};
+
+static uint64_t
+next_random(Generator *g)
+{
+    g->state ^= g->state >> 12;
+    g->state ^= g->state << 25;
+    g->state ^= g->state >> 27;
+    return g->state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t
+random_below(Generator *g, uint32_t n)
+{
+    return n ? (uint32_t)((next_random(g) >> 32) % n) : 0;
+}
+
+static int
+chance(Generator *g, int percent)
+{
+    return percent > 0 && (int)random_below(g, 100) < percent;
+}
+
+/* output, buffered by hand: records are written a few bytes at a time */
+
+static void
+flush(Generator *g)
+{
+    if (g->length && fwrite(g->buffer, 1, g->length, g->file) != g->length) {
+        g->failed = 1;
+    }
+    g->length = 0;
+}
+
+static void
+put(Generator *g, const void *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t chunk;
+
+    g->written += n;
+    while (n > 0) {
+        if (g->length == GEN_BUFFER) {
+            flush(g);
+        }
+        chunk = GEN_BUFFER - g->length < n ? GEN_BUFFER - g->length : n;
+        memcpy(g->buffer + g->length, p, chunk);
+        g->length += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+static void
+put_u8(Generator *g, uint8_t v)
+{
+    put(g, &v, 1);
+}
+
+static void
+put_be16(Generator *g, uint16_t v)
+{
+    unsigned char b[2] = {(unsigned char)(v >> 8), (unsigned char)v};
+
+    put(g, b, 2);
+}
+
+static void
+put_be32(Generator *g, uint32_t v)
+{
+    unsigned char b[4] = {(unsigned char)(v >> 24), (unsigned char)(v >> 16),
+                          (unsigned char)(v >> 8), (unsigned char)v};
+
+    put(g, b, 4);
+}
+
+static void
+put_be64(Generator *g, uint64_t v)
+{
+    put_be32(g, (uint32_t)(v >> 32));
+    put_be32(g, (uint32_t)v);
+}
+
+static void
+put_float(Generator *g, float f)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &f, sizeof(bits));
+    put_be32(g, bits);
+}
+
+static void
+put_double(Generator *g, double d)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &d, sizeof(bits));
+    put_be64(g, bits);
+}
+
+static void
+put_utf(Generator *g, const char *text)
+{
+    size_t n = strlen(text);
+
+    put_be16(g, (uint16_t)n);
+    put(g, text, n);
+}
+
+static void
+put_reference(Generator *g, uint32_t handle)
+{
+    put_u8(g, TC_REFERENCE);
+    put_be32(g, BASE_WIRE_HANDLE + handle);
+}
+
+/* back reference pools: recent handles of one kind, a random one replaced when full */
+
+static void
+pool_add(Generator *g, Pool *pool, uint32_t handle)
+{
+    if (pool->n < GEN_POOL) {
+        pool->handles[pool->n++] = handle;
+    }
+    else {
+        pool->handles[random_below(g, GEN_POOL)] = handle;
+    }
+}
+
+static int
+pool_pick(Generator *g, Pool *pool)
+{
+    /* a back reference instead of a new value, as often as -r asks */
+    if (pool->n == 0 || !chance(g, g->options->refs)) {
+        return 0;
+    }
+    put_reference(g, pool->handles[random_below(g, (uint32_t)pool->n)]);
+    return 1;
+}
+
+static void
+reset(Generator *g)
+{
+    /* after a TC_RESET everything is sent again */
+    int i;
+
+    for (i = 0; i < g->n_classes; i++) {
+        g->classes[i].handle = GEN_NONE;
+    }
+    g->next_handle = 0;
+    g->n_type_names = 0;
+    g->strings.n = g->integers.n = g->nodes.n = 0;
+}
+
+/* content */
+
+static void
+write_string(Generator *g, const char *text, size_t n)
+{
+    if (n > 0xffff) {
+        put_u8(g, TC_LONGSTRING);
+        put_be64(g, n);
+    }
+    else {
+        put_u8(g, TC_STRING);
+        put_be16(g, (uint16_t)n);
+    }
+    put(g, text, n);
+    g->next_handle++;
+}
+
+static void
+write_type_name(Generator *g, const char *name)
+{
+    /* field class names are strings, shared like any other */
+    int i;
+
+    for (i = 0; i < g->n_type_names; i++) {
+        if (strcmp(g->type_names[i].name, name) == 0) {
+            put_reference(g, g->type_names[i].handle);
+            return;
+        }
+    }
+    g->type_names[g->n_type_names].name = name;
+    g->type_names[g->n_type_names++].handle = g->next_handle;
+    write_string(g, name, strlen(name));
+}
+
+static void
+write_text(Generator *g)
+{
+    /* a java.lang.String of -l random characters, or a back reference */
+    static const char letters[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    uint32_t i, handle;
+
+    if (pool_pick(g, &g->strings)) {
+        return;
+    }
+    for (i = 0; i < g->options->string; i++) {
+        g->text[i] = letters[random_below(g, sizeof(letters) - 1)];
+    }
+    handle = g->next_handle;
+    write_string(g, g->text, g->options->string);
+    pool_add(g, &g->strings, handle);
+}
+
+static void
+write_class_desc(Generator *g, int c)
+{
+    /* classDesc, with its superclasses, or a reference to it */
+    GenClass *cls;
+    int i;
+
+    if (c < 0) {
+        put_u8(g, TC_NULL);
+        return;
+    }
+    cls = &g->classes[c];
+    if (cls->handle != GEN_NONE) {
+        put_reference(g, cls->handle);
+        return;
+    }
+    put_u8(g, TC_CLASSDESC);
+    put_utf(g, cls->name);
+    put_be64(g, cls->suid);
+    cls->handle = g->next_handle++;
+    put_u8(g, cls->flags);
+    put_be16(g, (uint16_t)cls->n_fields);
+    for (i = 0; i < cls->n_fields; i++) {
+        put_u8(g, (uint8_t)cls->fields[i].type);
+        put_utf(g, cls->fields[i].name);
+        if (cls->fields[i].class_name != NULL) {
+            write_type_name(g, cls->fields[i].class_name);
+        }
+    }
+    put_u8(g, TC_ENDBLOCKDATA);
+    write_class_desc(g, cls->super);
+}
+
+static uint32_t
+begin_object(Generator *g, int c)
+{
+    put_u8(g, TC_OBJECT);
+    write_class_desc(g, c);
+    return g->next_handle++;
+}
+
+static void
+write_integer(Generator *g, int32_t value, int shared)
+{
+    /* a java.lang.Integer, a back reference to one if 'shared' allows */
+    uint32_t handle;
+
+    if (shared && pool_pick(g, &g->integers)) {
+        return;
+    }
+    handle = begin_object(g, g->integer);
+    put_be32(g, (uint32_t)value);
+    pool_add(g, &g->integers, handle);
+}
+
+static void
+write_block_header(Generator *g, uint8_t length)
+{
+    put_u8(g, TC_BLOCKDATA);
+    put_u8(g, length);
+}
+
+static int
+compare_ints(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+write_collection(Generator *g, int c)
+{
+    /* * what the writeObject() of each java.util class writes: its
+     * fields, a header block and the elements, up to TC_ENDBLOCKDATA
+     * */
+    uint32_t n = g->options->collection, i, capacity;
+    int32_t *values;
+
+    if (n == 0) {
+        put_u8(g, TC_NULL);
+        return;
+    }
+    begin_object(g, c);
+    if (c == g->array_list) {
+        put_be32(g, n);
+        write_block_header(g, 4);
+        put_be32(g, n);
+        for (i = 0; i < n; i++) {
+            write_text(g);
+        }
+    }
+    else if (c == g->hash_map || c == g->hash_set) {
+        for (capacity = 16; capacity * 3 / 4 < n; capacity *= 2) {
+        }
+        if (c == g->hash_map) {
+            put_float(g, 0.75f);
+            put_be32(g, capacity * 3 / 4);
+            write_block_header(g, 8);
+            put_be32(g, capacity);
+            put_be32(g, n);
+        }
+        else {
+            write_block_header(g, 12);
+            put_be32(g, capacity);
+            put_float(g, 0.75f);
+            put_be32(g, n);
+        }
+        for (i = 0; i < n; i++) {
+            if (c == g->hash_map) {
+                write_text(g);
+            }
+            write_integer(g, (int32_t)random_below(g, 1000000), 1);
+        }
+    }
+    else {
+        /* * PriorityQueue: its queue array in heap order, which sorted is;
+         * no back references, they would break the order
+         * */
+        values = (int32_t *)malloc(n * sizeof(int32_t));
+        if (values == NULL) {
+            g->failed = 1;
+            return;
+        }
+        for (i = 0; i < n; i++) {
+            values[i] = (int32_t)random_below(g, 1000000);
+        }
+        qsort(values, n, sizeof(int32_t), compare_ints);
+        put_be32(g, n);
+        put_u8(g, TC_NULL);     /* comparator */
+        write_block_header(g, 4);
+        put_be32(g, n + 1 > 2 ? n + 1 : 2);
+        for (i = 0; i < n; i++) {
+            write_integer(g, values[i], 0);
+        }
+        free(values);
+    }
+    put_u8(g, TC_ENDBLOCKDATA);
+}
+
+static void
+write_array(Generator *g, int c)
+{
+    uint32_t i;
+
+    put_u8(g, TC_ARRAY);
+    write_class_desc(g, c);
+    g->next_handle++;
+    put_be32(g, g->options->array);
+    for (i = 0; i < g->options->array; i++) {
+        if (c == g->ints) {
+            put_be32(g, (uint32_t)next_random(g));
+        }
+        else {
+            put_double(g, (double)(next_random(g) >> 11) * 0x1p-53 * 1000.0);
+        }
+    }
+}
+
+static void
+write_node(Generator *g, int depth)
+{
+    /* bench.Node, its superclasses' fields first */
+    uint32_t handle;
+    int level;
+
+    handle = begin_object(g, g->node);
+    for (level = 0; level < g->options->levels; level++) {
+        if (level == 0) {
+            put_be32(g, (uint32_t)next_random(g));
+            put_be64(g, next_random(g));
+            write_text(g);
+        }
+        else {
+            put_u8(g, (uint8_t)random_below(g, 2));
+            put_double(g, (double)(next_random(g) >> 11) * 0x1p-53);
+        }
+    }
+
+    put_be32(g, (uint32_t)depth);
+    if (depth <= 1) {
+        put_u8(g, TC_NULL);
+    }
+    else if (!pool_pick(g, &g->nodes)) {
+        write_node(g, depth - 1);
+    }
+    write_array(g, g->ints);
+    write_collection(g, g->array_list);
+    write_collection(g, g->hash_set);
+    write_text(g);
+    write_collection(g, g->priority_queue);
+    write_array(g, g->doubles);
+    write_collection(g, g->hash_map);
+
+    /* only finished nodes are referenced, so the trees stay trees */
+    pool_add(g, &g->nodes, handle);
+}
+
+/* the classes of the stream */
+
+static uint64_t
+class_suid(const char *name)
+{
+    /* a stable serialVersionUID for the bench classes, FNV-1a of the name */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int
+add_class(Generator *g, const char *name, uint64_t suid, uint8_t flags,
+          const GenField *fields, int n_fields, int super)
+{
+    GenClass *cls = &g->classes[g->n_classes];
+
+    cls->name = (char *)malloc(strlen(name) + 1);
+    if (cls->name == NULL) {
+        return -1;
+    }
+    strcpy(cls->name, name);
+    cls->suid = suid;
+    cls->flags = flags;
+    cls->fields = fields;
+    cls->n_fields = n_fields;
+    cls->super = super;
+    cls->handle = GEN_NONE;
+    return g->n_classes++;
+}
+
+#define N_FIELDS(fields) ((int)(sizeof(fields) / sizeof(fields[0])))
+
+static int
+define_classes(Generator *g)
+{
+    char name[32];
+    int level, super = -1, number;
+
+    g->classes = (GenClass *)calloc(MAX_LEVELS + 10, sizeof(GenClass));
+    if (g->classes == NULL) {
+        return -1;
+    }
+    for (level = 0; level < g->options->levels; level++) {
+        snprintf(name, sizeof(name), "bench.Level%d", level);
+        super = level == 0
+            ? add_class(g, name, class_suid(name), SC_SERIALIZABLE, base_fields,
+                        N_FIELDS(base_fields), -1)
+            : add_class(g, name, class_suid(name), SC_SERIALIZABLE, level_fields[level - 1],
+                        2, super);
+        if (super < 0) {
+            return -1;
+        }
+    }
+    /* the serialVersionUIDs of the java classes are the JDK's */
+    number = add_class(g, "java.lang.Number", 0x86ac951d0b94e08bULL, SC_SERIALIZABLE,
+                       NULL, 0, -1);
+    if ((g->node = add_class(g, "bench.Node", class_suid("bench.Node"), SC_SERIALIZABLE,
+                             node_fields, N_FIELDS(node_fields), super)) < 0
+        || number < 0
+        || (g->integer = add_class(g, "java.lang.Integer", 0x12e2a0a4f7818738ULL,
+                                   SC_SERIALIZABLE, integer_fields, 1, number)) < 0
+        || (g->array_list = add_class(g, "java.util.ArrayList", 0x7881d21d99c7619dULL,
+                                      SC_SERIALIZABLE | SC_WRITE_METHOD, size_fields, 1,
+                                      -1)) < 0
+        || (g->hash_map = add_class(g, "java.util.HashMap", 0x0507dac1c31660d1ULL,
+                                    SC_SERIALIZABLE | SC_WRITE_METHOD, hash_map_fields, 2,
+                                    -1)) < 0
+        || (g->hash_set = add_class(g, "java.util.HashSet", 0xba44859596b8b734ULL,
+                                    SC_SERIALIZABLE | SC_WRITE_METHOD, NULL, 0, -1)) < 0
+        || (g->priority_queue = add_class(g, "java.util.PriorityQueue", 0x94da30b4fb3f82b1ULL,
+                                          SC_SERIALIZABLE | SC_WRITE_METHOD,
+                                          priority_queue_fields, 2, -1)) < 0
+        || (g->ints = add_class(g, "[I", 0x4dba602676eab2a5ULL, SC_SERIALIZABLE,
+                                NULL, 0, -1)) < 0
+        || (g->doubles = add_class(g, "[D", 0x3ea68c14ab635a1eULL, SC_SERIALIZABLE,
+                                   NULL, 0, -1)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int
+generate(const char *filename, const Options *options)
+{
+    Generator g;
+    long record;
+    int i, status = 0;
+
+    memset(&g, 0, sizeof(Generator));
+    g.options = options;
+    /* splitmix64 of the seed, xorshift must not start at 0 */
+    g.state = options->seed + 0x9e3779b97f4a7c15ULL;
+    g.state = (g.state ^ (g.state >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    g.state = (g.state ^ (g.state >> 27)) * 0x94d049bb133111ebULL;
+    g.state ^= g.state >> 31;
+    if (g.state == 0) {
+        g.state = 1;
+    }
+
+    g.file = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "wb");
+    if (g.file == NULL) {
+        perror(filename);
+        return -1;
+    }
+    g.buffer = (unsigned char *)malloc(GEN_BUFFER);
+    g.text = (char *)malloc(options->string ? options->string : 1);
+    if (g.buffer == NULL || g.text == NULL || define_classes(&g) < 0) {
+        fprintf(stderr, "jsogen: out of memory\n");
+        status = -1;
+        goto done;
+    }
+
+    put_be16(&g, 0xaced);
+    put_be16(&g, 5);
+    for (record = 0; !g.failed; record++) {
+        if (options->size ? g.written >= options->size : record >= options->records) {
+            break;
+        }
+        if (options->reset > 0 && record > 0 && record % options->reset == 0) {
+            put_u8(&g, TC_RESET);
+            reset(&g);
+        }
+        write_node(&g, options->depth);
+    }
+    flush(&g);
+    if (g.failed || fflush(g.file) != 0) {
+        perror(filename);
+        status = -1;
+    }
+    else {
+        fprintf(stderr, "%s: %ld records, %llu bytes\n", filename, record,
+                (unsigned long long)g.written);
+    }
+
+done:
+    if (g.file != stdout && fclose(g.file) != 0) {
+        status = -1;
+    }
+    for (i = 0; i < g.n_classes; i++) {
+        free(g.classes[i].name);
+    }
+    free(g.classes);
+    free(g.buffer);
+    free(g.text);
+    return status;
+}
+
+static uint64_t
+parse_size(const char *text)
+{
+    char *end;
+    uint64_t n = strtoull(text, &end, 10);
+
+    switch (*end) {
+        case 'G': case 'g': n <<= 10; /* fall through */
+        case 'M': case 'm': n <<= 10; /* fall through */
+        case 'K': case 'k': n <<= 10; break;
+    }
+    return n;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: jsogen [-s seed] [-n records] [-S size] [-d depth] [-H levels]\n"
+                    "              [-a array] [-c collection] [-l string] [-r percent]\n"
+                    "              [-R reset] out.ser\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    Options options;
+    const char *filename = NULL;
+    const char *arg, *value;
+    int i;
+
+    memset(&options, 0, sizeof(Options));
+    options.seed = 1;
+    options.records = 1000;
+    options.depth = 3;
+    options.levels = 2;
+    options.array = 64;
+    options.collection = 8;
+    options.string = 16;
+    options.refs = 10;
+    options.reset = 1000;
+
+    for (i = 1; i < argc; i++) {
+        arg = argv[i];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            if (filename != NULL) {
+                usage();
+                return 2;
+            }
+            filename = arg;
+            continue;
+        }
+        if (arg[2] != '\0' || i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        value = argv[++i];
+        switch (arg[1]) {
+            case 's': options.seed = strtoull(value, NULL, 10); break;
+            case 'n': options.records = strtol(value, NULL, 10); break;
+            case 'S': options.size = parse_size(value); break;
+            case 'd': options.depth = atoi(value); break;
+            case 'H': options.levels = atoi(value); break;
+            case 'a': options.array = (uint32_t)strtoul(value, NULL, 10); break;
+            case 'c': options.collection = (uint32_t)strtoul(value, NULL, 10); break;
+            case 'l': options.string = (uint32_t)strtoul(value, NULL, 10); break;
+            case 'r': options.refs = atoi(value); break;
+            case 'R': options.reset = strtol(value, NULL, 10); break;
+            default:
+                usage();
+                return 2;
+        }
+    }
+    if (filename == NULL || options.records < 0 || options.depth < 1
+        || options.levels < 0 || options.levels > MAX_LEVELS
+        || options.refs < 0 || options.refs > 100 || options.reset < 0) {
+        usage();
+        return 2;
+    }
+    return generate(filename, &options) < 0 ? 1 : 0;
+}
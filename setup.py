@@ -1,4 +1,4 @@
 from distutils.core import setup, Extension
 
-extension_mod = Extension("jso_reader", ["jso_reader.c", "javatype.c"], undef_macros=['NDEBUG'])
+extension_mod = Extension("jso_reader", ["jso_reader.c", "javatype.c", "jso_file.c", "jso_array.c", "jso_bswap.c", "jso_arena.c", "jso_cache.c", "jso_registry.c", "jso_scan.c", "jso_pool.c", "jso.c", "jso_events.c"], undef_macros=['NDEBUG'])
 setup(name="jso_reader", ext_modules=[extension_mod])
@@ -5,16 +5,115 @@
 import unittest
 from numpy import allclose
 from pprint import pprint
-from os.path import join
+from os.path import join, exists
 from math import pow
 from jso_reader import (
     _test_parse_primitive_array, 
     _test_parse_class_descriptor,
-    stream_read
+    stream_read,
+    stream_read_bytes,
+    stream_read_many,
+    StreamError,
+    PrimitiveArray,
+    _bswap_kernel,
+    _class_cache_info,
+    _tape_info,
+    register_reader,
+    unregister_reader,
+    iter_stream,
+    read_records,
+    scan_stream,
+    walk_stream,
+    StreamParser,
+    LazyObject
 )
 
 from os import system, pardir
+from tempfile import NamedTemporaryFile
+from struct import pack
 import sys
+import gc
+from concurrent.futures import ThreadPoolExecutor
+import ctypes
+
+
+def primitive_array_stream(typecode, fmt, values):
+    """serialize a single java primitive array the way ObjectOutputStream does"""
+    classname = b"[" + typecode.encode()
+    return (b"\xac\xed\x00\x05\x75\x72" + pack(">H", len(classname)) + classname
+            + pack(">Q", 0x1234) + b"\x02\x00\x00\x78\x70"
+            + pack(">i", len(values)) + pack(">%d%s" % (len(values), fmt), *values))
+
+
+def int_matrix_stream(rows, trailing_reference=None):
+    """serialize an Object[] holding an int[][] (rows may be None or ragged),
+    optionally followed by a TC_REFERENCE to the handle 'trailing_reference'"""
+    def classdesc(name):
+        name = name.encode()
+        return (b"\x72" + pack(">H", len(name)) + name + pack(">Q", 0x1234)
+                + b"\x02\x00\x00\x78\x70")
+
+    # handles: 0 Object[] desc, 1 Object[], 2 int[][] desc, 3 int[][], 4 int[] desc
+    out = b"\xac\xed\x00\x05\x75" + classdesc("[Ljava.lang.Object;")
+    out += pack(">i", 1 if trailing_reference is None else 2)
+    out += b"\x75" + classdesc("[[I") + pack(">i", len(rows))
+    first = True
+    for row in rows:
+        if row is None:
+            out += b"\x70"
+            continue
+        out += b"\x75" + (classdesc("[I") if first else b"\x71" + pack(">I", 0x7e0004))
+        out += pack(">i", len(row)) + pack(">%di" % len(row), *row)
+        first = False
+    if trailing_reference is not None:
+        out += b"\x71" + pack(">I", 0x7e0000 + trailing_reference)
+    return out
+
+
+PRIMITIVE_FORMATS = {"B": ">b", "C": ">H", "D": ">d", "F": ">f",
+                     "I": ">i", "J": ">q", "S": ">h", "Z": ">?"}
+
+
+def object_stream(classname, suid, fields, values, parents=(), annotation=None):
+    """serialize one object of a serializable class; fields are (typecode, name)
+    pairs, object fields are java.lang.String and take either a str, the
+    wire handle of an earlier string or the encoded bytes of any other
+    content. parents are (classname, suid, fields,
+    values) of the superclasses, nearest first. annotation is the raw data a
+    writeObject() method of the class wrote after its fields"""
+    def utf(text):
+        text = text.encode()
+        return pack(">H", len(text)) + text
+
+    classes = [(classname, suid, fields, values)] + list(parents)
+    out = b"\xac\xed\x00\x05\x73"
+    for name, uid, class_fields, _ in classes:
+        flags = 0x03 if annotation is not None and name == classname else 0x02
+        out += b"\x72" + utf(name) + pack(">QBH", uid, flags, len(class_fields))
+        for typecode, field in class_fields:
+            out += typecode.encode() + utf(field)
+            if typecode == "L":
+                out += b"\x74" + utf("Ljava/lang/String;")
+        out += b"\x78"
+    out += b"\x70"
+    for _, _, class_fields, class_values in reversed(classes):
+        for (typecode, name), value in zip(class_fields, class_values):
+            if typecode in PRIMITIVE_FORMATS:
+                out += pack(PRIMITIVE_FORMATS[typecode], value)
+            elif isinstance(value, str):
+                out += b"\x74" + utf(value)
+            elif isinstance(value, bytes):
+                out += value
+            else:
+                out += b"\x71" + pack(">I", value)
+    if annotation is not None:
+        out += annotation + b"\x78"
+    return out
+
+
+def block_data(payload):
+    """one TC_BLOCKDATA segment"""
+    return b"\x77" + pack(">B", len(payload)) + payload
 
 class TestParsePrimitiveArray(unittest.TestCase):
 
@@ -403,5 +502,1265 @@ class ContainerUnitTest(unittest.TestCase):
         self.assertDictEqual(from_file, expected)
 
 
+class TestTypedArrays(unittest.TestCase):
+
+    def test_double_array(self):
+        filename = "primitive_arrays/double_array_unsigned.ser"
+        from_file = stream_read(filename, typed_arrays=True)
+        expected = [0.2343134, 1234132.3431, 312431.3, 0, 1.1234]
+
+        self.assertIsInstance(from_file, PrimitiveArray)
+        self.assertEqual(from_file.typecode, 'D')
+        self.assertEqual(memoryview(from_file).format, 'd')
+        self.assertEqual(memoryview(from_file).tolist(), expected)
+
+    def test_int_array_limits(self):
+        filename = "primitive_arrays/int_array_limits.ser"
+        from_file = stream_read(filename, typed_arrays=True)
+
+        self.assertEqual(len(from_file), 3)
+        self.assertEqual(from_file.nbytes, 12)
+        self.assertEqual(list(memoryview(from_file)), [2147483647, 0, -2147483648])
+
+    def test_matches_list_output(self):
+        for name in ("boolean_array_mixed", "short_array_limits", "long_array_limits",
+                     "float_array_signed", "double_array_empty"):
+            filename = join("primitive_arrays", name + ".ser")
+            typed = stream_read(filename, typed_arrays=True)
+            self.assertEqual(typed.tolist(), stream_read(filename))
+
+    def test_nested_object(self):
+        filename = "object_w_nested_object.ser"
+        from_file = stream_read(filename, typed_arrays=True)
+
+        self.assertEqual(from_file['firstName'], 'jack')
+        self.assertEqual(from_file['siblings'][0]['ssn'], 2345678)
+
+
+class TestHandles(unittest.TestCase):
+
+    def test_many_back_references(self):
+        # Object[] of n new strings followed by references to them in reverse;
+        # handle 0 is the array class descriptor and 1 the array itself
+        n = 5000
+        name = b"[Ljava.lang.Object;"
+        data = (b"\xac\xed\x00\x05\x75\x72" + pack(">H", len(name)) + name
+                + pack(">Q", 0x1234) + b"\x02\x00\x00\x78\x70" + pack(">i", 2 * n))
+        for i in range(n):
+            string = str(i).encode()
+            data += b"\x74" + pack(">H", len(string)) + string
+        for i in reversed(range(n)):
+            data += b"\x71" + pack(">I", 0x7e0002 + i)
+
+        expected = [str(i) for i in range(n)]
+        self.assertEqual(stream_read_bytes(data), expected + expected[::-1])
+
+    def test_unknown_handle(self):
+        with self.assertRaises(StreamError):
+            stream_read_bytes(b"\xac\xed\x00\x05\x71\x00\x7e\x00\x05")
+
+    def test_handles_released_after_parse(self):
+        # the array is a handle; the table must not keep a reference to it
+        data = primitive_array_stream("I", "i", [1, 2, 3])
+        for typed in (False, True):
+            from_bytes = stream_read_bytes(data, typed_arrays=typed)
+            self.assertEqual(sys.getrefcount(from_bytes), 2)
+
+
+class TestMultiDimensionalArrays(unittest.TestCase):
+
+    def test_double_array_2d(self):
+        filename = "primitive_arrays/double_array_unsigned_2d.ser"
+        from_file = stream_read(filename, typed_arrays=True)
+
+        self.assertIsInstance(from_file, PrimitiveArray)
+        self.assertEqual(from_file.shape, (2, 5))
+        self.assertEqual(from_file.strides, (40, 8))
+        self.assertEqual(memoryview(from_file).shape, (2, 5))
+        self.assertEqual(from_file.tolist(), stream_read(filename))
+
+    def test_double_array_3d(self):
+        filename = "primitive_arrays/double_array_unsigned_3d.ser"
+        from_file = stream_read(filename, typed_arrays=True)
+
+        self.assertEqual(from_file.shape, (2, 2, 5))
+        self.assertEqual(memoryview(from_file).tolist(), stream_read(filename))
+        self.assertEqual(from_file[1].shape, (2, 5))
+        self.assertEqual(from_file[1][0].tolist(), [0.2343134, 1234132.3431, 312431.3, 0, 1.1234])
+
+    def test_ragged_falls_back_to_nested(self):
+        rows = [[1, 2, 3], [4, 5], [6, 7, 8]]
+        from_buffer = stream_read_bytes(int_matrix_stream(rows), typed_arrays=True)[0]
+
+        self.assertIsInstance(from_buffer, list)
+        self.assertEqual([row.tolist() for row in from_buffer], rows)
+
+    def test_null_row_falls_back_to_nested(self):
+        rows = [[1, 2], None, [3, 4]]
+        from_buffer = stream_read_bytes(int_matrix_stream(rows), typed_arrays=True)[0]
+
+        self.assertEqual([row.tolist() for row in from_buffer], [[1, 2], [3, 4]])
+
+    def test_reference_to_row(self):
+        rows = [[1, 2, 3], [4, 5, 6]]
+        # handle 6 is the second row
+        matrix, row = stream_read_bytes(int_matrix_stream(rows, 6), typed_arrays=True)
+
+        self.assertEqual(matrix.shape, (2, 3))
+        self.assertEqual(row.tolist(), [4, 5, 6])
+        self.assertEqual(stream_read_bytes(int_matrix_stream(rows, 6)), [rows, [4, 5, 6]])
+
+    def test_empty_rows(self):
+        from_buffer = stream_read_bytes(int_matrix_stream([[], []]), typed_arrays=True)[0]
+
+        self.assertEqual(from_buffer.shape, (2, 0))
+        self.assertEqual(from_buffer.tolist(), [[], []])
+
+
+class TestByteSwapKernels(unittest.TestCase):
+
+    # lengths around every vector width so the scalar tails are covered
+    lengths = [0, 1, 3, 7, 8, 15, 16, 17, 31, 33, 64, 100, 1001]
+    cases = [
+        ('S', 'h', lambda i: (i * 7919) % 65536 - 32768),
+        ('C', 'H', lambda i: (i * 7919) % 55000),
+        ('I', 'i', lambda i: (i * 2654435761) % 2**32 - 2**31),
+        ('F', 'f', lambda i: i * 0.5 - 17.25),
+        ('J', 'q', lambda i: (i * 11400714819323198485) % 2**64 - 2**63),
+        ('D', 'd', lambda i: i * 1.0e-3 - 5.5),
+    ]
+
+    def setUp(self):
+        self.default = _bswap_kernel()
+
+    def tearDown(self):
+        _bswap_kernel(self.default)
+
+    def test_kernels_agree(self):
+        for kernel in ("scalar", "ssse3", "avx2"):
+            try:
+                _bswap_kernel(kernel)
+            except ValueError:
+                continue  # not supported on this CPU
+            for typecode, fmt, value in self.cases:
+                for n in self.lengths:
+                    values = [value(i) for i in range(n)]
+                    data = primitive_array_stream(typecode, fmt, values)
+                    typed = stream_read_bytes(data, typed_arrays=True)
+                    self.assertEqual(typed.tolist(), stream_read_bytes(data),
+                                     (kernel, typecode, n))
+
+
+class TestReadBytes(unittest.TestCase):
+
+    def _read(self, filename):
+        with open(filename, "rb") as fd:
+            return fd.read()
+
+    def test_bytes(self):
+        filename = "object_w_nested_object.ser"
+        self.assertEqual(stream_read_bytes(self._read(filename)), stream_read(filename))
+
+    def test_memoryview_slice(self):
+        filename = "primitive_arrays/int_array_signed.ser"
+        padded = b"xxxx" + self._read(filename) + b"yyyy"
+        from_buffer = stream_read_bytes(memoryview(padded)[4:-4])
+
+        self.assertEqual(from_buffer, [0, -1, -2, -3, -4, -5, -6, -7, -8, -9])
+
+    def test_bytearray(self):
+        filename = "primitive_wrappers/string_single_sentence.ser"
+        from_buffer = stream_read_bytes(bytearray(self._read(filename)))
+
+        self.assertEqual(from_buffer, "This is a string that I am saving to a .ser file")
+
+
+class TestStreamErrors(unittest.TestCase):
+
+    def _truncated(self, filename, n_bytes):
+        with open(filename, "rb") as fd:
+            data = fd.read()
+        tmp = NamedTemporaryFile(suffix=".ser")
+        tmp.write(data[:n_bytes])
+        tmp.flush()
+        return tmp
+
+    def test_truncated_primitive_array(self):
+        filename = "primitive_arrays/double_array_unsigned.ser"
+        with self._truncated(filename, -3) as tmp:
+            with self.assertRaises(StreamError):
+                stream_read(tmp.name)
+
+    def test_truncated_object(self):
+        with self._truncated("object_w_nested_object.ser", 150) as tmp:
+            with self.assertRaises(StreamError):
+                stream_read(tmp.name)
+
+    def test_mmap_matches_read(self):
+        filename = "object_w_nested_object.ser"
+        self.assertEqual(stream_read(filename, mmap=True), stream_read(filename))
+
+    def test_mmap_truncated(self):
+        with self._truncated("object_w_nested_object.ser", 100) as tmp:
+            with self.assertRaises(StreamError):
+                stream_read(tmp.name, mmap=True)
+
+    def test_bad_header(self):
+        with self.assertRaises(StreamError):
+            stream_read_bytes(b"\xac\xed\x00\x06\x70")
+        with self.assertRaises(StreamError):
+            stream_read_bytes(b"")
+
+    def test_missing_file(self):
+        with self.assertRaises(OSError):
+            stream_read("does_not_exist.ser")
+
+    def test_unsupported_content(self):
+        # these used to end the process through exit()
+        self_reference = object_stream("err.Self", 1, [("L", "me")], [0x7e0002])
+        bad_field = (b"\xac\xed\x00\x05\x73\x72\x00\x01a" + bytes(8)
+                     + b"\x02\x00\x01Q\x00\x01x\x78\x70")
+        proxy = b"\xac\xed\x00\x05\x73\x7d\x00\x00\x00\x00"
+        for data in (self_reference, bad_field, proxy):
+            with self.assertRaises(StreamError):
+                stream_read_bytes(data)
+
+
+class TestDecodePlans(unittest.TestCase):
+
+    def test_primitive_runs_around_objects(self):
+        fields = [("I", "a"), ("J", "b"), ("L", "c"), ("Z", "d"), ("D", "e"), ("L", "f"), ("S", "g")]
+        values = [-1, 2**40, "x", True, 0.5, "y", -3]
+        data = object_stream("plan.Mixed", 1, fields, values)
+        expected = {"a": -1, "b": 2**40, "c": "x", "d": True, "e": 0.5, "f": "y", "g": -3}
+
+        self.assertEqual(stream_read_bytes(data), expected)
+
+    def test_superclass_fields_first(self):
+        parent = ("plan.Parent", 2, [("I", "x"), ("I", "y")], [10, 20])
+        data = object_stream("plan.Child", 1, [("I", "x"), ("L", "s")], [1, "child"], [parent])
+        expected = {"x": 1, "s": "child", "y": 20, "super.x": 10}
+
+        self.assertEqual(stream_read_bytes(data), expected)
+
+    def test_truncated_run(self):
+        data = object_stream("plan.Run", 1, [("J", "a"), ("J", "b")], [1, 2])
+        with self.assertRaises(StreamError):
+            stream_read_bytes(data[:-3])
+
+
+class TestClassDispatch(unittest.TestCase):
+
+    def test_boxed_wrapper(self):
+        data = object_stream("java.lang.Long", 0x3b8be490cc8f23df, [("J", "value")], [5])
+        self.assertEqual(stream_read_bytes(data), 5)
+
+    def test_prefix_of_wrapper_is_plain(self):
+        # used to match java.lang.Long by prefix and unwrap the value
+        data = object_stream("java.lang.LongValue", 1, [("J", "value")], [5])
+        self.assertEqual(stream_read_bytes(data), {"value": 5})
+
+    def test_user_class_with_value_field(self):
+        data = object_stream("java.lang.Integers", 1, [("I", "value")], [7])
+        self.assertEqual(stream_read_bytes(data), {"value": 7})
+
+
+class TestReadObjectHandlers(unittest.TestCase):
+
+    def tearDown(self):
+        for classname in ("app.Custom", "app.Skipped"):
+            try:
+                unregister_reader(classname)
+            except KeyError:
+                pass
+
+    def custom_stream(self):
+        # writeObject: defaultWriteObject, writeInt, writeUTF, writeObject(String),
+        # with the int split over two blocks
+        annotation = (block_data(b"\x00\x00") + block_data(b"\x00\x2a" + pack(">H", 2) + b"hi")
+                      + b"\x74" + pack(">H", 3) + b"obj")
+        return object_stream("app.Custom", 1, [("I", "n")], [7], annotation=annotation)
+
+    def test_python_handler(self):
+        def read_custom(block, fields):
+            return dict(fields, count=block.read_int(), name=block.read_utf(),
+                        extra=block.read_object())
+
+        register_reader("app.Custom", read_custom)
+        self.assertEqual(stream_read_bytes(self.custom_stream()),
+                         {"n": 7, "count": 42, "name": "hi", "extra": "obj"})
+
+    def test_unread_data_is_skipped(self):
+        register_reader("app.Custom", lambda block, fields: fields)
+        self.assertEqual(stream_read_bytes(self.custom_stream()), {"n": 7})
+
+    def test_read_past_block_data(self):
+        def read_too_much(block, fields):
+            block.read_bytes(6)
+            return block.read_int()
+
+        register_reader("app.Custom", read_too_much)
+        with self.assertRaises(EOFError):
+            stream_read_bytes(self.custom_stream())
+
+    def test_unregistered_class(self):
+        with self.assertRaises(StreamError):
+            stream_read_bytes(self.custom_stream())
+
+    def test_unregister(self):
+        register_reader("app.Custom", lambda block, fields: fields)
+        unregister_reader("app.Custom")
+        with self.assertRaises(KeyError):
+            unregister_reader("app.Custom")
+
+
+class TestClassCache(unittest.TestCase):
+
+    def test_repeated_class_hits(self):
+        data = object_stream("cache.Point", 1, [("I", "x"), ("I", "y")], [3, -4])
+        stream_read_bytes(data)
+        before = _class_cache_info()
+        for i in range(10):
+            self.assertEqual(stream_read_bytes(data), {"x": 3, "y": -4})
+        after = _class_cache_info()
+
+        self.assertEqual(after["hits"] - before["hits"], 10)
+        self.assertEqual(after["entries"], before["entries"])
+
+    def test_suid_and_fields_are_part_of_the_key(self):
+        fields = [("I", "x"), ("I", "y")]
+        self.assertEqual(stream_read_bytes(object_stream("cache.Pair", 1, fields, [1, 2])),
+                         {"x": 1, "y": 2})
+        self.assertEqual(stream_read_bytes(object_stream("cache.Pair", 2, fields[::-1], [1, 2])),
+                         {"y": 1, "x": 2})
+        self.assertEqual(stream_read_bytes(object_stream("cache.Pair", 1, fields[:1], [5])),
+                         {"x": 5})
+
+    def test_field_keys_are_shared(self):
+        parent = ("cache.Base", 3, [("I", "x")], [1])
+        data = object_stream("cache.Keys", 4, [("I", "x"), ("I", "y")], [2, 3], [parent])
+        first = stream_read_bytes(data)
+        second = stream_read_bytes(data)
+
+        self.assertEqual(first, {"x": 2, "y": 3, "super.x": 1})
+        for a, b in zip(first, second):
+            self.assertIs(a, b)
+
+    def test_cached_field_strings_keep_their_handles(self):
+        # handles: 0 class, 1 and 2 the field class names, 3 the object,
+        # 4 the value of 'a', which 'b' refers back to
+        data = object_stream("cache.Names", 7, [("L", "a"), ("L", "b")], ["first", 0x7e0004])
+        for i in range(3):
+            self.assertEqual(stream_read_bytes(data), {"a": "first", "b": "first"})
+
+
+class TestIterStream(unittest.TestCase):
+
+    def string(self, text):
+        return b"\x74" + pack(">H", len(text)) + text.encode()
+
+    def reference(self, handle):
+        return b"\x71" + pack(">I", 0x7e0000 + handle)
+
+    def test_concatenated_records(self):
+        point = object_stream("iter.Point", 1, [("I", "x"), ("I", "y")], [1, 2])
+        data = point + self.string("two") + block_data(b"\x00\x03") + point[4:]
+        self.assertEqual(list(iter_stream(data)),
+                         [{"x": 1, "y": 2}, "two", b"\x00\x03", {"x": 1, "y": 2}])
+
+    def test_references_span_records(self):
+        point = object_stream("iter.Named", 1, [("L", "name")], ["p"])
+        # handles: 0 class, 1 field class name, 2 object, 3 its name
+        data = point + self.reference(3) + self.reference(2)
+        first, name, second = iter_stream(data)
+        self.assertEqual(first, {"name": "p"})
+        self.assertEqual(name, "p")
+        self.assertIs(first, second)
+
+    def test_arrays_let_go_between_records(self):
+        # handles: 0 class, 1 the array
+        data = primitive_array_stream("I", "i", [1, 2, 3]) + self.reference(1)
+        it = iter_stream(data, typed_arrays=True)
+        first = next(it)
+        self.assertEqual(sys.getrefcount(first), 2)
+        second = next(it)
+        self.assertEqual(list(second), [1, 2, 3])
+        self.assertIsNot(first, second)
+        self.assertEqual(list(iter_stream(data)), [[1, 2, 3], [1, 2, 3]])
+
+    def test_reset_restarts_handles(self):
+        data = (b"\xac\xed\x00\x05" + self.string("a") + b"\x79"
+                + self.string("b") + self.reference(0) + b"\x79" + self.reference(0))
+        it = iter_stream(data)
+        self.assertEqual([next(it), next(it), next(it)], ["a", "b", "b"])
+        with self.assertRaises(StreamError):
+            next(it)
+        self.assertEqual(list(it), [])
+
+    def test_file(self):
+        data = b"\xac\xed\x00\x05" + b"".join(self.string(str(i)) for i in range(100))
+        with NamedTemporaryFile(suffix=".ser") as f:
+            f.write(data)
+            f.flush()
+            self.assertEqual(list(iter_stream(f.name)), [str(i) for i in range(100)])
+
+    def test_truncated_record(self):
+        it = iter_stream(b"\xac\xed\x00\x05" + self.string("ok") + self.string("cut")[:-1])
+        self.assertEqual(next(it), "ok")
+        with self.assertRaises(StreamError):
+            next(it)
+
+    def test_bad_header(self):
+        with self.assertRaises(StreamError):
+            iter_stream(b"\xac\xed\x00\x04")
+
+
+class TestStreamParser(unittest.TestCase):
+
+    def records(self):
+        point = object_stream("push.Point", 1, [("I", "x"), ("L", "name")], [5, "p"])
+        return (point + b"\x74\x00\x03abc" + block_data(b"\x01\x02")
+                + b"\x71" + pack(">I", 0x7e0003) + b"\x79" + point[4:]
+                + primitive_array_stream("D", "d", [0.5] * 40)[4:])
+
+    def feed_chunks(self, data, size):
+        parser = StreamParser()
+        out = []
+        for i in range(0, len(data), size):
+            out.extend(parser.feed(data[i:i + size]))
+        parser.close()
+        return out
+
+    def test_every_chunk_size(self):
+        data = self.records()
+        expected = list(iter_stream(data))
+        self.assertEqual(len(expected), 6)
+        for size in range(1, len(data) + 1):
+            self.assertEqual(self.feed_chunks(data, size), expected, size)
+
+    def test_records_come_back_as_they_complete(self):
+        parser = StreamParser()
+        self.assertEqual(parser.feed(b"\xac\xed"), [])
+        self.assertEqual(parser.feed(b"\x00\x05\x74\x00\x02o"), [])
+        self.assertEqual(parser.feed(b"k\x74\x00"), ["ok"])
+        self.assertEqual(parser.feed(b"\x00\x74\x00\x01a"), ["", "a"])
+        parser.close()
+
+    def test_large_array(self):
+        values = list(range(100000))
+        data = primitive_array_stream("I", "i", values)
+        parser = StreamParser(typed_arrays=True)
+        out = []
+        for i in range(0, len(data), 1000):
+            out.extend(parser.feed(data[i:i + 1000]))
+        self.assertEqual(len(out), 1)
+        self.assertEqual(out[0].tolist(), values)
+
+    def test_handlers_run_once(self):
+        # fed a byte at a time, each object is still decoded once
+        calls = []
+        self.addCleanup(unregister_reader, "push.Counted")
+        register_reader("push.Counted", lambda block, fields: calls.append(block.read_int())
+                        or fields["x"])
+        data = object_stream("push.Counted", 1, [("I", "x")], [0],
+                             annotation=block_data(pack(">i", 0)))
+        for i in range(1, 20):
+            data += (b"\x73\x71" + pack(">I", 0x7e0000) + pack(">i", i)
+                     + block_data(pack(">i", i)) + b"\x78")
+        self.assertEqual(self.feed_chunks(data, 1), list(range(20)))
+        self.assertEqual(calls, list(range(20)))
+
+    def test_shared_between_threads(self):
+        # a typed array decode keeps the GIL, so another feed() can't
+        # move the buffer under it
+        values = list(range(50000))
+        array = primitive_array_stream("I", "i", values)[4:]
+        parser = StreamParser(typed_arrays=True)
+        parser.feed(b"\xac\xed\x00\x05")
+        with ThreadPoolExecutor(4) as pool:
+            out = sum(pool.map(lambda i: parser.feed(array), range(64)), [])
+        self.assertEqual(len(out), 64)
+        for result in out:
+            self.assertEqual(result.tolist(), values)
+
+    def test_close_inside_record(self):
+        parser = StreamParser()
+        parser.feed(b"\xac\xed\x00\x05\x74\x00\x05ab")
+        with self.assertRaises(StreamError):
+            parser.close()
+
+    def test_bad_data(self):
+        parser = StreamParser()
+        with self.assertRaises(StreamError):
+            parser.feed(b"\xac\xed\x00\x04\x70")
+        with self.assertRaises(StreamError):
+            parser.feed(b"\x70")
+
+
+class TestLazyObjects(unittest.TestCase):
+
+    def object_array(self, *elements):
+        """an Object[] holding the given encoded objects"""
+        name = b"[Ljava.lang.Object;"
+        return (b"\xac\xed\x00\x05\x75\x72" + pack(">H", len(name)) + name
+                + pack(">Q", 0x1234) + b"\x02\x00\x00\x78\x70"
+                + pack(">i", len(elements)) + b"".join(elements))
+
+    def test_same_values_as_eager(self):
+        parent = ("lazy.Base", 3, [("I", "x"), ("L", "label")], [1, "base"])
+        data = object_stream("lazy.Leaf", 4, [("I", "x"), ("D", "weight"), ("L", "name")],
+                             [2, 0.25, "leaf"], [parent])
+        ob = stream_read_bytes(data, lazy=True)
+
+        self.assertIsInstance(ob, LazyObject)
+        self.assertEqual(ob.classname, "lazy.Leaf")
+        self.assertFalse(ob.decoded)
+        self.assertEqual(ob["name"], "leaf")
+        self.assertTrue(ob.decoded)
+        self.assertEqual(ob, stream_read_bytes(data))
+        self.assertEqual(ob.to_dict(), {"x": 2, "weight": 0.25, "name": "leaf",
+                                        "super.x": 1, "label": "base"})
+        self.assertEqual(len(ob), 5)
+        self.assertIn("label", ob)
+        self.assertEqual(ob.get("missing", 7), 7)
+        with self.assertRaises(KeyError):
+            ob["missing"]
+
+    def test_nested_objects_stay_lazy(self):
+        point = object_stream("lazy.Point", 1, [("I", "x"), ("L", "tag")], [5, "p"])[4:]
+        # handles: 0 array class, 1 array, 2 point class, 3 field class name,
+        # 4 point, 5 its tag
+        data = self.object_array(point, b"\x71" + pack(">I", 0x7e0004),
+                                 b"\x71" + pack(">I", 0x7e0005))
+        first, second, tag = stream_read_bytes(data, lazy=True)
+
+        self.assertIs(first, second)
+        self.assertFalse(first.decoded)
+        self.assertEqual(first, {"x": 5, "tag": "p"})
+        self.assertEqual(tag, "p")
+        self.assertEqual([first, second, tag], stream_read_bytes(data))
+
+    def test_arrays_and_handlers_wait_for_access(self):
+        # the handler of a field's class only runs once the fields are read
+        calls = []
+        self.addCleanup(unregister_reader, "lazy.Custom")
+        register_reader("lazy.Custom", lambda block, fields: calls.append(1) or block.read_int())
+        custom = object_stream("lazy.Custom", 1, [], [], annotation=block_data(pack(">i", 9)))[4:]
+        numbers = primitive_array_stream("I", "i", [1, 2, 3])[4:]
+        # handles: 0 Holder class, 1 to 3 field class names, 4 holder,
+        # 5 int[] class, 6 the array, 7 Custom class, 8 custom
+        data = object_stream("lazy.Holder", 1, [("L", "numbers"), ("L", "custom"), ("L", "same")],
+                             [numbers, custom, 0x7e0006])
+        ob = stream_read_bytes(data, lazy=True)
+        self.assertEqual(calls, [])
+        self.assertEqual(ob["custom"], 9)
+        self.assertEqual(calls, [1])
+        self.assertEqual(ob["numbers"], [1, 2, 3])
+        self.assertIs(ob["numbers"], ob["same"])
+        self.assertEqual(ob, stream_read_bytes(data))
+
+    def test_proxies_keep_the_input(self):
+        data = bytearray(object_stream("lazy.Held", 1, [("J", "n")], [1 << 40]))
+        ob = stream_read_bytes(data, lazy=True)
+        with self.assertRaises(BufferError):
+            data.append(0)
+        self.assertEqual(ob["n"], 1 << 40)
+        del ob
+        gc.collect()
+        data.append(0)
+
+    def test_file(self):
+        data = object_stream("lazy.File", 1, [("S", "s"), ("L", "t")], [-3, "x"])
+        with NamedTemporaryFile(suffix=".ser") as f:
+            f.write(data)
+            f.flush()
+            for use_mmap in (False, True):
+                self.assertEqual(stream_read(f.name, mmap=use_mmap, lazy=True),
+                                 {"s": -3, "t": "x"})
+
+    def test_truncated(self):
+        data = object_stream("lazy.Cut", 1, [("I", "a"), ("L", "b")], [1, "abc"])
+        with self.assertRaises(StreamError):
+            stream_read_bytes(data[:-1], lazy=True)
+
+
+class TestFieldProjection(unittest.TestCase):
+
+    def item(self, price, sku):
+        return object_stream("proj.Item", 1, [("D", "price"), ("L", "sku")], [price, sku])[4:]
+
+    def order(self):
+        name = b"[Ljava.lang.Object;"
+        items = (b"\x75\x72" + pack(">H", len(name)) + name + pack(">Q", 1)
+                 + b"\x02\x00\x00\x78\x70" + pack(">i", 2)
+                 + self.item(2.5, "A1") + self.item(3.5, "B2"))
+        customer = object_stream("proj.Customer", 1, [("L", "name")], ["ann"])[4:]
+        samples = primitive_array_stream("I", "i", [1, 2, 3])[4:]
+        return object_stream("proj.Order", 1, [("I", "id"), ("L", "customer"), ("L", "samples"),
+                                               ("L", "items"), ("L", "note")],
+                             [7, customer, samples, items, "late"])
+
+    def test_selected_paths(self):
+        data = self.order()
+        full = stream_read_bytes(data)
+        self.assertEqual(stream_read_bytes(data, fields=["id", "items[*].price", "note"]),
+                         {"id": 7, "note": "late",
+                          "items": [{"price": 2.5}, {"price": 3.5}]})
+        self.assertEqual(stream_read_bytes(data, fields=["customer", "customer.name"]),
+                         {"customer": full["customer"]})
+        self.assertEqual(stream_read_bytes(data, fields=["items.sku"]),
+                         {"items": [{"sku": "A1"}, {"sku": "B2"}]})
+        self.assertEqual(stream_read_bytes(data, fields=[]), {})
+
+    def test_reference_to_skipped_object(self):
+        # handles: 0 holder class, 1 and 2 field class names, 3 holder,
+        # 4 item class, 5 its field class name, 6 item, 7 its sku
+        data = object_stream("proj.Holder", 1, [("L", "skipped"), ("L", "wanted")],
+                             [self.item(1.5, "C3"), b"\x71" + pack(">I", 0x7e0006)])
+        self.assertEqual(stream_read_bytes(data, fields=["wanted"]),
+                         {"wanted": {"price": 1.5, "sku": "C3"}})
+        self.assertEqual(stream_read_bytes(data, fields=["wanted.sku"]),
+                         {"wanted": {"sku": "C3"}})
+
+    def test_file_and_lazy(self):
+        data = self.order()
+        with NamedTemporaryFile(suffix=".ser") as f:
+            f.write(data)
+            f.flush()
+            ob = stream_read(f.name, fields=["customer", "id"], lazy=True)
+        self.assertEqual(ob, {"id": 7, "customer": {"name": "ann"}})
+        self.assertIsInstance(ob["customer"], LazyObject)
+
+    def test_bad_paths(self):
+        with self.assertRaises(TypeError):
+            stream_read_bytes(self.order(), fields=[1])
+        with self.assertRaises(ValueError):
+            stream_read_bytes(self.order(), fields=["[*]"])
+
+
+class TestScanIndex(unittest.TestCase):
+
+    def string(self, text):
+        return b"\x74" + pack(">H", len(text)) + text.encode()
+
+    def reference(self, handle):
+        return b"\x71" + pack(">I", 0x7e0000 + handle)
+
+    def test_object_record(self):
+        data = object_stream("scan.Point", 1, [("I", "x"), ("L", "name")], [1, "p"])
+        index = scan_stream(data)
+        # handles: 0 class, 1 field class name, 2 object, 3 its name
+        handles = index["handles"]
+        self.assertEqual(list(handles["type"]), [0x72, 0x74, 0x73, 0x74])
+        self.assertEqual(list(handles["class"]), [-1, -1, 0, -1])
+        self.assertEqual(handles["offset"][2], 4)
+        self.assertEqual(handles["offset"][0], 5)
+        self.assertEqual(handles["offset"][3] + handles["length"][3], len(data))
+        self.assertEqual(handles["offset"][2] + handles["length"][2], len(data))
+        self.assertEqual(index["classes"], {0: "scan.Point"})
+        records = index["records"]
+        self.assertEqual(list(records["offset"]), [4])
+        self.assertEqual(list(records["length"]), [len(data) - 4])
+        self.assertEqual(list(records["type"]), [0x73])
+        self.assertEqual(list(records["handle"]), [2])
+
+    def test_references_and_blocks(self):
+        data = (b"\xac\xed\x00\x05" + self.string("a") + block_data(b"\x01\x02")
+                + self.reference(0) + b"\x70")
+        records = scan_stream(data)["records"]
+        self.assertEqual(list(records["type"]), [0x74, 0x77, 0x71, 0x70])
+        self.assertEqual(list(records["handle"]), [0, -1, 0, -1])
+        self.assertEqual(list(records["length"]), [4, 4, 5, 1])
+
+    def test_reset_generations(self):
+        data = (b"\xac\xed\x00\x05" + self.string("a") + b"\x79"
+                + self.string("b") + self.reference(0))
+        index = scan_stream(data)
+        self.assertEqual(len(index["handles"]["type"]), 2)
+        # TC_RESET is not a record, the reference resolves to "b"
+        self.assertEqual(list(index["records"]["handle"]), [0, 1, 1])
+        with self.assertRaises(StreamError):
+            scan_stream(data + b"\x79" + self.reference(0))
+
+    def test_matches_iter_stream(self):
+        point = object_stream("scan.Pair", 1, [("I", "x"), ("I", "y")], [1, 2])
+        # the matrix goes first, its back references assume it starts at handle 0
+        data = (int_matrix_stream([[1], None, [2, 3]]) + point[4:]
+                + primitive_array_stream("I", "i", [1, 2, 3])[4:] + point[4:])
+        with NamedTemporaryFile(suffix=".ser") as f:
+            f.write(data)
+            f.flush()
+            index = scan_stream(f.name)
+        self.assertEqual(len(index["records"]["offset"]), len(list(iter_stream(data))))
+
+    def test_invalid_streams(self):
+        data = object_stream("scan.Point", 1, [("I", "x")], [1])
+        for cut in (3, 6, len(data) - 1):
+            with self.assertRaises(StreamError):
+                scan_stream(data[:cut])
+        with self.assertRaises(StreamError):
+            scan_stream(b"\xac\xed\x00\x05\x00")
+        with self.assertRaises(StreamError):
+            scan_stream(b"\xac\xed\x00\x05" + self.reference(5))
+
+    def test_field_class_name_objects(self):
+        # an object where a field's class name goes, whose class is a
+        # reference to the descriptor still being defined
+        data = (b"\xac\xed\x00\x05\x73\x72\x00\x01A" + pack(">QBH", 1, 2, 1)
+                + b"L\x00\x01f" + b"\x73" + self.reference(0) + b"\x70\x78\x70\x70")
+        with self.assertRaises(StreamError):
+            scan_stream(data)
+        with self.assertRaises(StreamError):
+            walk_stream(data, object())
+
+
+class TestTwoPhaseRead(unittest.TestCase):
+
+    def tearDown(self):
+        try:
+            unregister_reader("app.Custom")
+        except KeyError:
+            pass
+
+    def string(self, text):
+        return b"\x74" + pack(">H", len(text)) + text.encode()
+
+    def array_list(self, items):
+        return object_stream("java.util.ArrayList", 0x7881d21d99c7619d, [("I", "size")],
+                             [len(items)], annotation=block_data(pack(">i", len(items)))
+                             + b"".join(items))[4:]
+
+    def test_collections(self):
+        # handles: 0 holder, 1 and 2 field class names, 3 holder, 4 list class,
+        # 5 list, 6 "a", 7 "b", 8 map class, 9 map, 10 "k"
+        hash_map = object_stream("java.util.HashMap", 0x0507dac1c31660d1,
+                                 [("F", "loadFactor"), ("I", "threshold")], [0.75, 12],
+                                 annotation=block_data(pack(">ii", 16, 2)) + self.string("k")
+                                 + b"\x71" + pack(">I", 0x7e0006) + b"\x71" + pack(">I", 0x7e0007)
+                                 + b"\x71" + pack(">I", 0x7e0005))[4:]
+        data = object_stream("two.Holder", 1, [("L", "items"), ("L", "index")],
+                             [self.array_list([self.string("a"), self.string("b"), b"\x70"]),
+                              hash_map])
+        ob = stream_read_bytes(data)
+        self.assertEqual(ob["items"], ["a", "b", None])
+        self.assertEqual(ob["index"], {"k": "a", "b": ["a", "b", None]})
+        self.assertIs(ob["index"]["b"], ob["items"])
+
+    def test_handlers_inside_the_tape(self):
+        # the annotation goes through the handler, the objects around it don't
+        register_reader("app.Custom", lambda block, fields: dict(fields, n=block.read_int()))
+        custom = object_stream("app.Custom", 1, [("I", "x")], [1],
+                               annotation=block_data(pack(">i", 9)) + self.string("rest"))[4:]
+        # handles: 0 list class, 1 list, 2 custom class, 3 custom, 4 "rest", 5 "after"
+        data = (b"\xac\xed\x00\x05"
+                + self.array_list([custom, self.string("after"), b"\x71" + pack(">I", 0x7e0003)]))
+        first, after, again = stream_read_bytes(data)
+        self.assertEqual(first, {"x": 1, "n": 9})
+        self.assertEqual(after, "after")
+        self.assertIs(again, first)
+
+    def test_large_typed_array(self):
+        values = list(range(-20000, 20000))
+        data = primitive_array_stream("J", "q", values)
+        self.assertEqual(list(stream_read_bytes(data, typed_arrays=True)), values)
+        self.assertEqual(stream_read_bytes(data), values)
+
+    def test_threads(self):
+        rows = [[i * 100 + j for j in range(100)] for i in range(200)]
+        data = int_matrix_stream(rows)
+        expected = stream_read_bytes(data)
+        with NamedTemporaryFile(suffix=".ser") as f:
+            f.write(data)
+            f.flush()
+            with ThreadPoolExecutor(4) as pool:
+                results = list(pool.map(lambda i: stream_read(f.name) if i % 2
+                                        else stream_read_bytes(data), range(16)))
+        self.assertEqual(expected, [rows])
+        for result in results:
+            self.assertEqual(result, expected)
+
+    def test_divergence_is_counted(self):
+        # the tape builds these without falling back to the one pass reader
+        before = _tape_info()["divergences"]
+        data = object_stream("two.Holder", 1, [("L", "items")],
+                             [self.array_list([self.string("a"), b"\x70"])])
+        self.assertEqual(stream_read_bytes(data), {"items": ["a", None]})
+        self.assertEqual(len(read_records(int_matrix_stream([[1], None]) + data[4:])), 2)
+        self.assertEqual(_tape_info()["divergences"], before)
+        # externalizable data is read again by the one pass reader
+        external = (b"\xac\xed\x00\x05\x73\x72\x00\x01E" + pack(">QBH", 1, 0x0c, 0)
+                    + b"\x78\x70" + block_data(b"\x01\x02") + b"\x78")
+        self.assertEqual(stream_read_bytes(external), {})
+        self.assertEqual(_tape_info()["divergences"], before + 1)
+
+    def test_invalid_descriptor_reference(self):
+        # the scanner runs first, a field class name that is an object
+        # referring to its own class must come back as StreamError
+        data = (b"\xac\xed\x00\x05\x73\x72\x00\x01A" + pack(">QBH", 1, 2, 1)
+                + b"L\x00\x01f\x73\x71" + pack(">I", 0x7e0000) + b"\x70\x78\x70\x70")
+        with self.assertRaises(StreamError):
+            stream_read_bytes(data)
+        with self.assertRaises(StreamError):
+            read_records(data)
+        with NamedTemporaryFile(suffix=".ser") as f:
+            f.write(data)
+            f.flush()
+            with self.assertRaises(StreamError):
+                stream_read(f.name)
+
+
+class TestReadMany(unittest.TestCase):
+
+    def setUp(self):
+        self.files = []
+
+    def tearDown(self):
+        for f in self.files:
+            f.close()
+
+    def write(self, data):
+        f = NamedTemporaryFile(suffix=".ser")
+        f.write(data)
+        f.flush()
+        self.files.append(f)
+        return f.name
+
+    def test_order(self):
+        streams = [primitive_array_stream("I", "i", list(range(n))) for n in range(40)]
+        paths = [self.write(data) for data in streams]
+        expected = [stream_read_bytes(data) for data in streams]
+        for threads in (0, 1, 3, 64):
+            self.assertEqual(stream_read_many(paths, threads=threads), expected)
+        self.assertEqual(stream_read_many(iter(paths), mmap=True), expected)
+        self.assertEqual(stream_read_many([]), [])
+
+    def test_typed_arrays(self):
+        path = self.write(primitive_array_stream("J", "q", list(range(20000))))
+        result, = stream_read_many([path], typed_arrays=True)
+        self.assertIsInstance(result, PrimitiveArray)
+        self.assertEqual(list(result), list(range(20000)))
+
+    def test_errors_are_values(self):
+        good = self.write(object_stream("many.Point", 1, [("I", "x")], [7]))
+        truncated = self.write(primitive_array_stream("D", "d", [1.0, 2.0])[:-3])
+        cyclic = self.write(object_stream("many.Self", 1, [("L", "me")], [0x7e0002]))
+        results = stream_read_many([good, "does_not_exist.ser", truncated, cyclic, good],
+                                   threads=2)
+        self.assertEqual(results[0], {"x": 7})
+        self.assertIsInstance(results[1], OSError)
+        self.assertEqual(results[1].filename, "does_not_exist.ser")
+        self.assertIsInstance(results[2], StreamError)
+        self.assertIsInstance(results[3], StreamError)
+        self.assertEqual(results[4], {"x": 7})
+
+    def test_invalid_paths(self):
+        with self.assertRaises(TypeError):
+            stream_read_many(None)
+        with self.assertRaises(TypeError):
+            stream_read_many([1])
+
+
+class TestReadRecords(unittest.TestCase):
+
+    def string(self, text):
+        return b"\x74" + pack(">H", len(text)) + text.encode()
+
+    def reference(self, handle):
+        return b"\x71" + pack(">I", 0x7e0000 + handle)
+
+    def test_matches_iter_stream(self):
+        point = object_stream("records.Named", 1, [("L", "name")], ["p"])
+        # handles: 0 class, 1 field class name, 2 object, 3 its name
+        data = (point + self.reference(3) + block_data(b"\x00\x03") + self.reference(2)
+                + b"\x70" + point[4:])
+        records = read_records(data)
+        self.assertEqual(records, list(iter_stream(data)))
+        self.assertIs(records[0], records[3])
+        self.assertEqual(records[2], b"\x00\x03")
+
+    def test_resets(self):
+        data = (b"\xac\xed\x00\x05" + self.string("a") + b"\x79"
+                + self.string("b") + self.reference(0) + b"\x79"
+                + object_stream("records.Point", 1, [("I", "x")], [3])[4:] + self.reference(1))
+        self.assertEqual(read_records(data), ["a", "b", "b", {"x": 3}, {"x": 3}])
+        with self.assertRaises(StreamError):
+            read_records(data + b"\x79" + self.reference(0))
+
+    def test_threads(self):
+        fields = [("I", "x"), ("J", "y"), ("D", "w"), ("F", "g"), ("Z", "f"), ("C", "c"),
+                  ("S", "s"), ("B", "b"), ("L", "name")]
+        names = ["plain", "caf\u00e9", "\u263a smile", "\U0001f600 face", ""]
+        arrays = [("I", "i"), ("J", "q"), ("D", "d"), ("Z", "?"), ("C", "H"), ("B", "b")]
+        data = b"\xac\xed\x00\x05"
+        for i in range(2000):
+            if i % 3 == 0:
+                data += object_stream("records.All", 1, fields,
+                                      [i, -i << 33, i / 3, 0.5, i % 2 == 0, 0x263a + i, -i,
+                                       i % 100 - 50, names[i % len(names)]])[4:]
+            elif i % 3 == 1:
+                typecode, fmt = arrays[i % len(arrays)]
+                values = [j % 2 == 0 if fmt == "?" else j % 100 for j in range(i % 40)]
+                data += primitive_array_stream(typecode, fmt, values)[4:]
+            else:
+                # a string and a reference back to it, after a reset
+                chars = (names[i % len(names)] * 3).encode()
+                data += b"\x79\x74" + pack(">H", len(chars)) + chars + self.reference(0)
+        expected = list(iter_stream(data))
+        self.assertEqual(len(expected), 2000 + 666)
+        for typed_arrays in (False, True):
+            def read(threads):
+                return [r.tolist() if hasattr(r, "tolist") else r
+                        for r in read_records(data, threads=threads, typed_arrays=typed_arrays)]
+            one = read(1)
+            for threads in (0, 4, 64):
+                self.assertEqual(read(threads), one)
+        self.assertEqual(read_records(data, threads=4), expected)
+
+    def test_strings_the_codec_rejects(self):
+        # a lone surrogate and an overlong NUL are left to the utf-8 codec
+        for chars in (b"\xed\xa0\xbd", b"a\xc0\x80"):
+            data = b"\xac\xed\x00\x05" + b"\x74" + pack(">H", len(chars)) + chars
+            with self.assertRaises(UnicodeDecodeError):
+                list(iter_stream(data))
+            with self.assertRaises(UnicodeDecodeError):
+                read_records(data, threads=2)
+
+    def test_large_typed_arrays(self):
+        arrays = [list(range(n, n + 20000 + n)) for n in range(6)]
+        data = b"\xac\xed\x00\x05" + b"".join(
+            primitive_array_stream("J", "q", values)[4:] + b"\x79" for values in arrays)
+        records = read_records(data, typed_arrays=True)
+        self.assertEqual([list(r) for r in records], arrays)
+        self.assertEqual(read_records(data), arrays)
+
+    def test_handlers_see_decoded_arrays(self):
+        seen = []
+        register_reader("records.Custom",
+                        lambda block, fields: seen.append((list(fields["a"]), block.read_int())))
+        try:
+            values = list(range(10000))
+            array = primitive_array_stream("J", "q", values)[4:]
+            data = object_stream("records.Custom", 1, [("L", "a")], [array],
+                                 annotation=block_data(pack(">i", 9)))
+            read_records(data, typed_arrays=True)
+        finally:
+            unregister_reader("records.Custom")
+        self.assertEqual(seen, [(values, 9)])
+
+    def test_file_and_errors(self):
+        data = b"\xac\xed\x00\x05" + b"".join(self.string(str(i)) for i in range(50))
+        with NamedTemporaryFile(suffix=".ser") as f:
+            f.write(data)
+            f.flush()
+            self.assertEqual(read_records(f.name), [str(i) for i in range(50)])
+        with self.assertRaises(StreamError):
+            read_records(data[:-1])
+        with self.assertRaises(StreamError):
+            read_records(b"\xac\xed\x00\x04")
+        self.assertEqual(read_records(b"\xac\xed\x00\x05"), [])
+
+
+class TestParallelDecode(unittest.TestCase):
+
+    def test_giant_arrays(self):
+        # past the 8MB threshold and not a whole number of 1MB chunks
+        for typecode, fmt, values in (("J", "q", list(range(-600001, 600000))),
+                                      ("D", "d", [i / 4 for i in range(1100003)]),
+                                      ("Z", "?", [i % 3 == 0 for i in range(9000001)])):
+            data = primitive_array_stream(typecode, fmt, values)
+            self.assertEqual(list(stream_read_bytes(data, typed_arrays=True)), values)
+            self.assertEqual(list(next(iter_stream(data, typed_arrays=True))), values)
+            first, = read_records(data, typed_arrays=True)
+            self.assertEqual(list(first), values)
+
+
+class EventRecorder:
+    """a walk_stream handler that logs every event as a tuple"""
+
+    def __init__(self):
+        self.events = []
+
+    def __getattr__(self, name):
+        if name.startswith("_"):
+            raise AttributeError(name)
+        return lambda *args: self.events.append((name,) + args)
+
+
+class ValueBuilder:
+    """a walk_stream handler that builds the values iter_stream gives, so
+    libjso's grammar can be checked against the python reader's"""
+
+    def __init__(self):
+        self.records = []
+        self.handles = {}
+        self.stack = []             # [container, name of the object field being read]
+
+    def add(self, value):
+        if not self.stack:
+            self.records.append(value)
+        elif isinstance(self.stack[-1][0], list):
+            self.stack[-1][0].append(value)
+        else:
+            self.stack[-1][0][self.stack[-1][1]] = value
+
+    def object_begin(self, classname, handle):
+        self.handles[handle] = {}
+        self.stack.append([self.handles[handle], None])
+
+    def field(self, name, typecode, value):
+        if typecode in "L[":
+            self.stack[-1][1] = name
+        else:
+            self.stack[-1][0][name] = value
+
+    def array_begin(self, typecode, n_elements, handle):
+        self.handles[handle] = []
+        self.stack.append([self.handles[handle], None])
+
+    def primitive_array(self, typecode, array):
+        self.stack[-1][0].extend(array.tolist())
+
+    def end_container(self, handle):
+        self.add(self.stack.pop()[0])
+
+    object_end = array_end = end_container
+
+    def string(self, text, handle):
+        self.handles[handle] = text
+        self.add(text)
+
+    def reference(self, handle):
+        self.add(self.handles[handle])
+
+    def block_data(self, data):
+        self.add(data)
+
+
+class TestWalkStream(unittest.TestCase):
+
+    def test_matches_iter_stream(self):
+        # libjso walks with its own grammar (jso_scan.c, jso_events.c), the
+        # python reader with jso_reader.c; both must read a stream the same
+        point = object_stream("walk.Child", 2, [("L", "name"), ("J", "id")], ["c", 9],
+                              parents=[("walk.Base", 1, [("I", "x"), ("D", "w")], [7, 0.5])])
+        # handles: 0 Object[] desc, 1 Object[], 2 int[][] desc, 3 int[][], 4 int[] desc,
+        # 5 and 6 the rows, then 7 Child, 8 its field class name, 9 Base,
+        # 10 object, 11 "c"
+        data = (int_matrix_stream([[1, 2], [3, 4]]) + point[4:] + block_data(b"\x00\x01")
+                + b"\x71" + pack(">I", 0x7e000b) + b"\x71" + pack(">I", 0x7e0006)
+                + primitive_array_stream("J", "q", [5, -6])[4:])
+        builder = ValueBuilder()
+        walk_stream(data, builder)
+        self.assertEqual(len(builder.records), 6)
+        self.assertEqual(builder.records, list(iter_stream(data)))
+        self.assertEqual(builder.records, read_records(data))
+
+    def test_object_events(self):
+        data = object_stream("walk.Child", 2, [("L", "name"), ("L", "alias")], ["c", 0x7e0004],
+                             parents=[("walk.Base", 1, [("I", "x"), ("D", "w")], [7, 0.5])])
+        recorder = EventRecorder()
+        walk_stream(data, recorder)
+        # handles: 0 Child, 1 and 2 its field class names, 3 Base, 4 object, 5 "c"
+        self.assertEqual(recorder.events, [
+            ("record_begin", 4),
+            ("object_begin", "walk.Child", 4),
+            ("class_data", "walk.Base"),
+            ("field", "x", "I", 7),
+            ("field", "w", "D", 0.5),
+            ("class_data", "walk.Child"),
+            ("field", "name", "L", None),
+            ("string", "c", 5),
+            ("field", "alias", "L", None),
+            ("reference", 4),
+            ("object_end", 4),
+            ("record_end",),
+            ("end",)])
+
+    def test_arrays_and_annotations(self):
+        data = (int_matrix_stream([[1, 2], None])
+                + object_stream("walk.Box", 1, [("Z", "full")], [True],
+                                annotation=block_data(b"\x01\x02"))[4:])
+        recorder = EventRecorder()
+        walk_stream(data, recorder)
+        events = recorder.events
+        self.assertEqual(events[:4], [("record_begin", 4), ("array_begin", "L", 1, 1),
+                                      ("array_begin", "[", 2, 3), ("array_begin", "I", 2, 5)])
+        name, typecode, array = events[4]
+        self.assertEqual((name, typecode, list(array)), ("primitive_array", "I", [1, 2]))
+        self.assertEqual(events[5:9], [("array_end", 5), ("null",), ("array_end", 3),
+                                       ("array_end", 1)])
+        self.assertEqual(events[9], ("record_end",))
+        self.assertEqual(events[11:], [
+            ("object_begin", "walk.Box", 7),
+            ("class_data", "walk.Box"),
+            ("field", "full", "Z", True),
+            ("annotation_begin", "walk.Box"),
+            ("block_data", b"\x01\x02"),
+            ("annotation_end", "walk.Box"),
+            ("object_end", 7),
+            ("record_end",),
+            ("end",)])
+
+    def test_modified_utf8(self):
+        class Strings:
+            def __init__(self):
+                self.seen = []
+
+            def string(self, text, handle):
+                self.seen.append(text)
+
+        # NUL as C0 80 and U+1F600 as the surrogates D83D DE00, 3 bytes each
+        chars = [b"a\xc0\x80b", b"\xed\xa0\xbd\xed\xb8\x80!", b"\xed\xa0\xbd", "é".encode()]
+        data = b"\xac\xed\x00\x05" + b"".join(b"\x74" + pack(">H", len(c)) + c for c in chars)
+        strings = Strings()
+        walk_stream(data, strings)
+        self.assertEqual(strings.seen, ["a\x00b", "\U0001f600!", "\ud83d", "é"])
+
+    def test_handler_subsets_and_errors(self):
+        class Strings:
+            def __init__(self):
+                self.seen = []
+
+            def string(self, text, handle):
+                self.seen.append(text)
+
+        data = object_stream("walk.Point", 1, [("I", "x"), ("L", "name")], [1, "p"])
+        strings = Strings()
+        with NamedTemporaryFile(suffix=".ser") as f:
+            f.write(data)
+            f.flush()
+            walk_stream(f.name, strings)
+        self.assertEqual(strings.seen, ["p"])
+
+        class Stop:
+            def field(self, *args):
+                raise KeyError("stop")
+
+        with self.assertRaises(KeyError):
+            walk_stream(data, Stop())
+        with self.assertRaises(StreamError):
+            walk_stream(data[:-1], strings)
+
+
+LIBJSO = join(pardir, "build", "native", "libjso.so")
+
+
+class JsoHandle(ctypes.Structure):
+    _fields_ = [("index", ctypes.c_size_t), ("offset", ctypes.c_uint64),
+                ("length", ctypes.c_uint64), ("type", ctypes.c_uint8),
+                ("class_handle", ctypes.c_uint32), ("body", ctypes.c_uint64),
+                ("count", ctypes.c_uint64), ("element_type", ctypes.c_char),
+                ("name", ctypes.c_void_p), ("name_length", ctypes.c_uint16),
+                ("flags", ctypes.c_uint8), ("n_fields", ctypes.c_uint16)]
+
+
+class JsoRecord(ctypes.Structure):
+    _fields_ = [("offset", ctypes.c_uint64), ("length", ctypes.c_uint64),
+                ("type", ctypes.c_uint8), ("handle", ctypes.c_uint32),
+                ("first_handle", ctypes.c_size_t), ("n_handles", ctypes.c_size_t),
+                ("generation", ctypes.c_size_t)]
+
+
+RECORD_CALLBACK = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.POINTER(JsoRecord))
+HANDLE_CALLBACK = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.POINTER(JsoHandle))
+
+
+class JsoVisitor(ctypes.Structure):
+    _fields_ = [("record_begin", RECORD_CALLBACK), ("handle", HANDLE_CALLBACK),
+                ("record_end", RECORD_CALLBACK)]
+
+
+@unittest.skipUnless(exists(LIBJSO), "libjso not built, run make")
+class TestLibjso(unittest.TestCase):
+    """the native library through ctypes, as a C caller sees it"""
+
+    @classmethod
+    def setUpClass(cls):
+        lib = ctypes.CDLL(LIBJSO)
+        lib.Jso_OpenBuffer.restype = ctypes.c_void_p
+        lib.Jso_OpenBuffer.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int]
+        lib.Jso_Close.argtypes = [ctypes.c_void_p]
+        lib.Jso_Error.restype = ctypes.c_char_p
+        lib.Jso_Error.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+        lib.Jso_RecordCount.restype = ctypes.c_size_t
+        lib.Jso_RecordCount.argtypes = [ctypes.c_void_p]
+        lib.Jso_HandleCount.restype = ctypes.c_size_t
+        lib.Jso_HandleCount.argtypes = [ctypes.c_void_p]
+        lib.Jso_GetHandle.argtypes = [ctypes.c_void_p, ctypes.c_size_t,
+                                      ctypes.POINTER(JsoHandle)]
+        lib.Jso_GetRecord.argtypes = [ctypes.c_void_p, ctypes.c_size_t,
+                                      ctypes.POINTER(JsoRecord)]
+        lib.Jso_Visit.argtypes = [ctypes.c_void_p, ctypes.POINTER(JsoVisitor), ctypes.c_void_p]
+        lib.Jso_DecodeArray.restype = ctypes.c_size_t
+        lib.Jso_DecodeArray.argtypes = [ctypes.c_char, ctypes.c_void_p, ctypes.c_void_p,
+                                        ctypes.c_size_t]
+        cls.lib = lib
+
+    def open(self, data):
+        """index 'data', which the test keeps alive until the stream is closed"""
+        stream = self.lib.Jso_OpenBuffer(data, len(data), 0)
+        self.addCleanup(self.lib.Jso_Close, stream)
+        return stream
+
+    def handles(self, stream):
+        """the handles Jso_GetHandle gives out, None for those it refuses"""
+        out = []
+        for i in range(self.lib.Jso_HandleCount(stream)):
+            handle = JsoHandle()
+            status = self.lib.Jso_GetHandle(stream, i, ctypes.byref(handle))
+            out.append(handle if status == 0 else None)
+        return out
+
+    def test_handles(self):
+        data = (object_stream("lib.Point", 1, [("I", "x"), ("L", "name")], [5, "p"])
+                + primitive_array_stream("S", "h", [1, -2, 3])[4:])
+        stream = self.open(data)
+        self.assertIsNone(self.lib.Jso_Error(stream, None))
+        self.assertEqual(self.lib.Jso_RecordCount(stream), 2)
+        # handles: 0 Point, 1 field class name, 2 object, 3 "p", 4 short[] class, 5 array
+        desc, _, point, name, _, array = self.handles(stream)
+        self.assertEqual(ctypes.string_at(desc.name, desc.name_length), b"lib.Point")
+        self.assertEqual(desc.n_fields, 2)
+        self.assertEqual(point.class_handle, 0)
+        self.assertEqual(data[point.body:point.body + 4], pack(">i", 5))
+        self.assertEqual(data[name.body:name.body + name.count], b"p")
+        self.assertEqual((array.element_type, array.count), (b"S", 3))
+        values = (ctypes.c_int16 * 3)()
+        self.assertEqual(self.lib.Jso_DecodeArray(b"S", values, data[array.body:], 3), 6)
+        self.assertEqual(list(values), [1, -2, 3])
+
+    def test_truncated_stream(self):
+        # cut right after the class descriptor of an array: the array's
+        # handle is issued, its length and elements aren't there
+        data = primitive_array_stream("I", "i", [1, 2])[:-12]
+        stream = self.open(data)
+        offset = ctypes.c_size_t()
+        self.assertEqual(self.lib.Jso_Error(stream, ctypes.byref(offset)),
+                         b"unexpected end of stream")
+        self.assertEqual(offset.value, len(data))
+        self.assertEqual(self.lib.Jso_RecordCount(stream), 0)
+        desc, array = self.handles(stream)
+        self.assertEqual(ctypes.string_at(desc.name, desc.name_length), b"[I")
+        self.assertIsNone(array)
+
+    def test_error_keeps_earlier_records(self):
+        data = object_stream("lib.Point", 1, [("I", "x")], [5]) + b"\x74\x00\x05ab"
+        stream = self.open(data)
+        self.assertIsNotNone(self.lib.Jso_Error(stream, None))
+        self.assertEqual(self.lib.Jso_RecordCount(stream), 1)
+        handles = self.handles(stream)
+        self.assertEqual([h is not None for h in handles], [True, True, False])
+        # the string's handle belongs to no record
+        record = JsoRecord()
+        self.assertEqual(self.lib.Jso_GetRecord(stream, 0, ctypes.byref(record)), 0)
+        self.assertEqual((record.first_handle, record.n_handles), (0, 2))
+        visited = []
+        visitor = JsoVisitor(RECORD_CALLBACK(), HANDLE_CALLBACK(
+            lambda context, handle: visited.append(handle.contents.index) or 0),
+            RECORD_CALLBACK())
+        self.assertEqual(self.lib.Jso_Visit(stream, ctypes.byref(visitor), None), 0)
+        self.assertEqual(visited, [0, 1])
+
+
 if __name__ == '__main__':
     unittest.main()
\ No newline at end of file